@@ -0,0 +1,385 @@
+/*
+ ============================================================================
+ Name        : coap_bench.c
+ Description : Microbenchmarks for the CoAP encode/decode primitives
+ ============================================================================
+ */
+
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ *
+ * Host benchmark comparing the original per-field API with the single-pass
+ * parser, the builder and the request templates.  Kept outside src so the
+ * Eclipse build of the library is not affected.  Build with optimisation
+ * against the same FreeRTOS headers (POSIX/Win32 simulator port) as the
+ * library, e.g.
+ *
+ *    gcc -O2 -std=gnu99 -I../src -I<FreeRTOS include> -I<port include>
+ *        coap_bench.c ../src/coap.c ../src/coap_random.c ../src/coap_template.c
+ *        ../src/coap_config.c
+ *
+ * Every operation runs over each corpus message for at least
+ * COAP_BENCH_MIN_NS and reports ns/op, bytes/op and MB/s.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "coap.h"
+#include "coap_template.h"
+
+#define COAP_BENCH_MIN_NS           50000000ULL   //time spent per operation and message
+#define COAP_BENCH_CORPUS_SIZE      8
+#define COAP_BENCH_PROXY_URI_SIZE   200           //forces an extended option length
+
+/// CoapBenchMessage struct
+typedef struct
+{
+   const char *pName;                   ///< Shape of the message
+   uint8_t buffer[MAX_BUFFER_SIZE];     ///< Encoded message
+   uint16_t length;                     ///< Length of the message
+} CoapBenchMessage;
+
+/// Runs one operation on a message, returns a value that is folded into the sink.
+typedef uint32_t (*CoapBenchOperation)(CoapBenchMessage *pMessage);
+
+static CoapBenchMessage coapBenchCorpus[COAP_BENCH_CORPUS_SIZE];   // Messages to decode.
+static uint8_t coapBenchPayload[MAX_BUFFER_SIZE];                   // Payload bytes.
+static uint8_t coapBenchScratch[MAX_BUFFER_SIZE];                   // Encode target.
+static CoapTemplate coapBenchTemplate;                              // Exosite dataPacket shape.
+static volatile uint32_t coapBenchSink;                             // Keeps results alive.
+
+/*!*****************************************************************************
+ * \brief Reads a monotonic clock
+ *
+ * \return Returns nanoseconds since an arbitrary start.
+ *
+ ********************************************************************************/
+static uint64_t coapBenchNow(void)
+{
+#ifdef _WIN32
+   LARGE_INTEGER counter;     // Used to store the counter.
+   LARGE_INTEGER frequency;   // Used to store the counter frequency.
+
+   QueryPerformanceCounter(&counter);
+   QueryPerformanceFrequency(&frequency);
+
+   return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+   struct timespec now;   // Used to store the clock.
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+/*!*****************************************************************************
+ * \brief Encodes one corpus message with the builder
+ *
+ * \param CoapBenchMessage *pMessage [out] - Message to fill.
+ *
+ * \param char *pName [in] - Shape of the message.
+ *
+ * \param U8 pathCount [in] - Uri-Path options to add.
+ *
+ * \param bool extended [in] - Add options with extended delta and length.
+ *
+ * \param U16 payloadLength [in] - Payload bytes, 0 for none.
+ *
+ ********************************************************************************/
+static void coapBenchAddMessage(CoapBenchMessage *pMessage, const char *pName, uint8_t pathCount, bool extended, uint16_t payloadLength)
+{
+   CoapMessageBuilder builder;   // Used to encode the message.
+   uint8_t token[4] = { 0xDE, 0xAD, 0xBE, 0xEF };   // Used as the token.
+   uint8_t value[4];             // Used to encode uint options.
+   uint8_t i;                    // Used as an iterator.
+
+   pMessage->pName = pName;
+
+   coapBuilderInit(&builder, pMessage->buffer, sizeof(pMessage->buffer), COAP_TYPE_CON, COAP_POST, 0x1234, token, sizeof(token));
+
+   if( extended )
+   {
+      coapBuilderAddOption(&builder, COAP_OPTION_URI_HOST, sizeof(SERVER_NAME) - 1, (uint8_t *)SERVER_NAME);
+   }
+
+   for( i = 0; i < pathCount; i++ )
+   {
+      coapBuilderAddOption(&builder, COAP_OPTION_URI_PATH, (i % 2) ? CIK_LENGTH : 2, (i % 2) ? (uint8_t *)CIK : (uint8_t *)URI_PREFIX);
+   }
+
+   if( pathCount > 0 )
+   {
+      coapBuilderAddOption(&builder, COAP_OPTION_CONTENT_FORMAT, coapEncodeOptionUint(COAP_FORMAT_OCTET_STREAM, value), value);
+   }
+
+   if( extended )
+   {
+      coapBuilderAddOption(&builder, COAP_OPTION_PROXY_URI, COAP_BENCH_PROXY_URI_SIZE, coapBenchPayload);
+      coapBuilderAddOption(&builder, COAP_OPTION_SIZE1, coapEncodeOptionUint(payloadLength, value), value);
+   }
+
+   if( payloadLength > 0 )
+   {
+      coapBuilderSetPayload(&builder, payloadLength, coapBenchPayload);
+   }
+
+   pMessage->length = builder.length;
+}
+
+/*!*****************************************************************************
+ * \brief Builds the corpus
+ *
+ * Description:
+ *  0 to 20 options, 0 to 1400 byte payloads and a message with extended
+ *  deltas and lengths.
+ *
+ ********************************************************************************/
+static void coapBenchInitCorpus(void)
+{
+   uint16_t i;   // Used as an iterator.
+
+   for( i = 0; i < sizeof(coapBenchPayload); i++ )
+   {
+      coapBenchPayload[i] = 'a' + (i % 26);
+   }
+
+   coapBenchAddMessage(&coapBenchCorpus[0], "empty (0 opt, 0 B)", 0, false, 0);
+   coapBenchAddMessage(&coapBenchCorpus[1], "uplink (4 opt, 16 B)", 3, false, 16);
+   coapBenchAddMessage(&coapBenchCorpus[2], "accel (4 opt, 202 B)", 3, false, ACCEL_SIZE);
+   coapBenchAddMessage(&coapBenchCorpus[3], "8 opt, 256 B", 7, false, 256);
+   coapBenchAddMessage(&coapBenchCorpus[4], "20 opt, 0 B", 19, false, 0);
+   coapBenchAddMessage(&coapBenchCorpus[5], "4 opt, 1400 B", 3, false, 1400);
+   coapBenchAddMessage(&coapBenchCorpus[6], "extended (7 opt, 32 B)", 3, true, 32);
+   coapBenchAddMessage(&coapBenchCorpus[7], "payload only (0 opt, 64 B)", 0, false, 64);
+
+   coapTemplateInit(&coapBenchTemplate, COAP_TYPE_CON, COAP_POST, PACKET_ALIAS, COAP_FORMAT_OCTET_STREAM);
+}
+
+// Decode operations, original API first.
+
+static uint32_t coapBenchValidatePacket(CoapBenchMessage *pMessage)
+{
+   return (uint32_t)coapValidatePacket(pMessage->buffer, pMessage->length);
+}
+
+static uint32_t coapBenchGetOptions(CoapBenchMessage *pMessage)
+{
+   uint8_t *pData;    // Used to store the option data.
+   uint8_t number;    // Used to store the option number.
+   uint32_t sum = 0;  // Used to fold the results.
+   int32_t count;     // Used to store the option count.
+   int32_t i;         // Used as an iterator.
+
+   count = coapGetOptionCount(pMessage->buffer, pMessage->length);
+
+   for( i = 1; i <= count; i++ )
+   {
+      sum += coapGetOption(pMessage->buffer, pMessage->length, (uint8_t)i, &number, &pData, NULL) + number;
+   }
+
+   return sum;
+}
+
+static uint32_t coapBenchGetPayload(CoapBenchMessage *pMessage)
+{
+   uint8_t *pPayload = NULL;   // Used to store the payload.
+
+   return (uint32_t)coapGetPayload(pMessage->buffer, pMessage->length, &pPayload) + (pPayload != NULL);
+}
+
+static uint32_t coapBenchValidateMessage(CoapBenchMessage *pMessage)
+{
+   return (uint32_t)coapValidateMessage(pMessage->buffer, pMessage->length, NULL);
+}
+
+static uint32_t coapBenchParseView(CoapBenchMessage *pMessage)
+{
+   CoapMessageView view;   // Used to store the parsed message.
+   uint32_t sum = 0;       // Used to fold the results.
+   uint8_t i;              // Used as an iterator.
+
+   sum = (uint32_t)coapParseMessage(pMessage->buffer, pMessage->length, &view);
+
+   for( i = 0; i < view.optionCount; i++ )
+   {
+      sum += view.options[i].number + view.options[i].length;
+   }
+
+   return sum + view.payloadLength;
+}
+
+static uint32_t coapBenchSetHeader(CoapBenchMessage *pMessage)
+{
+   uint16_t length = 0;   // Used to store the message length.
+
+   (void)pMessage;
+
+   coapSetPacketHeader(coapBenchScratch, &length, COAP_VERSION, COAP_TYPE_CON, 4, COAP_POST, 0x1234);
+
+   return length;
+}
+
+// Encode operations, each builds the uplink shape of the message with the
+// same options (Uri-Host, Uri-Path prefix/alias/CIK, Content-Format).
+
+static uint32_t coapBenchEncodeLegacy(CoapBenchMessage *pMessage)
+{
+   uint8_t token[4] = { 0xDE, 0xAD, 0xBE, 0xEF };   // Used as the token.
+   uint8_t format = COAP_FORMAT_OCTET_STREAM;      // Used as the Content-Format.
+   uint8_t *pointer = coapBenchScratch;             // Used as the insertion point.
+   uint16_t length = 0;                             // Used to store the message length.
+   uint16_t payloadLength = pMessage->length;       // Used to store the payload length.
+
+   coapSetPacketHeader(coapBenchScratch, &length, COAP_VERSION, COAP_TYPE_CON, sizeof(token), COAP_POST, 0x1234);
+   coapSetToken(coapBenchScratch, &length, token, sizeof(token));
+   length = COAP_HDR_BYTES + sizeof(token);
+
+   coapAddOption(coapBenchScratch, &length, COAP_OPTION_URI_HOST, sizeof(SERVER_NAME) - 1, (uint8_t *)SERVER_NAME, &pointer);
+   coapAddOption(coapBenchScratch, &length, COAP_OPTION_URI_PATH, sizeof(URI_PREFIX) - 1, (uint8_t *)URI_PREFIX, &pointer);
+   coapAddOption(coapBenchScratch, &length, COAP_OPTION_URI_PATH, sizeof(PACKET_ALIAS) - 1, (uint8_t *)PACKET_ALIAS, &pointer);
+   coapAddOption(coapBenchScratch, &length, COAP_OPTION_URI_PATH, CIK_LENGTH, (uint8_t *)CIK, &pointer);
+   coapAddOption(coapBenchScratch, &length, COAP_OPTION_CONTENT_FORMAT, 1, &format, &pointer);
+
+   if( payloadLength > 1300 )
+   {
+      payloadLength = 1300;
+   }
+
+   coapSetPayload(coapBenchScratch, &length, payloadLength, coapBenchPayload, coapBenchScratch + length, &pointer);
+
+   return length;
+}
+
+static uint32_t coapBenchEncodeBuilder(CoapBenchMessage *pMessage)
+{
+   CoapMessageBuilder builder;                      // Used to encode the message.
+   uint8_t token[4] = { 0xDE, 0xAD, 0xBE, 0xEF };   // Used as the token.
+   uint8_t format = COAP_FORMAT_OCTET_STREAM;      // Used as the Content-Format.
+   uint16_t payloadLength = pMessage->length;       // Used to store the payload length.
+
+   if( payloadLength > 1300 )
+   {
+      payloadLength = 1300;
+   }
+
+   coapBuilderInit(&builder, coapBenchScratch, sizeof(coapBenchScratch), COAP_TYPE_CON, COAP_POST, 0x1234, token, sizeof(token));
+   coapBuilderAddOption(&builder, COAP_OPTION_URI_HOST, sizeof(SERVER_NAME) - 1, (uint8_t *)SERVER_NAME);
+   coapBuilderAddOption(&builder, COAP_OPTION_URI_PATH, sizeof(URI_PREFIX) - 1, (uint8_t *)URI_PREFIX);
+   coapBuilderAddOption(&builder, COAP_OPTION_URI_PATH, sizeof(PACKET_ALIAS) - 1, (uint8_t *)PACKET_ALIAS);
+   coapBuilderAddOption(&builder, COAP_OPTION_URI_PATH, CIK_LENGTH, (uint8_t *)CIK);
+   coapBuilderAddOption(&builder, COAP_OPTION_CONTENT_FORMAT, 1, &format);
+   coapBuilderSetPayload(&builder, payloadLength, coapBenchPayload);
+
+   return builder.length;
+}
+
+static uint32_t coapBenchEncodeTemplate(CoapBenchMessage *pMessage)
+{
+   uint8_t token[4] = { 0xDE, 0xAD, 0xBE, 0xEF };   // Used as the token.
+   uint16_t payloadLength = pMessage->length;       // Used to store the payload length.
+   uint16_t length = 0;                             // Used to store the message length.
+
+   if( payloadLength > 1300 )
+   {
+      payloadLength = 1300;
+   }
+
+   coapTemplateBuild(&coapBenchTemplate, coapBenchScratch, sizeof(coapBenchScratch), 0x1234, token, coapBenchPayload, payloadLength, &length);
+
+   return length;
+}
+
+/*!*****************************************************************************
+ * \brief Times one operation over every corpus message
+ *
+ * Description:
+ *  Doubles the iteration count until the run lasts COAP_BENCH_MIN_NS, then
+ *  prints ns/op, bytes/op and MB/s.  Bytes are the corpus message length for
+ *  decode operations and the length actually written for encode operations.
+ *
+ * \param char *pName [in] - Operation name.
+ *
+ * \param CoapBenchOperation operation [in] - Operation to time.
+ *
+ * \param bool encodes [in] - The operation returns the length it encoded.
+ *
+ ********************************************************************************/
+static void coapBenchRun(const char *pName, CoapBenchOperation operation, bool encodes)
+{
+   CoapBenchMessage *pMessage;   // Used to store the current message.
+   uint64_t iterations;          // Used to store the iteration count.
+   uint64_t start;               // Used to store the start time.
+   uint64_t elapsed;             // Used to store the run time.
+   uint64_t n;                   // Used as an iterator.
+   uint32_t sum;                 // Used to fold the results.
+   double nsPerOp;               // Used to store the result.
+   uint32_t bytes;               // Used to store the bytes per operation.
+   uint8_t i;                    // Used as an iterator.
+
+   for( i = 0; i < COAP_BENCH_CORPUS_SIZE; i++ )
+   {
+      pMessage = &coapBenchCorpus[i];
+      iterations = 1024;
+      bytes = encodes ? operation(pMessage) : pMessage->length;
+
+      for( ;; )
+      {
+         sum = 0;
+         start = coapBenchNow();
+
+         for( n = 0; n < iterations; n++ )
+         {
+            sum += operation(pMessage);
+         }
+
+         elapsed = coapBenchNow() - start;
+
+         if( elapsed >= COAP_BENCH_MIN_NS )
+         {
+            break;
+         }
+
+         iterations *= 2;
+      }
+
+      coapBenchSink += sum;
+      nsPerOp = (double)elapsed / (double)iterations;
+
+      printf("%-22s %-28s %9.1f ns/op %6u B/op %9.1f MB/s\n", pName, pMessage->pName, nsPerOp,
+             (unsigned)bytes, bytes * 1e3 / nsPerOp);
+   }
+}
+
+int main(void)
+{
+   coapBenchInitCorpus();
+
+   printf("-- decode, original API --\n");
+   coapBenchRun("coapValidatePacket", coapBenchValidatePacket, false);
+   coapBenchRun("coapGetOption (all)", coapBenchGetOptions, false);
+   coapBenchRun("coapGetPayload", coapBenchGetPayload, false);
+
+   printf("-- decode, single pass --\n");
+   coapBenchRun("coapValidateMessage", coapBenchValidateMessage, false);
+   coapBenchRun("coapParseMessage", coapBenchParseView, false);
+
+   printf("-- encode header --\n");
+   coapBenchRun("coapSetPacketHeader", coapBenchSetHeader, true);
+
+   printf("-- encode uplink (payload = message length, max 1300 B) --\n");
+   coapBenchRun("coapAddOption", coapBenchEncodeLegacy, true);
+   coapBenchRun("coapBuilder", coapBenchEncodeBuilder, true);
+   coapBenchRun("coapTemplateBuild", coapBenchEncodeTemplate, true);
+
+   printf("sink %u\n", (unsigned)coapBenchSink);
+
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,652 @@
+/*
+ ============================================================================
+ Name        : coap_replay.c
+ Description : Replays captured CoAP traffic through the decode path
+ ============================================================================
+ */
+
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ *
+ * Host harness that feeds the UDP payloads of pcap captures through
+ * coapValidatePacket, coapGetOptionCount, coapGetOption and coapGetPayload,
+ * cross-checked against coapParseMessage, and reports messages/s and the time
+ * spent in each function.  Kept outside src like coap_bench.c.
+ *
+ *    gcc -O2 -std=gnu99 -I../src -I<FreeRTOS include> -I<port include>
+ *        coap_replay.c ../src/coap.c ../src/coap_random.c
+ *    ./a.out [-p port] [-n passes] [-o corpus dir] capture.pcap ...
+ *
+ * Built with -DCOAP_REPLAY_FUZZER the same decode step is the libFuzzer entry
+ * point; the -o option writes every captured message as a seed file.
+ *
+ *    clang -g -O1 -fsanitize=fuzzer,address,undefined -DCOAP_REPLAY_FUZZER
+ *        -std=gnu99 -I../src ... coap_replay.c ../src/coap.c ../src/coap_random.c
+ *    ./a.out corpus/
+ *
+ * Captures are classic pcap (micro or nanosecond, either byte order) with
+ * Ethernet, Linux cooked, raw IP or BSD loopback framing; IPv4 and IPv6 UDP
+ * datagrams to or from the port are replayed, everything else is skipped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "coap.h"
+
+#define COAP_REPLAY_MIN_NS          200000000ULL  //time spent per function
+#define COAP_REPLAY_MAX_MESSAGES    1000000
+#define COAP_REPLAY_LINK_NULL       0
+#define COAP_REPLAY_LINK_ETHERNET   1
+#define COAP_REPLAY_LINK_RAW        101
+#define COAP_REPLAY_LINK_SLL        113
+#define COAP_REPLAY_LINK_IPV4       228
+#define COAP_REPLAY_LINK_IPV6       229
+#define COAP_REPLAY_FUNCTION_COUNT  5
+
+/// CoapReplayMessage struct
+typedef struct
+{
+   uint8_t *pData;                      ///< UDP payload, allocated to its exact length
+   uint16_t length;                     ///< Length of the payload
+} CoapReplayMessage;
+
+/// Runs one decode function over a message, returns a value that is folded into the sink.
+typedef uint32_t (*CoapReplayFunction)(uint8_t *pBuffer, uint16_t length);
+
+static volatile uint32_t coapReplaySink;   // Keeps results alive.
+
+/*!*****************************************************************************
+ * \brief Checks the legacy decoders against the single pass parser
+ *
+ * Description:
+ *  Runs every decode function on the message.  Whenever coapParseMessage
+ *  accepts it, the option count, every option length and the payload of the
+ *  legacy functions must agree with the view, otherwise the process aborts so
+ *  libFuzzer keeps the input.  Memory errors are left to the sanitizers; the
+ *  buffer is allocated to the exact message length so any over-read is caught.
+ *
+ * \param U8 *pBuffer [in] - Message.
+ *
+ * \param U16 length [in] - Length of the message.
+ *
+ *
+ * \return Returns a value derived from the results.
+ *
+ ********************************************************************************/
+static uint32_t coapReplayDecode(uint8_t *pBuffer, uint16_t length)
+{
+   CoapMessageView view;          // Used as the reference decode.
+   uint8_t *pPayload = NULL;      // Used to store the payload.
+   uint8_t *pData;                // Used to store the option data.
+   uint8_t number;                // Used to store the option number.
+   int32_t count;                 // Used to store the option count.
+   int32_t optionLength;          // Used to store the option length.
+   int16_t payloadLength;         // Used to store the payload length.
+   int8_t parsed;                 // Used to store the reference results.
+   uint32_t sum;                  // Used to fold the results.
+   int32_t i;                     // Used as an iterator.
+
+   sum = (uint32_t)coapValidatePacket(pBuffer, length);
+   parsed = coapParseMessage(pBuffer, length, &view);
+   count = coapGetOptionCount(pBuffer, length);
+   payloadLength = coapGetPayload(pBuffer, length, &pPayload);
+
+   if( parsed == COAP_OK )
+   {
+      if( count != view.optionCount || payloadLength != view.payloadLength ||
+          (view.payloadLength > 0 && pPayload != view.pPayload) )
+      {
+         abort();
+      }
+   }
+
+   for( i = 1; i <= count; i++ )
+   {
+      number = 0;
+      optionLength = coapGetOption(pBuffer, length, (uint8_t)i, &number, &pData, NULL);
+
+      // coapGetOption keeps option numbers in 8 bits.
+      if( parsed == COAP_OK && view.options[i - 1].number <= 0xFF &&
+          optionLength != view.options[i - 1].length )
+      {
+         abort();
+      }
+
+      sum += optionLength + number;
+   }
+
+   return sum + count + payloadLength;
+}
+
+#ifdef COAP_REPLAY_FUZZER
+
+/*!*****************************************************************************
+ * \brief libFuzzer entry point
+ *
+ * \param U8 *pData [in] - Input generated by the fuzzer.
+ *
+ * \param size_t size [in] - Length of the input.
+ *
+ *
+ * \return Returns 0.
+ *
+ ********************************************************************************/
+int LLVMFuzzerTestOneInput(const uint8_t *pData, size_t size)
+{
+   uint8_t *pBuffer;   // Used to store a private copy of the input.
+
+   if( size > MAX_BUFFER_SIZE )
+   {
+      return 0;
+   }
+
+   pBuffer = malloc(size > 0 ? size : 1);
+
+   if( pBuffer == NULL )
+   {
+      return 0;
+   }
+
+   memcpy(pBuffer, pData, size);
+   coapReplaySink += coapReplayDecode(pBuffer, (uint16_t)size);
+   free(pBuffer);
+
+   return 0;
+}
+
+#else
+
+static CoapReplayMessage *coapReplayMessages;   // Captured messages.
+static uint32_t coapReplayCount;                // Messages in coapReplayMessages.
+static uint64_t coapReplayBytes;                // Bytes in coapReplayMessages.
+
+/*!*****************************************************************************
+ * \brief Reads a monotonic clock
+ *
+ * \return Returns nanoseconds since an arbitrary start.
+ *
+ ********************************************************************************/
+static uint64_t coapReplayNow(void)
+{
+#ifdef _WIN32
+   LARGE_INTEGER counter;     // Used to store the counter.
+   LARGE_INTEGER frequency;   // Used to store the counter frequency.
+
+   QueryPerformanceCounter(&counter);
+   QueryPerformanceFrequency(&frequency);
+
+   return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+   struct timespec now;   // Used to store the clock.
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+}
+
+/*!*****************************************************************************
+ * \brief Reads a 16 or 32 bit field of a pcap header
+ *
+ * \param U8 *pData [in] - Field.
+ *
+ * \param U8 size [in] - 2 or 4.
+ *
+ * \param bool swapped [in] - Capture was written in the other byte order.
+ *
+ *
+ * \return Returns the value.
+ *
+ ********************************************************************************/
+static uint32_t coapReplayField(const uint8_t *pData, uint8_t size, bool swapped)
+{
+   uint32_t value = 0;   // Used to store the value.
+   uint8_t i;            // Used as an iterator.
+
+   // pcap fields are little endian unless the magic reads swapped.
+   for( i = 0; i < size; i++ )
+   {
+      value |= (uint32_t)pData[swapped ? size - 1 - i : i] << (8 * i);
+   }
+
+   return value;
+}
+
+/*!*****************************************************************************
+ * \brief Finds the CoAP message in a captured frame
+ *
+ * \param U32 linkType [in] - Link type of the capture.
+ *
+ * \param U8 *pFrame [in] - Captured bytes.
+ *
+ * \param U32 length [in] - Number of captured bytes.
+ *
+ * \param U16 port [in] - UDP port of the CoAP traffic, 0 for any.
+ *
+ * \param U8 **pPayload [out] - Start of the UDP payload.
+ *
+ *
+ * \return Returns the payload length or -1 if the frame is not CoAP.
+ *
+ ********************************************************************************/
+static int32_t coapReplayUdpPayload(uint32_t linkType, const uint8_t *pFrame, uint32_t length, uint16_t port, const uint8_t **pPayload)
+{
+   const uint8_t *pEnd = pFrame + length;   // Used to store the end of the frame.
+   const uint8_t *pUdp;                     // Used to store the UDP header.
+   uint16_t etherType;                      // Used to store the network protocol.
+   uint16_t udpLength;                      // Used to store the datagram length.
+   uint8_t version;                         // Used to store the IP version.
+
+   switch( linkType )
+   {
+      case COAP_REPLAY_LINK_ETHERNET:
+         if( length < 14 )
+         {
+            return -1;
+         }
+
+         etherType = (pFrame[12] << 8) | pFrame[13];
+         pFrame += 14;
+
+         // Skip one 802.1Q tag.
+         if( etherType == 0x8100 && pEnd - pFrame >= 4 )
+         {
+            etherType = (pFrame[2] << 8) | pFrame[3];
+            pFrame += 4;
+         }
+
+         if( etherType != 0x0800 && etherType != 0x86DD )
+         {
+            return -1;
+         }
+         break;
+
+      case COAP_REPLAY_LINK_SLL:
+         if( length < 16 )
+         {
+            return -1;
+         }
+
+         pFrame += 16;
+         break;
+
+      case COAP_REPLAY_LINK_NULL:
+         if( length < 4 )
+         {
+            return -1;
+         }
+
+         pFrame += 4;
+         break;
+
+      case COAP_REPLAY_LINK_RAW:
+      case COAP_REPLAY_LINK_IPV4:
+      case COAP_REPLAY_LINK_IPV6:
+         break;
+
+      default:
+         return -1;
+   }
+
+   if( pEnd - pFrame < 1 )
+   {
+      return -1;
+   }
+
+   version = pFrame[0] >> 4;
+
+   if( version == 4 )
+   {
+      // UDP, no fragments (fragment offset or more fragments set).
+      if( pEnd - pFrame < 20 || pFrame[9] != 17 || (((pFrame[6] << 8) | pFrame[7]) & 0x3FFF) != 0 )
+      {
+         return -1;
+      }
+
+      pUdp = pFrame + (pFrame[0] & 0x0F) * 4;
+   }
+   else if( version == 6 )
+   {
+      // UDP straight after the fixed header, extension headers are not followed.
+      if( pEnd - pFrame < 40 || pFrame[6] != 17 )
+      {
+         return -1;
+      }
+
+      pUdp = pFrame + 40;
+   }
+   else
+   {
+      return -1;
+   }
+
+   if( pEnd - pUdp < 8 )
+   {
+      return -1;
+   }
+
+   if( port != 0 && ((pUdp[0] << 8) | pUdp[1]) != port && ((pUdp[2] << 8) | pUdp[3]) != port )
+   {
+      return -1;
+   }
+
+   udpLength = (pUdp[4] << 8) | pUdp[5];
+
+   // Truncated captures are skipped, a partial message is not real traffic.
+   if( udpLength < 8 || udpLength - 8 > pEnd - (pUdp + 8) )
+   {
+      return -1;
+   }
+
+   *pPayload = pUdp + 8;
+
+   return udpLength - 8;
+}
+
+/*!*****************************************************************************
+ * \brief Loads the CoAP messages of a capture
+ *
+ * \param char *pPath [in] - pcap file.
+ *
+ * \param U16 port [in] - UDP port of the CoAP traffic, 0 for any.
+ *
+ *
+ * \return Returns the number of messages loaded or -1 on error.
+ *
+ ********************************************************************************/
+static int32_t coapReplayLoad(const char *pPath, uint16_t port)
+{
+   FILE *pFile;                   // Used to read the capture.
+   uint8_t header[24];            // Used to store the file header.
+   uint8_t record[16];            // Used to store a record header.
+   uint8_t *pFrame;               // Used to store a captured frame.
+   const uint8_t *pPayload;       // Used to store the CoAP message.
+   uint32_t magic;                // Used to store the magic number.
+   uint32_t linkType;             // Used to store the link type.
+   uint32_t capturedLength;       // Used to store the frame length.
+   int32_t length;                // Used to store the message length.
+   int32_t loaded = 0;            // Used to count the messages.
+   bool swapped;                  // Used to store the byte order.
+
+   pFile = fopen(pPath, "rb");
+
+   if( pFile == NULL )
+   {
+      return -1;
+   }
+
+   if( fread(header, 1, sizeof(header), pFile) != sizeof(header) )
+   {
+      fclose(pFile);
+      return -1;
+   }
+
+   magic = coapReplayField(header, 4, false);
+
+   if( magic == 0xA1B2C3D4UL || magic == 0xA1B23C4DUL )
+   {
+      swapped = false;
+   }
+   else if( magic == 0xD4C3B2A1UL || magic == 0x4D3CB2A1UL )
+   {
+      swapped = true;
+   }
+   else
+   {
+      // pcapng and other formats, convert with editcap -F pcap.
+      fclose(pFile);
+      return -1;
+   }
+
+   linkType = coapReplayField(header + 20, 4, swapped) & 0xFFFF;
+   pFrame = malloc(0x40000);
+
+   while( pFrame != NULL && coapReplayCount < COAP_REPLAY_MAX_MESSAGES &&
+          fread(record, 1, sizeof(record), pFile) == sizeof(record) )
+   {
+      capturedLength = coapReplayField(record + 8, 4, swapped);
+
+      if( capturedLength > 0x40000 || fread(pFrame, 1, capturedLength, pFile) != capturedLength )
+      {
+         break;
+      }
+
+      length = coapReplayUdpPayload(linkType, pFrame, capturedLength, port, &pPayload);
+
+      if( length < 0 || length > MAX_BUFFER_SIZE )
+      {
+         continue;
+      }
+
+      coapReplayMessages[coapReplayCount].pData = malloc(length > 0 ? length : 1);
+
+      if( coapReplayMessages[coapReplayCount].pData == NULL )
+      {
+         break;
+      }
+
+      memcpy(coapReplayMessages[coapReplayCount].pData, pPayload, length);
+      coapReplayMessages[coapReplayCount].length = (uint16_t)length;
+      coapReplayCount++;
+      coapReplayBytes += length;
+      loaded++;
+   }
+
+   free(pFrame);
+   fclose(pFile);
+
+   return loaded;
+}
+
+/*!*****************************************************************************
+ * \brief Writes every message as a libFuzzer seed
+ *
+ * \param char *pDirectory [in] - Existing corpus directory.
+ *
+ ********************************************************************************/
+static void coapReplayWriteCorpus(const char *pDirectory)
+{
+   char path[512];    // Used to store the seed file name.
+   FILE *pFile;       // Used to write the seed.
+   uint32_t i;        // Used as an iterator.
+
+   for( i = 0; i < coapReplayCount; i++ )
+   {
+      snprintf(path, sizeof(path), "%s/capture-%06u", pDirectory, (unsigned)i);
+      pFile = fopen(path, "wb");
+
+      if( pFile != NULL )
+      {
+         fwrite(coapReplayMessages[i].pData, 1, coapReplayMessages[i].length, pFile);
+         fclose(pFile);
+      }
+   }
+}
+
+// Decode functions, profiled one at a time over the whole capture.
+
+static uint32_t coapReplayValidatePacket(uint8_t *pBuffer, uint16_t length)
+{
+   return (uint32_t)coapValidatePacket(pBuffer, length);
+}
+
+static uint32_t coapReplayGetOptionCount(uint8_t *pBuffer, uint16_t length)
+{
+   return (uint32_t)coapGetOptionCount(pBuffer, length);
+}
+
+static uint32_t coapReplayGetOptions(uint8_t *pBuffer, uint16_t length)
+{
+   uint8_t *pData;    // Used to store the option data.
+   uint8_t number;    // Used to store the option number.
+   uint32_t sum = 0;  // Used to fold the results.
+   int32_t count;     // Used to store the option count.
+   int32_t i;         // Used as an iterator.
+
+   count = coapGetOptionCount(pBuffer, length);
+
+   for( i = 1; i <= count; i++ )
+   {
+      number = 0;
+      sum += coapGetOption(pBuffer, length, (uint8_t)i, &number, &pData, NULL) + number;
+   }
+
+   return sum;
+}
+
+static uint32_t coapReplayGetPayload(uint8_t *pBuffer, uint16_t length)
+{
+   uint8_t *pPayload = NULL;   // Used to store the payload.
+
+   return (uint32_t)coapGetPayload(pBuffer, length, &pPayload) + (pPayload != NULL);
+}
+
+static uint32_t coapReplayParseMessage(uint8_t *pBuffer, uint16_t length)
+{
+   CoapMessageView view;   // Used to store the view.
+
+   return (uint32_t)coapParseMessage(pBuffer, length, &view) + view.optionCount + view.payloadLength;
+}
+
+/*!*****************************************************************************
+ * \brief Times one function over the capture
+ *
+ * Description:
+ *  Replays the whole capture until COAP_REPLAY_MIN_NS have passed (at least
+ *  passes times), so the clock is read per pass and not per message.
+ *
+ * \param CoapReplayFunction function [in] - Function to time.
+ *
+ * \param U32 passes [in] - Minimum passes over the capture.
+ *
+ *
+ * \return Returns nanoseconds per message.
+ *
+ ********************************************************************************/
+static double coapReplayTime(CoapReplayFunction function, uint32_t passes)
+{
+   uint64_t start;       // Used to store the start time.
+   uint64_t elapsed;     // Used to store the run time.
+   uint64_t done = 0;    // Used to count the passes.
+   uint32_t sum = 0;     // Used to fold the results.
+   uint32_t i;           // Used as an iterator.
+
+   start = coapReplayNow();
+
+   do
+   {
+      for( i = 0; i < coapReplayCount; i++ )
+      {
+         sum += function(coapReplayMessages[i].pData, coapReplayMessages[i].length);
+      }
+
+      done++;
+      elapsed = coapReplayNow() - start;
+   } while( done < passes || elapsed < COAP_REPLAY_MIN_NS );
+
+   coapReplaySink += sum;
+
+   return (double)elapsed / ((double)done * coapReplayCount);
+}
+
+int main(int argc, char **argv)
+{
+   static const char *pNames[COAP_REPLAY_FUNCTION_COUNT] =
+   {
+      "coapValidatePacket", "coapGetOptionCount", "coapGetOption (all)", "coapGetPayload", "coapParseMessage"
+   };
+   static const CoapReplayFunction functions[COAP_REPLAY_FUNCTION_COUNT] =
+   {
+      coapReplayValidatePacket, coapReplayGetOptionCount, coapReplayGetOptions, coapReplayGetPayload, coapReplayParseMessage
+   };
+   const char *pCorpus = NULL;   // Used to store the seed directory.
+   uint16_t port = COAP_PORT;    // Used to store the port filter.
+   uint32_t passes = 1;          // Used to store the minimum passes.
+   double nsPerMessage[COAP_REPLAY_FUNCTION_COUNT];   // Used to store the profile.
+   double decodePath = 0;        // Used to store the legacy decode path time.
+   uint32_t i;                   // Used as an iterator.
+   int argument;                 // Used as an iterator.
+
+   coapReplayMessages = calloc(COAP_REPLAY_MAX_MESSAGES, sizeof(CoapReplayMessage));
+
+   for( argument = 1; argument < argc; argument++ )
+   {
+      if( strcmp(argv[argument], "-p") == 0 && argument + 1 < argc )
+      {
+         port = (uint16_t)atoi(argv[++argument]);
+      }
+      else if( strcmp(argv[argument], "-n") == 0 && argument + 1 < argc )
+      {
+         passes = (uint32_t)atoi(argv[++argument]);
+      }
+      else if( strcmp(argv[argument], "-o") == 0 && argument + 1 < argc )
+      {
+         pCorpus = argv[++argument];
+      }
+      else if( coapReplayMessages == NULL || coapReplayLoad(argv[argument], port) < 0 )
+      {
+         fprintf(stderr, "%s: can not read %s as a pcap capture\n", argv[0], argv[argument]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   if( coapReplayCount == 0 )
+   {
+      fprintf(stderr, "usage: %s [-p port (0 any)] [-n passes] [-o corpus dir] capture.pcap ...\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   if( pCorpus != NULL )
+   {
+      coapReplayWriteCorpus(pCorpus);
+   }
+
+   // One checked pass first, a disagreement aborts before anything is timed.
+   for( i = 0; i < coapReplayCount; i++ )
+   {
+      coapReplaySink += coapReplayDecode(coapReplayMessages[i].pData, coapReplayMessages[i].length);
+   }
+
+   printf("%u messages, %.1f B average, all decoders agree\n", (unsigned)coapReplayCount,
+          (double)coapReplayBytes / coapReplayCount);
+
+   for( i = 0; i < COAP_REPLAY_FUNCTION_COUNT; i++ )
+   {
+      nsPerMessage[i] = coapReplayTime(functions[i], passes);
+
+      if( i != 1 && i != 4 )
+      {
+         decodePath += nsPerMessage[i];
+      }
+   }
+
+   // Share of the decode path, coapGetOptionCount is inside coapGetOption (all).
+   for( i = 0; i < COAP_REPLAY_FUNCTION_COUNT; i++ )
+   {
+      printf("%-22s %9.1f ns/msg %12.0f msg/s", pNames[i], nsPerMessage[i], 1e9 / nsPerMessage[i]);
+
+      if( i != 1 && i != 4 )
+      {
+         printf(" %5.1f%%", 100.0 * nsPerMessage[i] / decodePath);
+      }
+
+      printf("\n");
+   }
+
+   printf("%-22s %9.1f ns/msg %12.0f msg/s %9.1f MB/s\n", "decode path", decodePath, 1e9 / decodePath,
+          (double)coapReplayBytes / coapReplayCount * 1e3 / decodePath);
+   printf("sink %u\n", (unsigned)coapReplaySink);
+
+   return EXIT_SUCCESS;
+}
+
+#endif /* COAP_REPLAY_FUZZER */
+
+//! @}
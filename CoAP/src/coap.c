@@ -6,6 +6,83 @@
  */
 
 #include "coap.h"
+#include "coap_random.h"
+#include "coap_stats.h"
+
+// Sets the bit for a CoAP code if it falls in the given 32 bit word of the bitmap.
+#define COAP_CODE_BIT(code, word)   ( (((code) >> 5) == (word)) ? (1UL << ((code) & 0x1F)) : 0UL )
+
+// One 32 bit word of the valid code bitmap, every CoapCode value is listed once.
+#define COAP_CODE_WORD(word)  ( COAP_CODE_BIT(COAP_EMPTY, word) | \
+                                COAP_CODE_BIT(COAP_GET, word) | \
+                                COAP_CODE_BIT(COAP_POST, word) | \
+                                COAP_CODE_BIT(COAP_PUT, word) | \
+                                COAP_CODE_BIT(COAP_DELETE, word) | \
+                                COAP_CODE_BIT(COAP_CREATED, word) | \
+                                COAP_CODE_BIT(COAP_DELETED, word) | \
+                                COAP_CODE_BIT(COAP_VALID, word) | \
+                                COAP_CODE_BIT(COAP_CHANGED, word) | \
+                                COAP_CODE_BIT(COAP_CONTENT, word) | \
+                                COAP_CODE_BIT(COAP_CONTINUE, word) | \
+                                COAP_CODE_BIT(COAP_BAD_REQUEST, word) | \
+                                COAP_CODE_BIT(COAP_UNAUTHORIZED, word) | \
+                                COAP_CODE_BIT(COAP_BAD_OPTION, word) | \
+                                COAP_CODE_BIT(COAP_FORBIDDEN, word) | \
+                                COAP_CODE_BIT(COAP_NOT_FOUND, word) | \
+                                COAP_CODE_BIT(COAP_METHOD_NOT_ALLOWED, word) | \
+                                COAP_CODE_BIT(COAP_NOT_ACCEPTABLE, word) | \
+                                COAP_CODE_BIT(COAP_PRECONDITION_FAILED, word) | \
+                                COAP_CODE_BIT(COAP_REQUEST_ENTITY_TOO_LARGE, word) | \
+                                COAP_CODE_BIT(COAP_UNSUPPORTED_CONTENT, word) | \
+                                COAP_CODE_BIT(COAP_INTERNAL_SERVER_ERROR, word) | \
+                                COAP_CODE_BIT(COAP_NOT_IMPLEMENTED, word) | \
+                                COAP_CODE_BIT(COAP_BAD_GATEWAY, word) | \
+                                COAP_CODE_BIT(COAP_SERVICE_UNAVAILABLE, word) | \
+                                COAP_CODE_BIT(COAP_GATEWAY_TIMEOUT, word) | \
+                                COAP_CODE_BIT(COAP_PROXYING_NOT_SUPPORTED, word) )
+
+// 256 bit bitmap of valid codes, resolved at compile time.
+static const uint32_t coapCodeBitmap[8] =
+{
+   COAP_CODE_WORD(0), COAP_CODE_WORD(1), COAP_CODE_WORD(2), COAP_CODE_WORD(3),
+   COAP_CODE_WORD(4), COAP_CODE_WORD(5), COAP_CODE_WORD(6), COAP_CODE_WORD(7)
+};
+
+// Option classification as per RFC 7252 section 5.4.6 and table 4.  Entries
+// that are not listed are unknown options (zero) unless the repo treats them
+// as invalid.
+static const uint8_t coapOptionFlags[COAP_OPTION_TABLE_SIZE] =
+{
+   [COAP_OPTION_IF_MATCH]       = COAP_OPTION_FLAG_KNOWN | COAP_OPTION_FLAG_CRITICAL | COAP_OPTION_FLAG_REPEATABLE | COAP_OPTION_FORMAT_OPAQUE,
+   [2]                          = COAP_OPTION_FLAG_INVALID,
+   [COAP_OPTION_URI_HOST]       = COAP_OPTION_FLAG_KNOWN | COAP_OPTION_FLAG_CRITICAL | COAP_OPTION_FLAG_UNSAFE | COAP_OPTION_FORMAT_STRING,
+   [COAP_OPTION_ETAG]           = COAP_OPTION_FLAG_KNOWN | COAP_OPTION_FLAG_REPEATABLE | COAP_OPTION_FORMAT_OPAQUE,
+   [COAP_OPTION_IF_NONE_MATCH]  = COAP_OPTION_FLAG_KNOWN | COAP_OPTION_FLAG_CRITICAL | COAP_OPTION_FORMAT_EMPTY,
+   [COAP_OPTION_OBSERVE]        = COAP_OPTION_FLAG_KNOWN | COAP_OPTION_FLAG_UNSAFE | COAP_OPTION_FORMAT_UINT,
+   [COAP_OPTION_URI_PORT]       = COAP_OPTION_FLAG_KNOWN | COAP_OPTION_FLAG_CRITICAL | COAP_OPTION_FLAG_UNSAFE | COAP_OPTION_FORMAT_UINT,
+   [COAP_OPTION_LOCATION_PATH]  = COAP_OPTION_FLAG_KNOWN | COAP_OPTION_FLAG_REPEATABLE | COAP_OPTION_FORMAT_STRING,
+   [9]                          = COAP_OPTION_FLAG_INVALID,
+   [10]                         = COAP_OPTION_FLAG_INVALID,
+   [COAP_OPTION_URI_PATH]       = COAP_OPTION_FLAG_KNOWN | COAP_OPTION_FLAG_CRITICAL | COAP_OPTION_FLAG_UNSAFE | COAP_OPTION_FLAG_REPEATABLE | COAP_OPTION_FORMAT_STRING,
+   [COAP_OPTION_CONTENT_FORMAT] = COAP_OPTION_FLAG_KNOWN | COAP_OPTION_FORMAT_UINT,
+   [COAP_OPTION_MAXAGE]         = COAP_OPTION_FLAG_KNOWN | COAP_OPTION_FLAG_UNSAFE | COAP_OPTION_FORMAT_UINT,
+   [COAP_OPTION_URI_QUERY]      = COAP_OPTION_FLAG_KNOWN | COAP_OPTION_FLAG_CRITICAL | COAP_OPTION_FLAG_UNSAFE | COAP_OPTION_FLAG_REPEATABLE | COAP_OPTION_FORMAT_STRING,
+   [COAP_OPTION_ACCEPT]         = COAP_OPTION_FLAG_KNOWN | COAP_OPTION_FLAG_CRITICAL | COAP_OPTION_FORMAT_UINT,
+   [COAP_OPTION_LOCATION_QUERY] = COAP_OPTION_FLAG_KNOWN | COAP_OPTION_FLAG_REPEATABLE | COAP_OPTION_FORMAT_STRING,
+   [COAP_OPTION_BLOCK2]         = COAP_OPTION_FLAG_KNOWN | COAP_OPTION_FLAG_CRITICAL | COAP_OPTION_FLAG_UNSAFE | COAP_OPTION_FORMAT_UINT,
+   [COAP_OPTION_BLOCK1]         = COAP_OPTION_FLAG_KNOWN | COAP_OPTION_FLAG_CRITICAL | COAP_OPTION_FLAG_UNSAFE | COAP_OPTION_FORMAT_UINT,
+   [COAP_OPTION_SIZE2]          = COAP_OPTION_FLAG_KNOWN | COAP_OPTION_FLAG_NO_CACHE_KEY | COAP_OPTION_FORMAT_UINT,
+   [COAP_OPTION_PROXY_URI]      = COAP_OPTION_FLAG_KNOWN | COAP_OPTION_FLAG_CRITICAL | COAP_OPTION_FLAG_UNSAFE | COAP_OPTION_FORMAT_STRING,
+   [COAP_OPTION_PROXY_SCHEME]   = COAP_OPTION_FLAG_KNOWN | COAP_OPTION_FLAG_CRITICAL | COAP_OPTION_FLAG_UNSAFE | COAP_OPTION_FORMAT_STRING,
+   [COAP_OPTION_SIZE1]          = COAP_OPTION_FLAG_KNOWN | COAP_OPTION_FLAG_NO_CACHE_KEY | COAP_OPTION_FORMAT_UINT,
+   [128]                        = COAP_OPTION_FLAG_INVALID,
+   [132]                        = COAP_OPTION_FLAG_INVALID,
+   [136]                        = COAP_OPTION_FLAG_INVALID,
+   [140]                        = COAP_OPTION_FLAG_INVALID
+};
+
+// Extended option delta/length decoder, shared by every option walk.
+static int32_t coapDecodeExtended(uint8_t nibble, uint8_t **pPointer, uint8_t *pEnd);
 
 
 /*!******************************************************************************
@@ -302,7 +379,8 @@ int16_t coapGetCode(uint8_t *pBuffer, uint16_t bufferLength)
  *
  * Description:
  *   The function coapCodeIsValid determines if a code parsed from a CoAP packet
- *   is valid.
+ *   is valid.  The lookup is a single bit test in coapCodeBitmap, which is built
+ *   at compile time from the CoapCode enum.
  *
  *   Link to valid codes:
  *           http://tools.ietf.org/html/rfc7252#section-12.1.2
@@ -317,145 +395,14 @@ int16_t coapGetCode(uint8_t *pBuffer, uint16_t bufferLength)
  ********************************************************************************/
 bool coapCodeIsValid(int16_t code)
 {
-   bool isValid = false;
-   switch( code )
+   // Codes are a single byte.
+   if( code < 0 || code > 0xFF )
    {
-   case COAP_EMPTY:
-
-      isValid = true;
-      break;
-
-   case COAP_GET:
-
-      isValid = true;
-      break;
-
-   case COAP_POST:
-
-      isValid = true;
-      break;
-
-   case COAP_PUT:
-
-      isValid = true;
-      break;
-
-   case COAP_DELETE:
-
-      isValid = true;
-      break;
-
-   case COAP_CREATED:
-
-      isValid = true;
-      break;
-
-   case COAP_DELETED:
-
-      isValid = true;
-      break;
-
-   case COAP_VALID:
-
-      isValid = true;
-      break;
-
-   case COAP_CHANGED:
-
-      isValid = true;
-      break;
-
-   case COAP_CONTENT:
-
-      isValid = true;
-      break;
-
-   case COAP_BAD_REQUEST:
-
-      isValid = true;
-      break;
-
-   case COAP_UNAUTHORIZED:
-
-      isValid = true;
-      break;
-
-   case COAP_BAD_OPTION:
-
-      isValid = true;
-      break;
-
-   case COAP_FORBIDDEN:
-
-      isValid = true;
-      break;
-
-   case COAP_NOT_FOUND:
-
-      isValid = true;
-      break;
-
-   case COAP_METHOD_NOT_ALLOWED:
-
-      isValid = true;
-      break;
-
-   case COAP_NOT_ACCEPTABLE:
-
-      isValid = true;
-      break;
-
-   case COAP_PRECONDITION_FAILED:
-
-      isValid = true;
-      break;
-
-   case COAP_REQUEST_ENTITY_TOO_LARGE:
-
-      isValid = true;
-      break;
-
-   case COAP_UNSUPPORTED_CONTENT:
-
-      isValid = true;
-      break;
-
-   case COAP_INTERNAL_SERVER_ERROR:
-
-      isValid = true;
-      break;
-
-   case COAP_NOT_IMPLEMENTED:
-
-      isValid = true;
-      break;
-
-   case COAP_BAD_GATEWAY:
-
-      isValid = true;
-      break;
-
-   case COAP_SERVICE_UNAVAILABLE:
-
-      isValid = true;
-      break;
-
-   case COAP_GATEWAY_TIMEOUT:
-
-      isValid = true;
-      break;
-
-   case COAP_PROXYING_NOT_SUPPORTED:
-
-      isValid = true;
-      break;
-
-   default:
-
-      break;
+      return false;
    }
 
-   return isValid;
+   // One load and a mask into the compile time bitmap.
+   return (coapCodeBitmap[code >> 5] >> (code & 0x1F)) & 0x01;
 }
 
 /*!*****************************************************************************
@@ -589,16 +536,14 @@ int8_t coapGetToken(uint8_t *pBuffer, uint16_t bufferLength, uint8_t *pToken)
  ********************************************************************************/
 int32_t coapGetOptionCount(uint8_t *pBuffer, uint16_t bufferLength)
 {
-   uint8_t *pointer = pBuffer;   // Used to index the buffer.
-   uint8_t additionalByte;       // Used to construct option header.
-   uint8_t byte;                 // Used to construct option header.
-   uint8_t optionLength = 0;     // Used to store the length of data of a option instance.
+   uint8_t *pointer = pBuffer;                // Used to index the buffer.
+   uint8_t *pEnd = pBuffer + bufferLength;    // One past the last byte of the buffer.
+   uint8_t byte;                              // Used to construct option header.
+   int32_t optionLength;                      // Used to store the length of data of a option instance.
 
    int8_t tokenLength;
    int32_t count = 0;            //used to store the option count
 
-   uint16_t newLength = bufferLength;     //used to keep track of the difference in length
-
    // Check if there are at least 4 btyes
    if( bufferLength < COAP_HDR_BYTES )
    {
@@ -617,98 +562,42 @@ int32_t coapGetOptionCount(uint8_t *pBuffer, uint16_t bufferLength)
       }
    }
 
-   // Determine if there are any options to count
-   if( (COAP_HDR_BYTES + tokenLength) == bufferLength )
-   {
-      //no options to count return count = 0.
-      return count;
-   }
-   else
+   // Check that the token fits in the buffer.
+   if( (COAP_HDR_BYTES + tokenLength) > bufferLength )
    {
-      //skip the header bytes and the token bytes
-      pointer += COAP_HDR_BYTES + tokenLength;
-
-      //update newLength
-      newLength -= (COAP_HDR_BYTES + tokenLength);
+      return COAP_INSUFFICIENT_BUFFER;
    }
 
-   //initially assign the byte value
-   byte = *pointer;
+   //skip the header bytes and the token bytes
+   pointer += COAP_HDR_BYTES + tokenLength;
 
    //loop through the remaining bytes of the buffer and determine the count
-   while( byte != COAP_PAYLOAD_MARKER && newLength != 0 )
+   while( pointer < pEnd && *pointer != COAP_PAYLOAD_MARKER )
    {
+      byte = *pointer++;
 
-      //determine the option length
-      optionLength = ( (byte & 0x0F) );
-
-      switch( optionLength )
+      // Skip the extended delta bytes, 13 adds one byte and 14 adds two.
+      if( coapDecodeExtended(byte >> 4, &pointer, pEnd) < 0 )
       {
-      case 0x0F:
-
-         //invalid option formatting
          return COAP_INVALID_PACKET;
+      }
 
-      case 0x0E:
-
-         //increment the option count
-         count++;
-
-         //index the buffer to the next byte
-         pointer++;
-
-         //assign the additional byte
-         additionalByte = *pointer;
-
-         //add 269 to the option length becuase of CoAP option format
-         optionLength = additionalByte + 269;
-
-         //subtract the optionLength + the additional byte
-         //to get the new length of the buffer
-         newLength -= (optionLength + 2);
-
-         //incremement the pointer to retrieve the next byte
-         pointer += (optionLength + 1);
-
-      case 0x0D:
-
-         //incrememnt the count
-         count++;
-
-         //index the buffer to the next byte
-         pointer++;
-
-         //assign the additional byte
-         additionalByte = *pointer;
-
-         //add 13 to the optionLength because of CoAP option format
-         optionLength = additionalByte + 13;
-
-         //subtract the optionLength + the additional byte to get the
-         //new length of the buffer
-         newLength -= (optionLength + 2);
-
-         //increment the pointer to retrieve the next byte
-         pointer += (optionLength + 1);
-
-         break;
-      default:
-
-         //increment the count
-         count++;
-
-         //subtract the option length to get the new length of the buffer
-         newLength -= (optionLength + 1);
-
-         //increment the pointer to retrieve the next byte
-         pointer += (optionLength + 1);
+      // Decode the length the same way, the extended bytes follow the delta's.
+      optionLength = coapDecodeExtended(byte & 0x0F, &pointer, pEnd);
 
-         break;
+      // Check that the option value fits in what is left of the buffer.
+      if( optionLength < 0 || optionLength > (pEnd - pointer) )
+      {
+         return COAP_INVALID_PACKET;
       }
 
-      // Assign the next byte within the array
-      byte = *pointer;
+      //increment the count
+      count++;
+
+      //increment the pointer to retrieve the next byte
+      pointer += optionLength;
    }
+
    return count;
 }
 
@@ -744,8 +633,8 @@ int32_t coapGetOption(uint8_t *pBuffer, uint16_t bufferLength, uint8_t optionInd
 {
    uint8_t *pointer = pBuffer;   // Used to index through the buffer.
    uint8_t *newPointer;          // Used to help index through the option decoder.
-   uint8_t *optionData;          // Used to store the option data
-   uint8_t optionLength = 0;     // Used to store the option length.
+   uint8_t *optionData = NULL;   // Used to store the option data
+   int32_t optionLength = 0;     // Used to store the option length.
    uint8_t optionNumber;         // Used to store the option number.
    uint8_t i;                    // Used as an iterator.
    uint16_t newLength;           // Used to keep track of the length left in buffer.
@@ -785,6 +674,12 @@ int32_t coapGetOption(uint8_t *pBuffer, uint16_t bufferLength, uint8_t optionInd
 
    for( i=0; i < optionIndex; i++ )
    {
+      // Check if the options ended with the buffer.
+      if( newLength == 0 )
+      {
+         return COAP_END_OF_PACKET;
+      }
+
       // Check if the current position is not the payload byte
       if( *pointer == COAP_PAYLOAD_MARKER )
       {
@@ -802,6 +697,7 @@ int32_t coapGetOption(uint8_t *pBuffer, uint16_t bufferLength, uint8_t optionInd
       }
 
       // Position pointer at next option intsance.
+      newLength -= newPointer - pointer;
       pointer = newPointer;
    }
 
@@ -853,8 +749,9 @@ int32_t coapGetOption(uint8_t *pBuffer, uint16_t bufferLength, uint8_t optionInd
  ********************************************************************************/
 int32_t coapDecodeOption(uint8_t *pPointer, uint16_t bufferLength, uint8_t *pOptionNumber, uint8_t **pOptionData, uint8_t **pNewPointer)
 {
+   uint8_t *pStart = pPointer;         // Used to store the start of the option instance.
 
-   uint8_t optionDelta;                // Used to keep track of delta for TLV format.
+   uint16_t optionDelta;               // Used to keep track of delta for TLV format.
 
    uint16_t optionLength;              // Used to keep track of the length of the option
 
@@ -876,6 +773,12 @@ int32_t coapDecodeOption(uint8_t *pPointer, uint16_t bufferLength, uint8_t *pOpt
    // The option length is stored as the last four bits
    optionLength = *pPointer & 0x0F;
 
+   // Check that the extended delta and length bytes are within the buffer.
+   if( bufferLength < 1 + (optionDelta == 0x0E ? 2 : optionDelta == 0x0D) + (optionLength == 0x0E ? 2 : optionLength == 0x0D) )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
    // Increment the pointer.
    pPointer++;
 
@@ -944,6 +847,12 @@ int32_t coapDecodeOption(uint8_t *pPointer, uint16_t bufferLength, uint8_t *pOpt
    // Assign the option number
    if( pOptionNumber != NULL )
    {
+      // The option number is a U8 here, anything larger needs coapParseMessage.
+      if( (*pOptionNumber + optionDelta) > 0xFF )
+      {
+         return COAP_INVALID_OPTION;
+      }
+
       *pOptionNumber += optionDelta;
    }
 
@@ -953,6 +862,12 @@ int32_t coapDecodeOption(uint8_t *pPointer, uint16_t bufferLength, uint8_t *pOpt
       *pOptionData = pPointer;
    }
 
+   // Check that the option value is within the buffer.
+   if( optionLength > bufferLength - (pPointer - pStart) )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
    // Position the pointer at the next option instance.
    pPointer += optionLength;
 
@@ -989,173 +904,78 @@ int32_t coapDecodeOption(uint8_t *pPointer, uint16_t bufferLength, uint8_t *pOpt
  ********************************************************************************/
 int16_t coapGetPayload(uint8_t *pBuffer, uint16_t bufferLength, uint8_t **pPayloadData)
 {
-   uint8_t *pointer = pBuffer;   // Used to index the buffer.
-   uint8_t byte;                 // Used to decode bytes in the buffer.
-   uint8_t additionalByte;       // Used to decode the additional TLV byte.
-
-   int16_t newLength;           // Used to keep track of the length.
+   uint8_t *pointer = pBuffer;                // Used to index the buffer.
+   uint8_t *pEnd = pBuffer + bufferLength;    // One past the last byte of the buffer.
+   uint8_t byte;                              // Used to decode bytes in the buffer.
 
    int8_t tokenLength;          // Used to store the token length.
 
-   int32_t optionLength = 0;    // Used to store the option length.
-   int32_t optionCount;         // Used to store the option count.
-   int32_t payloadSize = 0;     // Used to store the payload size.
+   int32_t optionLength;        // Used to store the option length.
 
    // Check if packet is at least 4 bytes
    if( bufferLength < COAP_HDR_BYTES )
    {
       return COAP_INVALID_PACKET;
    }
-   else
+
+   // Get the token length.
+   tokenLength = coapGetTokenLength(pBuffer, bufferLength);
+
+   // Check for errors.
+   if( tokenLength < 0 )
    {
-      // Store the length.
-      newLength = bufferLength;
+      // Return the error stored in tokenLength
+      return tokenLength;
+   }
 
-      // Get the option count.
-      optionCount = coapGetOptionCount(pBuffer, bufferLength);
+   // Check that there is enough buffer.
+   if( (COAP_HDR_BYTES + tokenLength) > bufferLength )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
 
-      // Get the token length.
-      tokenLength = coapGetTokenLength(pBuffer, bufferLength);
+   // Index the pointer pass the header and token bytes.
+   pointer += COAP_HDR_BYTES + tokenLength;
 
-      // Check for errors.
-      if(  optionCount < 0 )
-      {
-         // Return the error stored in optionCount
-         return optionCount;
-      }
-      else if( tokenLength < 0 )
+   // Skip the options in the same pass that checks them.
+   while( pointer < pEnd && *pointer != COAP_PAYLOAD_MARKER )
+   {
+      byte = *pointer++;
+
+      if( coapDecodeExtended(byte >> 4, &pointer, pEnd) < 0 )
       {
-         // Return the error stored in tokenLength
-         return tokenLength;
+         return COAP_INVALID_PACKET;
       }
-      else
-      {
-         // Check that there is enough buffer.
-         if( (COAP_HDR_BYTES + tokenLength) > bufferLength )
-         {
-            return COAP_INSUFFICIENT_BUFFER;
-         }
-         else if( (COAP_HDR_BYTES + tokenLength) == bufferLength )
-         {
-            // No buffer left for paylaod.
-            return payloadSize;
-         }
 
-         // No errors.  Add index the pointer pass the header and token bytes.
-         pointer += COAP_HDR_BYTES + tokenLength;
+      optionLength = coapDecodeExtended(byte & 0x0F, &pointer, pEnd);
 
-         // Subtract the header and token length.
-         newLength -= (int16_t)COAP_HDR_BYTES + tokenLength;
+      if( optionLength < 0 || optionLength > (pEnd - pointer) )
+      {
+         return COAP_INVALID_PACKET;
       }
-   }
 
-   // Assign the byte the pointer is pointing to.
-   byte = *pointer;
+      pointer += optionLength;
+   }
 
-   if( optionCount == 0 && byte == COAP_PAYLOAD_MARKER )
+   // No payload marker, no payload.
+   if( pointer == pEnd )
    {
-      // Copy the payload data skipping the payload marker.
-      pointer++;
-      newLength -= 1;
-      *pPayloadData = pointer;
-      //memcpy( pPayloadData, pointer, newLength );
-
-      // Return the size of the paylaod.
-      return (int16_t)newLength;
+      return 0;
    }
-   else if( optionCount > 0 && byte == COAP_PAYLOAD_MARKER )
+
+   // Skip the payload marker, which must be followed by a payload.
+   pointer++;
+
+   if( pointer == pEnd )
    {
-      // Return a formatting error.
+      // Return a formatting error
       return COAP_INVALID_PACKET;
    }
-   else  // Option Count is > 0
-   {
-      //loop through the remaining bytes of the buffer and determine the count
-      while( byte != COAP_PAYLOAD_MARKER || newLength == 0)
-      {
-
-         // Determine the option length.
-         optionLength = ( (byte & 0x0F) );
-
-         switch( optionLength )
-         {
-         case 0x0F:
-
-            // Invalid option formatting.
-            return COAP_INVALID_PACKET;
-
-         case 0x0E:
-
-            // Index the buffer to the next byte.
-            pointer++;
-
-            // Assign the additional byte
-            additionalByte = *pointer;
-
-            // Add 269 to the option length becuase of CoAP option format.
-            optionLength = additionalByte + 269;
-
-            // Subtract the optionLength + the additional byte
-            // to get the new length of the buffer.
-            newLength -= (optionLength + 2);
-
-            // Incremement the pointer to retrieve the next byte.
-            pointer += (optionLength + 1);
-
-         case 0x0D:
-
-            // Index the buffer to the next byte.
-            pointer++;
-
-            // Assign the additional byte.
-            additionalByte = *pointer;
 
-            // Add 13 to the optionLength because of CoAP option format.
-            optionLength = additionalByte + 13;
+   *pPayloadData = pointer;
 
-            // Subtract the optionLength + the additional byte to get the
-            // new length of the buffer.
-            newLength -= (optionLength + 2);
-
-            // Increment the pointer to retrieve the next byte.
-            pointer += (optionLength + 1);
-
-            break;
-         default:
-
-            // Subtract the option length to get the new length of the buffer.
-            newLength -= (optionLength + 1);
-
-            // Increment the pointer to retrieve the next byte.
-            pointer += (optionLength + 1);
-
-            break;
-         }
-
-         // Assign the next byte within the array
-         byte = *pointer;
-
-         // Decrement the optionCount variable.
-         optionCount--;
-      }
-
-      // Check the case that broke the loop
-      if( byte == COAP_PAYLOAD_MARKER && newLength != 0 )
-      {
-         // Assign the payload data skipping the payload marker.
-         pointer++;
-         newLength -= 1;
-
-         *pPayloadData = pointer;
-
-      }
-      else
-      {
-         // Return a formatting error
-         return COAP_INVALID_PACKET;
-      }
-   }
-   return newLength;
+   // Return the size of the paylaod.
+   return (int16_t)(pEnd - pointer);
 }
 
 
@@ -1177,21 +997,8 @@ int16_t coapGetPayload(uint8_t *pBuffer, uint16_t bufferLength, uint8_t **pPaylo
  ********************************************************************************/
 int16_t coapGetSize(uint8_t *pBuffer)
 {
-   uint8_t *pointer = pBuffer;
-   int16_t count = 0;
-
-
-   while( *pointer != 0 )
-   {
-      // Increment the count.
-      count++;
-
-      // Incrment the pointer.
-      pointer++;
-
-   }
-
-   return count;
+   // Endpoint strings are measured once by coapConfigInit, this is only kept for callers.
+   return (int16_t)strlen((const char *)pBuffer);
 }
 
 /*!*****************************************************************************
@@ -1420,8 +1227,11 @@ int8_t coapSetToken(uint8_t *pBuffer, uint16_t *pBufferLength, uint8_t *pToken,
    // Skip the header bytes.
    pBuffer += COAP_HDR_BYTES;
 
-   // Copy the token bytes to the buffer.
-   memcpy(pBuffer, pToken, tokenLength);
+   // Copy the token bytes to the buffer, pToken may be NULL without a token.
+   if( tokenLength > 0 )
+   {
+      memcpy(pBuffer, pToken, tokenLength);
+   }
 
    // Set the new length.
    *pBufferLength = COAP_HDR_BYTES + tokenLength;
@@ -1599,12 +1409,14 @@ int8_t coapAddOption(uint8_t *pBuffer, uint16_t *pBufferLength, uint8_t option,
  * \return  Returns the new buffer length on success or < 0 for error.
  *
  ********************************************************************************/
-int8_t coapBuildOptionHeader(uint8_t *pBuffer, uint16_t *pBufferLength, uint8_t option, uint8_t previousOption, uint8_t optionLength, uint8_t optionHeaderLength, uint8_t **pNewPointer)
+int16_t coapBuildOptionHeader(uint8_t *pBuffer, uint16_t *pBufferLength, uint8_t option, uint8_t previousOption, uint8_t optionLength, uint8_t optionHeaderLength, uint8_t **pNewPointer)
 {
    uint8_t *pointer = *pNewPointer;  // Used to index the buffer.
    uint8_t *newPointer = *pNewPointer;
-   uint8_t delta;                   // Used to store the delta value to encode.
-   uint8_t length = optionLength;  // Used to store the length of the option.
+   uint16_t delta;                  // Used to store the delta value to encode.
+   uint16_t length = optionLength; // Used to store the length of the option.
+   uint8_t deltaNibble;             // Used to store the 4 bit delta field.
+   uint8_t lengthNibble;            // Used to store the 4 bit length field.
    int8_t tokenLength;             // Used to store the token length.
 
    // Check that therere is at least 4 bytes
@@ -1635,67 +1447,71 @@ int8_t coapBuildOptionHeader(uint8_t *pBuffer, uint16_t *pBufferLength, uint8_t
       return COAP_INSUFFICIENT_BUFFER;
    }
 
-   // Calculate the difference.
-   delta = option - previousOption;
-
    // Check that the option is not out of order.
-   if( delta < 0 )
+   if( option < previousOption )
    {
       return COAP_OPTIONS_OUT_OF_ORDER;
    }
 
+   // Calculate the difference.
+   delta = option - previousOption;
+
+   // Skip the option header byte, extended bytes follow it.
+   newPointer++;
+
    // Determine the type of encoding needed for delta
-   if( delta < 13 )
-   {
-      // Increment pNewPointer.
-      newPointer++;
-   }
    if( delta >= 13 && delta < 269 )
    {
-      // As per RFC 7252 option formating.
-      delta = 0x0D;
-
       // As per RFC 7252 option formatting.
+      deltaNibble = 0x0D;
+
+      // Assign then increment.
+      *newPointer = delta - 13;
       newPointer++;
-      *newPointer = option - 13;
    }
    else if( delta >= 269 )
    {
       // As per RFC 7252 option formatting.
-      delta = 0x0E;
+      deltaNibble = 0x0E;
 
-      // Asign the additional byte.
-      newPointer++;
+      // Assign then increment.
       *newPointer = (delta - 269) >> 8;
       newPointer++;
       *newPointer = (delta - 269) & 0xFF;
+      newPointer++;
+   }
+   else
+   {
+      deltaNibble = delta;
    }
 
-
-
-   if( optionLength >= 13 && optionLength < 269 )
+   if( length >= 13 && length < 269 )
    {
       // As per RFC 7252 option formatting.
-      length = 0x0D;
+      lengthNibble = 0x0D;
 
       // Assign then increment.
-      *newPointer = optionLength - 13;
+      *newPointer = length - 13;
       newPointer++;
    }
-   else if( optionLength >= 269 )
+   else if( length >= 269 )
    {
       // As per RFC 7252 option formatting.
-      length = 0x0E;
+      lengthNibble = 0x0E;
 
       // Assign then increment.
-      *newPointer = (optionLength - 269) >> 8;
+      *newPointer = (length - 269) >> 8;
       newPointer++;
-      *newPointer = (optionLength - 269) & 0xFF;
+      *newPointer = (length - 269) & 0xFF;
       newPointer++;
    }
+   else
+   {
+      lengthNibble = length;
+   }
 
    // Assign the option header byte.
-   *pointer = (delta & 0x0F) << 4 | length;
+   *pointer = (deltaNibble << 4) | lengthNibble;
 
    // Store the new address.
    *pNewPointer = newPointer;
@@ -1728,8 +1544,7 @@ int8_t coapBuildOptionHeader(uint8_t *pBuffer, uint16_t *pBufferLength, uint8_t
 int8_t coapBuildOptionHeaderLength(uint8_t option, uint8_t optionLength, uint8_t pPreviousOption)
 {
    int8_t length = 1;   // Used to create the option header.
-   int8_t delta;        // Used for delta encoding.
-   int8_t difference;   // Used to calculate delta.
+   uint16_t delta;      // Used for delta encoding.
 
    // Check that the option is valid.
    if( !coapOptionIsValid(option) )
@@ -1737,18 +1552,15 @@ int8_t coapBuildOptionHeaderLength(uint8_t option, uint8_t optionLength, uint8_t
       return COAP_INVALID_OPTION;
    }
 
-   // Calcualate the difference.
-   difference = option - pPreviousOption;
-
    // Check that the options are not out of order.
-   if( difference < 0 )
+   if( option < pPreviousOption )
    {
       return COAP_OPTIONS_OUT_OF_ORDER;
    }
    else
    {
-      // Assign delta.
-      delta = difference;
+      // Calcualate the difference.
+      delta = option - pPreviousOption;
    }
 
    // Check the delta.
@@ -1790,7 +1602,8 @@ int8_t coapBuildOptionHeaderLength(uint8_t option, uint8_t optionLength, uint8_t
  * \brief Determines if option is valid
  *
  * Description:
- *   This function determines if an option value is valid
+ *   This function determines if an option value is valid.  The check is a single
+ *   lookup in the coapOptionFlags table.
  *
  * Option format:
  *          https://tools.ietf.org/html/rfc7252#section-3.1
@@ -1813,19 +1626,59 @@ int8_t coapBuildOptionHeaderLength(uint8_t option, uint8_t optionLength, uint8_t
  ********************************************************************************/
 bool coapOptionIsValid(uint8_t option)
 {
-   //Check if the option ID passed in is a valid option
-   if( option == 2 || option == 9 || option == 10 )
+   // Unassigned and reserved option numbers are flagged in the option table.
+   return !(coapOptionFlags[option] & COAP_OPTION_FLAG_INVALID);
+}
+
+/*!*****************************************************************************
+ * \brief Classifies an option number
+ *
+ * Description:
+ *   Returns the COAP_OPTION_FLAG_* and COAP_OPTION_FORMAT_* bits of an option.
+ *   Known options are a single load from coapOptionFlags.  For option numbers
+ *   the table does not know, the critical, unsafe and no-cache-key bits are
+ *   derived from the option number itself as per RFC 7252 section 5.4.6.
+ *
+ * Option format:
+ *          https://tools.ietf.org/html/rfc7252#section-5.4.6
+ *
+ * \param U16 option [in] - Option number to classify.
+ *
+ *
+ * \return Returns the option flags.
+ *
+ ********************************************************************************/
+uint8_t coapOptionGetFlags(uint16_t option)
+{
+   uint8_t flags = 0;   // Used to store the option flags.
+
+   if( option < COAP_OPTION_TABLE_SIZE )
    {
-      return false;
+      flags = coapOptionFlags[option];
    }
 
-   //check if a reserved option ID was passed into the parameter
-   if( option == 128 || option == 132 || option == 136 || option == 140)
+   if( !(flags & COAP_OPTION_FLAG_KNOWN) )
    {
-      return false;
+      // Derive the classification from the option number.
+      if( option & 0x01 )
+      {
+         flags |= COAP_OPTION_FLAG_CRITICAL;
+      }
+
+      if( option & 0x02 )
+      {
+         flags |= COAP_OPTION_FLAG_UNSAFE;
+      }
+
+      if( (option & 0x1E) == 0x1C )
+      {
+         flags |= COAP_OPTION_FLAG_NO_CACHE_KEY;
+      }
+
+      flags |= COAP_OPTION_FORMAT_OPAQUE;
    }
 
-   return true;
+   return flags;
 }
 
 /*!*****************************************************************************
@@ -1993,7 +1846,10 @@ int8_t coapSetPacketHeader(uint8_t *pBuffer, uint16_t *pBufferLength, uint8_t ve
  * \brief Gets a random number
  *
  * Description:
- *  This function is used to get a random message id for a CoAP message.
+ *  This function is used to get a random message id for a CoAP message.  The
+ *  bits come from the calling task's generator (coap_random), so no newlib
+ *  lock is taken.  New code should prefer coapMessageIdNext and
+ *  coapGenerateToken.
  *
  * Packet format:
  *          https://tools.ietf.org/html/rfc7252#section-3.0
@@ -2002,16 +1858,17 @@ int8_t coapSetPacketHeader(uint8_t *pBuffer, uint16_t *pBufferLength, uint8_t ve
  * \return Returns a random U16
  *
  ********************************************************************************/
-uint16_t coapGetRandom()
+uint16_t coapGetRandom(void)
 {
-   return rand();
+   return (uint16_t)(coapRandom32() >> 16);
 }
 
 /*!*****************************************************************************
  * \brief Validates a CoAP message
  *
  * Description:
- *  Determines if a CoAP message is valid.
+ *  Determines if a CoAP message is valid.  Equivalent to coapValidateMessage
+ *  without a view.
  *
  * Packet format:
  *          https://tools.ietf.org/html/rfc7252#section-3.0
@@ -2025,90 +1882,953 @@ uint16_t coapGetRandom()
  ********************************************************************************/
 int8_t coapValidatePacket(uint8_t *pBuffer, uint16_t bufferLength)
 {
+   // Single pass validation, no view needed.
+   return coapValidateMessage(pBuffer, bufferLength, NULL);
+}
 
-   int32_t optionCount;
-   uint8_t tOptionNumber;
-   uint8_t *tOptionData = NULL;
-   uint8_t *pointer = pBuffer;
-   uint8_t *newPointer = pointer;
-
-   int i;
-
-   // Check if only 4 bytes were sent.
-   if( bufferLength == COAP_HDR_BYTES )
-   {
-
-      // Check if the version is valid.
-      if( !coapVersionIsValid(coapGetVersion(pBuffer, bufferLength) ) )
-      {
-         return coapGetVersion(pBuffer, bufferLength);
-      }
-
-      // Check if the type is valid.
-      if( !coapTypeIsValid(coapGetType(pBuffer, bufferLength) ) )
-      {
-         return coapGetType(pBuffer, bufferLength);
-      }
-
-      // Check if the token length is valid
-      if( !coapTokenLengthIsValid(coapGetTokenLength(pBuffer, bufferLength) ) )
-      {
-         return coapGetTokenLength(pBuffer, bufferLength);
+//! @}
+/*!*****************************************************************************
+ * \brief Decodes an extended option delta or length
+ *
+ * Description:
+ *  Helper for coapParseMessage.  Decodes a 4 bit option delta/length nibble and
+ *  any extended bytes that follow it, advancing *pPointer past the extended bytes.
+ *
+ * Option format:
+ *          https://tools.ietf.org/html/rfc7252#section-3.1
+ *
+ * \param U8 nibble [in] - The 4 bit delta or length field.
+ *
+ * \param U8 **pPointer [in\out] - Current position, updated past extended bytes.
+ *
+ * \param U8 *pEnd [in] - One past the last byte of the buffer.
+ *
+ * \return Returns the decoded value or < 0 for error.
+ *
+ ********************************************************************************/
+static int32_t coapDecodeExtended(uint8_t nibble, uint8_t **pPointer, uint8_t *pEnd)
+{
+   uint8_t *pointer = *pPointer;   // Used to index the buffer.
+   int32_t value;                  // Used to store the decoded value.
+
+   if( nibble < 0x0D )
+   {
+      return nibble;
+   }
+   else if( nibble == 0x0D )
+   {
+      // Check that the extended byte is within the buffer.
+      if( (pEnd - pointer) < 1 )
+      {
+         return COAP_INVALID_PACKET;
       }
 
-      // Check if the code is valid.
-      if( !coapCodeIsValid(coapGetType(pBuffer, bufferLength) ) )
+      // As per RFC 7252 add 13 to the extended byte.
+      value = *pointer + 13;
+      pointer += 1;
+   }
+   else if( nibble == 0x0E )
+   {
+      // Check that both extended bytes are within the buffer.
+      if( (pEnd - pointer) < 2 )
       {
-         return coapGetType(pBuffer, bufferLength);
+         return COAP_INVALID_PACKET;
       }
+
+      // As per RFC 7252 add 269 to the extended bytes.
+      value = ((int32_t)pointer[0] << 8 | pointer[1]) + 269;
+      pointer += 2;
    }
    else
    {
-      // Check if the version is valid.
-      if( !coapVersionIsValid(coapGetVersion(pBuffer, bufferLength) ) )
+      // 0x0F is reserved for the payload marker.
+      return COAP_INVALID_PACKET;
+   }
+
+   *pPointer = pointer;
+
+   return value;
+}
+
+#if COAP_FAST_SCAN
+/*!*****************************************************************************
+ * \brief Flags the bytes of a word that need the extended option decoder
+ *
+ * Description:
+ *  A header byte can be decoded directly when both nibbles are below 13.  Adding
+ *  3 to every nibble (no carry crosses a byte) sets bit 4 of a byte exactly when
+ *  one of its nibbles is 13, 14 or 15, which also covers the 0xFF payload
+ *  marker.  Used by coapWalkMessage to test eight header candidates with one
+ *  load and a few ALU operations instead of a compare and branch per nibble.
+ *
+ * \param U64 word [in] - Eight message bytes.
+ *
+ *
+ * \return Returns the word with bit 4 of every flagged byte set.
+ *
+ ********************************************************************************/
+static uint64_t coapSlowHeaderMask(uint64_t word)
+{
+   uint64_t high = (word >> 4) & 0x0F0F0F0F0F0F0F0FULL;   // Used to store the delta nibbles.
+   uint64_t low = word & 0x0F0F0F0F0F0F0F0FULL;           // Used to store the length nibbles.
+
+   return ((high + 0x0303030303030303ULL) | (low + 0x0303030303030303ULL)) & 0x1010101010101010ULL;
+}
+
+/*!*****************************************************************************
+ * \brief Tests the flag of one byte in a coapSlowHeaderMask word
+ *
+ * \param U64 mask [in] - Result of coapSlowHeaderMask.
+ *
+ * \param U8 index [in] - Byte index in memory order (0 to 7).
+ *
+ *
+ * \return Returns true if the byte needs the extended decoder.
+ *
+ ********************************************************************************/
+static inline bool coapSlowHeaderAt(uint64_t mask, uint8_t index)
+{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+   return (mask >> ((7 - index) * 8 + 4)) & 1;
+#else
+   return (mask >> (index * 8 + 4)) & 1;
+#endif
+}
+#endif /* COAP_FAST_SCAN */
+
+/*!*****************************************************************************
+ * \brief Walks the options and payload of a CoAP message once
+ *
+ * Description:
+ *  The part of the single pass that follows the token.  The option and payload
+ *  encoding is the same over UDP (RFC 7252) and TCP/WebSockets (RFC 8323), so
+ *  both framings share this walk; pView must already hold the header fields and
+ *  its option count, payload pointer and payload length are filled here.
+ *
+ * Options:
+ *          https://tools.ietf.org/html/rfc7252#section-3.1
+ *
+ *
+ * \param U8 *pPointer [in] - First byte after the token.
+ *
+ * \param U8 *pEnd [in] - One past the last byte of the message.
+ *
+ * \param CoapMessageView *pView [out] - View to fill or NULL.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapWalkOptions(uint8_t *pPointer, uint8_t *pEnd, CoapMessageView *pView)
+{
+   uint8_t *pointer = pPointer;              // Used to index the buffer.
+   uint8_t byte;                             // Used to decode the option header.
+   uint32_t optionNumber = 0;                // Running option number.
+   int32_t delta;                            // Used to store the decoded delta.
+   int32_t length;                           // Used to store the decoded length.
+   CoapOptionEntry *pEntry;                  // Used to fill the option array.
+#if COAP_FAST_SCAN
+   uint8_t *pWord = NULL;                    // Start of the word mask was computed for.
+   uint64_t word;                            // Used to load eight bytes.
+   uint64_t mask = 0;                        // Header bytes needing the extended decoder.
+#endif
+
+   // Walk the options until the payload marker or the end of the buffer.
+   while( pointer < pEnd )
+   {
+#if COAP_FAST_SCAN
+      // Reload the mask once the walk leaves the current eight byte window.
+      if( (pWord == NULL || (pointer - pWord) >= 8) && (pEnd - pointer) >= 8 )
       {
-         return coapGetVersion(pBuffer, bufferLength);
+         memcpy(&word, pointer, sizeof(word));
+         mask = coapSlowHeaderMask(word);
+         pWord = pointer;
       }
 
-      // Check if the type is valid.
-      if( !coapTypeIsValid(coapGetType(pBuffer, bufferLength) ) )
+      // Fast path, both nibbles below 13: no extended bytes, no marker.
+      if( pWord != NULL && (pointer - pWord) < 8 && !coapSlowHeaderAt(mask, (uint8_t)(pointer - pWord)) )
       {
-         return coapGetType(pBuffer, bufferLength);
+         byte = *pointer++;
+         length = byte & 0x0F;
+
+         if( length > (pEnd - pointer) )
+         {
+            return COAP_INVALID_PACKET;
+         }
+
+         optionNumber += byte >> 4;
+
+         if( optionNumber > 0xFFFF )
+         {
+            return COAP_OPTIONS_OUT_OF_ORDER;
+         }
+
+         if( pView != NULL )
+         {
+            if( pView->optionCount >= MAX_OPTION_COUNT )
+            {
+               return COAP_TOO_MANY_OPTIONS;
+            }
+
+            pEntry = &pView->options[pView->optionCount++];
+            pEntry->number = (uint16_t)optionNumber;
+            pEntry->length = (uint16_t)length;
+            pEntry->pData = pointer;
+         }
+
+         pointer += length;
+         continue;
       }
+#endif
+
+      byte = *pointer++;
 
-      // Check if the token length is valid
-      if( !coapTokenLengthIsValid(coapGetTokenLength(pBuffer, bufferLength) ) )
+      if( byte == COAP_PAYLOAD_MARKER )
       {
-         return coapGetTokenLength(pBuffer, bufferLength);
+         // As per RFC 7252 a payload marker followed by no payload is an error.
+         if( pointer == pEnd )
+         {
+            return COAP_INVALID_PAYLOAD;
+         }
+
+         if( pView != NULL )
+         {
+            pView->pPayload = pointer;
+            pView->payloadLength = (uint16_t)(pEnd - pointer);
+         }
+         break;
       }
 
-      // Check if the code is valid.
-      if( !coapCodeIsValid(coapGetType(pBuffer, bufferLength) ) )
+      delta = coapDecodeExtended(byte >> 4, &pointer, pEnd);
+
+      if( delta < 0 )
       {
-         return coapGetType(pBuffer, bufferLength);
+         return delta;
       }
 
-      // Retrieve option count.
-      optionCount = coapGetOptionCount(pBuffer, bufferLength);
+      length = coapDecodeExtended(byte & 0x0F, &pointer, pEnd);
 
-      // Check if there was an error.
-      if( optionCount < 0 )
+      if( length < 0 )
       {
-         return false;
+         return length;
       }
-      else
+
+      // Check that the option value fits in the buffer.
+      if( length > (pEnd - pointer) )
+      {
+         return COAP_INVALID_PACKET;
+      }
+
+      // Deltas are unsigned so ordering only breaks if the 16 bit option
+      // number space wraps.
+      optionNumber += delta;
+
+      if( optionNumber > 0xFFFF )
       {
-         // Loop through and validate each option
-         for( i=0; i<optionCount; i++ )
+         return COAP_OPTIONS_OUT_OF_ORDER;
+      }
+
+      if( pView != NULL )
+      {
+         if( pView->optionCount >= MAX_OPTION_COUNT )
          {
-            if( coapGetOption(pBuffer, bufferLength, i, &tOptionNumber, &tOptionData, newPointer) < 0 )
-            {
-               return coapGetOption(pBuffer, bufferLength, i, &tOptionNumber, &tOptionData, newPointer);
-            }
+            return COAP_TOO_MANY_OPTIONS;
          }
+
+         pEntry = &pView->options[pView->optionCount++];
+         pEntry->number = (uint16_t)optionNumber;
+         pEntry->length = (uint16_t)length;
+         pEntry->pData = pointer;
       }
+
+      // Position the pointer at the next option instance.
+      pointer += length;
    }
+
    return COAP_OK;
 }
 
-//! @}
\ No newline at end of file
+
+/*!*****************************************************************************
+ * \brief Walks a CoAP message once
+ *
+ * Description:
+ *  Shared single pass used by coapParseMessage and coapValidateMessage.  The
+ *  header, token, options and payload marker are each visited exactly once and
+ *  the walk stops at the first malformed field.  If pView is not NULL it is
+ *  filled as a by-product of the walk; if it is NULL nothing is stored and the
+ *  MAX_OPTION_COUNT limit of the view does not apply.
+ *
+ * Packet format:
+ *          https://tools.ietf.org/html/rfc7252#section-3
+ *
+ *
+ * \param U8 *pBuffer [in] - Pointer to CoAP message.
+ *
+ * \param U16 bufferLength [in] - Variable that contains the length of the CoAP message.
+ *
+ * \param CoapMessageView *pView [out] - View to fill or NULL.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+static int8_t coapWalkMessage(uint8_t *pBuffer, uint16_t bufferLength, CoapMessageView *pView)
+{
+   uint8_t *pointer = pBuffer;               // Used to index the buffer.
+   uint8_t *pEnd = pBuffer + bufferLength;   // One past the last byte of the buffer.
+   uint8_t version;                          // Used to store the version.
+   uint8_t tokenLength;                      // Used to store the token length.
+   uint8_t code;                             // Used to store the code.
+
+   // Check if the buffer has at least 4 bytes.
+   if( bufferLength < COAP_HDR_BYTES )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
+   // Decode the header in one go.
+   version = pointer[0] >> 6;
+   tokenLength = pointer[0] & COAP_HDR_TKL_MASK;
+   code = pointer[1];
+
+   if( pView != NULL )
+   {
+      pView->version = version;
+      pView->type = (pointer[0] >> 4) & 0x03;
+      pView->tokenLength = tokenLength;
+      pView->code = code;
+      pView->messageId = ((uint16_t)pointer[2] << 8) | pointer[3];
+      pView->pToken = pointer + COAP_HDR_BYTES;
+      pView->optionCount = 0;
+      pView->pPayload = NULL;
+      pView->payloadLength = 0;
+   }
+
+   if( !coapVersionIsValid(version) )
+   {
+      return COAP_INVALID_VERSION;
+   }
+
+   if( !coapTokenLengthIsValid(tokenLength) )
+   {
+      return COAP_INVALID_TOKEN_LENGTH;
+   }
+
+   if( !coapCodeIsValid(code) )
+   {
+      return COAP_UNKNOWN_CODE;
+   }
+
+   // Check that the token fits in the buffer.
+   if( (COAP_HDR_BYTES + tokenLength) > bufferLength )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   // Skip the header and token bytes.
+   return coapWalkOptions(pointer + COAP_HDR_BYTES + tokenLength, pEnd, pView);
+}
+
+/*!*****************************************************************************
+ * \brief Parses a CoAP message into a message view
+ *
+ * Description:
+ *  The function coapParseMessage walks a CoAP message exactly once and fills a
+ *  CoapMessageView with the header fields, the token, every option instance and
+ *  the payload.  No bytes are copied; the token, option and payload pointers all
+ *  point into pBuffer, so the view is only valid while pBuffer is.  Once parsed,
+ *  every field is available in O(1) without re-walking the buffer.
+ *
+ * Packet format:
+ *          https://tools.ietf.org/html/rfc7252#section-3
+ *
+ *
+ * \param U8 *pBuffer [in] - Pointer to CoAP message.
+ *
+ * \param U16 bufferLength [in] - Variable that contains the length of the CoAP message.
+ *
+ * \param CoapMessageView *pView [out] - View to fill, usually stack allocated.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapParseMessage(uint8_t *pBuffer, uint16_t bufferLength, CoapMessageView *pView)
+{
+   int8_t results;   // Used to store the result of the walk.
+
+   COAP_STAT_START(start);
+
+   results = coapWalkMessage(pBuffer, bufferLength, pView);
+
+   COAP_STAT_STOP(COAP_HIST_PARSE, start);
+   COAP_STAT_ERROR(results);
+
+   return results;
+}
+
+/*!*****************************************************************************
+ * \brief Validates a CoAP message in a single pass
+ *
+ * Description:
+ *  Determines if a CoAP message is valid by walking it once.  The walk stops at
+ *  the first malformed option, checks option ordering and the payload marker
+ *  rules as it goes and then applies the message level rules of RFC 7252 section
+ *  4.1 (an Empty message is exactly 4 bytes with no token).  If pView is not NULL
+ *  it is filled by the same walk, so a validated message never needs to be parsed
+ *  a second time.
+ *
+ * Packet format:
+ *          https://tools.ietf.org/html/rfc7252#section-3.0
+ *
+ * \param U8 *pBuffer [in] - Pointer to CoAP message
+ *
+ * \param U16 bufferLength [in] - Variable that contains the length of the CoAP message
+ *
+ * \param CoapMessageView *pView [out] - Optional view to fill, may be NULL.
+ *
+ * \return Returns COAP_OK if valid or <0 if invalid.
+ *
+ ********************************************************************************/
+int8_t coapValidateMessage(uint8_t *pBuffer, uint16_t bufferLength, CoapMessageView *pView)
+{
+   int8_t results;   // Used to store the result of the walk.
+
+   COAP_STAT_START(start);
+
+   results = coapWalkMessage(pBuffer, bufferLength, pView);
+
+   // An Empty message must not contain anything after the header.
+   if( results == COAP_OK && pBuffer[1] == COAP_EMPTY && bufferLength != COAP_HDR_BYTES )
+   {
+      results = COAP_INVALID_PACKET;
+   }
+
+   COAP_STAT_STOP(COAP_HIST_PARSE, start);
+   COAP_STAT_ERROR(results);
+
+   return results;
+}
+
+/*!*****************************************************************************
+ * \brief Finds an option in a message view
+ *
+ * Description:
+ *  Searches the options of a parsed message view for the next instance of
+ *  optionNumber, starting at startIndex.  Repeatable options (e.g. Uri-Path) can
+ *  be iterated by passing the previous result + 1 as startIndex.  Options are
+ *  stored in ascending order so the search stops as soon as it passes the number.
+ *
+ * \param CoapMessageView *pView [in] - View filled by coapParseMessage.
+ *
+ * \param U16 optionNumber [in] - Option number to find.
+ *
+ * \param U8 startIndex [in] - Index to start the search at.
+ *
+ *
+ * \return Returns the option index or COAP_INVALID_OPTION if not present.
+ *
+ ********************************************************************************/
+int8_t coapViewFindOption(CoapMessageView *pView, uint16_t optionNumber, uint8_t startIndex)
+{
+   uint8_t i;   // Used as an iterator.
+
+   for( i = startIndex; i < pView->optionCount; i++ )
+   {
+      if( pView->options[i].number == optionNumber )
+      {
+         return (int8_t)i;
+      }
+      else if( pView->options[i].number > optionNumber )
+      {
+         break;
+      }
+   }
+
+   return COAP_INVALID_OPTION;
+}
+
+/*!*****************************************************************************
+ * \brief Starts building a CoAP message
+ *
+ * Description:
+ *  The function coapBuilderInit encodes the header and token of a new message
+ *  into pBuffer and initialises a CoapMessageBuilder cursor behind them.  The
+ *  cursor caches the write position, the previous option number and the space
+ *  left, so options and the payload can then be appended without re-reading any
+ *  byte already written.
+ *
+ * Packet format:
+ *          https://tools.ietf.org/html/rfc7252#section-3
+ *
+ *
+ * \param CoapMessageBuilder *pBuilder [out] - Cursor to initialise.
+ *
+ * \param U8 *pBuffer [out] - Buffer the message is built in.
+ *
+ * \param U16 bufferSize [in] - Size of pBuffer in bytes.
+ *
+ * \param U8 type [in] - CoapMessageType of the message.
+ *
+ * \param CoapCode code [in] - Code of the message.
+ *
+ * \param U16 messageId [in] - Message id of the message.
+ *
+ * \param U8 *pToken [in] - Token bytes, may be NULL if tokenLength is 0.
+ *
+ * \param U8 tokenLength [in] - Length of the token bytes.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapBuilderInit(CoapMessageBuilder *pBuilder, uint8_t *pBuffer, uint16_t bufferSize, uint8_t type, CoapCode code, uint16_t messageId, uint8_t *pToken, uint8_t tokenLength)
+{
+   uint16_t length = 0;   // Used to store the encoded length.
+   int8_t results;        // Used to store the results of the setters.
+
+   // Check that the header and token fit in the buffer.
+   if( bufferSize < (COAP_HDR_BYTES + tokenLength) )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   // The header setters OR into the first byte so start from a clean byte.
+   pBuffer[0] = 0;
+
+   results = coapSetPacketHeader(pBuffer, &length, COAP_VERSION, type, tokenLength, code, messageId);
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   results = coapSetToken(pBuffer, &length, pToken, tokenLength);
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   pBuilder->pBuffer = pBuffer;
+   pBuilder->pPointer = pBuffer + length;
+   pBuilder->length = length;
+   pBuilder->remaining = bufferSize - length;
+   pBuilder->lastOption = 0;
+   pBuilder->hasPayload = false;
+
+#if COAP_STATS
+   pBuilder->start = COAP_STATS_CYCLES();
+#endif
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Appends an option to a message under construction
+ *
+ * Description:
+ *  The function coapBuilderAddOption delta encodes an option against the
+ *  previous option cached in the builder and writes it at the cursor.  Each call
+ *  is O(1) in header work: coapBuildOptionHeaderLength and coapBuildOptionHeader
+ *  are called directly and nothing already written is parsed again.  Options must
+ *  be appended in ascending option number order.
+ *
+ * Option format:
+ *          https://tools.ietf.org/html/rfc7252#section-3.1
+ *
+ *
+ * \param CoapMessageBuilder *pBuilder [in\out] - Cursor from coapBuilderInit.
+ *
+ * \param U8 option [in] - Option number to be encoded.
+ *
+ * \param U8 optionLength [in] - Length of the option data.
+ *
+ * \param U8 *pOptionData [in] - Pointer to option data to be encoded.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapBuilderAddOption(CoapMessageBuilder *pBuilder, uint8_t option, uint8_t optionLength, uint8_t *pOptionData)
+{
+   int8_t optionHeaderLength;   // Used to store the option header length.
+   int16_t results;             // Used to store the results of the header build.
+
+   // Options can not follow the payload.
+   if( pBuilder->hasPayload )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
+   // Compute the option header length against the cached previous option.
+   optionHeaderLength = coapBuildOptionHeaderLength(option, optionLength, pBuilder->lastOption);
+
+   if( optionHeaderLength < 0 )
+   {
+      return optionHeaderLength;
+   }
+
+   // Check that the option fits in the space left.
+   if( (optionHeaderLength + optionLength) > pBuilder->remaining )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   // Encode the option header at the cursor.
+   results = coapBuildOptionHeader(pBuilder->pBuffer, &pBuilder->length, option, pBuilder->lastOption, optionLength, optionHeaderLength, &pBuilder->pPointer);
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   // Attach the option data.
+   memcpy(pBuilder->pPointer, pOptionData, optionLength);
+
+   pBuilder->pPointer += optionLength;
+   pBuilder->length += optionHeaderLength + optionLength;
+   pBuilder->remaining -= optionHeaderLength + optionLength;
+   pBuilder->lastOption = option;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Appends options that are already encoded
+ *
+ * Description:
+ *  The function coapBuilderAddEncoded copies option bytes that were encoded
+ *  once, e.g. the endpoint options of coapConfigGet, at the cursor.  The first
+ *  option of pOptions must have been encoded against the option the builder
+ *  wrote last, which is only checked by number.  lastOption becomes the
+ *  previous option of the next coapBuilderAddOption.
+ *
+ * Option format:
+ *          https://tools.ietf.org/html/rfc7252#section-3.1
+ *
+ *
+ * \param CoapMessageBuilder *pBuilder [in\out] - Cursor from coapBuilderInit.
+ *
+ * \param U8 *pOptions [in] - Encoded options.
+ *
+ * \param U16 length [in] - Length of pOptions.
+ *
+ * \param U8 firstPrevious [in] - Option pOptions was encoded after, 0 for the first option.
+ *
+ * \param U8 lastOption [in] - Number of the last option in pOptions.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapBuilderAddEncoded(CoapMessageBuilder *pBuilder, const uint8_t *pOptions, uint16_t length, uint8_t firstPrevious, uint8_t lastOption)
+{
+   // Options can not follow the payload, and the deltas only hold after firstPrevious.
+   if( pBuilder->hasPayload || pBuilder->lastOption != firstPrevious )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
+   if( length > pBuilder->remaining )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   memcpy(pBuilder->pPointer, pOptions, length);
+
+   pBuilder->pPointer += length;
+   pBuilder->length += length;
+   pBuilder->remaining -= length;
+   pBuilder->lastOption = lastOption;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Attaches the payload to a message under construction
+ *
+ * Description:
+ *  Writes the payload marker and the payload at the cursor.  No option can be
+ *  appended afterwards.  The finished message is pBuilder->length bytes long.
+ *
+ * Packet format:
+ *          https://tools.ietf.org/html/rfc7252#section-3
+ *
+ *
+ * \param CoapMessageBuilder *pBuilder [in\out] - Cursor from coapBuilderInit.
+ *
+ * \param U16 payloadLength [in] - Length of the payload.
+ *
+ * \param U8 *pPayloadData [in] - Pointer to the payload data to be attached.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapBuilderSetPayload(CoapMessageBuilder *pBuilder, uint16_t payloadLength, uint8_t *pPayloadData)
+{
+   // Check that the payload length is valid.
+   if( payloadLength == 0 || pBuilder->hasPayload )
+   {
+      return COAP_INVALID_PAYLOAD;
+   }
+
+   // Check that the marker and payload fit in the space left.
+   if( (payloadLength + 1) > pBuilder->remaining )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   *pBuilder->pPointer++ = COAP_PAYLOAD_MARKER;
+
+   memcpy(pBuilder->pPointer, pPayloadData, payloadLength);
+
+   pBuilder->pPointer += payloadLength;
+   pBuilder->length += payloadLength + 1;
+   pBuilder->remaining -= payloadLength + 1;
+   pBuilder->hasPayload = true;
+
+   COAP_STAT_STOP(COAP_HIST_ENCODE, pBuilder->start);
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Encodes a uint option value
+ *
+ * Description:
+ *  Encodes value in network byte order using the fewest bytes possible, as
+ *  required for uint options (zero is encoded as an empty value).
+ *
+ * Option value formats:
+ *          https://tools.ietf.org/html/rfc7252#section-3.2
+ *
+ * \param U32 value [in] - Value to encode.
+ *
+ * \param U8 *pOptionData [out] - At least 4 bytes to receive the value.
+ *
+ *
+ * \return Returns the encoded length (0-4).
+ *
+ ********************************************************************************/
+uint8_t coapEncodeOptionUint(uint32_t value, uint8_t *pOptionData)
+{
+   uint8_t length = 0;   // Used to store the encoded length.
+   int8_t shift;         // Used to walk the bytes from the most significant.
+
+   for( shift = 24; shift >= 0; shift -= 8 )
+   {
+      if( length > 0 || ((value >> shift) & 0xFF) != 0 )
+      {
+         pOptionData[length++] = (value >> shift) & 0xFF;
+      }
+   }
+
+   return length;
+}
+
+/*!*****************************************************************************
+ * \brief Decodes a uint option value
+ *
+ * Option value formats:
+ *          https://tools.ietf.org/html/rfc7252#section-3.2
+ *
+ * \param U8 *pOptionData [in] - Option value.
+ *
+ * \param U16 optionLength [in] - Length of the value, at most 4.
+ *
+ *
+ * \return Returns the decoded value.
+ *
+ ********************************************************************************/
+uint32_t coapDecodeOptionUint(uint8_t *pOptionData, uint16_t optionLength)
+{
+   uint32_t value = 0;   // Used to store the decoded value.
+   uint16_t i;           // Used as an iterator.
+
+   for( i = 0; i < optionLength && i < 4; i++ )
+   {
+      value = (value << 8) | pOptionData[i];
+   }
+
+   return value;
+}
+
+/*!*****************************************************************************
+ * \brief Converts a Max-Age to ticks
+ *
+ * Description:
+ *  Max-Age is a uint up to about 136 years, which overflows a 32 bit tick
+ *  count at 1 kHz after about 71 minutes if converted through milliseconds.
+ *  It is clamped to COAP_MAX_AGE_LIMIT so now + ticks stays a deadline that
+ *  compares correctly; expiring early only costs a revalidation.
+ *
+ * Max-Age:
+ *          https://tools.ietf.org/html/rfc7252#section-5.10.5
+ *
+ * \param U32 maxAge [in] - Max-Age in seconds.
+ *
+ *
+ * \return Returns the freshness lifetime in ticks.
+ *
+ ********************************************************************************/
+TickType_t coapMaxAgeTicks(uint32_t maxAge)
+{
+   if( maxAge > COAP_MAX_AGE_LIMIT )
+   {
+      maxAge = COAP_MAX_AGE_LIMIT;
+   }
+
+   return (TickType_t)(maxAge * configTICK_RATE_HZ);
+}
+
+/*!*****************************************************************************
+ * \brief Reserves the payload area without recording the encode time
+ *
+ * \param CoapMessageBuilder *pBuilder [in\out] - Cursor from coapBuilderInit.
+ *
+ * \param U16 payloadLength [in] - Length of the payload.
+ *
+ * \param U8 **pPayload [out] - Where the payload must be written.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+static int8_t coapBuilderReserve(CoapMessageBuilder *pBuilder, uint16_t payloadLength, uint8_t **pPayload)
+{
+   // Check that the payload length is valid.
+   if( payloadLength == 0 || pBuilder->hasPayload )
+   {
+      return COAP_INVALID_PAYLOAD;
+   }
+
+   // Check that the marker and payload fit in the space left.
+   if( (payloadLength + 1) > pBuilder->remaining )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   *pBuilder->pPointer++ = COAP_PAYLOAD_MARKER;
+   *pPayload = pBuilder->pPointer;
+
+   pBuilder->pPointer += payloadLength;
+   pBuilder->length += payloadLength + 1;
+   pBuilder->remaining -= payloadLength + 1;
+   pBuilder->hasPayload = true;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Reserves the payload area of a message under construction
+ *
+ * Description:
+ *  Writes the payload marker and hands back a pointer to payloadLength bytes
+ *  behind it, so a producer can write the payload straight into the message
+ *  instead of copying it in with coapBuilderSetPayload.
+ *
+ * Packet format:
+ *          https://tools.ietf.org/html/rfc7252#section-3
+ *
+ *
+ * \param CoapMessageBuilder *pBuilder [in\out] - Cursor from coapBuilderInit.
+ *
+ * \param U16 payloadLength [in] - Length of the payload.
+ *
+ * \param U8 **pPayload [out] - Where the payload must be written.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapBuilderReservePayload(CoapMessageBuilder *pBuilder, uint16_t payloadLength, uint8_t **pPayload)
+{
+   int8_t results = coapBuilderReserve(pBuilder, payloadLength, pPayload);   // Used to store the results.
+
+   if( results == COAP_OK )
+   {
+      COAP_STAT_STOP(COAP_HIST_ENCODE, pBuilder->start);
+   }
+
+   return results;
+}
+
+/*!*****************************************************************************
+ * \brief Gets the total length of a fragment list
+ *
+ * \param CoapFragment *pFragments [in] - Fragments.
+ *
+ * \param U8 fragmentCount [in] - Number of fragments.
+ *
+ *
+ * \return Returns the sum of the fragment lengths.
+ *
+ ********************************************************************************/
+uint32_t coapFragmentsLength(const CoapFragment *pFragments, uint8_t fragmentCount)
+{
+   uint32_t length = 0;   // Used to store the total length.
+   uint8_t i;             // Used as an iterator.
+
+   for( i = 0; i < fragmentCount; i++ )
+   {
+      length += pFragments[i].length;
+   }
+
+   return length;
+}
+
+/*!*****************************************************************************
+ * \brief Attaches a payload gathered from several fragments
+ *
+ * Description:
+ *  Writes each fragment straight after the previous one in the message, so
+ *  records kept in separate buffers (time stamp header, ACCEL, GPS, TEMP,
+ *  LIGHT) are copied once, into the frame, instead of through a temporary.
+ *
+ * Message format:
+ *          https://tools.ietf.org/html/rfc7252#section-3
+ *
+ * \param CoapMessageBuilder *pBuilder [in\out] - Builder of the message.
+ *
+ * \param CoapFragment *pFragments [in] - Payload fragments in order.
+ *
+ * \param U8 fragmentCount [in] - Number of fragments.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapBuilderSetPayloadGather(CoapMessageBuilder *pBuilder, const CoapFragment *pFragments, uint8_t fragmentCount)
+{
+   uint32_t payloadLength;   // Used to store the payload length.
+   uint8_t *pPayload;        // Used to store the reserved payload.
+   int8_t results;           // Used to store the results.
+   uint8_t i;                // Used as an iterator.
+
+   payloadLength = coapFragmentsLength(pFragments, fragmentCount);
+
+   if( payloadLength > 0xFFFF )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   results = coapBuilderReserve(pBuilder, (uint16_t)payloadLength, &pPayload);
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   for( i = 0; i < fragmentCount; i++ )
+   {
+      memcpy(pPayload, pFragments[i].pData, pFragments[i].length);
+      pPayload += pFragments[i].length;
+   }
+
+   COAP_STAT_STOP(COAP_HIST_ENCODE, pBuilder->start);
+
+   return COAP_OK;
+}
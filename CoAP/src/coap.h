@@ -17,7 +17,7 @@
 #include "string.h"
 #include "stdlib.h"
 
-/*Server and URI Related*/
+/*Server and URI Related, defaults of coapConfigInit*/
 #define LED_ALIAS                   "led" //LEDs
 #define CONFIG_ALIAS                "config2"
 #define PACKET_ALIAS                "dataPacket"
@@ -41,6 +41,9 @@
 #define MAX_OPTION_LIST_SIZE        8
 #define MAX_TOKEN_LENGTH            8
 #define COAP_MIN_MESSAGE_SIZE       4
+#ifndef COAP_FAST_SCAN
+#define COAP_FAST_SCAN              1 //word-at-a-time option header scan in coapParseMessage/coapValidateMessage
+#endif
 
 //COAP Header
 #define COAP_HDR_BYTES              4
@@ -56,6 +59,23 @@
 #define COAP_PAYLOAD_MARKER         0xFF
 #define COAP_OPTION_END             0xF0
 
+//Option Classification (coapOptionGetFlags)
+#define COAP_OPTION_TABLE_SIZE         256
+#define COAP_OPTION_FLAG_CRITICAL      0x01
+#define COAP_OPTION_FLAG_UNSAFE        0x02
+#define COAP_OPTION_FLAG_NO_CACHE_KEY  0x04
+#define COAP_OPTION_FLAG_REPEATABLE    0x08
+#define COAP_OPTION_FLAG_KNOWN         0x10
+#define COAP_OPTION_FLAG_INVALID       0x20
+#define COAP_OPTION_FORMAT_MASK        0xC0
+#define COAP_OPTION_FORMAT_EMPTY       0x00
+#define COAP_OPTION_FORMAT_OPAQUE      0x40
+#define COAP_OPTION_FORMAT_UINT        0x80
+#define COAP_OPTION_FORMAT_STRING      0xC0
+
+//Max-Age (coapMaxAgeTicks), a quarter of the tick range keeps (int32_t)(now - deadline) valid
+#define COAP_MAX_AGE_LIMIT          ((uint32_t)((TickType_t)~(TickType_t)0 / 4 / configTICK_RATE_HZ))
+
 // Message Buffer Variables
 #define MAX_MESSAGE_QUEUE           100
 #define MAX_RETRY                   3
@@ -76,6 +96,7 @@ typedef enum
    COAP_OPTION_URI_HOST = 3,
    COAP_OPTION_ETAG = 4,
    COAP_OPTION_IF_NONE_MATCH = 5,
+   COAP_OPTION_OBSERVE = 6,
    COAP_OPTION_URI_PORT = 7,
    COAP_OPTION_LOCATION_PATH = 8,
    COAP_OPTION_URI_PATH = 11,
@@ -84,6 +105,9 @@ typedef enum
    COAP_OPTION_URI_QUERY = 15,
    COAP_OPTION_ACCEPT = 17,
    COAP_OPTION_LOCATION_QUERY = 20,
+   COAP_OPTION_BLOCK2 = 23,
+   COAP_OPTION_BLOCK1 = 27,
+   COAP_OPTION_SIZE2 = 28,
    COAP_OPTION_PROXY_URI = 35,
    COAP_OPTION_PROXY_SCHEME = 39,
    COAP_OPTION_SIZE1 = 60
@@ -118,7 +142,16 @@ typedef enum
    COAP_INVALID_OPTION_DATA = -14,      ///< Invalid option data
    COAP_INVALID_BUFFER_LENGTH = -15,    ///< Invalid buffer length
    COAP_INVALID_TYPE = -16,             ///< Invalid CoAP type
-   COAP_DID_NOT_FIND_CODE = -17         ///< CoAP did not find code
+   COAP_DID_NOT_FIND_CODE = -17,        ///< CoAP did not find code
+   COAP_MESSAGE_TIMEOUT = -18,          ///< Confirmable message was never acknowledged
+   COAP_MESSAGE_RESET = -19,            ///< Peer answered with a Reset message
+   COAP_UNKNOWN_MESSAGE_ID = -20,       ///< No exchange matches the message id
+   COAP_NO_RESOURCES = -21,             ///< Fixed size table or pool is full
+   COAP_UNKNOWN_TOKEN = -22,            ///< No exchange or observation matches the token
+   COAP_CACHE_MISS = -23,               ///< No cached response for the request
+   COAP_CACHE_STALE = -24,              ///< Cached response must be revalidated
+   COAP_DUPLICATE_MESSAGE = -25,        ///< Message id was already seen from the endpoint
+   COAP_TOKEN_IN_USE = -26              ///< Token already belongs to an exchange or observation
 }CoapErrorCode;
 
 
@@ -135,6 +168,7 @@ typedef enum
    COAP_VALID = 0x43,                      ///< SUCCESS 2.03 Valid
    COAP_CHANGED = 0x44,                    ///< SUCCESS 2.04 Changes
    COAP_CONTENT = 0x45,                    ///< SUCCESS 2.05 Content
+   COAP_CONTINUE = 0x5F,                   ///< SUCCESS 2.31 Continue (RFC 7959)
    COAP_BAD_REQUEST = 0x80,                ///< CLIENT ERROR 4.00 Bad Request
    COAP_UNAUTHORIZED = 0x81,               ///< CLIENT_ERROR 4.01 Unauthorized
    COAP_BAD_OPTION = 0x82,                 ///< CLIENT_ERROR 4.02 Bad Option
@@ -155,6 +189,19 @@ typedef enum
 }CoapCode;
 
 
+/// CoapContentFormat enum
+typedef enum
+{
+   COAP_FORMAT_TEXT_PLAIN = 0,          ///< text/plain;charset=utf-8
+   COAP_FORMAT_LINK = 40,               ///< application/link-format
+   COAP_FORMAT_XML = 41,                ///< application/xml
+   COAP_FORMAT_OCTET_STREAM = 42,       ///< application/octet-stream
+   COAP_FORMAT_EXI = 47,                ///< application/exi
+   COAP_FORMAT_JSON = 50,               ///< application/json
+   COAP_FORMAT_CBOR = 60,               ///< application/cbor (RFC 7049)
+   COAP_FORMAT_NONE = -1                ///< No Content-Format option
+} CoapContentFormat;
+
 /// CoapAlias enum
 typedef enum
 {
@@ -166,11 +213,54 @@ typedef enum
    COAP_TEXT = 5                        ///< Text for the console
 } CoapAlias;
 
+/// CoapOptionEntry struct
+typedef struct
+{
+   uint16_t number;                     ///< Absolute option number (deltas already applied)
+   uint16_t length;                     ///< Length of the option value in bytes
+   uint8_t *pData;                      ///< Option value, points into the parsed buffer
+} CoapOptionEntry;
+
+/// CoapMessageView struct
+typedef struct
+{
+   uint8_t version;                     ///< CoAP version
+   uint8_t type;                        ///< CoapMessageType
+   uint8_t tokenLength;                 ///< Token length (0-8)
+   uint8_t code;                        ///< CoapCode
+   uint16_t messageId;                  ///< Message id
+   uint8_t *pToken;                     ///< Token bytes, points into the parsed buffer
+   uint8_t optionCount;                 ///< Number of valid entries in options[]
+   CoapOptionEntry options[MAX_OPTION_COUNT]; ///< Options in wire order
+   uint8_t *pPayload;                   ///< Payload, points into the parsed buffer (NULL if none)
+   uint16_t payloadLength;              ///< Payload length in bytes
+} CoapMessageView;
+
+/// CoapMessageBuilder struct
+typedef struct
+{
+   uint8_t *pBuffer;                    ///< Start of the message being built
+   uint8_t *pPointer;                   ///< Next writeable byte
+   uint16_t length;                     ///< Bytes written so far
+   uint16_t remaining;                  ///< Bytes left in the buffer
+   uint8_t lastOption;                  ///< Number of the last option written (0 if none)
+   bool hasPayload;                     ///< Set once the payload has been attached
+   uint32_t start;                      ///< COAP_STATS_CYCLES() at coapBuilderInit, with COAP_STATS only
+} CoapMessageBuilder;
+
+/// CoapFragment struct, one piece of a gathered payload
+typedef struct
+{
+   const uint8_t *pData;                ///< Fragment bytes, e.g. a sensor DMA buffer
+   uint16_t length;                     ///< Fragment length in bytes
+} CoapFragment;
+
 extern xQueueHandle coapMsgQ;
 
 void coapTask(void);
 
 bool coapOptionIsValid(uint8_t option);
+uint8_t coapOptionGetFlags(uint16_t option);
 bool coapVersionIsValid(int8_t version);
 bool coapTypeIsValid(int8_t type);
 bool coapCodeIsValid(int16_t code);
@@ -183,6 +273,7 @@ int16_t coapGetCode(uint8_t *pBuffer, uint16_t bufferLength);
 int16_t coapGetMessageId(uint8_t *pBuffer, uint16_t bufferLength);
 int16_t coapGetPayload(uint8_t *pBuffer, uint16_t bufferLength, uint8_t **pPayloadData);
 int16_t coapGetSize(uint8_t *pBuffer);
+uint16_t coapGetRandom(void);
 int32_t coapGetOptionCount(uint8_t *pBuffer, uint16_t bufferLength);
 int32_t coapGetOption(uint8_t *pBuffer, uint16_t bufferLength, uint8_t optionIndex, uint8_t *pOptionNumber, uint8_t **pOptionData, uint8_t *pNewPointer);
 
@@ -190,17 +281,36 @@ int8_t coapSetVersion(uint8_t *pBuffer, uint16_t *pBufferLength, uint8_t version
 int8_t coapSetType(uint8_t *pBuffer, uint16_t *pBufferLength, uint8_t type);
 int8_t coapSetTokenLength(uint8_t *pBuffer, uint16_t *pBufferLength, uint8_t tokenLength);
 int8_t coapSetCode(uint8_t *pBuffer, uint16_t *pBufferLength, CoapCode code);
+int8_t coapSetMessageId(uint8_t *pBuffer, uint16_t *pBufferLength, uint16_t messageId);
 int8_t coapSetToken(uint8_t *pBuffer, uint16_t *pBufferLength, uint8_t *pToken, uint8_t tokenLength);
 int8_t coapSetPacketHeader(uint8_t *pBuffer, uint16_t *pBufferLength, uint8_t version, uint8_t type, uint8_t tokenLength, CoapCode code, uint16_t messageId);
 int32_t coapSetPayload(uint8_t *pBuffer, uint16_t *pBufferLength, uint16_t payloadLength, uint8_t *pPayloadData, uint8_t *pPointer, uint8_t **pNewPointer);
 
 // Adjusters/Decoders
 int8_t coapAddOption(uint8_t *pBuffer, uint16_t *pBufferLength, uint8_t option, uint8_t optionLength, uint8_t *pOptionData, uint8_t **pNewPointer);
-int8_t coapBuildOptionHeader(uint8_t *pBuffer, uint16_t *pBufferLength, uint8_t option, uint8_t previousOption, uint8_t optionLength, uint8_t optionHeaderLength, uint8_t **pNewPointer);
+int16_t coapBuildOptionHeader(uint8_t *pBuffer, uint16_t *pBufferLength, uint8_t option, uint8_t previousOption, uint8_t optionLength, uint8_t optionHeaderLength, uint8_t **pNewPointer);
 int8_t coapBuildOptionHeaderLength(uint8_t option, uint8_t optionLength, uint8_t pPreviousOption);
 int8_t coapValidatePacket(uint8_t *pBuffer, uint16_t bufferLength);
 int32_t coapDecodeOption(uint8_t *pBuffer, uint16_t bufferLength, uint8_t *pOptionNumber, uint8_t **optionData, uint8_t **pNewPointer);
 
+// Message View
+int8_t coapParseMessage(uint8_t *pBuffer, uint16_t bufferLength, CoapMessageView *pView);
+int8_t coapValidateMessage(uint8_t *pBuffer, uint16_t bufferLength, CoapMessageView *pView);
+int8_t coapViewFindOption(CoapMessageView *pView, uint16_t optionNumber, uint8_t startIndex);
+int8_t coapWalkOptions(uint8_t *pPointer, uint8_t *pEnd, CoapMessageView *pView);
+
+// Message Builder
+int8_t coapBuilderInit(CoapMessageBuilder *pBuilder, uint8_t *pBuffer, uint16_t bufferSize, uint8_t type, CoapCode code, uint16_t messageId, uint8_t *pToken, uint8_t tokenLength);
+int8_t coapBuilderAddOption(CoapMessageBuilder *pBuilder, uint8_t option, uint8_t optionLength, uint8_t *pOptionData);
+int8_t coapBuilderAddEncoded(CoapMessageBuilder *pBuilder, const uint8_t *pOptions, uint16_t length, uint8_t firstPrevious, uint8_t lastOption);
+int8_t coapBuilderSetPayload(CoapMessageBuilder *pBuilder, uint16_t payloadLength, uint8_t *pPayloadData);
+int8_t coapBuilderReservePayload(CoapMessageBuilder *pBuilder, uint16_t payloadLength, uint8_t **pPayload);
+int8_t coapBuilderSetPayloadGather(CoapMessageBuilder *pBuilder, const CoapFragment *pFragments, uint8_t fragmentCount);
+uint32_t coapFragmentsLength(const CoapFragment *pFragments, uint8_t fragmentCount);
+uint8_t coapEncodeOptionUint(uint32_t value, uint8_t *pOptionData);
+uint32_t coapDecodeOptionUint(uint8_t *pOptionData, uint16_t optionLength);
+TickType_t coapMaxAgeTicks(uint32_t maxAge);
+
 //! @}
 #endif  /* COAP_H */
 
@@ -0,0 +1,385 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_batch.h"
+#include "coap_stats.h"
+
+#ifdef COAP_LINUX_GATEWAY
+
+#include <errno.h>
+
+/*!*****************************************************************************
+ * \brief Initialises the batch rings of a socket
+ *
+ * Description:
+ *  Points every mmsghdr at its slot once, so a batch call only has to reset
+ *  the lengths.  The socket should be non-blocking or the caller must only
+ *  receive after poll/epoll reported it readable.
+ *
+ * \param CoapBatchIo *pIo [out] - Batch state to initialise.
+ *
+ * \param int socket [in] - Bound UDP socket.
+ *
+ ********************************************************************************/
+void coapBatchInit(CoapBatchIo *pIo, int socket)
+{
+   uint8_t i;   // Used as an iterator.
+
+   memset(pIo, 0, sizeof(*pIo));
+   pIo->socket = socket;
+
+   for( i = 0; i < COAP_BATCH_SIZE; i++ )
+   {
+      pIo->rxVectors[i].iov_base = pIo->rx[i].buffer;
+      pIo->rxVectors[i].iov_len = MAX_BUFFER_SIZE;
+      pIo->rxHeaders[i].msg_hdr.msg_iov = &pIo->rxVectors[i];
+      pIo->rxHeaders[i].msg_hdr.msg_iovlen = 1;
+      pIo->rxHeaders[i].msg_hdr.msg_name = &pIo->rx[i].address;
+
+      pIo->txVectors[i].iov_base = pIo->tx[i].buffer;
+      pIo->txHeaders[i].msg_hdr.msg_iov = &pIo->txVectors[i];
+      pIo->txHeaders[i].msg_hdr.msg_iovlen = 1;
+      pIo->txHeaders[i].msg_hdr.msg_name = &pIo->tx[i].address;
+      pIo->txHeaders[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Receives up to COAP_BATCH_SIZE datagrams with one system call
+ *
+ * \param CoapBatchIo *pIo [in\out] - Batch state.
+ *
+ *
+ * \return Returns the number of datagrams received or < 0 for error.
+ *
+ ********************************************************************************/
+int16_t coapBatchReceiveAll(CoapBatchIo *pIo)
+{
+   int count;   // Used to store the recvmmsg result.
+   int i;       // Used as an iterator.
+
+   for( i = 0; i < COAP_BATCH_SIZE; i++ )
+   {
+      pIo->rxHeaders[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+   }
+
+   count = recvmmsg(pIo->socket, pIo->rxHeaders, COAP_BATCH_SIZE, MSG_DONTWAIT, NULL);
+
+   pIo->rxNext = 0;
+   pIo->rxCount = 0;
+
+   if( count < 0 )
+   {
+      return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : COAP_INVALID_PACKET;
+   }
+
+   for( i = 0; i < count; i++ )
+   {
+      pIo->rx[i].length = (uint16_t)pIo->rxHeaders[i].msg_len;
+   }
+
+   pIo->rxCount = (uint8_t)count;
+
+   COAP_STAT_ADD(COAP_STAT_RX, count);
+
+   return count;
+}
+
+/*!*****************************************************************************
+ * \brief Sends every queued reply with one system call
+ *
+ * Description:
+ *  sendmmsg may send fewer than asked (e.g. a full socket buffer); the rest
+ *  goes in further calls, and whatever cannot be sent is dropped as UDP would.
+ *
+ * \param CoapBatchIo *pIo [in\out] - Batch state.
+ *
+ *
+ * \return Returns the number of replies sent.
+ *
+ ********************************************************************************/
+int16_t coapBatchFlush(CoapBatchIo *pIo)
+{
+   int sent = 0;   // Used to store the datagrams sent so far.
+   int count;      // Used to store the sendmmsg result.
+   int i;          // Used as an iterator.
+
+   for( i = 0; i < pIo->txCount; i++ )
+   {
+      pIo->txVectors[i].iov_len = pIo->tx[i].length;
+   }
+
+   while( sent < pIo->txCount )
+   {
+      count = sendmmsg(pIo->socket, &pIo->txHeaders[sent], pIo->txCount - sent, 0);
+
+      if( count <= 0 )
+      {
+         break;
+      }
+
+      sent += count;
+   }
+
+   pIo->txCount = 0;
+
+   COAP_STAT_ADD(COAP_STAT_TX, sent);
+
+   return sent;
+}
+
+/*!*****************************************************************************
+ * \brief CoapSendCallback of the gateway transport
+ *
+ * Description:
+ *  Queues the datagram for the peer of the last datagram handed out by
+ *  coapBatchReceive (or the peer set by the caller) and flushes only when the
+ *  ring is full, so one receive batch produces one sendmmsg.
+ *
+ * \param void *pContext [in] - CoapBatchIo of the socket.
+ *
+ * \param U8 *pBuffer [in] - Datagram to send.
+ *
+ * \param U16 length [in] - Length of the datagram.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapBatchSend(void *pContext, uint8_t *pBuffer, uint16_t length)
+{
+   CoapBatchIo *pIo = (CoapBatchIo *)pContext;   // Used to access the batch state.
+
+   if( length > MAX_BUFFER_SIZE )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   if( pIo->txCount == COAP_BATCH_SIZE )
+   {
+      coapBatchFlush(pIo);
+   }
+
+   memcpy(pIo->tx[pIo->txCount].buffer, pBuffer, length);
+   pIo->tx[pIo->txCount].length = length;
+   pIo->tx[pIo->txCount].address = pIo->peer;
+   pIo->txCount++;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Sends one datagram from a gather list
+ *
+ * Description:
+ *  The kernel assembles the datagram from the list (e.g. built by
+ *  coapTemplateGatherList), so the payload fragments are never copied into a
+ *  frame.  Queued replies are flushed first to keep the send order.
+ *
+ * \param void *pContext [in] - CoapBatchIo of the socket.
+ *
+ * \param CoapFragment *pList [in] - Header and payload fragments.
+ *
+ * \param U8 count [in] - Entries in pList.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapBatchSendGather(void *pContext, const CoapFragment *pList, uint8_t count)
+{
+   CoapBatchIo *pIo = (CoapBatchIo *)pContext;          // Used to access the batch state.
+   struct iovec vectors[COAP_BATCH_MAX_FRAGMENTS];      // Used to describe the fragments.
+   struct msghdr message;                               // Used to describe the datagram.
+   uint8_t i;                                           // Used as an iterator.
+
+   if( count > COAP_BATCH_MAX_FRAGMENTS )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   for( i = 0; i < count; i++ )
+   {
+      vectors[i].iov_base = (void *)pList[i].pData;
+      vectors[i].iov_len = pList[i].length;
+   }
+
+   memset(&message, 0, sizeof(message));
+   message.msg_name = &pIo->peer;
+   message.msg_namelen = sizeof(pIo->peer);
+   message.msg_iov = vectors;
+   message.msg_iovlen = count;
+
+   coapBatchFlush(pIo);
+
+   if( sendmsg(pIo->socket, &message, 0) < 0 )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
+   COAP_STAT_INC(COAP_STAT_TX);
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief CoapReceiveCallback of the gateway transport
+ *
+ * Description:
+ *  Hands out the next datagram of the current batch, refilling the ring with
+ *  one recvmmsg when it is empty.  Queued replies are flushed before the
+ *  refill, so the replies to a batch leave in one sendmmsg.
+ *
+ * \param void *pContext [in] - CoapBatchIo of the socket.
+ *
+ * \param U8 *pBuffer [out] - Receives the datagram.
+ *
+ * \param U16 bufferSize [in] - Size of pBuffer.
+ *
+ *
+ * \return Returns the datagram length, 0 if nothing is waiting or < 0 for error.
+ *
+ ********************************************************************************/
+int16_t coapBatchReceive(void *pContext, uint8_t *pBuffer, uint16_t bufferSize)
+{
+   CoapBatchIo *pIo = (CoapBatchIo *)pContext;   // Used to access the batch state.
+   CoapBatchSlot *pSlot;                          // Used to store the datagram slot.
+   int16_t count;                                 // Used to store the batch size.
+
+   if( pIo->rxNext == pIo->rxCount )
+   {
+      coapBatchFlush(pIo);
+
+      count = coapBatchReceiveAll(pIo);
+
+      if( count <= 0 )
+      {
+         return count;
+      }
+   }
+
+   pSlot = &pIo->rx[pIo->rxNext++];
+
+   if( pSlot->length > bufferSize )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   memcpy(pBuffer, pSlot->buffer, pSlot->length);
+   pIo->peer = pSlot->address;
+
+   return pSlot->length;
+}
+
+/*!*****************************************************************************
+ * \brief Serves one batch of requests
+ *
+ * Description:
+ *  Receives a batch, parses each datagram in place with the single pass
+ *  parser, answers duplicates from the deduplication table and dispatches the
+ *  rest, building each reply straight into its tx slot.  ACK and RST messages
+ *  complete the server's own confirmables in pEngine.  All replies leave in
+ *  one sendmmsg.  Call whenever the socket is readable.
+ *
+ * \param CoapBatchIo *pIo [in\out] - Batch state.
+ *
+ * \param CoapServer *pServer [in] - Resources to dispatch to.
+ *
+ * \param CoapMessageIdGenerator *pMessageIds [in\out] - Generator of the socket.
+ *
+ * \param CoapDedupTable *pDedup [in\out] - Deduplication table, may be NULL.
+ *
+ * \param CoapRetransmitEngine *pEngine [in\out] - Receives ACK/RST of messages
+ *                                               the server sent, may be NULL.
+ *
+ *
+ * \return Returns the number of datagrams received or < 0 for error.
+ *
+ ********************************************************************************/
+int16_t coapBatchServe(CoapBatchIo *pIo, const CoapServer *pServer, CoapMessageIdGenerator *pMessageIds, CoapDedupTable *pDedup, CoapRetransmitEngine *pEngine)
+{
+   CoapMessageView view;     // Used to store the parsed request.
+   CoapBatchSlot *pRx;       // Used to store the received datagram.
+   CoapBatchSlot *pTx;       // Used to store the reply slot.
+   uint8_t *pReply;          // Used to store the reply location.
+   uint16_t replyLength;     // Used to store the reply length.
+   uint32_t address;         // Used to store the peer address.
+   uint16_t port;            // Used to store the peer port.
+   int16_t count;            // Used to store the batch size.
+   int16_t i;                // Used as an iterator.
+
+   count = coapBatchReceiveAll(pIo);
+
+   for( i = 0; i < count; i++ )
+   {
+      pRx = &pIo->rx[i];
+
+      if( coapValidateMessage(pRx->buffer, pRx->length, &view) < 0 )
+      {
+         continue;
+      }
+
+      address = pRx->address.sin_addr.s_addr;
+      port = ntohs(pRx->address.sin_port);
+
+      if( view.type == COAP_TYPE_ACK || view.type == COAP_TYPE_RST )
+      {
+         if( pEngine != NULL )
+         {
+            coapRetransmitHandleMessageFrom(pEngine, address, port, &view);
+         }
+
+         continue;
+      }
+
+      if( pIo->txCount == COAP_BATCH_SIZE )
+      {
+         coapBatchFlush(pIo);
+      }
+
+      pTx = &pIo->tx[pIo->txCount];
+
+      if( pDedup != NULL && coapDedupCheck(pDedup, address, port, &view, &pReply, &replyLength) == COAP_DUPLICATE_MESSAGE )
+      {
+         if( replyLength > 0 )
+         {
+            memcpy(pTx->buffer, pReply, replyLength);
+         }
+      }
+      else
+      {
+         if( coapServerDispatchView(pServer, pMessageIds, &view, pRx->buffer, pTx->buffer, MAX_BUFFER_SIZE, &pReply, &replyLength) < 0 )
+         {
+            continue;
+         }
+
+         if( replyLength > 0 && pReply != pTx->buffer )
+         {
+            memcpy(pTx->buffer, pReply, replyLength);
+         }
+
+         if( pDedup != NULL && replyLength > 0 )
+         {
+            coapDedupStore(pDedup, address, port, view.messageId, pTx->buffer, replyLength);
+         }
+      }
+
+      if( replyLength > 0 )
+      {
+         pTx->length = replyLength;
+         pTx->address = pRx->address;
+         pIo->txCount++;
+      }
+   }
+
+   coapBatchFlush(pIo);
+
+   pIo->rxNext = pIo->rxCount;
+
+   return count;
+}
+
+#endif  /* COAP_LINUX_GATEWAY */
@@ -0,0 +1,64 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_BATCH_H
+#define COAP_BATCH_H
+
+#include "coap.h"
+
+#ifdef COAP_LINUX_GATEWAY
+
+#ifndef _GNU_SOURCE
+#error "COAP_LINUX_GATEWAY builds need -D_GNU_SOURCE for recvmmsg/sendmmsg"
+#endif
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "coap_server.h"
+#include "coap_dedup.h"
+#include "coap_retransmit.h"
+
+/*Batch I/O Related (Linux gateway build)*/
+#ifndef COAP_BATCH_SIZE
+#define COAP_BATCH_SIZE             32    //datagrams per recvmmsg/sendmmsg call
+#endif
+#define COAP_BATCH_MAX_FRAGMENTS    8     //gather list entries per datagram
+
+/// One datagram slot of a batch ring
+typedef struct
+{
+   uint8_t buffer[MAX_BUFFER_SIZE];     ///< Datagram bytes
+   struct sockaddr_in address;          ///< Peer the datagram came from or goes to
+   uint16_t length;                     ///< Datagram length
+} CoapBatchSlot;
+
+/// CoapBatchIo struct, the pContext of a CoapTransport on the gateway
+typedef struct
+{
+   int socket;                                    ///< Bound UDP socket
+   CoapBatchSlot rx[COAP_BATCH_SIZE];             ///< Received datagrams
+   CoapBatchSlot tx[COAP_BATCH_SIZE];             ///< Queued replies
+   struct mmsghdr rxHeaders[COAP_BATCH_SIZE];     ///< recvmmsg descriptors, point into rx
+   struct mmsghdr txHeaders[COAP_BATCH_SIZE];     ///< sendmmsg descriptors, point into tx
+   struct iovec rxVectors[COAP_BATCH_SIZE];       ///< One vector per rx slot
+   struct iovec txVectors[COAP_BATCH_SIZE];       ///< One vector per tx slot
+   uint8_t rxCount;                               ///< Datagrams in rx
+   uint8_t rxNext;                                ///< Next rx slot handed out
+   uint8_t txCount;                               ///< Replies queued in tx
+   struct sockaddr_in peer;                       ///< Peer of the last datagram handed out
+} CoapBatchIo;
+
+void coapBatchInit(CoapBatchIo *pIo, int socket);
+int16_t coapBatchReceiveAll(CoapBatchIo *pIo);
+int16_t coapBatchFlush(CoapBatchIo *pIo);
+int8_t coapBatchSend(void *pContext, uint8_t *pBuffer, uint16_t length);
+int8_t coapBatchSendGather(void *pContext, const CoapFragment *pList, uint8_t count);
+int16_t coapBatchReceive(void *pContext, uint8_t *pBuffer, uint16_t bufferSize);
+int16_t coapBatchServe(CoapBatchIo *pIo, const CoapServer *pServer, CoapMessageIdGenerator *pMessageIds, CoapDedupTable *pDedup, CoapRetransmitEngine *pEngine);
+
+#endif  /* COAP_LINUX_GATEWAY */
+
+//! @}
+#endif  /* COAP_BATCH_H */
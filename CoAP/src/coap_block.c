@@ -0,0 +1,432 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_block.h"
+
+/*!*****************************************************************************
+ * \brief Encodes a Block1/Block2 option value
+ *
+ * Block option format:
+ *          https://tools.ietf.org/html/rfc7959#section-2.2
+ *
+ * \param U32 num [in] - Block number (20 bits).
+ *
+ * \param bool more [in] - More blocks follow.
+ *
+ * \param U8 szx [in] - Block size exponent, the block size is 16 << szx.
+ *
+ * \param U8 *pOptionData [out] - At least 4 bytes to receive the value.
+ *
+ *
+ * \return Returns the encoded length (0-3).
+ *
+ ********************************************************************************/
+uint8_t coapBlockEncode(uint32_t num, bool more, uint8_t szx, uint8_t *pOptionData)
+{
+   return coapEncodeOptionUint((num << 4) | (more ? 0x08 : 0x00) | (szx & 0x07), pOptionData);
+}
+
+/*!*****************************************************************************
+ * \brief Decodes a Block1/Block2 option value
+ *
+ * Block option format:
+ *          https://tools.ietf.org/html/rfc7959#section-2.2
+ *
+ * \param U8 *pOptionData [in] - Option value.
+ *
+ * \param U16 optionLength [in] - Length of the option value.
+ *
+ * \param U32 *pNum [out] - Block number.
+ *
+ * \param bool *pMore [out] - More blocks follow.
+ *
+ * \param U8 *pSzx [out] - Block size exponent.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapBlockDecode(uint8_t *pOptionData, uint16_t optionLength, uint32_t *pNum, bool *pMore, uint8_t *pSzx)
+{
+   uint32_t value;   // Used to store the option value.
+
+   if( optionLength > 3 )
+   {
+      return COAP_INVALID_OPTION_DATA;
+   }
+
+   value = coapDecodeOptionUint(pOptionData, optionLength);
+
+   // SZX 7 is reserved.
+   if( (value & 0x07) == 0x07 )
+   {
+      return COAP_INVALID_OPTION_DATA;
+   }
+
+   *pNum = value >> 4;
+   *pMore = (value & 0x08) != 0;
+   *pSzx = value & 0x07;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Initialises a block-wise transfer
+ *
+ * Description:
+ *  For uploads (Block1) and for serving large resources (Block2) set totalSize
+ *  and read; the payload is pulled one block at a time straight into the
+ *  outgoing message, so only the message buffer of the current block is in use.
+ *  For downloads (Block2) set write; every received block is handed to it as it
+ *  arrives.
+ *
+ * \param CoapBlockTransfer *pTransfer [out] - Transfer to initialise.
+ *
+ * \param U32 totalSize [in] - Size of the payload to send, 0 for downloads.
+ *
+ * \param U8 szx [in] - Preferred block size exponent (at most COAP_BLOCK_SZX_MAX).
+ *
+ * \param CoapBlockReadCallback read [in] - Payload source or NULL.
+ *
+ * \param CoapBlockWriteCallback write [in] - Payload sink or NULL.
+ *
+ * \param void *pContext [in] - Passed to read and write.
+ *
+ ********************************************************************************/
+void coapBlockInit(CoapBlockTransfer *pTransfer, uint32_t totalSize, uint8_t szx, CoapBlockReadCallback read, CoapBlockWriteCallback write, void *pContext)
+{
+   pTransfer->read = read;
+   pTransfer->write = write;
+   pTransfer->pContext = pContext;
+   pTransfer->totalSize = totalSize;
+   pTransfer->num = 0;
+   pTransfer->szx = (szx > COAP_BLOCK_SZX_MAX) ? COAP_BLOCK_SZX_MAX : szx;
+   pTransfer->done = false;
+}
+
+/*!*****************************************************************************
+ * \brief Writes the current block into a message
+ *
+ * Description:
+ *  Appends the Block1 or Block2 option for the current block (plus Size1/Size2
+ *  on the first block) and reads the block straight into the payload area of the
+ *  message.  The caller appends every option numbered below the block option
+ *  first; the payload finishes the message, so no other option may follow.
+ *
+ * Block-wise transfers:
+ *          https://tools.ietf.org/html/rfc7959#section-2
+ *
+ * \param CoapBlockTransfer *pTransfer [in] - Transfer with read set.
+ *
+ * \param CoapMessageBuilder *pBuilder [in\out] - Message under construction.
+ *
+ * \param U8 option [in] - COAP_OPTION_BLOCK1 or COAP_OPTION_BLOCK2.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapBlockWriteBlock(CoapBlockTransfer *pTransfer, CoapMessageBuilder *pBuilder, uint8_t option)
+{
+   uint8_t optionData[4];   // Used to store encoded option values.
+   uint8_t optionLength;    // Used to store encoded option lengths.
+   uint8_t *pPayload;       // Used to store the payload area.
+   uint32_t offset;         // Used to store the block offset.
+   uint16_t blockLength;    // Used to store the length of this block.
+   bool more;               // Used to store the M bit.
+   int8_t results;          // Used to store results.
+
+   if( pTransfer->read == NULL || (option != COAP_OPTION_BLOCK1 && option != COAP_OPTION_BLOCK2) )
+   {
+      return COAP_INVALID_OPTION;
+   }
+
+   offset = pTransfer->num * COAP_BLOCK_SIZE(pTransfer->szx);
+
+   if( pTransfer->num > COAP_BLOCK_NUM_MAX || offset >= pTransfer->totalSize )
+   {
+      return COAP_INVALID_PAYLOAD;
+   }
+
+   // The last block may be short.
+   blockLength = COAP_BLOCK_SIZE(pTransfer->szx);
+
+   if( (pTransfer->totalSize - offset) < blockLength )
+   {
+      blockLength = pTransfer->totalSize - offset;
+   }
+
+   more = (offset + blockLength) < pTransfer->totalSize;
+
+   optionLength = coapBlockEncode(pTransfer->num, more, pTransfer->szx, optionData);
+   results = coapBuilderAddOption(pBuilder, option, optionLength, optionData);
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   // Announce the total size with the first block.
+   if( pTransfer->num == 0 )
+   {
+      optionLength = coapEncodeOptionUint(pTransfer->totalSize, optionData);
+      results = coapBuilderAddOption(pBuilder, (option == COAP_OPTION_BLOCK1) ? COAP_OPTION_SIZE1 : COAP_OPTION_SIZE2, optionLength, optionData);
+
+      if( results < 0 )
+      {
+         return results;
+      }
+   }
+
+   results = coapBuilderReservePayload(pBuilder, blockLength, &pPayload);
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   return pTransfer->read(pTransfer->pContext, offset, pPayload, blockLength);
+}
+
+/*!*****************************************************************************
+ * \brief Advances a Block1 upload from the server response
+ *
+ * Description:
+ *  Handles the response to the block just sent.  A 2.31 Continue (or any 2.xx
+ *  before the last block) moves to the next block, adopting a smaller block size
+ *  if the server asked for one.  A 4.13 carrying a smaller size restarts the
+ *  upload at that size.  After the response to the last block done is set.
+ *
+ * Block1 option:
+ *          https://tools.ietf.org/html/rfc7959#section-2.5
+ *
+ * \param CoapBlockTransfer *pTransfer [in\out] - Upload in progress.
+ *
+ * \param CoapMessageView *pView [in] - Parsed response.
+ *
+ *
+ * \return Returns COAP_OK if the upload continues or is done, < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapBlock1HandleResponse(CoapBlockTransfer *pTransfer, CoapMessageView *pView)
+{
+   CoapOptionEntry *pEntry;   // Used to store the Block1 option.
+   uint32_t nextOffset;       // Used to store the offset of the next block.
+   uint32_t num = 0;          // Used to store the decoded block number.
+   uint8_t szx = pTransfer->szx;   // Used to store the decoded block size, unchanged without Block1.
+   bool more = false;         // Used to store the decoded M bit.
+   int8_t index;              // Used to store the Block1 option index.
+
+   index = coapViewFindOption(pView, COAP_OPTION_BLOCK1, 0);
+
+   if( index >= 0 )
+   {
+      pEntry = &pView->options[index];
+
+      if( coapBlockDecode(pEntry->pData, pEntry->length, &num, &more, &szx) < 0 )
+      {
+         return COAP_INVALID_OPTION_DATA;
+      }
+   }
+
+   if( pView->code == COAP_REQUEST_ENTITY_TOO_LARGE )
+   {
+      // Restart with the size the server can take.
+      if( index >= 0 && szx < pTransfer->szx )
+      {
+         pTransfer->szx = szx;
+         pTransfer->num = 0;
+         return COAP_OK;
+      }
+
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   // Anything but a success response ends the upload.
+   if( (pView->code >> 5) != 2 )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
+   nextOffset = (pTransfer->num + 1) * COAP_BLOCK_SIZE(pTransfer->szx);
+
+   if( nextOffset >= pTransfer->totalSize )
+   {
+      pTransfer->done = true;
+      return COAP_OK;
+   }
+
+   // The server may ask for smaller blocks from here on.
+   if( index >= 0 && szx < pTransfer->szx )
+   {
+      pTransfer->szx = szx;
+   }
+
+   pTransfer->num = nextOffset / COAP_BLOCK_SIZE(pTransfer->szx);
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Requests the next block of a Block2 download
+ *
+ * Description:
+ *  Appends the Block2 option asking for the current block at the preferred size.
+ *  Sending it with the first request lets the client negotiate the block size
+ *  up front.
+ *
+ * Block2 option:
+ *          https://tools.ietf.org/html/rfc7959#section-2.4
+ *
+ * \param CoapBlockTransfer *pTransfer [in] - Download in progress.
+ *
+ * \param CoapMessageBuilder *pBuilder [in\out] - Request under construction.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapBlock2AddOption(CoapBlockTransfer *pTransfer, CoapMessageBuilder *pBuilder)
+{
+   uint8_t optionData[4];   // Used to store the encoded option value.
+   uint8_t optionLength;    // Used to store the encoded option length.
+
+   optionLength = coapBlockEncode(pTransfer->num, false, pTransfer->szx, optionData);
+
+   return coapBuilderAddOption(pBuilder, COAP_OPTION_BLOCK2, optionLength, optionData);
+}
+
+/*!*****************************************************************************
+ * \brief Consumes one block of a Block2 download
+ *
+ * Description:
+ *  Hands the payload of a response to the write callback at its offset.  If the
+ *  response has no Block2 option the whole body arrived at once.  done is set
+ *  after the last block, otherwise num is the block to request next.
+ *
+ * Block2 option:
+ *          https://tools.ietf.org/html/rfc7959#section-2.4
+ *
+ * \param CoapBlockTransfer *pTransfer [in\out] - Download with write set.
+ *
+ * \param CoapMessageView *pView [in] - Parsed response.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapBlock2HandleResponse(CoapBlockTransfer *pTransfer, CoapMessageView *pView)
+{
+   CoapOptionEntry *pEntry;   // Used to store the Block2 option.
+   uint32_t offset = 0;       // Used to store the offset of the block.
+   uint32_t num;              // Used to store the decoded block number.
+   uint8_t szx;               // Used to store the decoded block size.
+   bool more = false;         // Used to store the decoded M bit.
+   int8_t index;              // Used to store the Block2 option index.
+   int8_t results;            // Used to store the write results.
+
+   if( (pView->code >> 5) != 2 || pTransfer->write == NULL )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
+   index = coapViewFindOption(pView, COAP_OPTION_BLOCK2, 0);
+
+   if( index >= 0 )
+   {
+      pEntry = &pView->options[index];
+
+      if( coapBlockDecode(pEntry->pData, pEntry->length, &num, &more, &szx) < 0 )
+      {
+         return COAP_INVALID_OPTION_DATA;
+      }
+
+      offset = num * COAP_BLOCK_SIZE(szx);
+
+      // The block must be the one that was asked for.
+      if( offset != pTransfer->num * COAP_BLOCK_SIZE(pTransfer->szx) )
+      {
+         return COAP_INVALID_PACKET;
+      }
+
+      pTransfer->szx = szx;
+   }
+
+   if( pView->payloadLength > 0 )
+   {
+      results = pTransfer->write(pTransfer->pContext, offset, pView->pPayload, pView->payloadLength);
+
+      if( results < 0 )
+      {
+         return results;
+      }
+   }
+
+   if( more )
+   {
+      pTransfer->num = (offset + pView->payloadLength) / COAP_BLOCK_SIZE(pTransfer->szx);
+   }
+   else
+   {
+      pTransfer->done = true;
+   }
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Selects the block a request asks for when serving a large resource
+ *
+ * Description:
+ *  Reads the Block2 option of an incoming request.  The smaller of the client's
+ *  and the server's block sizes is used and the block number is translated to
+ *  it.  Without a Block2 option the first block is served.  Follow with
+ *  coapBlockWriteBlock(pTransfer, pBuilder, COAP_OPTION_BLOCK2).
+ *
+ * Block2 option:
+ *          https://tools.ietf.org/html/rfc7959#section-2.4
+ *
+ * \param CoapBlockTransfer *pTransfer [in\out] - Transfer with totalSize and read set.
+ *
+ * \param CoapMessageView *pView [in] - Parsed request.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapBlock2FromRequest(CoapBlockTransfer *pTransfer, CoapMessageView *pView)
+{
+   CoapOptionEntry *pEntry;   // Used to store the Block2 option.
+   uint32_t num;              // Used to store the decoded block number.
+   uint8_t szx;               // Used to store the decoded block size.
+   bool more;                 // Used to store the decoded M bit.
+   int8_t index;              // Used to store the Block2 option index.
+
+   pTransfer->num = 0;
+
+   index = coapViewFindOption(pView, COAP_OPTION_BLOCK2, 0);
+
+   if( index < 0 )
+   {
+      return COAP_OK;
+   }
+
+   pEntry = &pView->options[index];
+
+   if( coapBlockDecode(pEntry->pData, pEntry->length, &num, &more, &szx) < 0 )
+   {
+      return COAP_INVALID_OPTION_DATA;
+   }
+
+   if( szx < pTransfer->szx )
+   {
+      pTransfer->szx = szx;
+   }
+
+   pTransfer->num = (num * COAP_BLOCK_SIZE(szx)) / COAP_BLOCK_SIZE(pTransfer->szx);
+
+   return COAP_OK;
+}
@@ -0,0 +1,45 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_BLOCK_H
+#define COAP_BLOCK_H
+
+#include "coap.h"
+
+/*Block-wise Transfer Related (RFC 7959)*/
+#define COAP_BLOCK_SZX_MAX          6     //1024 byte blocks
+#define COAP_BLOCK_SZX_DEFAULT      6     //fits MAX_BUFFER_SIZE with room for options
+#define COAP_BLOCK_SIZE(szx)        (16U << (szx))
+#define COAP_BLOCK_NUM_MAX          0xFFFFF  //NUM is at most 20 bits
+
+/// Supplies length bytes of the payload starting at offset, written straight into the message.
+typedef int8_t (*CoapBlockReadCallback)(void *pContext, uint32_t offset, uint8_t *pBuffer, uint16_t length);
+
+/// Consumes length bytes of a received payload that start at offset.
+typedef int8_t (*CoapBlockWriteCallback)(void *pContext, uint32_t offset, uint8_t *pData, uint16_t length);
+
+/// CoapBlockTransfer struct
+typedef struct
+{
+   CoapBlockReadCallback read;          ///< Payload source for Block1 uploads and Block2 serving
+   CoapBlockWriteCallback write;        ///< Payload sink for Block2 downloads
+   void *pContext;                      ///< Passed to read and write
+   uint32_t totalSize;                  ///< Size of the whole payload when sending
+   uint32_t num;                        ///< Block number of the next block
+   uint8_t szx;                         ///< Negotiated block size exponent
+   bool done;                           ///< Set once the last block has been exchanged
+} CoapBlockTransfer;
+
+uint8_t coapBlockEncode(uint32_t num, bool more, uint8_t szx, uint8_t *pOptionData);
+int8_t coapBlockDecode(uint8_t *pOptionData, uint16_t optionLength, uint32_t *pNum, bool *pMore, uint8_t *pSzx);
+void coapBlockInit(CoapBlockTransfer *pTransfer, uint32_t totalSize, uint8_t szx, CoapBlockReadCallback read, CoapBlockWriteCallback write, void *pContext);
+int8_t coapBlockWriteBlock(CoapBlockTransfer *pTransfer, CoapMessageBuilder *pBuilder, uint8_t option);
+int8_t coapBlock1HandleResponse(CoapBlockTransfer *pTransfer, CoapMessageView *pView);
+int8_t coapBlock2AddOption(CoapBlockTransfer *pTransfer, CoapMessageBuilder *pBuilder);
+int8_t coapBlock2HandleResponse(CoapBlockTransfer *pTransfer, CoapMessageView *pView);
+int8_t coapBlock2FromRequest(CoapBlockTransfer *pTransfer, CoapMessageView *pView);
+
+//! @}
+#endif  /* COAP_BLOCK_H */
@@ -0,0 +1,400 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_cache.h"
+
+/*!*****************************************************************************
+ * \brief Builds the cache key of a request
+ *
+ * Description:
+ *  The key is the method followed by every Uri-Path and Uri-Query option as
+ *  number, length and value, in message order.  The 32 bit FNV-1a hash of the
+ *  key is compared before the key bytes.
+ *
+ * Caching:
+ *          https://tools.ietf.org/html/rfc7252#section-5.6
+ *
+ * \param CoapMessageView *pRequest [in] - Parsed request.
+ *
+ * \param U8 code [in] - Method stored in the key.
+ *
+ * \param U8 *pKey [out] - COAP_CACHE_KEY_SIZE bytes for the key.
+ *
+ * \param U32 *pHash [out] - Hash of the key.
+ *
+ *
+ * \return Returns the key length or COAP_INSUFFICIENT_BUFFER if the key does not
+ *         fit, in which case the request is not cached.
+ *
+ ********************************************************************************/
+static int16_t coapCacheBuildKey(CoapMessageView *pRequest, uint8_t code, uint8_t *pKey, uint32_t *pHash)
+{
+   CoapOptionEntry *pOption;    // Used to store the current option.
+   uint32_t hash = 2166136261UL;   // Used to compute the FNV-1a hash.
+   uint16_t length = 0;         // Used to store the key length.
+   uint16_t i;                  // Used as an iterator.
+
+   pKey[length++] = code;
+
+   for( i = 0; i < pRequest->optionCount; i++ )
+   {
+      pOption = &pRequest->options[i];
+
+      if( pOption->number != COAP_OPTION_URI_PATH && pOption->number != COAP_OPTION_URI_QUERY )
+      {
+         continue;
+      }
+
+      if( pOption->length > 0xFF || length + 2 + pOption->length > COAP_CACHE_KEY_SIZE )
+      {
+         return COAP_INSUFFICIENT_BUFFER;
+      }
+
+      pKey[length++] = (uint8_t)pOption->number;
+      pKey[length++] = (uint8_t)pOption->length;
+      memcpy(pKey + length, pOption->pData, pOption->length);
+      length += pOption->length;
+   }
+
+   for( i = 0; i < length; i++ )
+   {
+      hash = (hash ^ pKey[i]) * 16777619UL;
+   }
+
+   *pHash = hash;
+
+   return length;
+}
+
+/*!*****************************************************************************
+ * \brief Finds the entry cached for a request
+ *
+ * \param CoapCache *pCache [in] - Cache to search.
+ *
+ * \param CoapMessageView *pRequest [in] - Parsed request.
+ *
+ *
+ * \return Returns the entry or NULL.
+ *
+ ********************************************************************************/
+static CoapCacheEntry *coapCacheFind(CoapCache *pCache, CoapMessageView *pRequest)
+{
+   uint8_t key[COAP_CACHE_KEY_SIZE];   // Used to store the request key.
+   CoapCacheEntry *pEntry;             // Used to check each entry.
+   uint32_t hash;                      // Used to store the key hash.
+   int16_t keyLength;                  // Used to store the key length.
+   uint8_t i;                          // Used as an iterator.
+
+   keyLength = coapCacheBuildKey(pRequest, COAP_GET, key, &hash);
+
+   if( keyLength < 0 )
+   {
+      return NULL;
+   }
+
+   for( i = 0; i < COAP_CACHE_ENTRIES; i++ )
+   {
+      pEntry = &pCache->entries[i];
+
+      if( pEntry->inUse && pEntry->hash == hash && pEntry->keyLength == keyLength &&
+          memcmp(pEntry->key, key, keyLength) == 0 )
+      {
+         return pEntry;
+      }
+   }
+
+   return NULL;
+}
+
+/*!*****************************************************************************
+ * \brief Reads the freshness lifetime of a response
+ *
+ * \param CoapMessageView *pResponse [in] - Parsed response.
+ *
+ *
+ * \return Returns the Max-Age in seconds.
+ *
+ ********************************************************************************/
+static uint32_t coapCacheMaxAge(CoapMessageView *pResponse)
+{
+   int8_t index = coapViewFindOption(pResponse, COAP_OPTION_MAXAGE, 0);   // Used to store the option index.
+
+   if( index < 0 )
+   {
+      return COAP_CACHE_DEFAULT_MAX_AGE;
+   }
+
+   return coapDecodeOptionUint(pResponse->options[index].pData, pResponse->options[index].length);
+}
+
+/*!*****************************************************************************
+ * \brief Initialises a response cache
+ *
+ * \param CoapCache *pCache [out] - Cache to initialise.
+ *
+ ********************************************************************************/
+void coapCacheInit(CoapCache *pCache)
+{
+   memset(pCache, 0, sizeof(*pCache));
+}
+
+/*!*****************************************************************************
+ * \brief Serves a GET request from the cache
+ *
+ * Description:
+ *  Copies a fresh cached response into pBuffer.  The copy keeps the message id
+ *  and token of the upstream exchange; the caller answers its local client with
+ *  the options and payload.  A stale entry is kept so the upstream request can
+ *  carry its ETag (coapCacheAddETag) and be answered with 2.03 Valid.
+ *
+ * \param CoapCache *pCache [in\out] - Cache to search.
+ *
+ * \param CoapMessageView *pRequest [in] - Parsed request.
+ *
+ * \param U8 *pBuffer [out] - Receives the cached response.
+ *
+ * \param U16 bufferSize [in] - Size of pBuffer.
+ *
+ * \param U16 *pLength [out] - Length of the cached response.
+ *
+ *
+ * \return Returns COAP_OK if the response was served, COAP_CACHE_STALE if it
+ *         must be revalidated, COAP_CACHE_MISS or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapCacheGet(CoapCache *pCache, CoapMessageView *pRequest, uint8_t *pBuffer, uint16_t bufferSize, uint16_t *pLength)
+{
+   CoapCacheEntry *pEntry;                 // Used to store the cached entry.
+   TickType_t now = xTaskGetTickCount();   // Used to check freshness.
+
+   if( pRequest->code != COAP_GET )
+   {
+      return COAP_CACHE_MISS;
+   }
+
+   pEntry = coapCacheFind(pCache, pRequest);
+
+   if( pEntry == NULL )
+   {
+      return COAP_CACHE_MISS;
+   }
+
+   if( (int32_t)(now - pEntry->expiryTick) >= 0 )
+   {
+      return COAP_CACHE_STALE;
+   }
+
+   if( pEntry->responseLength > bufferSize )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   memcpy(pBuffer, pEntry->response, pEntry->responseLength);
+   *pLength = pEntry->responseLength;
+   pEntry->usedTick = now;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Adds the ETag of a stale entry to the revalidation request
+ *
+ * Description:
+ *  Options go in ascending order, so call this after options below ETag (4)
+ *  such as Uri-Host and before Uri-Path.
+ *
+ * \param CoapCache *pCache [in] - Cache holding the stale entry.
+ *
+ * \param CoapMessageView *pRequest [in] - Parsed local request.
+ *
+ * \param CoapMessageBuilder *pBuilder [in\out] - Upstream request being built.
+ *
+ *
+ * \return Returns COAP_OK, COAP_CACHE_MISS if there is no ETag to send or < 0
+ *         for error.
+ *
+ ********************************************************************************/
+int8_t coapCacheAddETag(CoapCache *pCache, CoapMessageView *pRequest, CoapMessageBuilder *pBuilder)
+{
+   CoapCacheEntry *pEntry = coapCacheFind(pCache, pRequest);   // Used to store the cached entry.
+
+   if( pEntry == NULL || pEntry->etagLength == 0 )
+   {
+      return COAP_CACHE_MISS;
+   }
+
+   return coapBuilderAddOption(pBuilder, COAP_OPTION_ETAG, pEntry->etagLength, pEntry->etag);
+}
+
+/*!*****************************************************************************
+ * \brief Stores or revalidates the upstream response to a GET
+ *
+ * Description:
+ *  A 2.05 Content response with a non-zero Max-Age replaces the entry for the
+ *  request, evicting the least recently used entry if the cache is full.  A
+ *  2.03 Valid response refreshes the entry's lifetime (and ETag) and copies the
+ *  stored 2.05 into pBuffer, so the body is never transferred again.  Other
+ *  responses leave the cache as it is and *pLength is set to 0.
+ *
+ * Revalidation:
+ *          https://tools.ietf.org/html/rfc7252#section-5.6.2
+ *
+ * \param CoapCache *pCache [in\out] - Cache to update.
+ *
+ * \param CoapMessageView *pRequest [in] - Parsed local request.
+ *
+ * \param U8 *pResponse [in] - Upstream response.
+ *
+ * \param U16 length [in] - Length of the upstream response.
+ *
+ * \param U8 *pBuffer [out] - Receives the cached 2.05 on a 2.03 Valid.
+ *
+ * \param U16 bufferSize [in] - Size of pBuffer.
+ *
+ * \param U16 *pLength [out] - Length copied into pBuffer.
+ *
+ *
+ * \return Returns COAP_OK on success, COAP_CACHE_MISS if a 2.03 has no entry to
+ *         revalidate or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapCacheStore(CoapCache *pCache, CoapMessageView *pRequest, uint8_t *pResponse, uint16_t length, uint8_t *pBuffer, uint16_t bufferSize, uint16_t *pLength)
+{
+   CoapMessageView response;               // Used to store the parsed response.
+   CoapCacheEntry *pEntry;                 // Used to store the entry to update.
+   TickType_t now = xTaskGetTickCount();   // Used to compute the expiry.
+   uint8_t key[COAP_CACHE_KEY_SIZE];       // Used to store the key of a new entry.
+   uint32_t hash;                          // Used to store the key hash.
+   uint32_t maxAge;                        // Used to store the freshness lifetime.
+   int16_t keyLength;                      // Used to store the key length.
+   int8_t index;                           // Used to store the ETag index.
+   uint8_t i;                              // Used as an iterator.
+
+   *pLength = 0;
+
+   if( pRequest->code != COAP_GET )
+   {
+      return COAP_OK;
+   }
+
+   if( coapParseMessage(pResponse, length, &response) < 0 )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
+   maxAge = coapCacheMaxAge(&response);
+   index = coapViewFindOption(&response, COAP_OPTION_ETAG, 0);
+   pEntry = coapCacheFind(pCache, pRequest);
+
+   if( response.code == COAP_VALID )
+   {
+      if( pEntry == NULL )
+      {
+         return COAP_CACHE_MISS;
+      }
+
+      if( pEntry->responseLength > bufferSize )
+      {
+         return COAP_INSUFFICIENT_BUFFER;
+      }
+
+      if( index >= 0 && response.options[index].length <= COAP_CACHE_ETAG_SIZE )
+      {
+         memcpy(pEntry->etag, response.options[index].pData, response.options[index].length);
+         pEntry->etagLength = (uint8_t)response.options[index].length;
+      }
+
+      pEntry->expiryTick = now + coapMaxAgeTicks(maxAge);
+      pEntry->usedTick = now;
+
+      memcpy(pBuffer, pEntry->response, pEntry->responseLength);
+      *pLength = pEntry->responseLength;
+
+      return COAP_OK;
+   }
+
+   if( response.code != COAP_CONTENT )
+   {
+      return COAP_OK;
+   }
+
+   if( maxAge == 0 || length > COAP_CACHE_RESPONSE_SIZE ||
+       (index >= 0 && response.options[index].length > COAP_CACHE_ETAG_SIZE) )
+   {
+      // Not cacheable here, drop whatever was stored for the request.
+      if( pEntry != NULL )
+      {
+         pEntry->inUse = false;
+      }
+
+      return COAP_OK;
+   }
+
+   if( pEntry == NULL )
+   {
+      // Built first, a request that has no key must not evict anything.
+      keyLength = coapCacheBuildKey(pRequest, COAP_GET, key, &hash);
+
+      if( keyLength < 0 )
+      {
+         return COAP_OK;
+      }
+
+      // Take a free entry, or the least recently used one.
+      pEntry = &pCache->entries[0];
+
+      for( i = 0; i < COAP_CACHE_ENTRIES && pEntry->inUse; i++ )
+      {
+         if( !pCache->entries[i].inUse ||
+             (int32_t)(pCache->entries[i].usedTick - pEntry->usedTick) < 0 )
+         {
+            pEntry = &pCache->entries[i];
+         }
+      }
+
+      memcpy(pEntry->key, key, keyLength);
+      pEntry->hash = hash;
+      pEntry->keyLength = (uint16_t)keyLength;
+   }
+
+   memcpy(pEntry->response, pResponse, length);
+   pEntry->responseLength = length;
+   pEntry->etagLength = 0;
+
+   if( index >= 0 )
+   {
+      memcpy(pEntry->etag, response.options[index].pData, response.options[index].length);
+      pEntry->etagLength = (uint8_t)response.options[index].length;
+   }
+
+   pEntry->expiryTick = now + coapMaxAgeTicks(maxAge);
+   pEntry->usedTick = now;
+   pEntry->inUse = true;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Drops the cached response for a resource
+ *
+ * Description:
+ *  Call when a PUT, POST or DELETE to the resource succeeds so the next GET is
+ *  not served the old representation.
+ *
+ * \param CoapCache *pCache [in\out] - Cache to update.
+ *
+ * \param CoapMessageView *pRequest [in] - Parsed request to the resource.
+ *
+ ********************************************************************************/
+void coapCacheInvalidate(CoapCache *pCache, CoapMessageView *pRequest)
+{
+   CoapCacheEntry *pEntry = coapCacheFind(pCache, pRequest);   // Used to store the cached entry.
+
+   if( pEntry != NULL )
+   {
+      pEntry->inUse = false;
+   }
+}
@@ -0,0 +1,46 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_CACHE_H
+#define COAP_CACHE_H
+
+#include "coap.h"
+
+/*Response Cache Related (RFC 7252 section 5.6)*/
+#define COAP_CACHE_ENTRIES          8     //cached responses
+#define COAP_CACHE_RESPONSE_SIZE    256   //largest response kept, bigger ones are not cached
+#define COAP_CACHE_KEY_SIZE         64    //method + Uri-Path/Uri-Query bytes
+#define COAP_CACHE_ETAG_SIZE        8     //ETag is at most 8 bytes
+#define COAP_CACHE_DEFAULT_MAX_AGE  60    //seconds, when a response has no Max-Age
+
+/// CoapCacheEntry struct
+typedef struct
+{
+   uint8_t key[COAP_CACHE_KEY_SIZE];            ///< Method and Uri-Path/Uri-Query options
+   uint8_t response[COAP_CACHE_RESPONSE_SIZE];  ///< Encoded 2.05 response
+   uint8_t etag[COAP_CACHE_ETAG_SIZE];          ///< ETag of the response, used to revalidate
+   uint32_t hash;                               ///< Hash of key, compared first
+   uint16_t keyLength;                          ///< Length of key
+   uint16_t responseLength;                     ///< Length of response
+   uint8_t etagLength;                          ///< Length of etag, 0 if the response had none
+   TickType_t expiryTick;                       ///< Response is fresh until this tick
+   TickType_t usedTick;                         ///< Last hit, the oldest entry is evicted first
+   bool inUse;                                  ///< Entry holds a response
+} CoapCacheEntry;
+
+/// CoapCache struct
+typedef struct
+{
+   CoapCacheEntry entries[COAP_CACHE_ENTRIES];  ///< Cached responses
+} CoapCache;
+
+void coapCacheInit(CoapCache *pCache);
+int8_t coapCacheGet(CoapCache *pCache, CoapMessageView *pRequest, uint8_t *pBuffer, uint16_t bufferSize, uint16_t *pLength);
+int8_t coapCacheAddETag(CoapCache *pCache, CoapMessageView *pRequest, CoapMessageBuilder *pBuilder);
+int8_t coapCacheStore(CoapCache *pCache, CoapMessageView *pRequest, uint8_t *pResponse, uint16_t length, uint8_t *pBuffer, uint16_t bufferSize, uint16_t *pLength);
+void coapCacheInvalidate(CoapCache *pCache, CoapMessageView *pRequest);
+
+//! @}
+#endif  /* COAP_CACHE_H */
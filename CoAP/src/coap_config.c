@@ -0,0 +1,294 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_config.h"
+
+// Configuration used by every template.
+static CoapConfig coapConfig;
+
+/*!*****************************************************************************
+ * \brief Encodes the endpoint options of the configuration
+ *
+ * Description:
+ *  Uri-Host and the Uri-Path prefix are encoded as the first options of a
+ *  message, the CIK as a Uri-Path that follows the alias.  The generation is
+ *  changed only when both encodings succeed, so templates never pick up half
+ *  an update.
+ *
+ * Uris:
+ *          https://tools.ietf.org/html/rfc7252#section-6.4
+ *
+ * \param CoapConfig *pConfig [in\out] - Configuration with host, prefix and cik set.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+static int8_t coapConfigEncode(CoapConfig *pConfig)
+{
+   CoapMessageBuilder builder;                                  // Used to encode the options.
+   uint8_t buffer[COAP_HDR_BYTES + COAP_CONFIG_OPTIONS_SIZE + COAP_CONFIG_CIK_OPTION_SIZE];   // Used as the scratch message.
+   int8_t results;                                              // Used to store the results.
+
+   results = coapBuilderInit(&builder, buffer, sizeof(buffer), COAP_TYPE_CON, COAP_POST, 0, NULL, 0);
+
+   if( results == COAP_OK )
+   {
+      results = coapBuilderAddOption(&builder, COAP_OPTION_URI_HOST, pConfig->hostLength, pConfig->host);
+   }
+
+   if( results == COAP_OK )
+   {
+      results = coapBuilderAddOption(&builder, COAP_OPTION_URI_PATH, pConfig->prefixLength, pConfig->prefix);
+   }
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   memcpy(pConfig->options, buffer + COAP_HDR_BYTES, builder.length - COAP_HDR_BYTES);
+   pConfig->optionsLength = builder.length - COAP_HDR_BYTES;
+
+   // The CIK is encoded behind an empty Uri-Path, its 1 byte header is skipped.
+   results = coapBuilderInit(&builder, buffer, sizeof(buffer), COAP_TYPE_CON, COAP_POST, 0, NULL, 0);
+
+   if( results == COAP_OK )
+   {
+      results = coapBuilderAddOption(&builder, COAP_OPTION_URI_PATH, 0, pConfig->cik);
+   }
+
+   if( results == COAP_OK )
+   {
+      results = coapBuilderAddOption(&builder, COAP_OPTION_URI_PATH, pConfig->cikLength, pConfig->cik);
+   }
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   memcpy(pConfig->cikOption, buffer + COAP_HDR_BYTES + 1, builder.length - COAP_HDR_BYTES - 1);
+   pConfig->cikOptionLength = builder.length - COAP_HDR_BYTES - 1;
+
+   pConfig->generation++;
+
+   if( pConfig->generation == 0 )
+   {
+      pConfig->generation = 1;
+   }
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Copies one string of the configuration
+ *
+ * \param U8 *pField [out] - Field to set.
+ *
+ * \param U8 *pLength [out] - Length of the field.
+ *
+ * \param U8 fieldSize [in] - Size of pField.
+ *
+ * \param char *pValue [in] - New value.
+ *
+ *
+ * \return Returns COAP_OK or COAP_INSUFFICIENT_BUFFER if the value does not fit.
+ *
+ ********************************************************************************/
+static int8_t coapConfigCopy(uint8_t *pField, uint8_t *pLength, uint8_t fieldSize, const char *pValue)
+{
+   size_t length = strlen(pValue);   // Used to store the value length.
+
+   if( length > fieldSize )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   memcpy(pField, pValue, length);
+   *pLength = (uint8_t)length;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Loads the compile-time endpoint
+ *
+ * Description:
+ *  SERVER_NAME, COAP_PORT, URI_PREFIX and CIK are measured and encoded here,
+ *  once.  coapConfigGet calls this on first use, so it only needs calling to
+ *  go back to the defaults.
+ *
+ ********************************************************************************/
+void coapConfigInit(void)
+{
+   uint16_t generation = coapConfig.generation;   // Used to keep the generation moving.
+
+   memset(&coapConfig, 0, sizeof(coapConfig));
+   coapConfig.generation = generation;
+   coapConfig.port = COAP_PORT;
+
+   coapConfigCopy(coapConfig.host, &coapConfig.hostLength, sizeof(coapConfig.host), SERVER_NAME);
+   coapConfigCopy(coapConfig.prefix, &coapConfig.prefixLength, sizeof(coapConfig.prefix), URI_PREFIX);
+   coapConfigCopy(coapConfig.cik, &coapConfig.cikLength, sizeof(coapConfig.cik), CIK);
+   coapConfigEncode(&coapConfig);
+}
+
+/*!*****************************************************************************
+ * \brief Gets the current endpoint
+ *
+ * \return Returns the configuration, compare generation to detect updates.
+ *
+ ********************************************************************************/
+const CoapConfig *coapConfigGet(void)
+{
+   if( coapConfig.generation == 0 )
+   {
+      coapConfigInit();
+   }
+
+   return &coapConfig;
+}
+
+/*!*****************************************************************************
+ * \brief Switches to another server
+ *
+ * Description:
+ *  Templates pick the change up at their next coapTemplateRefresh; the
+ *  transport is reconnected by the caller.  Call from the task that sends
+ *  (or before it starts), the configuration has no lock.
+ *
+ * \param char *pHost [in] - Server name sent as Uri-Host.
+ *
+ * \param U16 port [in] - Server port.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error, the configuration is
+ *         unchanged on error.
+ *
+ ********************************************************************************/
+int8_t coapConfigSetServer(const char *pHost, uint16_t port)
+{
+   CoapConfig config = *coapConfigGet();   // Used to stage the update.
+   int8_t results;                         // Used to store the results.
+
+   results = coapConfigCopy(config.host, &config.hostLength, sizeof(config.host), pHost);
+
+   if( results == COAP_OK )
+   {
+      config.port = port;
+      results = coapConfigEncode(&config);
+   }
+
+   if( results == COAP_OK )
+   {
+      coapConfig = config;
+   }
+
+   return results;
+}
+
+/*!*****************************************************************************
+ * \brief Changes the URI prefix
+ *
+ * \param char *pPrefix [in] - First Uri-Path segment, e.g. "1a".
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error, the configuration is
+ *         unchanged on error.
+ *
+ ********************************************************************************/
+int8_t coapConfigSetPrefix(const char *pPrefix)
+{
+   CoapConfig config = *coapConfigGet();   // Used to stage the update.
+   int8_t results;                         // Used to store the results.
+
+   results = coapConfigCopy(config.prefix, &config.prefixLength, sizeof(config.prefix), pPrefix);
+
+   if( results == COAP_OK )
+   {
+      results = coapConfigEncode(&config);
+   }
+
+   if( results == COAP_OK )
+   {
+      coapConfig = config;
+   }
+
+   return results;
+}
+
+/*!*****************************************************************************
+ * \brief Rotates the CIK
+ *
+ * \param char *pCik [in] - New client interface key.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error, the configuration is
+ *         unchanged on error.
+ *
+ ********************************************************************************/
+int8_t coapConfigSetCik(const char *pCik)
+{
+   CoapConfig config = *coapConfigGet();   // Used to stage the update.
+   int8_t results;                         // Used to store the results.
+
+   results = coapConfigCopy(config.cik, &config.cikLength, sizeof(config.cik), pCik);
+
+   if( results == COAP_OK )
+   {
+      results = coapConfigEncode(&config);
+   }
+
+   if( results == COAP_OK )
+   {
+      coapConfig = config;
+   }
+
+   return results;
+}
+
+/*!*****************************************************************************
+ * \brief Builds the endpoint of another device
+ *
+ * Description:
+ *  Copies the current server and prefix and sets the CIK of a device behind a
+ *  gateway, e.g. for its coapSchcInit rules.  The generation of pConfig keeps
+ *  moving, so calling again after the device rotates its CIK is picked up by
+ *  anything built from the old value.
+ *
+ * \param CoapConfig *pConfig [in\out] - Configuration of the device, zeroed before first use.
+ *
+ * \param char *pCik [in] - Client interface key of the device.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error, pConfig is unchanged
+ *         on error.
+ *
+ ********************************************************************************/
+int8_t coapConfigDevice(CoapConfig *pConfig, const char *pCik)
+{
+   CoapConfig config = *coapConfigGet();   // Used to stage the update.
+   int8_t results;                         // Used to store the results.
+
+   config.generation = pConfig->generation;
+
+   results = coapConfigCopy(config.cik, &config.cikLength, sizeof(config.cik), pCik);
+
+   if( results == COAP_OK )
+   {
+      results = coapConfigEncode(&config);
+   }
+
+   if( results == COAP_OK )
+   {
+      *pConfig = config;
+   }
+
+   return results;
+}
+
+//! @}
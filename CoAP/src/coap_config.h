@@ -0,0 +1,43 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_CONFIG_H
+#define COAP_CONFIG_H
+
+#include "coap.h"
+
+/*Endpoint Configuration Related*/
+#define COAP_CONFIG_HOST_SIZE       64    //longest server name
+#define COAP_CONFIG_PREFIX_SIZE     12    //longest URI prefix
+#define COAP_CONFIG_CIK_SIZE        64    //longest CIK, Exosite CIKs are CIK_LENGTH
+#define COAP_CONFIG_OPTIONS_SIZE    (2 + COAP_CONFIG_HOST_SIZE + 2 + COAP_CONFIG_PREFIX_SIZE)
+#define COAP_CONFIG_CIK_OPTION_SIZE (2 + COAP_CONFIG_CIK_SIZE)
+
+/// CoapConfig struct, the endpoint resolved once, SERVER_NAME, COAP_PORT, URI_PREFIX and CIK until changed
+typedef struct
+{
+   uint8_t options[COAP_CONFIG_OPTIONS_SIZE];          ///< Uri-Host and Uri-Path prefix, encoded right after the token
+   uint8_t cikOption[COAP_CONFIG_CIK_OPTION_SIZE];     ///< Uri-Path CIK, encoded after another Uri-Path
+   uint8_t host[COAP_CONFIG_HOST_SIZE];                ///< Server name, e.g. for the socket or the proxy
+   uint8_t prefix[COAP_CONFIG_PREFIX_SIZE];            ///< URI prefix
+   uint8_t cik[COAP_CONFIG_CIK_SIZE];                  ///< Client interface key
+   uint8_t optionsLength;                              ///< Length of options
+   uint8_t cikOptionLength;                            ///< Length of cikOption
+   uint8_t hostLength;                                 ///< Length of host
+   uint8_t prefixLength;                               ///< Length of prefix
+   uint8_t cikLength;                                  ///< Length of cik
+   uint16_t port;                                      ///< Server port
+   uint16_t generation;                                ///< Changes with every update, 0 before coapConfigInit
+} CoapConfig;
+
+void coapConfigInit(void);
+const CoapConfig *coapConfigGet(void);
+int8_t coapConfigSetServer(const char *pHost, uint16_t port);
+int8_t coapConfigSetPrefix(const char *pPrefix);
+int8_t coapConfigSetCik(const char *pCik);
+int8_t coapConfigDevice(CoapConfig *pConfig, const char *pCik);
+
+//! @}
+#endif  /* COAP_CONFIG_H */
@@ -0,0 +1,255 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_congestion.h"
+
+/*!*****************************************************************************
+ * \brief Limits an RTO to the supported range
+ *
+ * \param U32 rtoMs [in] - Estimate to limit.
+ *
+ *
+ * \return Returns the limited estimate.
+ *
+ ********************************************************************************/
+static uint32_t coapCongestionClamp(uint32_t rtoMs)
+{
+   if( rtoMs < COAP_CONGESTION_MIN_RTO_MS )
+   {
+      return COAP_CONGESTION_MIN_RTO_MS;
+   }
+
+   if( rtoMs > COAP_CONGESTION_MAX_RTO_MS )
+   {
+      return COAP_CONGESTION_MAX_RTO_MS;
+   }
+
+   return rtoMs;
+}
+
+/*!*****************************************************************************
+ * \brief Feeds an RTT sample to an RFC 6298 estimator
+ *
+ * Description:
+ *  SRTT and RTTVAR use the gains 1/8 and 1/4; the first sample sets SRTT = R and
+ *  RTTVAR = R/2.
+ *
+ * RTO computation:
+ *          https://tools.ietf.org/html/rfc6298#section-2
+ *
+ * \param U32 *pSrtt [in\out] - Smoothed RTT in ms.
+ *
+ * \param U32 *pRttvar [in\out] - RTT variation in ms.
+ *
+ * \param bool *pHasSample [in\out] - Estimator holds a sample.
+ *
+ * \param U32 rttMs [in] - New sample.
+ *
+ * \param U8 k [in] - Variance multiplier, 4 (strong) or 1 (weak).
+ *
+ *
+ * \return Returns the RTO of the estimator in ms.
+ *
+ ********************************************************************************/
+static uint32_t coapCongestionEstimate(uint32_t *pSrtt, uint32_t *pRttvar, bool *pHasSample, uint32_t rttMs, uint8_t k)
+{
+   uint32_t deviation;   // Used to store |SRTT - R|.
+
+   if( !*pHasSample )
+   {
+      *pSrtt = rttMs;
+      *pRttvar = rttMs / 2;
+      *pHasSample = true;
+   }
+   else
+   {
+      deviation = (*pSrtt > rttMs) ? *pSrtt - rttMs : rttMs - *pSrtt;
+      *pRttvar = (3 * *pRttvar + deviation) / 4;
+      *pSrtt = (7 * *pSrtt + rttMs) / 8;
+   }
+
+   return *pSrtt + k * *pRttvar;
+}
+
+/*!*****************************************************************************
+ * \brief Initialises the state of a destination
+ *
+ * \param CoapCongestion *pCongestion [out] - State to initialise.
+ *
+ ********************************************************************************/
+void coapCongestionInit(CoapCongestion *pCongestion)
+{
+   memset(pCongestion, 0, sizeof(*pCongestion));
+
+   pCongestion->rto = COAP_CONGESTION_INITIAL_RTO_MS;
+   pCongestion->window = COAP_CONGESTION_INITIAL_WINDOW;
+}
+
+/*!*****************************************************************************
+ * \brief Checks whether another CON may be sent to the destination
+ *
+ * \param CoapCongestion *pCongestion [in] - State of the destination.
+ *
+ *
+ * \return Returns true if the window has room.
+ *
+ ********************************************************************************/
+bool coapCongestionCanSend(const CoapCongestion *pCongestion)
+{
+   return pCongestion->inFlight < pCongestion->window;
+}
+
+/*!*****************************************************************************
+ * \brief Gets the timeout of a new CON
+ *
+ * Description:
+ *  A random value in [RTO, 1.5 * RTO] like ACK_TIMEOUT in RFC 7252.  Before
+ *  that, an estimate that has not been updated for a while is aged towards the
+ *  default: a small RTO (< 1 s) is doubled after 16 RTOs without a sample and a
+ *  large one (> 3 s) moves half way to 2 s after 4 RTOs, so a stale estimate
+ *  neither hammers nor starves a destination.
+ *
+ * CoCoA:
+ *          https://tools.ietf.org/html/draft-ietf-core-cocoa-03#section-4.2
+ *
+ * \param CoapCongestion *pCongestion [in\out] - State of the destination.
+ *
+ * \param U32 nowMs [in] - Current time.
+ *
+ *
+ * \return Returns the initial timeout in ms.
+ *
+ ********************************************************************************/
+uint32_t coapCongestionInitialTimeout(CoapCongestion *pCongestion, uint32_t nowMs)
+{
+   uint32_t idle = nowMs - pCongestion->updateMs;   // Used to store the time since the last update.
+
+   if( pCongestion->rto < 1000 && idle > 16 * pCongestion->rto )
+   {
+      pCongestion->rto = coapCongestionClamp(2 * pCongestion->rto);
+      pCongestion->updateMs = nowMs;
+   }
+   else if( pCongestion->rto > 3000 && idle > 4 * pCongestion->rto )
+   {
+      pCongestion->rto = (pCongestion->rto + COAP_CONGESTION_INITIAL_RTO_MS) / 2;
+      pCongestion->updateMs = nowMs;
+   }
+
+   return pCongestion->rto + (coapGetRandom() % (pCongestion->rto / 2 + 1));
+}
+
+/*!*****************************************************************************
+ * \brief Gets the timeout of the next retransmission
+ *
+ * Description:
+ *  Variable back-off factor: 3 below an RTO of 1 s, 1.5 above 3 s and 2 in
+ *  between, so short RTOs still back off out of a burst and long ones do not
+ *  stretch an exchange into minutes.
+ *
+ * \param CoapCongestion *pCongestion [in] - State of the destination.
+ *
+ * \param U32 timeoutMs [in] - Timeout that just expired.
+ *
+ *
+ * \return Returns the next timeout in ms.
+ *
+ ********************************************************************************/
+uint32_t coapCongestionBackoff(const CoapCongestion *pCongestion, uint32_t timeoutMs)
+{
+   if( pCongestion->rto < 1000 )
+   {
+      return timeoutMs * 3;
+   }
+
+   if( pCongestion->rto > 3000 )
+   {
+      return timeoutMs + timeoutMs / 2;
+   }
+
+   return timeoutMs * 2;
+}
+
+/*!*****************************************************************************
+ * \brief Takes an RTT sample from an acknowledged CON
+ *
+ * Description:
+ *  A CON acknowledged without retransmission updates the strong estimator
+ *  (K = 4) and RTO = RTO_strong / 2 + RTO / 2.  One acknowledged after one or
+ *  two retransmissions is ambiguous; its RTT is measured from the first
+ *  transmission and updates the weak estimator (K = 1) with
+ *  RTO = RTO_weak / 4 + 3 * RTO / 4.  Later ones are not used.
+ *  Clean ACKs also grow the window by one per window of ACKs (additive
+ *  increase) up to COAP_CONGESTION_MAX_WINDOW.
+ *
+ * \param CoapCongestion *pCongestion [in\out] - State of the destination.
+ *
+ * \param U32 rttMs [in] - Time since the first transmission.
+ *
+ * \param U8 retransmitCount [in] - Retransmissions before the ACK.
+ *
+ * \param U32 nowMs [in] - Current time.
+ *
+ ********************************************************************************/
+void coapCongestionOnAck(CoapCongestion *pCongestion, uint32_t rttMs, uint8_t retransmitCount, uint32_t nowMs)
+{
+   uint32_t rto;   // Used to store the estimator RTO.
+
+   if( retransmitCount == 0 )
+   {
+      rto = coapCongestionEstimate(&pCongestion->strongSrtt, &pCongestion->strongRttvar, &pCongestion->hasStrong, rttMs, 4);
+      pCongestion->rto = coapCongestionClamp(rto / 2 + pCongestion->rto / 2);
+      pCongestion->updateMs = nowMs;
+
+      if( ++pCongestion->ackCount >= pCongestion->window )
+      {
+         pCongestion->ackCount = 0;
+
+         if( pCongestion->window < COAP_CONGESTION_MAX_WINDOW )
+         {
+            pCongestion->window++;
+         }
+      }
+   }
+   else if( retransmitCount <= 2 )
+   {
+      rto = coapCongestionEstimate(&pCongestion->weakSrtt, &pCongestion->weakRttvar, &pCongestion->hasWeak, rttMs, 1);
+      pCongestion->rto = coapCongestionClamp(rto / 4 + 3 * pCongestion->rto / 4);
+      pCongestion->updateMs = nowMs;
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Backs off after a loss
+ *
+ * Description:
+ *  Called on the first retransmission of an exchange: the window is halved
+ *  (multiplicative decrease), never below one.
+ *
+ * \param CoapCongestion *pCongestion [in\out] - State of the destination.
+ *
+ ********************************************************************************/
+void coapCongestionOnLoss(CoapCongestion *pCongestion)
+{
+   pCongestion->window = (pCongestion->window > 1) ? pCongestion->window / 2 : 1;
+   pCongestion->ackCount = 0;
+}
+
+/*!*****************************************************************************
+ * \brief Reports the estimator and window of a destination
+ *
+ * \param CoapCongestion *pCongestion [in] - State of the destination.
+ *
+ * \param CoapCongestionReport *pReport [out] - Receives the values.
+ *
+ ********************************************************************************/
+void coapCongestionReport(const CoapCongestion *pCongestion, CoapCongestionReport *pReport)
+{
+   pReport->rtoMs = pCongestion->rto;
+   pReport->srttMs = pCongestion->hasStrong ? pCongestion->strongSrtt : 0;
+   pReport->rttvarMs = pCongestion->strongRttvar;
+   pReport->window = pCongestion->window;
+   pReport->inFlight = pCongestion->inFlight;
+}
@@ -0,0 +1,58 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_CONGESTION_H
+#define COAP_CONGESTION_H
+
+#include "coap.h"
+
+/*Congestion Control Related (CoCoA, draft-ietf-core-cocoa)*/
+#define COAP_CONGESTION_INITIAL_RTO_MS  2000   //ACK_TIMEOUT until the first RTT sample
+#define COAP_CONGESTION_MIN_RTO_MS      100    //one retransmission tick
+#define COAP_CONGESTION_MAX_RTO_MS      60000
+#define COAP_CONGESTION_INITIAL_WINDOW  1      //NSTART
+#ifndef COAP_CONGESTION_NOW_MS
+#define COAP_CONGESTION_NOW_MS()        ((uint32_t)(((uint64_t)xTaskGetTickCount() * 1000) / configTICK_RATE_HZ))   //exact for any tick rate
+#endif
+#ifndef COAP_CONGESTION_MAX_WINDOW
+#define COAP_CONGESTION_MAX_WINDOW      8      //concurrent CONs to one destination, < COAP_MAX_PENDING
+#endif
+
+/// CoapCongestion struct, the estimator and window of one destination
+typedef struct
+{
+   uint32_t rto;                        ///< RTO_overall in ms
+   uint32_t strongSrtt;                 ///< Smoothed RTT of clean exchanges in ms
+   uint32_t strongRttvar;               ///< RTT variation of clean exchanges in ms
+   uint32_t weakSrtt;                   ///< Smoothed RTT of retransmitted exchanges in ms
+   uint32_t weakRttvar;                 ///< RTT variation of retransmitted exchanges in ms
+   uint32_t updateMs;                   ///< Time of the last RTO update
+   uint8_t window;                      ///< CONs allowed in flight
+   uint8_t inFlight;                    ///< CONs in flight
+   uint8_t ackCount;                    ///< Clean ACKs since the window last grew
+   bool hasStrong;                      ///< strongSrtt holds a sample
+   bool hasWeak;                        ///< weakSrtt holds a sample
+} CoapCongestion;
+
+/// CoapCongestionReport struct
+typedef struct
+{
+   uint32_t rtoMs;                      ///< Current RTO_overall
+   uint32_t srttMs;                     ///< Smoothed RTT of clean exchanges, 0 before a sample
+   uint32_t rttvarMs;                   ///< RTT variation of clean exchanges
+   uint8_t window;                      ///< CONs allowed in flight
+   uint8_t inFlight;                    ///< CONs in flight
+} CoapCongestionReport;
+
+void coapCongestionInit(CoapCongestion *pCongestion);
+bool coapCongestionCanSend(const CoapCongestion *pCongestion);
+uint32_t coapCongestionInitialTimeout(CoapCongestion *pCongestion, uint32_t nowMs);
+uint32_t coapCongestionBackoff(const CoapCongestion *pCongestion, uint32_t timeoutMs);
+void coapCongestionOnAck(CoapCongestion *pCongestion, uint32_t rttMs, uint8_t retransmitCount, uint32_t nowMs);
+void coapCongestionOnLoss(CoapCongestion *pCongestion);
+void coapCongestionReport(const CoapCongestion *pCongestion, CoapCongestionReport *pReport);
+
+//! @}
+#endif  /* COAP_CONGESTION_H */
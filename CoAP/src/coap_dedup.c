@@ -0,0 +1,286 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_dedup.h"
+#include "coap_stats.h"
+
+/*!*****************************************************************************
+ * \brief Computes the home slot of an exchange
+ *
+ * \param CoapDedupTable *pTable [in] - Table the slot is in.
+ *
+ * \param U32 address [in] - Endpoint address.
+ *
+ * \param U16 port [in] - Endpoint port.
+ *
+ * \param U16 messageId [in] - Message id.
+ *
+ *
+ * \return Returns the slot index.
+ *
+ ********************************************************************************/
+static uint16_t coapDedupSlot(const CoapDedupTable *pTable, uint32_t address, uint16_t port, uint16_t messageId)
+{
+   uint32_t hash;   // Used to mix the key.
+
+   hash = (address ^ ((uint32_t)port << 16) ^ messageId) * 2654435761UL;
+
+   return (hash >> 16) & (pTable->entryCount - 1);
+}
+
+/*!*****************************************************************************
+ * \brief Removes an entry and closes the gap behind it
+ *
+ * Description:
+ *  Backward shift deletion: every later entry of the cluster whose home slot
+ *  is not between the gap and itself moves back into the gap, so a probe
+ *  can still stop at the first unused slot and no tombstones are left.
+ *
+ * \param CoapDedupTable *pTable [in\out] - Table holding the entry.
+ *
+ * \param U16 slot [in] - Slot of the entry to remove.
+ *
+ ********************************************************************************/
+static void coapDedupRemove(CoapDedupTable *pTable, uint16_t slot)
+{
+   uint16_t mask = pTable->entryCount - 1;   // Used to wrap the slots.
+   uint16_t next = slot;                     // Used to store the entry looked at.
+   uint16_t home;                            // Used to store the home slot of next.
+   CoapDedupEntry *pNext;                    // Used to store the entry looked at.
+
+   while( true )
+   {
+      pTable->pEntries[slot].inUse = false;
+
+      do
+      {
+         next = (next + 1) & mask;
+         pNext = &pTable->pEntries[next];
+
+         if( !pNext->inUse )
+         {
+            return;
+         }
+
+         home = coapDedupSlot(pTable, pNext->address, pNext->port, pNext->messageId);
+      }
+      while( ((next - home) & mask) < ((next - slot) & mask) );
+
+      pTable->pEntries[slot] = *pNext;
+      slot = next;
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Probes for an exchange
+ *
+ * Description:
+ *  Linear probing from the home slot, ended by the first unused slot.
+ *  Expired entries met on the way are removed with coapDedupRemove, so the
+ *  probe length follows the live entries rather than every slot ever used.
+ *
+ * \param CoapDedupTable *pTable [in\out] - Table to search.
+ *
+ * \param U32 address [in] - Endpoint address.
+ *
+ * \param U16 port [in] - Endpoint port.
+ *
+ * \param U16 messageId [in] - Message id.
+ *
+ * \param CoapDedupEntry **ppFree [out] - Slot to insert in, NULL if full.
+ *
+ *
+ * \return Returns the live entry of the exchange or NULL.
+ *
+ ********************************************************************************/
+static CoapDedupEntry *coapDedupFind(CoapDedupTable *pTable, uint32_t address, uint16_t port, uint16_t messageId, CoapDedupEntry **ppFree)
+{
+   CoapDedupEntry *pEntry;                 // Used to store the probed entry.
+   TickType_t now = xTaskGetTickCount();   // Used to check expiry.
+   uint16_t slot;                          // Used to store the probed slot.
+   uint16_t i = 0;                         // Used to count the probed slots.
+
+   *ppFree = NULL;
+   slot = coapDedupSlot(pTable, address, port, messageId);
+
+   while( i < pTable->entryCount )
+   {
+      pEntry = &pTable->pEntries[slot];
+
+      if( !pEntry->inUse )
+      {
+         *ppFree = pEntry;
+         return NULL;
+      }
+
+      // The slot now holds a shifted entry or is unused, look at it again.
+      if( (int32_t)(now - pEntry->expiryTick) >= 0 )
+      {
+         coapDedupRemove(pTable, slot);
+         continue;
+      }
+
+      if( pEntry->messageId == messageId && pEntry->port == port && pEntry->address == address )
+      {
+         return pEntry;
+      }
+
+      slot = (slot + 1) & (pTable->entryCount - 1);
+      i++;
+   }
+
+   return NULL;
+}
+
+/*!*****************************************************************************
+ * \brief Initialises a deduplication table
+ *
+ * Description:
+ *  A device keeps COAP_DEDUP_ENTRIES entries; a gateway answering many
+ *  endpoints passes a larger array, see the rate note in coap_dedup.h.
+ *
+ * \param CoapDedupTable *pTable [out] - Table to initialise.
+ *
+ * \param CoapDedupEntry *pEntries [in] - Storage, must stay valid.
+ *
+ * \param U16 entryCount [in] - Number of pEntries, a power of 2 up to 32768.
+ *
+ *
+ * \return Returns COAP_OK or COAP_INVALID_BUFFER_LENGTH if entryCount is
+ *         not a power of 2, which the probe mask relies on.
+ *
+ ********************************************************************************/
+int8_t coapDedupInit(CoapDedupTable *pTable, CoapDedupEntry *pEntries, uint16_t entryCount)
+{
+   if( entryCount == 0 || (entryCount & (entryCount - 1)) != 0 || entryCount > 32768 )
+   {
+      return COAP_INVALID_BUFFER_LENGTH;
+   }
+
+   memset(pEntries, 0, entryCount * sizeof(*pEntries));
+
+   pTable->pEntries = pEntries;
+   pTable->entryCount = entryCount;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Checks whether a received message is a duplicate
+ *
+ * Description:
+ *  Call before handing a CON or NON message to its handler.  A new message is
+ *  recorded for EXCHANGE_LIFETIME (CON) or NON_LIFETIME (NON) and COAP_OK is
+ *  returned.  A duplicate returns COAP_DUPLICATE_MESSAGE with the reply that was
+ *  stored for the first copy, so it can be sent again without running the
+ *  handler; *pReplyLength is 0 if there is nothing to replay (handler still
+ *  running, NON without a reply, reply too large to keep).  When every slot is
+ *  live the message is processed without being recorded, so memory stays at
+ *  the table size; this is counted in COAP_STAT_DEDUP_FULL and means the
+ *  table is too small for the message rate.
+ *
+ * Message Deduplication:
+ *          https://tools.ietf.org/html/rfc7252#section-4.5
+ *
+ * \param CoapDedupTable *pTable [in\out] - Table to check.
+ *
+ * \param U32 address [in] - Address of the sender.
+ *
+ * \param U16 port [in] - Port of the sender.
+ *
+ * \param CoapMessageView *pView [in] - Parsed message.
+ *
+ * \param U8 **ppReply [out] - Reply to replay for a duplicate.
+ *
+ * \param U16 *pReplyLength [out] - Length of the reply to replay.
+ *
+ *
+ * \return Returns COAP_OK for a new message or COAP_DUPLICATE_MESSAGE.
+ *
+ ********************************************************************************/
+int8_t coapDedupCheck(CoapDedupTable *pTable, uint32_t address, uint16_t port, CoapMessageView *pView, uint8_t **ppReply, uint16_t *pReplyLength)
+{
+   CoapDedupEntry *pEntry;   // Used to store the matching entry.
+   CoapDedupEntry *pFree;    // Used to store the slot to insert in.
+   uint32_t lifetime;        // Used to store the entry lifetime in seconds.
+
+   *ppReply = NULL;
+   *pReplyLength = 0;
+
+   if( pView->type != COAP_TYPE_CON && pView->type != COAP_TYPE_NON )
+   {
+      return COAP_OK;
+   }
+
+   pEntry = coapDedupFind(pTable, address, port, pView->messageId, &pFree);
+
+   if( pEntry != NULL )
+   {
+      *ppReply = pEntry->reply;
+      *pReplyLength = pEntry->replyLength;
+      COAP_STAT_INC(COAP_STAT_DUPLICATE);
+      return COAP_DUPLICATE_MESSAGE;
+   }
+
+   if( pFree != NULL )
+   {
+      lifetime = (pView->type == COAP_TYPE_CON) ? COAP_EXCHANGE_LIFETIME : COAP_NON_LIFETIME;
+
+      pFree->address = address;
+      pFree->port = port;
+      pFree->messageId = pView->messageId;
+      pFree->expiryTick = xTaskGetTickCount() + pdMS_TO_TICKS(lifetime * 1000UL);
+      pFree->replyLength = 0;
+      pFree->inUse = true;
+   }
+   else
+   {
+      COAP_STAT_INC(COAP_STAT_DEDUP_FULL);
+   }
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Stores the reply sent for a message so duplicates can be answered
+ *
+ * \param CoapDedupTable *pTable [in\out] - Table holding the exchange.
+ *
+ * \param U32 address [in] - Address of the sender.
+ *
+ * \param U16 port [in] - Port of the sender.
+ *
+ * \param U16 messageId [in] - Message id of the request.
+ *
+ * \param U8 *pReply [in] - ACK or response that was sent.
+ *
+ * \param U16 length [in] - Length of the reply.
+ *
+ *
+ * \return Returns COAP_OK on success, COAP_UNKNOWN_MESSAGE_ID if the exchange
+ *         was not recorded or COAP_INSUFFICIENT_BUFFER if the reply is too big.
+ *
+ ********************************************************************************/
+int8_t coapDedupStore(CoapDedupTable *pTable, uint32_t address, uint16_t port, uint16_t messageId, uint8_t *pReply, uint16_t length)
+{
+   CoapDedupEntry *pFree;    // Unused, required by coapDedupFind.
+   CoapDedupEntry *pEntry = coapDedupFind(pTable, address, port, messageId, &pFree);   // Used to store the exchange.
+
+   if( pEntry == NULL )
+   {
+      return COAP_UNKNOWN_MESSAGE_ID;
+   }
+
+   if( length > COAP_DEDUP_RESPONSE_SIZE )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   memcpy(pEntry->reply, pReply, length);
+   pEntry->replyLength = length;
+
+   return COAP_OK;
+}
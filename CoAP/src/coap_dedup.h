@@ -0,0 +1,52 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_DEDUP_H
+#define COAP_DEDUP_H
+
+#include "coap.h"
+
+/*Deduplication Related (RFC 7252 section 4.5)*/
+#ifndef COAP_DEDUP_ENTRIES
+#define COAP_DEDUP_ENTRIES          16    //exchanges remembered by a device table, a power of 2 up to 32768
+#endif
+#define COAP_DEDUP_RESPONSE_SIZE    128   //largest reply replayed, bigger ones are not kept
+#define COAP_EXCHANGE_LIFETIME      247   //seconds, RFC 7252 section 4.8.2
+#define COAP_NON_LIFETIME           145   //seconds, RFC 7252 section 4.8.2
+
+// Every entry stays live for its lifetime, so a table only deduplicates up
+// to entryCount / COAP_EXCHANGE_LIFETIME CON messages per second (about
+// 0.06/s with 16 entries).  Above that, messages are processed without being
+// recorded and counted in COAP_STAT_DEDUP_FULL; size the table for the peak
+// rate.
+#if (COAP_DEDUP_ENTRIES & (COAP_DEDUP_ENTRIES - 1)) != 0 || COAP_DEDUP_ENTRIES > 32768
+#error "COAP_DEDUP_ENTRIES must be a power of 2 up to 32768"
+#endif
+
+/// CoapDedupEntry struct
+typedef struct
+{
+   uint32_t address;                            ///< Endpoint address
+   uint16_t port;                               ///< Endpoint port
+   uint16_t messageId;                          ///< Message id of the exchange
+   TickType_t expiryTick;                       ///< Entry can be reused after this tick
+   uint16_t replyLength;                        ///< Length of reply, 0 until coapDedupStore
+   uint8_t reply[COAP_DEDUP_RESPONSE_SIZE];     ///< ACK or response sent for the message
+   bool inUse;                                  ///< Slot holds an exchange, expired ones are removed when probed
+} CoapDedupEntry;
+
+/// CoapDedupTable struct, the entries belong to the owner so each can size its table
+typedef struct
+{
+   CoapDedupEntry *pEntries;                    ///< Open addressed exchanges
+   uint16_t entryCount;                         ///< Number of pEntries, a power of 2 up to 32768
+} CoapDedupTable;
+
+int8_t coapDedupInit(CoapDedupTable *pTable, CoapDedupEntry *pEntries, uint16_t entryCount);
+int8_t coapDedupCheck(CoapDedupTable *pTable, uint32_t address, uint16_t port, CoapMessageView *pView, uint8_t **ppReply, uint16_t *pReplyLength);
+int8_t coapDedupStore(CoapDedupTable *pTable, uint32_t address, uint16_t port, uint16_t messageId, uint8_t *pReply, uint16_t length);
+
+//! @}
+#endif  /* COAP_DEDUP_H */
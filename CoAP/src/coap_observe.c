@@ -0,0 +1,401 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_observe.h"
+
+/*!*****************************************************************************
+ * \brief Finds the observation registered with a token
+ *
+ * \param CoapObserveTable *pTable [in] - Table to search.
+ *
+ * \param U8 *pToken [in] - Token bytes.
+ *
+ * \param U8 tokenLength [in] - Token length.
+ *
+ *
+ * \return Returns the observation or NULL.
+ *
+ ********************************************************************************/
+static CoapObservation *coapObserveFind(CoapObserveTable *pTable, uint8_t *pToken, uint8_t tokenLength)
+{
+   CoapObservation *pEntry;   // Used to check each entry.
+   uint8_t i;                 // Used as an iterator.
+
+   for( i = 0; i < COAP_MAX_OBSERVATIONS; i++ )
+   {
+      pEntry = &pTable->entries[i];
+
+      if( pEntry->inUse &&
+          (pEntry->request[0] & COAP_HDR_TKL_MASK) == tokenLength &&
+          memcmp(pEntry->request + COAP_HDR_BYTES, pToken, tokenLength) == 0 )
+      {
+         return pEntry;
+      }
+   }
+
+   return NULL;
+}
+
+/*!*****************************************************************************
+ * \brief Sends the registration of an observation with a new message id
+ *
+ * \param CoapObserveTable *pTable [in] - Table owning the observation.
+ *
+ * \param CoapObservation *pEntry [in\out] - Observation to (re-)register.
+ *
+ *
+ * \return Returns the send results.
+ *
+ ********************************************************************************/
+static int8_t coapObserveSend(CoapObserveTable *pTable, CoapObservation *pEntry)
+{
+   uint16_t messageId;   // Used to store the new message id.
+   int8_t results;       // Used to store the send results.
+
+   // A registration still waiting for its ACK is superseded by this one.
+   coapRetransmitCancel(&pTable->engine, (uint16_t)coapGetMessageId(pEntry->request, pEntry->requestLength));
+
+   // Same token, new message id (header bytes 3 and 4).
+   messageId = coapMessageIdNext(pTable->pMessageIds);
+   pEntry->request[2] = messageId >> 8;
+   pEntry->request[3] = messageId & 0xFF;
+
+   // Re-register if the registration itself goes unanswered.
+   pEntry->expiryTick = xTaskGetTickCount() + pdMS_TO_TICKS((COAP_OBSERVE_DEFAULT_MAX_AGE + COAP_OBSERVE_REREGISTER_MARGIN) * 1000UL);
+
+   results = pTable->send(pTable->pContext, pEntry->request, pEntry->requestLength);
+
+   if( results < 0 || coapGetType(pEntry->request, pEntry->requestLength) != COAP_TYPE_CON )
+   {
+      return results;
+   }
+
+   return coapRetransmitAdd(&pTable->engine, pEntry->request, pEntry->requestLength, pEntry);
+}
+
+/*!*****************************************************************************
+ * \brief Completes the exchange of a confirmable registration
+ *
+ * Description:
+ *  A Reset means the server refuses the observation, so the entry is removed.
+ *  On a timeout the entry is kept and registered again once it expires.  A
+ *  piggybacked response is handled by coapObserveHandleMessage after the
+ *  engine has matched the ACK.
+ *
+ * \param void *pUserData [in] - Observation of the registration.
+ *
+ * \param U16 messageId [in] - Message id of the registration.
+ *
+ * \param S8 result [in] - Result of the exchange.
+ *
+ * \param CoapMessageView *pResponse [in] - ACK view or NULL.
+ *
+ ********************************************************************************/
+static void coapObserveRetransmitComplete(void *pUserData, uint16_t messageId, int8_t result, CoapMessageView *pResponse)
+{
+   CoapObservation *pEntry = (CoapObservation *)pUserData;   // Observation of the exchange.
+
+   (void)messageId;
+   (void)pResponse;
+
+   if( result == COAP_MESSAGE_RESET )
+   {
+      pEntry->inUse = false;
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Initialises an observe table
+ *
+ * \param CoapObserveTable *pTable [out] - Table to initialise.
+ *
+ * \param CoapSendCallback send [in] - Used to send registrations.
+ *
+ * \param void *pContext [in] - Passed to send.
+ *
+ * \param CoapMessageIdGenerator *pMessageIds [in] - Generator of the socket send
+ *        writes to, e.g. coapTaskMessageIds(), or NULL if only the table sends
+ *        on it.  Registrations must not reuse a message id another sender on
+ *        the socket has in flight.
+ *
+ ********************************************************************************/
+void coapObserveInit(CoapObserveTable *pTable, CoapSendCallback send, void *pContext, CoapMessageIdGenerator *pMessageIds)
+{
+   memset(pTable, 0, sizeof(*pTable));
+
+   pTable->send = send;
+   pTable->pContext = pContext;
+   pTable->pMessageIds = pMessageIds;
+   pTable->lastTick = xTaskGetTickCount();
+
+   if( pMessageIds == NULL )
+   {
+      coapMessageIdInit(&pTable->messageIds);
+      pTable->pMessageIds = &pTable->messageIds;
+   }
+
+   coapRetransmitInit(&pTable->engine, send, coapObserveRetransmitComplete, pContext);
+}
+
+/*!*****************************************************************************
+ * \brief Registers interest in a resource
+ *
+ * Description:
+ *  pRequest is a GET carrying an Observe option of 0 and a token that is unique
+ *  among the observations.  It is copied into the table and sent; the copy is
+ *  re-sent (with a fresh message id, same token) whenever the freshest
+ *  notification outlives its Max-Age, so the client never has to poll.
+ *  A confirmable registration is retransmitted by the table's own engine until
+ *  an ACK or RST reaches coapObserveHandleMessage; if it cannot be sent at all
+ *  the entry is removed again so the token can be retried.
+ *  The send callback is called from here and from coapObservePoll; with coapTask
+ *  both run from its poll hook so the socket keeps a single owner.
+ *
+ * Registration:
+ *          https://tools.ietf.org/html/rfc7641#section-3.1
+ *
+ * \param CoapObserveTable *pTable [in\out] - Table to add the observation to.
+ *
+ * \param U8 *pRequest [in] - Registration request.
+ *
+ * \param U16 length [in] - Length of the request.
+ *
+ * \param CoapObserveHandler handler [in] - Receives every fresh notification.
+ *
+ * \param void *pUserData [in] - Passed to handler.
+ *
+ *
+ * \return Returns COAP_OK on success, COAP_TOKEN_IN_USE if the token is
+ *         already observed or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapObserveRegister(CoapObserveTable *pTable, uint8_t *pRequest, uint16_t length, CoapObserveHandler handler, void *pUserData)
+{
+   CoapObservation *pEntry;   // Used to store the new entry.
+   CoapMessageView view;      // Used to check the request.
+   int8_t results;            // Used to store the send results.
+   uint8_t i;                 // Used as an iterator.
+
+   if( length > COAP_OBSERVE_REQUEST_SIZE )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   if( coapParseMessage(pRequest, length, &view) < 0 || view.code != COAP_GET ||
+       coapViewFindOption(&view, COAP_OPTION_OBSERVE, 0) < 0 )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
+   if( coapObserveFind(pTable, view.pToken, view.tokenLength) != NULL )
+   {
+      return COAP_TOKEN_IN_USE;
+   }
+
+   for( i = 0; i < COAP_MAX_OBSERVATIONS; i++ )
+   {
+      pEntry = &pTable->entries[i];
+
+      if( !pEntry->inUse )
+      {
+         memcpy(pEntry->request, pRequest, length);
+         pEntry->requestLength = length;
+         pEntry->hasSequence = false;
+         pEntry->handler = handler;
+         pEntry->pUserData = pUserData;
+         pEntry->inUse = true;
+
+         results = coapObserveSend(pTable, pEntry);
+
+         if( results < 0 )
+         {
+            coapRetransmitCancel(&pTable->engine, (uint16_t)coapGetMessageId(pEntry->request, pEntry->requestLength));
+            pEntry->inUse = false;
+         }
+
+         return results;
+      }
+   }
+
+   return COAP_NO_RESOURCES;
+}
+
+/*!*****************************************************************************
+ * \brief Forgets an observation
+ *
+ * Description:
+ *  After cancelling, the next notification for the token is unknown and should
+ *  be answered with a Reset so the server removes the observer.
+ *
+ * \param CoapObserveTable *pTable [in\out] - Table holding the observation.
+ *
+ * \param U8 *pToken [in] - Token bytes of the registration.
+ *
+ * \param U8 tokenLength [in] - Token length.
+ *
+ *
+ * \return Returns COAP_OK on success or COAP_UNKNOWN_TOKEN.
+ *
+ ********************************************************************************/
+int8_t coapObserveCancel(CoapObserveTable *pTable, uint8_t *pToken, uint8_t tokenLength)
+{
+   CoapObservation *pEntry = coapObserveFind(pTable, pToken, tokenLength);
+
+   if( pEntry == NULL )
+   {
+      return COAP_UNKNOWN_TOKEN;
+   }
+
+   coapRetransmitCancel(&pTable->engine, (uint16_t)coapGetMessageId(pEntry->request, pEntry->requestLength));
+   pEntry->inUse = false;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Handles a response or notification for an observation
+ *
+ * Description:
+ *  Matches the message to an observation by token.  Notifications that are not
+ *  fresher than the last one delivered (RFC 7641 section 3.4 ordering over the 24
+ *  bit sequence, or more than 128 seconds later) are dropped, so a reordered
+ *  notification never overwrites newer state.  A fresh notification refreshes
+ *  the re-registration deadline from its Max-Age.  A response without an Observe
+ *  option means the server ended the observation; it is delivered and the entry
+ *  is removed.
+ *
+ * Notifications:
+ *          https://tools.ietf.org/html/rfc7641#section-3.4
+ *
+ * \param CoapObserveTable *pTable [in\out] - Table holding the observation.
+ *
+ * \param CoapMessageView *pView [in] - Parsed response or notification.
+ *
+ *
+ * \return Returns COAP_OK if the message belongs to an observation (fresh or
+ *         not), COAP_UNKNOWN_TOKEN otherwise.
+ *
+ ********************************************************************************/
+int8_t coapObserveHandleMessage(CoapObserveTable *pTable, CoapMessageView *pView)
+{
+   CoapObservation *pEntry;   // Used to store the matching observation.
+   TickType_t now;            // Used to store the current tick.
+   uint32_t sequence;         // Used to store the Observe value.
+   uint32_t maxAge;           // Used to store the Max-Age value.
+   int8_t index;              // Used to store option indexes.
+   bool fresh;                // Used to store the freshness decision.
+
+   if( pView->type == COAP_TYPE_ACK || pView->type == COAP_TYPE_RST )
+   {
+      // Ends the retransmission of a registration, an empty one carries no token.
+      if( coapRetransmitHandleMessage(&pTable->engine, pView) == COAP_OK && pView->code == COAP_EMPTY )
+      {
+         return COAP_OK;
+      }
+
+      if( pView->code == COAP_EMPTY )
+      {
+         return COAP_UNKNOWN_TOKEN;
+      }
+   }
+
+   pEntry = coapObserveFind(pTable, pView->pToken, pView->tokenLength);
+
+   if( pEntry == NULL )
+   {
+      return COAP_UNKNOWN_TOKEN;
+   }
+
+   index = coapViewFindOption(pView, COAP_OPTION_OBSERVE, 0);
+
+   if( index < 0 )
+   {
+      // The server does not (or no longer) keep us as an observer.
+      pEntry->inUse = false;
+      pEntry->handler(pEntry->pUserData, pView);
+      return COAP_OK;
+   }
+
+   now = xTaskGetTickCount();
+   sequence = coapDecodeOptionUint(pView->options[index].pData, pView->options[index].length) & 0xFFFFFF;
+
+   if( !pEntry->hasSequence )
+   {
+      fresh = true;
+   }
+   else
+   {
+      fresh = (pEntry->sequence < sequence && (sequence - pEntry->sequence) < COAP_OBSERVE_SEQUENCE_HALF) ||
+              (pEntry->sequence > sequence && (pEntry->sequence - sequence) > COAP_OBSERVE_SEQUENCE_HALF) ||
+              ((now - pEntry->notifyTick) > pdMS_TO_TICKS(COAP_OBSERVE_FRESHNESS_S * 1000UL));
+   }
+
+   if( !fresh )
+   {
+      return COAP_OK;
+   }
+
+   pEntry->sequence = sequence;
+   pEntry->notifyTick = now;
+   pEntry->hasSequence = true;
+
+   index = coapViewFindOption(pView, COAP_OPTION_MAXAGE, 0);
+
+   if( index >= 0 )
+   {
+      maxAge = coapDecodeOptionUint(pView->options[index].pData, pView->options[index].length);
+   }
+   else
+   {
+      maxAge = COAP_OBSERVE_DEFAULT_MAX_AGE;
+   }
+
+   // Clamped before the margin is added, so neither can overflow the tick count.
+   pEntry->expiryTick = now + coapMaxAgeTicks(maxAge) + pdMS_TO_TICKS(COAP_OBSERVE_REREGISTER_MARGIN * 1000UL);
+
+   pEntry->handler(pEntry->pUserData, pView);
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Re-registers observations whose notifications went stale
+ *
+ * Description:
+ *  Call periodically (e.g. once a second).  Any observation whose freshest
+ *  notification is older than its Max-Age is registered again with the same
+ *  token, as per RFC 7641 section 3.3.1.  Also advances the retransmission of
+ *  unacknowledged registrations by the COAP_RETRANS_TICK_MS steps elapsed, so
+ *  their timing is only as fine as the call period.
+ *
+ * \param CoapObserveTable *pTable [in\out] - Table to check.
+ *
+ ********************************************************************************/
+void coapObservePoll(CoapObserveTable *pTable)
+{
+   TickType_t now = xTaskGetTickCount();   // Used to store the current tick.
+   uint8_t i;                              // Used as an iterator.
+
+   if( pTable->engine.pendingCount == 0 )
+   {
+      // Nothing was outstanding, don't replay idle time into the wheel.
+      pTable->lastTick = now;
+   }
+
+   while( (now - pTable->lastTick) >= pdMS_TO_TICKS(COAP_RETRANS_TICK_MS) )
+   {
+      coapRetransmitTick(&pTable->engine);
+      pTable->lastTick += pdMS_TO_TICKS(COAP_RETRANS_TICK_MS);
+   }
+
+   for( i = 0; i < COAP_MAX_OBSERVATIONS; i++ )
+   {
+      if( pTable->entries[i].inUse && (int32_t)(now - pTable->entries[i].expiryTick) >= 0 )
+      {
+         coapObserveSend(pTable, &pTable->entries[i]);
+      }
+   }
+}
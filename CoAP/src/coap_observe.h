@@ -0,0 +1,57 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_OBSERVE_H
+#define COAP_OBSERVE_H
+
+#include "coap.h"
+#include "coap_retransmit.h"
+#include "coap_random.h"
+
+/*Observe Related (RFC 7641)*/
+#define COAP_MAX_OBSERVATIONS          4      //resources observed at once
+#define COAP_OBSERVE_REQUEST_SIZE      128    //registration request kept for re-registering
+#define COAP_OBSERVE_SEQUENCE_HALF     (1UL << 23)
+#define COAP_OBSERVE_FRESHNESS_S       128    //notifications this much newer always win
+#define COAP_OBSERVE_DEFAULT_MAX_AGE   60     //seconds, when a notification has no Max-Age
+#define COAP_OBSERVE_REREGISTER_MARGIN 2      //seconds past Max-Age before re-registering
+
+/// Receives a fresh notification (or the final response if the server ended the observation).
+typedef void (*CoapObserveHandler)(void *pUserData, CoapMessageView *pView);
+
+/// CoapObservation struct
+typedef struct
+{
+   uint8_t request[COAP_OBSERVE_REQUEST_SIZE];  ///< Registration GET, token included
+   uint16_t requestLength;                      ///< Length of the registration
+   uint32_t sequence;                           ///< Observe value of the freshest notification
+   TickType_t notifyTick;                       ///< Tick of the freshest notification
+   TickType_t expiryTick;                       ///< Re-register once this passes
+   bool hasSequence;                            ///< A notification has been received
+   bool inUse;                                  ///< Entry holds an observation
+   CoapObserveHandler handler;                  ///< Receives notifications
+   void *pUserData;                             ///< Passed to handler
+} CoapObservation;
+
+/// CoapObserveTable struct
+typedef struct
+{
+   CoapObservation entries[COAP_MAX_OBSERVATIONS];  ///< Active observations
+   CoapSendCallback send;                           ///< Used to (re-)register
+   CoapMessageIdGenerator *pMessageIds;             ///< Generator of the socket, shared with its other senders
+   CoapMessageIdGenerator messageIds;               ///< Used as pMessageIds if the table owns its socket
+   void *pContext;                                  ///< Passed to send
+   CoapRetransmitEngine engine;                     ///< Retransmits registrations until acknowledged
+   TickType_t lastTick;                             ///< Last retransmission tick processed by coapObservePoll
+} CoapObserveTable;
+
+void coapObserveInit(CoapObserveTable *pTable, CoapSendCallback send, void *pContext, CoapMessageIdGenerator *pMessageIds);
+int8_t coapObserveRegister(CoapObserveTable *pTable, uint8_t *pRequest, uint16_t length, CoapObserveHandler handler, void *pUserData);
+int8_t coapObserveCancel(CoapObserveTable *pTable, uint8_t *pToken, uint8_t tokenLength);
+int8_t coapObserveHandleMessage(CoapObserveTable *pTable, CoapMessageView *pView);
+void coapObservePoll(CoapObserveTable *pTable);
+
+//! @}
+#endif  /* COAP_OBSERVE_H */
@@ -0,0 +1,253 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_pool.h"
+
+// Block storage.  Free blocks hold the free list link in their first bytes.
+static uint32_t coapPoolSmall[(COAP_POOL_SMALL_COUNT * COAP_POOL_SMALL_SIZE) / sizeof(uint32_t)];
+static uint32_t coapPoolMedium[(COAP_POOL_MEDIUM_COUNT * COAP_POOL_MEDIUM_SIZE) / sizeof(uint32_t)];
+static uint32_t coapPoolLarge[(COAP_POOL_LARGE_COUNT * ((COAP_POOL_LARGE_SIZE + 3) & ~3)) / sizeof(uint32_t)];
+
+// Size classes, smallest first.
+static CoapPoolClass coapPoolClasses[COAP_POOL_CLASS_COUNT] =
+{
+   { (uint8_t *)coapPoolSmall, NULL, COAP_POOL_SMALL_SIZE, COAP_POOL_SMALL_COUNT, 0 },
+   { (uint8_t *)coapPoolMedium, NULL, COAP_POOL_MEDIUM_SIZE, COAP_POOL_MEDIUM_COUNT, 0 },
+   { (uint8_t *)coapPoolLarge, NULL, (COAP_POOL_LARGE_SIZE + 3) & ~3, COAP_POOL_LARGE_COUNT, 0 }
+};
+
+/*!*****************************************************************************
+ * \brief Finds the size class owning a buffer
+ *
+ * \param U8 *pBuffer [in] - Buffer returned by coapPoolAlloc.
+ *
+ *
+ * \return Returns the class or NULL if pBuffer is not a pool block.
+ *
+ ********************************************************************************/
+static CoapPoolClass *coapPoolFindClass(uint8_t *pBuffer)
+{
+   CoapPoolClass *pClass;   // Used to check each class.
+   uint8_t i;               // Used as an iterator.
+
+   for( i = 0; i < COAP_POOL_CLASS_COUNT; i++ )
+   {
+      pClass = &coapPoolClasses[i];
+
+      if( pBuffer >= pClass->pStorage &&
+          pBuffer < pClass->pStorage + (uint32_t)pClass->blockSize * pClass->blockCount &&
+          ((uint32_t)(pBuffer - pClass->pStorage) % pClass->blockSize) == 0 )
+      {
+         return pClass;
+      }
+   }
+
+   return NULL;
+}
+
+/*!*****************************************************************************
+ * \brief Pops a block, caller holds the critical section
+ *
+ * \param U16 size [in] - Bytes needed.
+ *
+ *
+ * \return Returns a block or NULL if none is free.
+ *
+ ********************************************************************************/
+static uint8_t *coapPoolPop(uint16_t size)
+{
+   CoapPoolClass *pClass;   // Used to check each class.
+   uint8_t *pBlock;         // Used to store the popped block.
+   uint8_t i;               // Used as an iterator.
+
+   // Take the smallest class that fits, falling back to bigger ones.
+   for( i = 0; i < COAP_POOL_CLASS_COUNT; i++ )
+   {
+      pClass = &coapPoolClasses[i];
+
+      if( pClass->blockSize >= size && pClass->pFree != NULL )
+      {
+         pBlock = pClass->pFree;
+         memcpy(&pClass->pFree, pBlock, sizeof(uint8_t *));
+         pClass->freeCount--;
+
+         return pBlock;
+      }
+   }
+
+   return NULL;
+}
+
+/*!*****************************************************************************
+ * \brief Pushes a block back, caller holds the critical section
+ *
+ * \param U8 *pBuffer [in] - Block to release.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+static int8_t coapPoolPush(uint8_t *pBuffer)
+{
+   CoapPoolClass *pClass = coapPoolFindClass(pBuffer);   // Class owning the block.
+
+   if( pClass == NULL )
+   {
+      return COAP_INVALID_BUFFER_LENGTH;
+   }
+
+   memcpy(pBuffer, &pClass->pFree, sizeof(uint8_t *));
+   pClass->pFree = pBuffer;
+   pClass->freeCount++;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Initialises the message buffer pool
+ *
+ * Description:
+ *  Links every block of every size class into its free list.  Must be called
+ *  once before the first allocation.  The number of blocks per class is set at
+ *  compile time with COAP_POOL_SMALL_COUNT, COAP_POOL_MEDIUM_COUNT and
+ *  COAP_POOL_LARGE_COUNT (each at least 1).
+ *
+ ********************************************************************************/
+void coapPoolInit(void)
+{
+   CoapPoolClass *pClass;   // Used to initialise each class.
+   uint8_t *pBlock;         // Used to link each block.
+   uint16_t j;              // Used as an iterator.
+   uint8_t i;               // Used as an iterator.
+
+   for( i = 0; i < COAP_POOL_CLASS_COUNT; i++ )
+   {
+      pClass = &coapPoolClasses[i];
+      pClass->pFree = NULL;
+
+      // Link back to front so the first block is handed out first.
+      for( j = pClass->blockCount; j > 0; j-- )
+      {
+         pBlock = pClass->pStorage + (uint32_t)(j - 1) * pClass->blockSize;
+         memcpy(pBlock, &pClass->pFree, sizeof(uint8_t *));
+         pClass->pFree = pBlock;
+      }
+
+      pClass->freeCount = pClass->blockCount;
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Allocates a message buffer
+ *
+ * Description:
+ *  Returns a block from the smallest size class that can hold size bytes, or
+ *  from a bigger class if that one is exhausted.  O(1), uses a short critical
+ *  section.  Must not be called from an interrupt, see coapPoolAllocFromISR.
+ *
+ * \param U16 size [in] - Bytes needed.
+ *
+ *
+ * \return Returns the buffer or NULL if none is free.
+ *
+ ********************************************************************************/
+uint8_t *coapPoolAlloc(uint16_t size)
+{
+   uint8_t *pBlock;   // Used to store the allocated block.
+
+   taskENTER_CRITICAL();
+   pBlock = coapPoolPop(size);
+   taskEXIT_CRITICAL();
+
+   return pBlock;
+}
+
+/*!*****************************************************************************
+ * \brief Allocates a message buffer from an interrupt
+ *
+ * \param U16 size [in] - Bytes needed.
+ *
+ *
+ * \return Returns the buffer or NULL if none is free.
+ *
+ ********************************************************************************/
+uint8_t *coapPoolAllocFromISR(uint16_t size)
+{
+   UBaseType_t savedInterruptStatus;   // Used to restore the interrupt mask.
+   uint8_t *pBlock;                    // Used to store the allocated block.
+
+   savedInterruptStatus = taskENTER_CRITICAL_FROM_ISR();
+   pBlock = coapPoolPop(size);
+   taskEXIT_CRITICAL_FROM_ISR(savedInterruptStatus);
+
+   return pBlock;
+}
+
+/*!*****************************************************************************
+ * \brief Releases a message buffer
+ *
+ * Description:
+ *  Returns a buffer from coapPoolAlloc to its size class.  The class is found
+ *  from the address, so only the pointer has to travel with the message.
+ *
+ * \param U8 *pBuffer [in] - Buffer to release.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 if pBuffer is not a pool block.
+ *
+ ********************************************************************************/
+int8_t coapPoolFree(uint8_t *pBuffer)
+{
+   int8_t results;   // Used to store the release results.
+
+   taskENTER_CRITICAL();
+   results = coapPoolPush(pBuffer);
+   taskEXIT_CRITICAL();
+
+   return results;
+}
+
+/*!*****************************************************************************
+ * \brief Releases a message buffer from an interrupt
+ *
+ * \param U8 *pBuffer [in] - Buffer to release.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 if pBuffer is not a pool block.
+ *
+ ********************************************************************************/
+int8_t coapPoolFreeFromISR(uint8_t *pBuffer)
+{
+   UBaseType_t savedInterruptStatus;   // Used to restore the interrupt mask.
+   int8_t results;                     // Used to store the release results.
+
+   savedInterruptStatus = taskENTER_CRITICAL_FROM_ISR();
+   results = coapPoolPush(pBuffer);
+   taskEXIT_CRITICAL_FROM_ISR(savedInterruptStatus);
+
+   return results;
+}
+
+/*!*****************************************************************************
+ * \brief Gets the usable size of a pool buffer
+ *
+ * \param U8 *pBuffer [in] - Buffer returned by coapPoolAlloc.
+ *
+ *
+ * \return Returns the block size or 0 if pBuffer is not a pool block.
+ *
+ ********************************************************************************/
+uint16_t coapPoolBlockSize(uint8_t *pBuffer)
+{
+   CoapPoolClass *pClass = coapPoolFindClass(pBuffer);   // Class owning the block.
+
+   if( pClass == NULL )
+   {
+      return 0;
+   }
+
+   return pClass->blockSize;
+}
@@ -0,0 +1,47 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_POOL_H
+#define COAP_POOL_H
+
+#include "coap.h"
+
+/*Message Buffer Pool Related*/
+#define COAP_POOL_SMALL_SIZE        64                 //most uplinks fit in here
+#define COAP_POOL_MEDIUM_SIZE       256
+#define COAP_POOL_LARGE_SIZE        MAX_BUFFER_SIZE
+
+// Number of buffers in each size class, override on the command line to resize.
+#ifndef COAP_POOL_SMALL_COUNT
+#define COAP_POOL_SMALL_COUNT       32
+#endif
+#ifndef COAP_POOL_MEDIUM_COUNT
+#define COAP_POOL_MEDIUM_COUNT      8
+#endif
+#ifndef COAP_POOL_LARGE_COUNT
+#define COAP_POOL_LARGE_COUNT       2
+#endif
+
+#define COAP_POOL_CLASS_COUNT       3
+
+/// CoapPoolClass struct
+typedef struct
+{
+   uint8_t *pStorage;                   ///< First block of the class
+   uint8_t *pFree;                      ///< Head of the free blocks, linked through the blocks
+   uint16_t blockSize;                  ///< Size of each block
+   uint16_t blockCount;                 ///< Number of blocks
+   uint16_t freeCount;                  ///< Number of free blocks
+} CoapPoolClass;
+
+void coapPoolInit(void);
+uint8_t *coapPoolAlloc(uint16_t size);
+uint8_t *coapPoolAllocFromISR(uint16_t size);
+int8_t coapPoolFree(uint8_t *pBuffer);
+int8_t coapPoolFreeFromISR(uint8_t *pBuffer);
+uint16_t coapPoolBlockSize(uint8_t *pBuffer);
+
+//! @}
+#endif  /* COAP_POOL_H */
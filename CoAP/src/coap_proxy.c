@@ -0,0 +1,996 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_proxy.h"
+
+/*!*****************************************************************************
+ * \brief Rewrites a response for a client in its own buffer
+ *
+ * Description:
+ *  Only the header and token change: the type becomes ACK with the client's
+ *  message id for a CON request, NON with a new message id otherwise, and the
+ *  token is swapped for the client's.  The options and payload are moved, not
+ *  re-encoded, so the same buffer can be rewritten again for the next client.
+ *
+ * \param CoapProxy *pProxy [in\out] - Proxy sending the response.
+ *
+ * \param CoapProxyClient *pClient [in] - Client to answer.
+ *
+ * \param U8 *pBuffer [in\out] - Validated response.
+ *
+ * \param U16 length [in] - Length of the response.
+ *
+ * \param U16 bufferSize [in] - Size of pBuffer.
+ *
+ *
+ * \return Returns the new length or 0 if the client token does not fit.
+ *
+ ********************************************************************************/
+static uint16_t coapProxyRewrite(CoapProxy *pProxy, CoapProxyClient *pClient, uint8_t *pBuffer, uint16_t length, uint16_t bufferSize)
+{
+   uint8_t tokenLength = pBuffer[0] & COAP_HDR_TKL_MASK;                 // Used to store the current token length.
+   uint16_t rest = length - COAP_HDR_BYTES - tokenLength;               // Used to store the options and payload length.
+   uint16_t messageId = pClient->messageId;                             // Used to store the new message id.
+   uint8_t type = COAP_TYPE_ACK;                                        // Used to store the new type.
+
+   if( COAP_HDR_BYTES + pClient->tokenLength + rest > bufferSize )
+   {
+      return 0;
+   }
+
+   if( pClient->type != COAP_TYPE_CON )
+   {
+      type = COAP_TYPE_NON;
+      messageId = coapMessageIdNext(&pProxy->messageIds);
+   }
+
+   memmove(pBuffer + COAP_HDR_BYTES + pClient->tokenLength, pBuffer + COAP_HDR_BYTES + tokenLength, rest);
+   memcpy(pBuffer + COAP_HDR_BYTES, pClient->token, pClient->tokenLength);
+
+   pBuffer[0] = (pBuffer[0] & COAP_HDR_VER_MASK) | (type << 4) | pClient->tokenLength;
+   pBuffer[2] = messageId >> 8;
+   pBuffer[3] = messageId & 0xFF;
+
+   return COAP_HDR_BYTES + pClient->tokenLength + rest;
+}
+
+/*!*****************************************************************************
+ * \brief Sends a response to a client
+ *
+ * Description:
+ *  The reply to a CON request is kept in the deduplication table, so a
+ *  retransmission that crosses the response is answered again.
+ *
+ * \param CoapProxy *pProxy [in\out] - Proxy sending the response.
+ *
+ * \param CoapProxyClient *pClient [in] - Client to answer.
+ *
+ * \param U8 *pBuffer [in\out] - Validated response, rewritten for the client.
+ *
+ * \param U16 length [in] - Length of the response.
+ *
+ * \param U16 bufferSize [in] - Size of pBuffer.
+ *
+ *
+ * \return Returns the length of the message now in pBuffer.
+ *
+ ********************************************************************************/
+static uint16_t coapProxyAnswer(CoapProxy *pProxy, CoapProxyClient *pClient, uint8_t *pBuffer, uint16_t length, uint16_t bufferSize)
+{
+   uint16_t newLength = coapProxyRewrite(pProxy, pClient, pBuffer, length, bufferSize);   // Used to store the rewritten length.
+
+   if( newLength == 0 )
+   {
+      return length;
+   }
+
+   length = newLength;
+
+   pProxy->send(pProxy->pContext, pClient->address, pClient->port, pBuffer, length);
+
+   if( pClient->type == COAP_TYPE_CON )
+   {
+      coapDedupStore(&pProxy->dedup, pClient->address, pClient->port, pClient->messageId, pBuffer, length);
+   }
+
+   return length;
+}
+
+/*!*****************************************************************************
+ * \brief Sends a header-only response to a client
+ *
+ * \param CoapProxy *pProxy [in\out] - Proxy sending the response.
+ *
+ * \param CoapProxyClient *pClient [in] - Client to answer.
+ *
+ * \param CoapCode code [in] - Response code, e.g. COAP_GATEWAY_TIMEOUT.
+ *
+ ********************************************************************************/
+static void coapProxyAnswerCode(CoapProxy *pProxy, CoapProxyClient *pClient, CoapCode code)
+{
+   pProxy->reply[0] = COAP_VERSION << 6;
+   pProxy->reply[1] = code;
+
+   coapProxyAnswer(pProxy, pClient, pProxy->reply, COAP_HDR_BYTES, sizeof(pProxy->reply));
+}
+
+/*!*****************************************************************************
+ * \brief Sends an empty ACK or RST to an origin
+ *
+ * \param CoapProxyOrigin *pOrigin [in] - Origin of the message.
+ *
+ * \param U8 type [in] - COAP_TYPE_ACK or COAP_TYPE_RST.
+ *
+ * \param U16 messageId [in] - Message id being answered.
+ *
+ ********************************************************************************/
+static void coapProxySendEmpty(CoapProxyOrigin *pOrigin, uint8_t type, uint16_t messageId)
+{
+   uint8_t message[COAP_HDR_BYTES];   // Used to store the empty message.
+
+   message[0] = (COAP_VERSION << 6) | (type << 4);
+   message[1] = COAP_EMPTY;
+   message[2] = messageId >> 8;
+   message[3] = messageId & 0xFF;
+
+   pOrigin->transport.send(pOrigin->transport.pContext, message, COAP_HDR_BYTES);
+}
+
+/*!*****************************************************************************
+ * \brief Finds or opens the pooled socket of an origin
+ *
+ * Description:
+ *  Open origins are shared by every client.  When the pool is full the least
+ *  recently used origin without pending exchanges is closed; its cached
+ *  responses go with it.
+ *
+ * \param CoapProxy *pProxy [in\out] - Proxy owning the pool.
+ *
+ * \param U8 *pHost [in] - Uri-Host of the origin.
+ *
+ * \param U16 hostLength [in] - Length of pHost.
+ *
+ * \param U16 port [in] - Port of the origin.
+ *
+ *
+ * \return Returns the origin index, COAP_NO_RESOURCES if every origin is busy,
+ *         COAP_INSUFFICIENT_BUFFER if the host is too long or the connect
+ *         callback's error.
+ *
+ ********************************************************************************/
+static int16_t coapProxyOpenOrigin(CoapProxy *pProxy, const uint8_t *pHost, uint16_t hostLength, uint16_t port)
+{
+   CoapProxyOrigin *pOrigin;                 // Used to check each origin.
+   CoapProxyOrigin *pFree = NULL;            // Used to store the origin to open.
+   TickType_t now = xTaskGetTickCount();     // Used to mark the origin used.
+   int8_t results;                           // Used to store the connect results.
+   uint8_t i;                                // Used as an iterator.
+
+   if( hostLength > COAP_PROXY_HOST_SIZE )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   for( i = 0; i < COAP_PROXY_MAX_ORIGINS; i++ )
+   {
+      pOrigin = &pProxy->origins[i];
+
+      if( !pOrigin->open )
+      {
+         if( pFree == NULL || pFree->open )
+         {
+            pFree = pOrigin;
+         }
+         continue;
+      }
+
+      if( pOrigin->port == port && pOrigin->hostLength == hostLength && memcmp(pOrigin->host, pHost, hostLength) == 0 )
+      {
+         pOrigin->usedTick = now;
+         return i;
+      }
+
+      if( pOrigin->pending == 0 && (pFree == NULL || (pFree->open && (int32_t)(pOrigin->usedTick - pFree->usedTick) < 0)) )
+      {
+         pFree = pOrigin;
+      }
+   }
+
+   if( pFree == NULL )
+   {
+      return COAP_NO_RESOURCES;
+   }
+
+   if( pFree->open )
+   {
+      pProxy->close(pProxy->pContext, &pFree->transport);
+      pFree->open = false;
+   }
+
+   results = pProxy->connect(pProxy->pContext, pHost, (uint8_t)hostLength, port, &pFree->transport);
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   memcpy(pFree->host, pHost, hostLength);
+   pFree->hostLength = (uint8_t)hostLength;
+   pFree->port = port;
+   pFree->usedTick = now;
+   pFree->pending = 0;
+   pFree->open = true;
+   coapMessageIdInit(&pFree->messageIds);
+   coapCacheInit(&pFree->cache);
+
+   return pFree - pProxy->origins;
+}
+
+/*!*****************************************************************************
+ * \brief Finds the exchange of a client request
+ *
+ * \param CoapProxy *pProxy [in] - Proxy to search.
+ *
+ * \param U32 address [in] - Client address.
+ *
+ * \param U16 port [in] - Client port.
+ *
+ * \param U16 messageId [in] - Message id of the client request.
+ *
+ *
+ * \return Returns the exchange or NULL.
+ *
+ ********************************************************************************/
+static CoapProxyExchange *coapProxyFindClient(CoapProxy *pProxy, uint32_t address, uint16_t port, uint16_t messageId)
+{
+   CoapProxyExchange *pExchange;   // Used to check each exchange.
+   CoapProxyClient *pClient;       // Used to check each client.
+   uint8_t i;                      // Used as an iterator.
+   uint8_t j;                      // Used as an iterator.
+
+   for( i = 0; i < COAP_PROXY_MAX_EXCHANGES; i++ )
+   {
+      pExchange = &pProxy->exchanges[i];
+
+      for( j = 0; pExchange->inUse && j < pExchange->clientCount; j++ )
+      {
+         pClient = &pExchange->clients[j];
+
+         if( pClient->address == address && pClient->port == port && pClient->messageId == messageId )
+         {
+            return pExchange;
+         }
+      }
+   }
+
+   return NULL;
+}
+
+/*!*****************************************************************************
+ * \brief Finds the exchange an upstream message belongs to
+ *
+ * Description:
+ *  Upstream tokens start with the exchange index, so a response is matched
+ *  with one comparison.  Without a matching token (empty ACK and RST) the
+ *  message id is searched for.
+ *
+ * \param CoapProxy *pProxy [in] - Proxy to search.
+ *
+ * \param U8 origin [in] - Origin the message came from.
+ *
+ * \param CoapMessageView *pView [in] - Parsed upstream message.
+ *
+ *
+ * \return Returns the exchange or NULL.
+ *
+ ********************************************************************************/
+static CoapProxyExchange *coapProxyFindUpstream(CoapProxy *pProxy, uint8_t origin, CoapMessageView *pView)
+{
+   CoapProxyExchange *pExchange;   // Used to check each exchange.
+   uint8_t i;                      // Used as an iterator.
+
+   if( pView->code != COAP_EMPTY )
+   {
+      if( pView->tokenLength != COAP_PROXY_TOKEN_LENGTH || pView->pToken[0] >= COAP_PROXY_MAX_EXCHANGES )
+      {
+         return NULL;
+      }
+
+      pExchange = &pProxy->exchanges[pView->pToken[0]];
+
+      if( !pExchange->inUse || pExchange->origin != origin ||
+          memcmp(pExchange->pRequest + COAP_HDR_BYTES, pView->pToken, COAP_PROXY_TOKEN_LENGTH) != 0 )
+      {
+         return NULL;
+      }
+
+      return pExchange;
+   }
+
+   for( i = 0; i < COAP_PROXY_MAX_EXCHANGES; i++ )
+   {
+      pExchange = &pProxy->exchanges[i];
+
+      if( pExchange->inUse && pExchange->origin == origin &&
+          ((pExchange->pRequest[2] << 8) | pExchange->pRequest[3]) == pView->messageId )
+      {
+         return pExchange;
+      }
+   }
+
+   return NULL;
+}
+
+/*!*****************************************************************************
+ * \brief Finds a pending GET an identical request can join
+ *
+ * Description:
+ *  Two GETs are identical when their options and payload match byte for byte,
+ *  Uri-Host included, so the comparison needs no decoding.
+ *
+ * \param CoapProxy *pProxy [in] - Proxy to search.
+ *
+ * \param U8 origin [in] - Origin of the request.
+ *
+ * \param U8 *pOptions [in] - Options of the request, after the token.
+ *
+ * \param U16 length [in] - Length of the options and payload.
+ *
+ *
+ * \return Returns the exchange or NULL.
+ *
+ ********************************************************************************/
+static CoapProxyExchange *coapProxyFindCoalesce(CoapProxy *pProxy, uint8_t origin, uint8_t *pOptions, uint16_t length)
+{
+   CoapProxyExchange *pExchange;   // Used to check each exchange.
+   uint8_t i;                      // Used as an iterator.
+
+   for( i = 0; i < COAP_PROXY_MAX_EXCHANGES; i++ )
+   {
+      pExchange = &pProxy->exchanges[i];
+
+      if( pExchange->inUse && pExchange->coalesce && pExchange->origin == origin &&
+          pExchange->clientCount < COAP_PROXY_MAX_CLIENTS &&
+          pExchange->requestLength - COAP_HDR_BYTES - COAP_PROXY_TOKEN_LENGTH == length &&
+          memcmp(pExchange->pRequest + COAP_HDR_BYTES + COAP_PROXY_TOKEN_LENGTH, pOptions, length) == 0 )
+      {
+         return pExchange;
+      }
+   }
+
+   return NULL;
+}
+
+/*!*****************************************************************************
+ * \brief Re-encodes a request that needs an option added or removed
+ *
+ * Description:
+ *  Only taken for requests carrying Proxy-Scheme, which the origin must not
+ *  see, and for the revalidation of a stale cache entry, which adds its ETag.
+ *  Everything else is forwarded by coapProxyForward without re-encoding.
+ *
+ * \param CoapProxy *pProxy [in\out] - Proxy forwarding the request.
+ *
+ * \param CoapProxyExchange *pExchange [in\out] - Exchange, pRequest is written.
+ *
+ * \param CoapMessageView *pView [in] - Parsed client request.
+ *
+ * \param U8 *pToken [in] - Upstream token.
+ *
+ * \param U16 messageId [in] - Upstream message id.
+ *
+ * \param U16 bufferSize [in] - Size of pRequest.
+ *
+ * \param bool revalidate [in] - Add the ETag of the stale cache entry.
+ *
+ *
+ * \return Returns the request length or < 0 for error.
+ *
+ ********************************************************************************/
+static int32_t coapProxyRebuild(CoapProxy *pProxy, CoapProxyExchange *pExchange, CoapMessageView *pView, uint8_t *pToken, uint16_t messageId, uint16_t bufferSize, bool revalidate)
+{
+   CoapMessageBuilder builder;     // Used to build the upstream request.
+   CoapOptionEntry *pOption;       // Used to store the current option.
+   CoapCache *pCache = &pProxy->origins[pExchange->origin].cache;   // Used to find the ETag.
+   int8_t results;                 // Used to store the results.
+   uint8_t i;                      // Used as an iterator.
+
+   results = coapBuilderInit(&builder, pExchange->pRequest, bufferSize, pView->type, (CoapCode)pView->code,
+                             messageId, pToken, COAP_PROXY_TOKEN_LENGTH);
+
+   for( i = 0; results == COAP_OK && i <= pView->optionCount; i++ )
+   {
+      pOption = &pView->options[i];
+
+      // ETag goes in ascending order, before the first option above it.
+      if( revalidate && (i == pView->optionCount || pOption->number > COAP_OPTION_ETAG) )
+      {
+         pExchange->revalidating = (coapCacheAddETag(pCache, pView, &builder) == COAP_OK);
+         revalidate = false;
+      }
+
+      if( i == pView->optionCount || pOption->number == COAP_OPTION_PROXY_SCHEME )
+      {
+         continue;
+      }
+
+      if( pOption->number > 0xFF || pOption->length > 0xFF )
+      {
+         return COAP_INVALID_OPTION;
+      }
+
+      results = coapBuilderAddOption(&builder, (uint8_t)pOption->number, (uint8_t)pOption->length, pOption->pData);
+   }
+
+   if( results == COAP_OK && pView->payloadLength > 0 )
+   {
+      results = coapBuilderSetPayload(&builder, pView->payloadLength, pView->pPayload);
+   }
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   return builder.length;
+}
+
+/*!*****************************************************************************
+ * \brief Sends a client request to its origin
+ *
+ * Description:
+ *  The request is copied into a pool buffer with the upstream token and
+ *  message id patched into the header; options and payload are copied as they
+ *  are.  The buffer lives until the exchange completes and is resent when the
+ *  client retransmits, so the proxy runs no retransmission timers of its own.
+ *
+ * \param CoapProxy *pProxy [in\out] - Proxy forwarding the request.
+ *
+ * \param CoapProxyClient *pClient [in] - Client of the request.
+ *
+ * \param CoapMessageView *pView [in] - Parsed client request.
+ *
+ * \param U8 *pBuffer [in] - Client request.
+ *
+ * \param U16 length [in] - Length of the client request.
+ *
+ * \param U8 origin [in] - Origin index.
+ *
+ * \param bool coalesce [in] - Identical GETs may join the exchange.
+ *
+ * \param bool rebuild [in] - The request carries Proxy-Scheme.
+ *
+ * \param bool revalidate [in] - A stale cache entry's ETag should be added.
+ *
+ *
+ * \return Returns the response code to send the client on failure or COAP_EMPTY.
+ *
+ ********************************************************************************/
+static CoapCode coapProxyForward(CoapProxy *pProxy, CoapProxyClient *pClient, CoapMessageView *pView, uint8_t *pBuffer, uint16_t length,
+                                 uint8_t origin, bool coalesce, bool rebuild, bool revalidate)
+{
+   CoapProxyOrigin *pOrigin = &pProxy->origins[origin];   // Used to store the origin.
+   CoapProxyExchange *pExchange = NULL;                   // Used to store the free exchange.
+   uint8_t token[COAP_PROXY_TOKEN_LENGTH];                // Used to store the upstream token.
+   uint16_t rest = length - COAP_HDR_BYTES - pView->tokenLength;   // Used to store the options and payload length.
+   uint16_t size;                                         // Used to store the pool buffer size.
+   uint16_t messageId;                                    // Used to store the upstream message id.
+   int32_t requestLength;                                 // Used to store the upstream request length.
+   uint8_t i;                                             // Used as an iterator.
+
+   for( i = 0; i < COAP_PROXY_MAX_EXCHANGES && pExchange == NULL; i++ )
+   {
+      if( !pProxy->exchanges[i].inUse )
+      {
+         pExchange = &pProxy->exchanges[i];
+      }
+   }
+
+   if( pExchange == NULL )
+   {
+      return COAP_SERVICE_UNAVAILABLE;
+   }
+
+   size = COAP_HDR_BYTES + COAP_PROXY_TOKEN_LENGTH + rest + (revalidate ? COAP_CACHE_ETAG_SIZE + 1 : 0) + (rebuild ? 1 : 0);
+   pExchange->pRequest = coapPoolAlloc(size);
+
+   if( pExchange->pRequest == NULL )
+   {
+      return COAP_SERVICE_UNAVAILABLE;
+   }
+
+   token[0] = pExchange - pProxy->exchanges;
+   coapGenerateToken(token + 1, COAP_PROXY_TOKEN_LENGTH - 1);
+   messageId = coapMessageIdNext(&pOrigin->messageIds);
+
+   pExchange->origin = origin;
+   pExchange->revalidating = false;
+
+   if( rebuild || revalidate )
+   {
+      requestLength = coapProxyRebuild(pProxy, pExchange, pView, token, messageId, size, revalidate);
+   }
+   else
+   {
+      pExchange->pRequest[0] = (pBuffer[0] & (COAP_HDR_VER_MASK | COAP_HDR_TYPE_MASK)) | COAP_PROXY_TOKEN_LENGTH;
+      pExchange->pRequest[1] = pBuffer[1];
+      pExchange->pRequest[2] = messageId >> 8;
+      pExchange->pRequest[3] = messageId & 0xFF;
+      memcpy(pExchange->pRequest + COAP_HDR_BYTES, token, COAP_PROXY_TOKEN_LENGTH);
+      memcpy(pExchange->pRequest + COAP_HDR_BYTES + COAP_PROXY_TOKEN_LENGTH, pBuffer + COAP_HDR_BYTES + pView->tokenLength, rest);
+      requestLength = COAP_HDR_BYTES + COAP_PROXY_TOKEN_LENGTH + rest;
+   }
+
+   if( requestLength < 0 || pOrigin->transport.send(pOrigin->transport.pContext, pExchange->pRequest, (uint16_t)requestLength) < 0 )
+   {
+      coapPoolFree(pExchange->pRequest);
+      return (requestLength < 0) ? COAP_INTERNAL_SERVER_ERROR : COAP_BAD_GATEWAY;
+   }
+
+   pExchange->clients[0] = *pClient;
+   pExchange->clientCount = 1;
+   pExchange->requestLength = (uint16_t)requestLength;
+   pExchange->expiryTick = xTaskGetTickCount() + pdMS_TO_TICKS(COAP_PROXY_TIMEOUT * 1000UL);
+   pExchange->coalesce = coalesce;
+   pExchange->acknowledged = false;
+   pExchange->inUse = true;
+   pOrigin->pending++;
+
+   return COAP_EMPTY;
+}
+
+/*!*****************************************************************************
+ * \brief Frees an exchange and its pool buffer
+ *
+ * \param CoapProxy *pProxy [in\out] - Proxy owning the exchange.
+ *
+ * \param CoapProxyExchange *pExchange [in\out] - Completed exchange.
+ *
+ ********************************************************************************/
+static void coapProxyRelease(CoapProxy *pProxy, CoapProxyExchange *pExchange)
+{
+   coapPoolFree(pExchange->pRequest);
+   pExchange->pRequest = NULL;
+   pExchange->inUse = false;
+   pProxy->origins[pExchange->origin].pending--;
+}
+
+/*!*****************************************************************************
+ * \brief Answers every client of an exchange with a code and frees it
+ *
+ * \param CoapProxy *pProxy [in\out] - Proxy owning the exchange.
+ *
+ * \param CoapProxyExchange *pExchange [in\out] - Failed exchange.
+ *
+ * \param CoapCode code [in] - COAP_BAD_GATEWAY or COAP_GATEWAY_TIMEOUT.
+ *
+ ********************************************************************************/
+static void coapProxyFail(CoapProxy *pProxy, CoapProxyExchange *pExchange, CoapCode code)
+{
+   uint8_t i;   // Used as an iterator.
+
+   for( i = 0; i < pExchange->clientCount; i++ )
+   {
+      coapProxyAnswerCode(pProxy, &pExchange->clients[i], code);
+   }
+
+   coapProxyRelease(pProxy, pExchange);
+}
+
+/*!*****************************************************************************
+ * \brief Initialises a forward proxy
+ *
+ * Description:
+ *  The proxy relays requests from many clients to their origins over one
+ *  pooled socket per origin.  Requests name the origin with Uri-Host and
+ *  Uri-Port, optionally with Proxy-Scheme "coap"; requests without Uri-Host
+ *  go to pDefaultHost.  Proxy-Uri requests are answered with 5.05, decoding
+ *  the URI would mean re-encoding every request.
+ *
+ * Proxying:
+ *          https://tools.ietf.org/html/rfc7252#section-5.7
+ *
+ * \param CoapProxy *pProxy [out] - Proxy to initialise.
+ *
+ * \param char *pDefaultHost [in] - Origin of requests without Uri-Host, e.g. SERVER_NAME.
+ *
+ * \param U16 defaultPort [in] - Port of pDefaultHost.
+ *
+ * \param CoapProxySendCallback send [in] - Sends to the clients.
+ *
+ * \param CoapProxyConnectCallback connect [in] - Opens an upstream socket.
+ *
+ * \param CoapProxyCloseCallback close [in] - Closes an upstream socket.
+ *
+ * \param void *pContext [in] - Passed to the callbacks.
+ *
+ ********************************************************************************/
+void coapProxyInit(CoapProxy *pProxy, const char *pDefaultHost, uint16_t defaultPort, CoapProxySendCallback send, CoapProxyConnectCallback connect, CoapProxyCloseCallback close, void *pContext)
+{
+   memset(pProxy, 0, sizeof(*pProxy));
+   coapDedupInit(&pProxy->dedup, pProxy->dedupEntries, COAP_PROXY_DEDUP_ENTRIES);
+   coapMessageIdInit(&pProxy->messageIds);
+
+   pProxy->pDefaultHost = pDefaultHost;
+   pProxy->defaultHostLength = (uint8_t)strlen(pDefaultHost);
+   pProxy->defaultPort = defaultPort;
+   pProxy->send = send;
+   pProxy->connect = connect;
+   pProxy->close = close;
+   pProxy->pContext = pContext;
+}
+
+/*!*****************************************************************************
+ * \brief Handles a request from a client
+ *
+ * Description:
+ *  A fresh cached response to a GET is answered at once.  A GET identical to
+ *  one already waiting for the origin joins it and is answered by the same
+ *  upstream response.  Anything else is forwarded with an upstream token and
+ *  message id.  Retransmissions of a pending request resend the upstream
+ *  request, retransmissions of an answered one get the stored reply.
+ *  Unsafe options the proxy does not know are answered with 5.02.
+ *
+ * \param CoapProxy *pProxy [in\out] - Proxy.
+ *
+ * \param U32 address [in] - Client address.
+ *
+ * \param U16 port [in] - Client port.
+ *
+ * \param U8 *pBuffer [in\out] - Client request, a ping is answered in place.
+ *
+ * \param U16 length [in] - Length of the request.
+ *
+ *
+ * \return Returns COAP_OK if the request was handled, COAP_DUPLICATE_MESSAGE
+ *         for a retransmission or < 0 if it was dropped.
+ *
+ ********************************************************************************/
+int8_t coapProxyHandleRequest(CoapProxy *pProxy, uint32_t address, uint16_t port, uint8_t *pBuffer, uint16_t length)
+{
+   CoapMessageView view;                  // Used to store the parsed request.
+   CoapProxyClient client;                // Used to store the client.
+   CoapProxyExchange *pExchange;          // Used to store the pending exchange.
+   CoapOptionEntry *pOption;              // Used to store the current option.
+   const uint8_t *pHost = (const uint8_t *)pProxy->pDefaultHost;   // Used to store the origin host.
+   uint16_t hostLength = pProxy->defaultHostLength;               // Used to store the host length.
+   uint16_t originPort = pProxy->defaultPort;                      // Used to store the origin port.
+   uint8_t *pReply;                       // Used to store the stored reply.
+   uint16_t replyLength;                  // Used to store the stored reply length.
+   uint16_t headerLength;                 // Used by coapSetType.
+   int16_t origin;                        // Used to store the origin index.
+   int8_t results;                        // Used to store the results.
+   CoapCode code;                         // Used to store the forward results.
+   bool observe = false;                  // Used to store whether Observe is present.
+   bool hasETag = false;                  // Used to store whether the client revalidates itself.
+   bool rebuild = false;                  // Used to store whether Proxy-Scheme must be removed.
+   bool coalesce;                         // Used to store whether the request can be shared.
+   uint8_t i;                             // Used as an iterator.
+
+   if( coapParseMessage(pBuffer, length, &view) < 0 )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
+   if( view.type == COAP_TYPE_ACK || view.type == COAP_TYPE_RST )
+   {
+      return COAP_INVALID_TYPE;
+   }
+
+   if( view.code == COAP_EMPTY )
+   {
+      // CoAP ping, answered with a Reset.
+      coapSetType(pBuffer, &headerLength, COAP_TYPE_RST);
+      pProxy->send(pProxy->pContext, address, port, pBuffer, COAP_HDR_BYTES);
+      return COAP_OK;
+   }
+
+   if( view.code > COAP_DELETE )
+   {
+      return COAP_UNKNOWN_CODE;
+   }
+
+   results = coapDedupCheck(&pProxy->dedup, address, port, &view, &pReply, &replyLength);
+
+   if( results == COAP_DUPLICATE_MESSAGE && replyLength > 0 )
+   {
+      pProxy->send(pProxy->pContext, address, port, pReply, replyLength);
+      return results;
+   }
+
+   // Checked whatever dedup says: a full table records nothing, and forwarding
+   // a retransmitted POST again would run it twice on the origin.
+   pExchange = coapProxyFindClient(pProxy, address, port, view.messageId);
+
+   if( pExchange != NULL )
+   {
+      if( !pExchange->acknowledged )
+      {
+         pProxy->origins[pExchange->origin].transport.send(pProxy->origins[pExchange->origin].transport.pContext,
+                                                           pExchange->pRequest, pExchange->requestLength);
+      }
+
+      return COAP_DUPLICATE_MESSAGE;
+   }
+
+   if( results == COAP_DUPLICATE_MESSAGE )
+   {
+      return results;
+   }
+
+   client.address = address;
+   client.port = port;
+   client.messageId = view.messageId;
+   client.type = view.type;
+   client.tokenLength = view.tokenLength;
+   memcpy(client.token, view.pToken, view.tokenLength);
+
+   for( i = 0; i < view.optionCount; i++ )
+   {
+      pOption = &view.options[i];
+
+      switch( pOption->number )
+      {
+         case COAP_OPTION_URI_HOST:
+            pHost = pOption->pData;
+            hostLength = pOption->length;
+            break;
+
+         case COAP_OPTION_URI_PORT:
+            originPort = (uint16_t)coapDecodeOptionUint(pOption->pData, pOption->length);
+            break;
+
+         case COAP_OPTION_OBSERVE:
+            observe = true;
+            break;
+
+         case COAP_OPTION_ETAG:
+            hasETag = true;
+            break;
+
+         case COAP_OPTION_PROXY_SCHEME:
+            if( pOption->length != 4 || memcmp(pOption->pData, "coap", 4) != 0 )
+            {
+               coapProxyAnswerCode(pProxy, &client, COAP_PROXYING_NOT_SUPPORTED);
+               return COAP_OK;
+            }
+
+            rebuild = true;
+            break;
+
+         case COAP_OPTION_PROXY_URI:
+            coapProxyAnswerCode(pProxy, &client, COAP_PROXYING_NOT_SUPPORTED);
+            return COAP_OK;
+
+         default:
+            if( (coapOptionGetFlags(pOption->number) & (COAP_OPTION_FLAG_UNSAFE | COAP_OPTION_FLAG_KNOWN)) == COAP_OPTION_FLAG_UNSAFE )
+            {
+               coapProxyAnswerCode(pProxy, &client, COAP_BAD_GATEWAY);
+               return COAP_OK;
+            }
+            break;
+      }
+   }
+
+   origin = coapProxyOpenOrigin(pProxy, pHost, hostLength, originPort);
+
+   if( origin < 0 )
+   {
+      coapProxyAnswerCode(pProxy, &client, (origin == COAP_NO_RESOURCES) ? COAP_SERVICE_UNAVAILABLE : COAP_BAD_GATEWAY);
+      return COAP_OK;
+   }
+
+   coalesce = (view.code == COAP_GET && !observe);
+   results = COAP_CACHE_MISS;
+
+   if( coalesce )
+   {
+      results = coapCacheGet(&pProxy->origins[origin].cache, &view, pProxy->reply, sizeof(pProxy->reply), &replyLength);
+
+      if( results == COAP_OK )
+      {
+         coapProxyAnswer(pProxy, &client, pProxy->reply, replyLength, sizeof(pProxy->reply));
+         return COAP_OK;
+      }
+
+      pExchange = coapProxyFindCoalesce(pProxy, (uint8_t)origin, pBuffer + COAP_HDR_BYTES + view.tokenLength,
+                                        length - COAP_HDR_BYTES - view.tokenLength);
+
+      if( pExchange != NULL )
+      {
+         pExchange->clients[pExchange->clientCount++] = client;
+         return COAP_OK;
+      }
+   }
+
+   code = coapProxyForward(pProxy, &client, &view, pBuffer, length, (uint8_t)origin, coalesce, rebuild,
+                           results == COAP_CACHE_STALE && !hasETag);
+
+   if( code != COAP_EMPTY )
+   {
+      coapProxyAnswerCode(pProxy, &client, code);
+   }
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Handles a datagram from an origin
+ *
+ * Description:
+ *  The response is stored in (or revalidates) the origin's cache, then
+ *  rewritten in place for each client of the exchange.  A separate CON
+ *  response is acknowledged upstream; anything that matches no exchange is
+ *  rejected with a Reset, which also cancels stray Observe notifications.
+ *
+ * \param CoapProxy *pProxy [in\out] - Proxy.
+ *
+ * \param U8 origin [in] - Index of the origin whose socket received it.
+ *
+ * \param U8 *pBuffer [in\out] - Datagram, rewritten for the clients.
+ *
+ * \param U16 length [in] - Length of the datagram.
+ *
+ * \param U16 bufferSize [in] - Size of pBuffer, room for a longer client token.
+ *
+ *
+ * \return Returns COAP_OK if it was handled, COAP_UNKNOWN_TOKEN if no exchange
+ *         matches or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapProxyHandleResponse(CoapProxy *pProxy, uint8_t origin, uint8_t *pBuffer, uint16_t length, uint16_t bufferSize)
+{
+   CoapProxyOrigin *pOrigin = &pProxy->origins[origin];   // Used to store the origin.
+   CoapMessageView view;                  // Used to store the parsed response.
+   CoapMessageView request;               // Used to store the parsed upstream request.
+   CoapProxyExchange *pExchange;          // Used to store the matching exchange.
+   uint8_t *pResponse = pBuffer;          // Used to store the response sent to the clients.
+   uint16_t responseSize = bufferSize;    // Used to store the size of pResponse.
+   uint16_t cachedLength;                 // Used to store the length of a revalidated response.
+   uint8_t i;                             // Used as an iterator.
+
+   if( origin >= COAP_PROXY_MAX_ORIGINS || !pOrigin->open )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
+   if( coapParseMessage(pBuffer, length, &view) < 0 )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
+   if( view.code != COAP_EMPTY && view.code <= COAP_DELETE )
+   {
+      // The proxy serves no requests from upstream.
+      if( view.type == COAP_TYPE_CON )
+      {
+         coapProxySendEmpty(pOrigin, COAP_TYPE_RST, view.messageId);
+      }
+
+      return COAP_UNKNOWN_CODE;
+   }
+
+   pExchange = coapProxyFindUpstream(pProxy, origin, &view);
+
+   if( view.code == COAP_EMPTY )
+   {
+      if( view.type == COAP_TYPE_CON )
+      {
+         coapProxySendEmpty(pOrigin, COAP_TYPE_RST, view.messageId);
+      }
+      else if( pExchange != NULL && view.type == COAP_TYPE_ACK )
+      {
+         pExchange->acknowledged = true;
+      }
+      else if( pExchange != NULL && view.type == COAP_TYPE_RST )
+      {
+         coapProxyFail(pProxy, pExchange, COAP_BAD_GATEWAY);
+      }
+
+      return (pExchange != NULL) ? COAP_OK : COAP_UNKNOWN_MESSAGE_ID;
+   }
+
+   if( pExchange == NULL )
+   {
+      if( view.type != COAP_TYPE_ACK )
+      {
+         coapProxySendEmpty(pOrigin, COAP_TYPE_RST, view.messageId);
+      }
+
+      return COAP_UNKNOWN_TOKEN;
+   }
+
+   if( view.type == COAP_TYPE_CON )
+   {
+      coapProxySendEmpty(pOrigin, COAP_TYPE_ACK, view.messageId);
+   }
+
+   if( coapParseMessage(pExchange->pRequest, pExchange->requestLength, &request) == COAP_OK )
+   {
+      // A 2.03 to the client's own ETag says nothing about the cached entry.
+      if( pExchange->coalesce && (view.code != COAP_VALID || pExchange->revalidating) )
+      {
+         coapCacheStore(&pOrigin->cache, &request, pBuffer, length, pProxy->reply, sizeof(pProxy->reply), &cachedLength);
+
+         // The 2.03 answers the ETag the proxy added, the clients get the cached 2.05.
+         if( view.code == COAP_VALID && cachedLength > 0 )
+         {
+            pResponse = pProxy->reply;
+            responseSize = sizeof(pProxy->reply);
+            length = cachedLength;
+         }
+      }
+      else if( request.code != COAP_GET && (view.code >> 5) == 2 )
+      {
+         coapCacheInvalidate(&pOrigin->cache, &request);
+      }
+   }
+
+   for( i = 0; i < pExchange->clientCount; i++ )
+   {
+      length = coapProxyAnswer(pProxy, &pExchange->clients[i], pResponse, length, responseSize);
+   }
+
+   coapProxyRelease(pProxy, pExchange);
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Reads every pooled upstream socket
+ *
+ * Description:
+ *  Call when an upstream socket has datagrams, e.g. from the select loop of
+ *  the gateway.  The transports' receive must not block.
+ *
+ * \param CoapProxy *pProxy [in\out] - Proxy.
+ *
+ ********************************************************************************/
+void coapProxyReceive(CoapProxy *pProxy)
+{
+   CoapProxyOrigin *pOrigin;   // Used to store the current origin.
+   int16_t length;             // Used to store the datagram length.
+   uint8_t i;                  // Used as an iterator.
+
+   for( i = 0; i < COAP_PROXY_MAX_ORIGINS; i++ )
+   {
+      pOrigin = &pProxy->origins[i];
+
+      // Leave room for a client token longer than the upstream one.
+      while( pOrigin->open &&
+             (length = pOrigin->transport.receive(pOrigin->transport.pContext, pProxy->buffer,
+                                                  sizeof(pProxy->buffer) - MAX_TOKEN_LENGTH)) > 0 )
+      {
+         coapProxyHandleResponse(pProxy, i, pProxy->buffer, (uint16_t)length, sizeof(pProxy->buffer));
+      }
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Times out exchanges the origin never answered
+ *
+ * Description:
+ *  Call about once a second.  The clients of an exchange older than
+ *  COAP_PROXY_TIMEOUT get 5.04 Gateway Timeout.
+ *
+ * \param CoapProxy *pProxy [in\out] - Proxy.
+ *
+ ********************************************************************************/
+void coapProxyPoll(CoapProxy *pProxy)
+{
+   TickType_t now = xTaskGetTickCount();   // Used to check the deadlines.
+   uint8_t i;                              // Used as an iterator.
+
+   for( i = 0; i < COAP_PROXY_MAX_EXCHANGES; i++ )
+   {
+      if( pProxy->exchanges[i].inUse && (int32_t)(now - pProxy->exchanges[i].expiryTick) >= 0 )
+      {
+         coapProxyFail(pProxy, &pProxy->exchanges[i], COAP_GATEWAY_TIMEOUT);
+      }
+   }
+}
+
+//! @}
@@ -0,0 +1,110 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_PROXY_H
+#define COAP_PROXY_H
+
+#include "coap.h"
+#include "coap_random.h"
+#include "coap_task.h"
+#include "coap_cache.h"
+#include "coap_dedup.h"
+#include "coap_pool.h"
+
+/*Forward Proxy Related (RFC 7252 section 5.7)*/
+#ifndef COAP_PROXY_MAX_ORIGINS
+#define COAP_PROXY_MAX_ORIGINS      4     //pooled upstream sockets, the least recently used idle one is closed
+#endif
+#ifndef COAP_PROXY_MAX_EXCHANGES
+#define COAP_PROXY_MAX_EXCHANGES    16    //requests waiting for the upstream, at most 256
+#endif
+#ifndef COAP_PROXY_DEDUP_ENTRIES
+#define COAP_PROXY_DEDUP_ENTRIES    4096  //client exchanges remembered, about 16 CON/s over EXCHANGE_LIFETIME (~600 KB)
+#endif
+#define COAP_PROXY_MAX_CLIENTS      4     //clients sharing one coalesced GET
+#define COAP_PROXY_TOKEN_LENGTH     4     //upstream token, exchange index and 3 random bytes
+#define COAP_PROXY_HOST_SIZE        64    //longest Uri-Host of an origin
+#define COAP_PROXY_TIMEOUT          93    //seconds, MAX_TRANSMIT_WAIT, then 5.04 Gateway Timeout
+
+#if (COAP_PROXY_DEDUP_ENTRIES & (COAP_PROXY_DEDUP_ENTRIES - 1)) != 0 || COAP_PROXY_DEDUP_ENTRIES > 32768
+#error "COAP_PROXY_DEDUP_ENTRIES must be a power of 2 up to 32768"
+#endif
+
+/// Sends one datagram to a downstream client.
+typedef int8_t (*CoapProxySendCallback)(void *pContext, uint32_t address, uint16_t port, uint8_t *pBuffer, uint16_t length);
+
+/// Opens the upstream socket of an origin and fills in pTransport, returns COAP_OK or < 0 for error.
+typedef int8_t (*CoapProxyConnectCallback)(void *pContext, const uint8_t *pHost, uint8_t hostLength, uint16_t port, CoapTransport *pTransport);
+
+/// Closes an upstream socket opened by the connect callback.
+typedef void (*CoapProxyCloseCallback)(void *pContext, CoapTransport *pTransport);
+
+/// CoapProxyClient struct, a downstream request waiting for an upstream response
+typedef struct
+{
+   uint32_t address;                    ///< Client address
+   uint16_t port;                       ///< Client port
+   uint16_t messageId;                  ///< Message id of the client request
+   uint8_t type;                        ///< CON is answered with a piggybacked ACK, NON with a NON
+   uint8_t tokenLength;                 ///< Length of token
+   uint8_t token[MAX_TOKEN_LENGTH];     ///< Client token, put back into the response
+} CoapProxyClient;
+
+/// CoapProxyExchange struct, one upstream request
+typedef struct
+{
+   CoapProxyClient clients[COAP_PROXY_MAX_CLIENTS];   ///< Clients answered by the response
+   uint8_t *pRequest;                   ///< Upstream request from coapPoolAlloc, resent on client retransmissions
+   uint16_t requestLength;              ///< Length of pRequest
+   TickType_t expiryTick;               ///< 5.04 Gateway Timeout after this tick
+   uint8_t origin;                      ///< Index of the origin
+   uint8_t clientCount;                 ///< Used clients entries
+   bool coalesce;                       ///< GET without Observe, identical GETs join the exchange
+   bool revalidating;                   ///< ETag of a stale cache entry was added, 2.03 is answered from the cache
+   bool acknowledged;                   ///< Upstream sent an empty ACK, retransmissions stop
+   bool inUse;                          ///< Exchange is pending
+} CoapProxyExchange;
+
+/// CoapProxyOrigin struct, a pooled upstream socket
+typedef struct
+{
+   uint8_t host[COAP_PROXY_HOST_SIZE];  ///< Uri-Host of the origin
+   uint8_t hostLength;                  ///< Length of host
+   uint16_t port;                       ///< Uri-Port of the origin
+   CoapTransport transport;             ///< Socket opened by the connect callback
+   CoapMessageIdGenerator messageIds;   ///< Upstream message ids
+   CoapCache cache;                     ///< Responses of the origin, the cache key has no Uri-Host
+   TickType_t usedTick;                 ///< Last request, the oldest idle origin is closed first
+   uint8_t pending;                     ///< Exchanges waiting on the origin
+   bool open;                           ///< transport is connected
+} CoapProxyOrigin;
+
+/// CoapProxy struct
+typedef struct
+{
+   CoapProxyOrigin origins[COAP_PROXY_MAX_ORIGINS];        ///< Upstream socket pool
+   CoapProxyExchange exchanges[COAP_PROXY_MAX_EXCHANGES];  ///< Pending upstream requests
+   CoapDedupTable dedup;                ///< Replies for client retransmissions
+   CoapDedupEntry dedupEntries[COAP_PROXY_DEDUP_ENTRIES];  ///< Storage of dedup, sized for a gateway
+   CoapMessageIdGenerator messageIds;   ///< Message ids of NON responses to clients
+   const char *pDefaultHost;            ///< Origin of requests without Uri-Host
+   uint8_t defaultHostLength;           ///< Length of pDefaultHost
+   uint16_t defaultPort;                ///< Port of pDefaultHost
+   CoapProxySendCallback send;          ///< Sends to the clients
+   CoapProxyConnectCallback connect;    ///< Opens upstream sockets
+   CoapProxyCloseCallback close;        ///< Closes upstream sockets
+   void *pContext;                      ///< Passed to send, connect and close
+   uint8_t buffer[MAX_BUFFER_SIZE];     ///< Upstream datagram read by coapProxyReceive
+   uint8_t reply[MAX_BUFFER_SIZE];      ///< Cached or error response being sent to a client
+} CoapProxy;
+
+void coapProxyInit(CoapProxy *pProxy, const char *pDefaultHost, uint16_t defaultPort, CoapProxySendCallback send, CoapProxyConnectCallback connect, CoapProxyCloseCallback close, void *pContext);
+int8_t coapProxyHandleRequest(CoapProxy *pProxy, uint32_t address, uint16_t port, uint8_t *pBuffer, uint16_t length);
+int8_t coapProxyHandleResponse(CoapProxy *pProxy, uint8_t origin, uint8_t *pBuffer, uint16_t length, uint16_t bufferSize);
+void coapProxyReceive(CoapProxy *pProxy);
+void coapProxyPoll(CoapProxy *pProxy);
+
+//! @}
+#endif  /* COAP_PROXY_H */
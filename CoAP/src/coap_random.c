@@ -0,0 +1,250 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_random.h"
+
+#define COAP_RANDOM_ROTL(x, k)      (((x) << (k)) | ((x) >> (32 - (k))))
+
+#ifdef COAP_LINUX_GATEWAY
+static __thread CoapRandomState *coapRandomThread = NULL;   // State of the calling thread.
+#endif
+static CoapRandomState coapRandomShared;        // Used by tasks without their own state.
+static bool coapRandomSharedSeeded = false;     // coapRandomShared has been seeded.
+
+/*!*****************************************************************************
+ * \brief Weak default entropy
+ *
+ * Description:
+ *  Mixes the tick count, a stack address and a counter.  This is not secret;
+ *  targets with a hardware RNG define COAP_ENTROPY_SOURCE() to read it so
+ *  tokens are unpredictable as RFC 7252 section 5.3.1 asks.
+ *
+ * \return Returns 32 bits of (weak) entropy.
+ *
+ ********************************************************************************/
+uint32_t coapRandomFallbackEntropy(void)
+{
+   static uint32_t counter = 0;   // Used to differ between calls in the same tick.
+   uint32_t stack;                // Used for its address.
+
+   counter += 0x9E3779B9UL;
+
+   return (uint32_t)xTaskGetTickCount() ^ (uint32_t)(uintptr_t)&stack ^ counter;
+}
+
+/*!*****************************************************************************
+ * \brief Seeds a generator from the entropy source
+ *
+ * Description:
+ *  Each state word is taken from COAP_ENTROPY_SOURCE() and run through a
+ *  splitmix32 step so weak entropy still spreads over all bits.
+ *
+ * \param CoapRandomState *pState [out] - State to seed.
+ *
+ ********************************************************************************/
+void coapRandomSeed(CoapRandomState *pState)
+{
+   uint32_t z;    // Used to mix the entropy.
+   uint8_t i;     // Used as an iterator.
+
+   for( i = 0; i < 4; i++ )
+   {
+      z = COAP_ENTROPY_SOURCE() + 0x9E3779B9UL * (i + 1);
+      z = (z ^ (z >> 16)) * 0x85EBCA6BUL;
+      z = (z ^ (z >> 13)) * 0xC2B2AE35UL;
+      pState->s[i] = z ^ (z >> 16);
+   }
+
+   // xoshiro must never be all zero.
+   if( (pState->s[0] | pState->s[1] | pState->s[2] | pState->s[3]) == 0 )
+   {
+      pState->s[0] = 1;
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Gives the calling task its own generator
+ *
+ * Description:
+ *  Seeds pState and stores it in the task's FreeRTOS thread local storage slot
+ *  COAP_RANDOM_TLS_INDEX, so coapRandom32 and coapGenerateToken run without any
+ *  lock.  pState must live as long as the task (e.g. on its stack in the task
+ *  function).  Requires configNUM_THREAD_LOCAL_STORAGE_POINTERS >
+ *  COAP_RANDOM_TLS_INDEX.  The Linux gateway build keeps the state in a
+ *  __thread pointer instead, one per worker thread.
+ *
+ * \param CoapRandomState *pState [in] - State for the calling task.
+ *
+ ********************************************************************************/
+void coapRandomTaskInit(CoapRandomState *pState)
+{
+   coapRandomSeed(pState);
+#ifdef COAP_LINUX_GATEWAY
+   coapRandomThread = pState;
+#else
+   vTaskSetThreadLocalStoragePointer(NULL, COAP_RANDOM_TLS_INDEX, pState);
+#endif
+}
+
+/*!*****************************************************************************
+ * \brief Steps a generator
+ *
+ * Description:
+ *  xoshiro128**: a handful of shifts, rotates and xors, no division, no lock.
+ *
+ * \param CoapRandomState *pState [in\out] - State to step.
+ *
+ *
+ * \return Returns 32 random bits.
+ *
+ ********************************************************************************/
+uint32_t coapRandomNext(CoapRandomState *pState)
+{
+   uint32_t *s = pState->s;                              // Used to shorten the state access.
+   uint32_t result = COAP_RANDOM_ROTL(s[1] * 5, 7) * 9;  // Used to store the output.
+   uint32_t t = s[1] << 9;                               // Used to store the shifted word.
+
+   s[2] ^= s[0];
+   s[3] ^= s[1];
+   s[1] ^= s[2];
+   s[0] ^= s[3];
+   s[2] ^= t;
+   s[3] = COAP_RANDOM_ROTL(s[3], 11);
+
+   return result;
+}
+
+/*!*****************************************************************************
+ * \brief Gets 32 random bits for the calling task
+ *
+ * Description:
+ *  Uses the task's own state when coapRandomTaskInit was called.  Other tasks
+ *  share one state under a short critical section, which is only meant for
+ *  code that is not on a send path.
+ *
+ * \return Returns 32 random bits.
+ *
+ ********************************************************************************/
+uint32_t coapRandom32(void)
+{
+   CoapRandomState *pState;   // Used to store the task state.
+   uint32_t result;           // Used to store the output.
+
+#ifdef COAP_LINUX_GATEWAY
+   pState = coapRandomThread;
+#else
+   pState = (CoapRandomState *)pvTaskGetThreadLocalStoragePointer(NULL, COAP_RANDOM_TLS_INDEX);
+#endif
+
+   if( pState != NULL )
+   {
+      return coapRandomNext(pState);
+   }
+
+   taskENTER_CRITICAL();
+
+   if( !coapRandomSharedSeeded )
+   {
+      coapRandomSeed(&coapRandomShared);
+      coapRandomSharedSeeded = true;
+   }
+
+   result = coapRandomNext(&coapRandomShared);
+
+   taskEXIT_CRITICAL();
+
+   return result;
+}
+
+/*!*****************************************************************************
+ * \brief Generates a token
+ *
+ * Description:
+ *  Fills the token with generator output four bytes at a time.
+ *
+ * Token:
+ *          https://tools.ietf.org/html/rfc7252#section-5.3.1
+ *
+ * \param U8 *pToken [out] - Receives the token.
+ *
+ * \param U8 tokenLength [in] - Token length, at most MAX_TOKEN_LENGTH.
+ *
+ ********************************************************************************/
+void coapGenerateToken(uint8_t *pToken, uint8_t tokenLength)
+{
+   uint32_t bits = 0;   // Used to store the current random word.
+   uint8_t i;           // Used as an iterator.
+
+   for( i = 0; i < tokenLength; i++ )
+   {
+      if( (i & 3) == 0 )
+      {
+         bits = coapRandom32();
+      }
+
+      pToken[i] = bits & 0xFF;
+      bits >>= 8;
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Initialises a message id generator
+ *
+ * Description:
+ *  Starts at a random value as RFC 7252 section 4.4 suggests, so ids do not
+ *  repeat across reboots.  Acknowledgements are matched by message id alone,
+ *  so every sender on a socket must draw from the same generator; this one
+ *  is for a socket only one task sends on, so no lock is needed.
+ *
+ * \param CoapMessageIdGenerator *pGenerator [out] - Generator to initialise.
+ *
+ ********************************************************************************/
+void coapMessageIdInit(CoapMessageIdGenerator *pGenerator)
+{
+   pGenerator->next = (uint16_t)(coapRandom32() >> 16);
+   pGenerator->shared = false;
+}
+
+/*!*****************************************************************************
+ * \brief Initialises a message id generator used by several tasks
+ *
+ * Description:
+ *  For a socket more than one task builds messages for, e.g. coapTask (Observe
+ *  registrations) and a producer task (uplink batches).
+ *
+ * \param CoapMessageIdGenerator *pGenerator [out] - Generator to initialise.
+ *
+ ********************************************************************************/
+void coapMessageIdInitShared(CoapMessageIdGenerator *pGenerator)
+{
+   coapMessageIdInit(pGenerator);
+   pGenerator->shared = true;
+}
+
+/*!*****************************************************************************
+ * \brief Gets the next message id for an endpoint
+ *
+ * \param CoapMessageIdGenerator *pGenerator [in\out] - Generator of the socket.
+ *
+ *
+ * \return Returns the message id.
+ *
+ ********************************************************************************/
+uint16_t coapMessageIdNext(CoapMessageIdGenerator *pGenerator)
+{
+   uint16_t messageId;   // Used to store the message id.
+
+   if( !pGenerator->shared )
+   {
+      return pGenerator->next++;
+   }
+
+   taskENTER_CRITICAL();
+   messageId = pGenerator->next++;
+   taskEXIT_CRITICAL();
+
+   return messageId;
+}
@@ -0,0 +1,43 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_RANDOM_H
+#define COAP_RANDOM_H
+
+#include "coap.h"
+
+/*Random Number Related*/
+#ifndef COAP_RANDOM_TLS_INDEX
+#define COAP_RANDOM_TLS_INDEX       0     //FreeRTOS thread local storage slot holding the task state
+#endif
+#ifndef COAP_ENTROPY_SOURCE
+#define COAP_ENTROPY_SOURCE()       coapRandomFallbackEntropy()   //override with the hardware RNG read
+#endif
+
+/// CoapRandomState struct, xoshiro128** state owned by one task
+typedef struct
+{
+   uint32_t s[4];                       ///< Generator state, never all zero
+} CoapRandomState;
+
+/// CoapMessageIdGenerator struct, one per socket, shared by everything sending on it
+typedef struct
+{
+   uint16_t next;                       ///< Message id handed out next
+   bool shared;                         ///< Used by several tasks, coapMessageIdNext takes a critical section
+} CoapMessageIdGenerator;
+
+uint32_t coapRandomFallbackEntropy(void);
+void coapRandomSeed(CoapRandomState *pState);
+void coapRandomTaskInit(CoapRandomState *pState);
+uint32_t coapRandomNext(CoapRandomState *pState);
+uint32_t coapRandom32(void);
+void coapGenerateToken(uint8_t *pToken, uint8_t tokenLength);
+void coapMessageIdInit(CoapMessageIdGenerator *pGenerator);
+void coapMessageIdInitShared(CoapMessageIdGenerator *pGenerator);
+uint16_t coapMessageIdNext(CoapMessageIdGenerator *pGenerator);
+
+//! @}
+#endif  /* COAP_RANDOM_H */
@@ -0,0 +1,577 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_retransmit.h"
+#include "coap_stats.h"
+
+/*!*****************************************************************************
+ * \brief Links a pending entry into the timer wheel
+ *
+ * Description:
+ *  Schedules an entry to expire after the given number of ticks.  The slot is
+ *  the tick modulo the wheel size and the remaining revolutions are kept in the
+ *  entry, so insertion is O(1) regardless of the timeout.
+ *
+ * \param CoapRetransmitEngine *pEngine [in\out] - Engine owning the entry.
+ *
+ * \param U8 index [in] - Entry to schedule.
+ *
+ * \param U16 ticks [in] - Ticks until expiry, at least 1.
+ *
+ ********************************************************************************/
+static void coapRetransmitSchedule(CoapRetransmitEngine *pEngine, uint8_t index, uint16_t ticks)
+{
+   CoapPendingMessage *pEntry = &pEngine->entries[index];   // Entry to link.
+   uint8_t slot;                                             // Used to store the target slot.
+
+   if( ticks == 0 )
+   {
+      ticks = 1;
+   }
+
+   slot = (pEngine->currentSlot + ticks) & (COAP_RETRANS_WHEEL_SLOTS - 1);
+
+   pEntry->slot = slot;
+   pEntry->rounds = (ticks - 1) / COAP_RETRANS_WHEEL_SLOTS;
+
+   // Push at the head of the slot.
+   pEntry->wheelPrev = COAP_RETRANS_NONE;
+   pEntry->wheelNext = pEngine->wheel[slot];
+
+   if( pEngine->wheel[slot] != COAP_RETRANS_NONE )
+   {
+      pEngine->entries[pEngine->wheel[slot]].wheelPrev = index;
+   }
+
+   pEngine->wheel[slot] = index;
+}
+
+/*!*****************************************************************************
+ * \brief Unlinks a pending entry from the timer wheel
+ *
+ * \param CoapRetransmitEngine *pEngine [in\out] - Engine owning the entry.
+ *
+ * \param U8 index [in] - Entry to unlink.
+ *
+ ********************************************************************************/
+static void coapRetransmitUnschedule(CoapRetransmitEngine *pEngine, uint8_t index)
+{
+   CoapPendingMessage *pEntry = &pEngine->entries[index];   // Entry to unlink.
+
+   if( pEntry->wheelPrev != COAP_RETRANS_NONE )
+   {
+      pEngine->entries[pEntry->wheelPrev].wheelNext = pEntry->wheelNext;
+   }
+   else
+   {
+      pEngine->wheel[pEntry->slot] = pEntry->wheelNext;
+   }
+
+   if( pEntry->wheelNext != COAP_RETRANS_NONE )
+   {
+      pEngine->entries[pEntry->wheelNext].wheelPrev = pEntry->wheelPrev;
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Finds the pending entry for a message id
+ *
+ * Description:
+ *  Message ids are only unique per endpoint, so the peer is part of the key.
+ *
+ * \param CoapRetransmitEngine *pEngine [in] - Engine to search.
+ *
+ * \param U32 address [in] - Peer address, 0 for a single peer engine.
+ *
+ * \param U16 port [in] - Peer port, 0 for a single peer engine.
+ *
+ * \param U16 messageId [in] - Message id to find.
+ *
+ *
+ * \return Returns the entry index or COAP_RETRANS_NONE.
+ *
+ ********************************************************************************/
+static uint8_t coapRetransmitFind(CoapRetransmitEngine *pEngine, uint32_t address, uint16_t port, uint16_t messageId)
+{
+   uint8_t index = pEngine->hash[messageId & (COAP_RETRANS_HASH_SIZE - 1)];
+   CoapPendingMessage *pEntry;   // Used to store the probed entry.
+
+   while( index != COAP_RETRANS_NONE )
+   {
+      pEntry = &pEngine->entries[index];
+
+      if( pEntry->messageId == messageId && pEntry->port == port && pEntry->address == address )
+      {
+         break;
+      }
+
+      index = pEntry->hashNext;
+   }
+
+   return index;
+}
+
+/*!*****************************************************************************
+ * \brief Releases a pending entry
+ *
+ * Description:
+ *  Removes an entry from the timer wheel and its message id bucket and returns
+ *  it to the free list.
+ *
+ * \param CoapRetransmitEngine *pEngine [in\out] - Engine owning the entry.
+ *
+ * \param U8 index [in] - Entry to release.
+ *
+ ********************************************************************************/
+static void coapRetransmitRelease(CoapRetransmitEngine *pEngine, uint8_t index)
+{
+   CoapPendingMessage *pEntry = &pEngine->entries[index];                       // Entry to release.
+   uint8_t *pLink = &pEngine->hash[pEntry->messageId & (COAP_RETRANS_HASH_SIZE - 1)];  // Used to walk the bucket.
+
+   coapRetransmitUnschedule(pEngine, index);
+
+   // Unlink from the message id bucket.
+   while( *pLink != index )
+   {
+      pLink = &pEngine->entries[*pLink].hashNext;
+   }
+
+   *pLink = pEntry->hashNext;
+
+   if( pEntry->pCongestion != NULL && pEntry->pCongestion->inFlight > 0 )
+   {
+      pEntry->pCongestion->inFlight--;
+   }
+
+   pEntry->inUse = false;
+   pEntry->hashNext = pEngine->freeList;
+   pEngine->freeList = index;
+   pEngine->pendingCount--;
+}
+
+/*!*****************************************************************************
+ * \brief Converts a timeout to wheel ticks
+ *
+ * \param U32 timeoutMs [in] - Timeout in ms.
+ *
+ *
+ * \return Returns the timeout in ticks, rounded up and limited to 16 bits.
+ *
+ ********************************************************************************/
+static uint16_t coapRetransmitTicks(uint32_t timeoutMs)
+{
+   uint32_t ticks = (timeoutMs + COAP_RETRANS_TICK_MS - 1) / COAP_RETRANS_TICK_MS;   // Used to store the ticks.
+
+   return (ticks > COAP_RETRANS_MAX_TIMEOUT_TICKS) ? COAP_RETRANS_MAX_TIMEOUT_TICKS : (uint16_t)ticks;
+}
+
+/*!*****************************************************************************
+ * \brief Initialises a retransmission engine
+ *
+ * Description:
+ *  Prepares an engine to track up to COAP_MAX_PENDING outstanding confirmable
+ *  messages.  The engine is not thread safe; it is meant to be owned by the
+ *  task doing the network I/O.
+ *
+ * \param CoapRetransmitEngine *pEngine [out] - Engine to initialise.
+ *
+ * \param CoapSendCallback send [in] - Used to retransmit messages.
+ *
+ * \param CoapRetransmitCallback complete [in] - Called when an exchange ends.
+ *
+ * \param void *pContext [in] - Passed to send.
+ *
+ ********************************************************************************/
+void coapRetransmitInit(CoapRetransmitEngine *pEngine, CoapSendCallback send, CoapRetransmitCallback complete, void *pContext)
+{
+   uint8_t i;   // Used as an iterator.
+
+   memset(pEngine, 0, sizeof(*pEngine));
+   memset(pEngine->wheel, COAP_RETRANS_NONE, sizeof(pEngine->wheel));
+   memset(pEngine->hash, COAP_RETRANS_NONE, sizeof(pEngine->hash));
+
+   // Chain every entry into the free list.
+   for( i = 0; i < COAP_MAX_PENDING; i++ )
+   {
+      pEngine->entries[i].hashNext = (i + 1 < COAP_MAX_PENDING) ? (i + 1) : COAP_RETRANS_NONE;
+   }
+
+   pEngine->freeList = 0;
+   pEngine->send = send;
+   pEngine->complete = complete;
+   pEngine->pContext = pContext;
+}
+
+/*!*****************************************************************************
+ * \brief Sets the destination state used by coapRetransmitAdd
+ *
+ * Description:
+ *  With a CoapCongestion the engine times its CONs from the CoCoA estimate of
+ *  the destination instead of the fixed ACK_TIMEOUT and keeps its window count
+ *  up to date; the sender checks coapCongestionCanSend before each new CON.
+ *  NULL keeps the fixed RFC 7252 timing.
+ *
+ * \param CoapRetransmitEngine *pEngine [in\out] - Engine to configure.
+ *
+ * \param CoapCongestion *pCongestion [in] - Initialised state or NULL.
+ *
+ ********************************************************************************/
+void coapRetransmitSetCongestion(CoapRetransmitEngine *pEngine, CoapCongestion *pCongestion)
+{
+   pEngine->pCongestion = pCongestion;
+}
+
+/*!*****************************************************************************
+ * \brief Starts tracking a confirmable message
+ *
+ * Description:
+ *  Same as coapRetransmitAddTo for the destination set with
+ *  coapRetransmitSetCongestion.
+ *
+ * \param CoapRetransmitEngine *pEngine [in\out] - Engine to add the message to.
+ *
+ * \param U8 *pBuffer [in] - Encoded CON message.
+ *
+ * \param U16 length [in] - Length of the message.
+ *
+ * \param void *pUserData [in] - Passed back to the completion callback.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapRetransmitAdd(CoapRetransmitEngine *pEngine, uint8_t *pBuffer, uint16_t length, void *pUserData)
+{
+   return coapRetransmitAddTo(pEngine, pEngine->pCongestion, pBuffer, length, pUserData);
+}
+
+/*!*****************************************************************************
+ * \brief Starts tracking a confirmable message to a destination
+ *
+ * Description:
+ *  Registers a CON message that has just been sent for its first transmission.
+ *  Without congestion state the initial timeout is a random value between
+ *  ACK_TIMEOUT and ACK_TIMEOUT * ACK_RANDOM_FACTOR and is doubled on every
+ *  retransmission as per RFC 7252 section 4.2; with it the timeout comes from
+ *  the destination's RTO estimate and the back-off is CoCoA's variable factor.
+ *  The buffer is not copied and must stay valid until the completion callback
+ *  runs or the message is cancelled.
+ *
+ * Retransmission:
+ *          https://tools.ietf.org/html/rfc7252#section-4.2
+ *
+ * \param CoapRetransmitEngine *pEngine [in\out] - Engine to add the message to.
+ *
+ * \param CoapCongestion *pCongestion [in\out] - State of the destination or NULL.
+ *
+ * \param U8 *pBuffer [in] - Encoded CON message.
+ *
+ * \param U16 length [in] - Length of the message.
+ *
+ * \param void *pUserData [in] - Passed back to the completion callback.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapRetransmitAddTo(CoapRetransmitEngine *pEngine, CoapCongestion *pCongestion, uint8_t *pBuffer, uint16_t length, void *pUserData)
+{
+   return coapRetransmitAddPeer(pEngine, pCongestion, 0, 0, pBuffer, length, pUserData);
+}
+
+/*!*****************************************************************************
+ * \brief Starts tracking a confirmable message to one of several peers
+ *
+ * Description:
+ *  Same as coapRetransmitAddTo for an engine serving many endpoints, e.g. a
+ *  gateway shard.  Only an ACK or RST passed to
+ *  coapRetransmitHandleMessageFrom with the same address and port completes
+ *  the message.
+ *
+ * \param CoapRetransmitEngine *pEngine [in\out] - Engine to add the message to.
+ *
+ * \param CoapCongestion *pCongestion [in\out] - State of the destination or NULL.
+ *
+ * \param U32 address [in] - Destination address.
+ *
+ * \param U16 port [in] - Destination port.
+ *
+ * \param U8 *pBuffer [in] - Encoded CON message.
+ *
+ * \param U16 length [in] - Length of the message.
+ *
+ * \param void *pUserData [in] - Passed back to the completion callback.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapRetransmitAddPeer(CoapRetransmitEngine *pEngine, CoapCongestion *pCongestion, uint32_t address, uint16_t port, uint8_t *pBuffer, uint16_t length, void *pUserData)
+{
+   CoapPendingMessage *pEntry;   // Used to fill the new entry.
+   uint16_t messageId;           // Used to store the message id.
+   uint16_t spread;              // Used to randomise the initial timeout.
+   uint8_t index;                // Used to store the new entry.
+   uint8_t bucket;               // Used to store the message id bucket.
+
+   if( length < COAP_HDR_BYTES )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
+   if( coapGetType(pBuffer, length) != COAP_TYPE_CON )
+   {
+      return COAP_INVALID_TYPE;
+   }
+
+   messageId = ((uint16_t)pBuffer[2] << 8) | pBuffer[3];
+
+   // A message id can only be outstanding once per peer.
+   if( coapRetransmitFind(pEngine, address, port, messageId) != COAP_RETRANS_NONE )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
+   if( pEngine->freeList == COAP_RETRANS_NONE )
+   {
+      return COAP_NO_RESOURCES;
+   }
+
+   // Take an entry off the free list.
+   index = pEngine->freeList;
+   pEntry = &pEngine->entries[index];
+   pEngine->freeList = pEntry->hashNext;
+   pEngine->pendingCount++;
+
+   pEntry->pBuffer = pBuffer;
+   pEntry->length = length;
+   pEntry->messageId = messageId;
+   pEntry->address = address;
+   pEntry->port = port;
+   pEntry->retransmitCount = 0;
+   pEntry->inUse = true;
+   pEntry->sentMs = COAP_CONGESTION_NOW_MS();
+   pEntry->pCongestion = pCongestion;
+   pEntry->pUserData = pUserData;
+
+   if( pCongestion != NULL )
+   {
+      // Initial timeout in [RTO, RTO * 1.5] of the destination.
+      pCongestion->inFlight++;
+      pEntry->timeout = coapRetransmitTicks(coapCongestionInitialTimeout(pCongestion, pEntry->sentMs));
+   }
+   else
+   {
+      // Initial timeout in [ACK_TIMEOUT, ACK_TIMEOUT * ACK_RANDOM_FACTOR].
+      spread = (COAP_ACK_TIMEOUT_TICKS * (COAP_ACK_RANDOM_FACTOR_PERCENT - 100)) / 100;
+      pEntry->timeout = COAP_ACK_TIMEOUT_TICKS + (coapGetRandom() % (spread + 1));
+   }
+
+   // Link into the message id bucket.
+   bucket = messageId & (COAP_RETRANS_HASH_SIZE - 1);
+   pEntry->hashNext = pEngine->hash[bucket];
+   pEngine->hash[bucket] = index;
+
+   coapRetransmitSchedule(pEngine, index, pEntry->timeout);
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Stops tracking a confirmable message
+ *
+ * Description:
+ *  Removes a pending message without calling the completion callback, e.g. when
+ *  the application abandons the request.  Only for single peer engines.
+ *
+ * \param CoapRetransmitEngine *pEngine [in\out] - Engine tracking the message.
+ *
+ * \param U16 messageId [in] - Message id to cancel.
+ *
+ *
+ * \return Returns COAP_OK on success or COAP_UNKNOWN_MESSAGE_ID.
+ *
+ ********************************************************************************/
+int8_t coapRetransmitCancel(CoapRetransmitEngine *pEngine, uint16_t messageId)
+{
+   uint8_t index = coapRetransmitFind(pEngine, 0, 0, messageId);   // Entry to cancel.
+
+   if( index == COAP_RETRANS_NONE )
+   {
+      return COAP_UNKNOWN_MESSAGE_ID;
+   }
+
+   coapRetransmitRelease(pEngine, index);
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Matches an incoming ACK or RST to a pending message
+ *
+ * Description:
+ *  Looks up the message id of an incoming ACK or RST in O(1).  A match ends the
+ *  exchange: the entry is released and the completion callback receives COAP_OK
+ *  (ACK, with the view so a piggybacked response can be handled) or
+ *  COAP_MESSAGE_RESET.
+ *
+ * Message matching:
+ *          https://tools.ietf.org/html/rfc7252#section-4.4
+ *
+ * \param CoapRetransmitEngine *pEngine [in\out] - Engine tracking the message.
+ *
+ * \param CoapMessageView *pView [in] - Parsed incoming message.
+ *
+ *
+ * \return Returns COAP_OK if the message completed an exchange, < 0 otherwise.
+ *
+ ********************************************************************************/
+int8_t coapRetransmitHandleMessage(CoapRetransmitEngine *pEngine, CoapMessageView *pView)
+{
+   return coapRetransmitHandleMessageFrom(pEngine, 0, 0, pView);
+}
+
+/*!*****************************************************************************
+ * \brief Matches an incoming ACK or RST from one of several peers
+ *
+ * Description:
+ *  Same as coapRetransmitHandleMessage for messages added with
+ *  coapRetransmitAddPeer: the message id only matches the exchange sent to
+ *  the same address and port, so one client cannot complete another's CON.
+ *
+ * \param CoapRetransmitEngine *pEngine [in\out] - Engine tracking the message.
+ *
+ * \param U32 address [in] - Address of the sender.
+ *
+ * \param U16 port [in] - Port of the sender.
+ *
+ * \param CoapMessageView *pView [in] - Parsed incoming message.
+ *
+ *
+ * \return Returns COAP_OK if the message completed an exchange, < 0 otherwise.
+ *
+ ********************************************************************************/
+int8_t coapRetransmitHandleMessageFrom(CoapRetransmitEngine *pEngine, uint32_t address, uint16_t port, CoapMessageView *pView)
+{
+   CoapPendingMessage *pEntry;   // Used to store the matching entry.
+   uint8_t index;      // Used to store the matching entry.
+   void *pUserData;    // Used to keep the user data past the release.
+   uint32_t now;       // Used to store the ACK time.
+
+   if( pView->type != COAP_TYPE_ACK && pView->type != COAP_TYPE_RST )
+   {
+      return COAP_INVALID_TYPE;
+   }
+
+   index = coapRetransmitFind(pEngine, address, port, pView->messageId);
+
+   if( index == COAP_RETRANS_NONE )
+   {
+      return COAP_UNKNOWN_MESSAGE_ID;
+   }
+
+   pEntry = &pEngine->entries[index];
+   pUserData = pEntry->pUserData;
+
+   if( pEntry->pCongestion != NULL && pView->type == COAP_TYPE_ACK )
+   {
+      now = COAP_CONGESTION_NOW_MS();
+      coapCongestionOnAck(pEntry->pCongestion, now - pEntry->sentMs, pEntry->retransmitCount, now);
+   }
+
+   coapRetransmitRelease(pEngine, index);
+
+   if( pEngine->complete != NULL )
+   {
+      pEngine->complete(pUserData, pView->messageId, (pView->type == COAP_TYPE_ACK) ? COAP_OK : COAP_MESSAGE_RESET, pView);
+   }
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Advances the retransmission timer wheel by one tick
+ *
+ * Description:
+ *  Must be called every COAP_RETRANS_TICK_MS.  Only the entries linked in the
+ *  slot under the wheel hand are visited, so the cost per tick does not grow
+ *  with the number of outstanding messages.  Expired entries are retransmitted
+ *  with a doubled timeout, or completed with COAP_MESSAGE_TIMEOUT once they have
+ *  been retransmitted COAP_MAX_RETRANS_COUNT times.
+ *
+ * \param CoapRetransmitEngine *pEngine [in\out] - Engine to advance.
+ *
+ ********************************************************************************/
+void coapRetransmitTick(CoapRetransmitEngine *pEngine)
+{
+   CoapPendingMessage *pEntry;   // Used to process an entry.
+   uint8_t index;                // Used to walk the slot.
+   uint8_t next;                 // Used to keep the walk past a relink.
+   uint16_t messageId;           // Used to keep the message id past the release.
+   void *pUserData;              // Used to keep the user data past the release.
+
+   pEngine->currentSlot = (pEngine->currentSlot + 1) & (COAP_RETRANS_WHEEL_SLOTS - 1);
+
+   index = pEngine->wheel[pEngine->currentSlot];
+
+   while( index != COAP_RETRANS_NONE )
+   {
+      pEntry = &pEngine->entries[index];
+      next = pEntry->wheelNext;
+
+      if( pEntry->rounds > 0 )
+      {
+         // Not due in this revolution.
+         pEntry->rounds--;
+      }
+      else if( pEntry->retransmitCount < COAP_MAX_RETRANS_COUNT )
+      {
+         // Retransmit and back off exponentially.
+         coapRetransmitUnschedule(pEngine, index);
+
+         pEntry->retransmitCount++;
+
+         if( pEntry->pCongestion != NULL )
+         {
+            // CoCoA variable back-off, the first loss also shrinks the window.
+            pEntry->timeout = coapRetransmitTicks(coapCongestionBackoff(pEntry->pCongestion, (uint32_t)pEntry->timeout * COAP_RETRANS_TICK_MS));
+
+            if( pEntry->retransmitCount == 1 )
+            {
+               coapCongestionOnLoss(pEntry->pCongestion);
+            }
+         }
+         else
+         {
+            pEntry->timeout *= 2;
+         }
+
+         if( pEngine->send != NULL )
+         {
+            pEngine->send(pEngine->pContext, pEntry->pBuffer, pEntry->length);
+         }
+
+         COAP_STAT_INC(COAP_STAT_RETRANSMIT);
+
+         coapRetransmitSchedule(pEngine, index, pEntry->timeout);
+      }
+      else
+      {
+         // Give up on the exchange.
+         messageId = pEntry->messageId;
+         pUserData = pEntry->pUserData;
+
+         coapRetransmitRelease(pEngine, index);
+
+         if( pEngine->complete != NULL )
+         {
+            pEngine->complete(pUserData, messageId, COAP_MESSAGE_TIMEOUT, NULL);
+         }
+      }
+
+      index = next;
+   }
+}
@@ -0,0 +1,79 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_RETRANSMIT_H
+#define COAP_RETRANSMIT_H
+
+#include "coap.h"
+#include "coap_congestion.h"
+
+/*Retransmission Related (RFC 7252 section 4.8)*/
+#define COAP_ACK_TIMEOUT_MS            2000  //initial ACK timeout
+#define COAP_ACK_RANDOM_FACTOR_PERCENT 150   //ACK_RANDOM_FACTOR of 1.5
+#define COAP_MAX_PENDING               16    //outstanding CON messages tracked at once (< 255)
+#define COAP_RETRANS_TICK_MS           100   //period coapRetransmitTick is called at
+#define COAP_RETRANS_WHEEL_SLOTS       64    //timer wheel slots, must be a power of 2
+#define COAP_RETRANS_HASH_SIZE         32    //message id buckets, must be a power of 2
+#define COAP_RETRANS_NONE              0xFF  //end of list marker
+
+#define COAP_ACK_TIMEOUT_TICKS         (COAP_ACK_TIMEOUT_MS / COAP_RETRANS_TICK_MS)
+#define COAP_RETRANS_MAX_TIMEOUT_TICKS 0xFFFF
+
+/// Sends (or re-sends) a message, returns COAP_OK or < 0 for error.
+typedef int8_t (*CoapSendCallback)(void *pContext, uint8_t *pBuffer, uint16_t length);
+
+/// Completion of a confirmable exchange.  result is COAP_OK when acknowledged,
+/// COAP_MESSAGE_RESET or COAP_MESSAGE_TIMEOUT otherwise.  pResponse is the ACK
+/// (possibly with a piggybacked response) or NULL.
+typedef void (*CoapRetransmitCallback)(void *pUserData, uint16_t messageId, int8_t result, CoapMessageView *pResponse);
+
+/// CoapPendingMessage struct
+typedef struct
+{
+   uint8_t *pBuffer;                    ///< Message to retransmit, owned by the caller until completion
+   uint16_t length;                     ///< Length of the message
+   uint16_t messageId;                  ///< Message id of the message
+   uint32_t address;                    ///< Destination address, 0 when the engine has a single peer
+   uint16_t port;                       ///< Destination port, 0 when the engine has a single peer
+   uint16_t timeout;                    ///< Current back-off in ticks
+   uint16_t rounds;                     ///< Wheel revolutions left before expiry
+   uint8_t retransmitCount;             ///< Retransmissions sent so far
+   uint8_t slot;                        ///< Wheel slot the entry is linked in
+   uint8_t wheelNext;                   ///< Next entry in the wheel slot
+   uint8_t wheelPrev;                   ///< Previous entry in the wheel slot
+   uint8_t hashNext;                    ///< Next entry in the message id bucket
+   bool inUse;                          ///< Entry is tracking a message
+   uint32_t sentMs;                     ///< COAP_CONGESTION_NOW_MS() of the first transmission
+   CoapCongestion *pCongestion;         ///< Destination state, NULL for fixed RFC 7252 timing
+   void *pUserData;                     ///< Passed back to the completion callback
+} CoapPendingMessage;
+
+/// CoapRetransmitEngine struct
+typedef struct
+{
+   CoapPendingMessage entries[COAP_MAX_PENDING];  ///< Fixed pool of pending entries
+   uint8_t wheel[COAP_RETRANS_WHEEL_SLOTS];       ///< Head entry of each wheel slot
+   uint8_t hash[COAP_RETRANS_HASH_SIZE];          ///< Head entry of each message id bucket
+   uint8_t freeList;                              ///< Head of the free entries
+   uint8_t currentSlot;                           ///< Slot the wheel hand points at
+   uint8_t pendingCount;                          ///< Number of entries in use
+   CoapCongestion *pCongestion;                   ///< Destination of coapRetransmitAdd, may be NULL
+   CoapSendCallback send;                         ///< Used to retransmit
+   CoapRetransmitCallback complete;               ///< Called once per exchange
+   void *pContext;                                ///< Passed to send
+} CoapRetransmitEngine;
+
+void coapRetransmitInit(CoapRetransmitEngine *pEngine, CoapSendCallback send, CoapRetransmitCallback complete, void *pContext);
+void coapRetransmitSetCongestion(CoapRetransmitEngine *pEngine, CoapCongestion *pCongestion);
+int8_t coapRetransmitAdd(CoapRetransmitEngine *pEngine, uint8_t *pBuffer, uint16_t length, void *pUserData);
+int8_t coapRetransmitAddTo(CoapRetransmitEngine *pEngine, CoapCongestion *pCongestion, uint8_t *pBuffer, uint16_t length, void *pUserData);
+int8_t coapRetransmitAddPeer(CoapRetransmitEngine *pEngine, CoapCongestion *pCongestion, uint32_t address, uint16_t port, uint8_t *pBuffer, uint16_t length, void *pUserData);
+int8_t coapRetransmitCancel(CoapRetransmitEngine *pEngine, uint16_t messageId);
+int8_t coapRetransmitHandleMessage(CoapRetransmitEngine *pEngine, CoapMessageView *pView);
+int8_t coapRetransmitHandleMessageFrom(CoapRetransmitEngine *pEngine, uint32_t address, uint16_t port, CoapMessageView *pView);
+void coapRetransmitTick(CoapRetransmitEngine *pEngine);
+
+//! @}
+#endif  /* COAP_RETRANSMIT_H */
@@ -0,0 +1,281 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_ring.h"
+#include "coap_task.h"
+
+/*!*****************************************************************************
+ * \brief Initialises a ring
+ *
+ * Description:
+ *  Every slab buffer starts on the free ring.  Register the ring with
+ *  coapTaskAddRing before the producer starts pushing.
+ *
+ * \param CoapRing *pRing [out] - Ring to initialise.
+ *
+ ********************************************************************************/
+void coapRingInit(CoapRing *pRing)
+{
+   uint16_t i;   // Used as an iterator.
+
+   memset(pRing, 0, sizeof(*pRing));
+
+   for( i = 0; i < COAP_RING_SIZE; i++ )
+   {
+      pRing->pFree[i] = pRing->buffers[i];
+   }
+
+   pRing->freeHead = COAP_RING_SIZE;
+}
+
+/*!*****************************************************************************
+ * \brief Takes a slab buffer for the next request
+ *
+ * Description:
+ *  Only called by the producer of the ring, from a task or an ISR.  Takes no
+ *  lock: the free ring is the reverse of the request ring, coapTask fills it
+ *  in coapRingRelease and the producer empties it here.
+ *
+ * \param CoapRing *pRing [in\out] - Ring of the calling producer.
+ *
+ *
+ * \return Returns a COAP_RING_BUFFER_SIZE buffer or NULL while every buffer
+ *         is queued or waiting for its exchange to complete.
+ *
+ ********************************************************************************/
+uint8_t *coapRingAlloc(CoapRing *pRing)
+{
+   uint16_t freeTail = pRing->freeTail;   // Used to store the entry to take.
+   uint8_t *pBuffer;                      // Used to store the buffer.
+
+   if( pRing->freeHead == freeTail )
+   {
+      return NULL;
+   }
+
+   // The entry was written before freeHead, don't let the read move ahead of it.
+   COAP_RING_BARRIER();
+   pBuffer = pRing->pFree[freeTail & (COAP_RING_SIZE - 1)];
+
+   COAP_RING_BARRIER();
+   pRing->freeTail = freeTail + 1;
+
+   return pBuffer;
+}
+
+/*!*****************************************************************************
+ * \brief Publishes a request in the next slot
+ *
+ * Description:
+ *  The slot is written before head moves, so coapTask never sees a half
+ *  written slot.  tail is read back after head is published: if coapTask had
+ *  already sent everything it may be about to sleep and has to be woken.  If
+ *  it had not, it is still draining and will see the new head itself, so the
+ *  notification is only sent on the empty to non-empty transition.
+ *
+ * \param CoapRing *pRing [in\out] - Ring of the calling producer.
+ *
+ * \param U8 *pBuffer [in] - Request from coapRingAlloc.
+ *
+ * \param U16 length [in] - Length of the request.
+ *
+ * \param bool *pWasEmpty [out] - The ring was empty, coapTask must be woken.
+ *
+ *
+ * \return Returns COAP_OK, COAP_INVALID_BUFFER_LENGTH or COAP_NO_RESOURCES
+ *         if the ring is full.
+ *
+ ********************************************************************************/
+static int8_t coapRingPublish(CoapRing *pRing, uint8_t *pBuffer, uint16_t length, bool *pWasEmpty)
+{
+   uint16_t head = pRing->head;   // Used to store the slot to fill.
+   CoapRingSlot *pSlot;           // Used to store the slot.
+
+   if( length < COAP_HDR_BYTES || length > COAP_RING_BUFFER_SIZE )
+   {
+      return COAP_INVALID_BUFFER_LENGTH;
+   }
+
+   if( (uint16_t)(head - pRing->tail) >= COAP_RING_SIZE )
+   {
+      return COAP_NO_RESOURCES;
+   }
+
+   pSlot = &pRing->slots[head & (COAP_RING_SIZE - 1)];
+   pSlot->pBuffer = pBuffer;
+   pSlot->length = length;
+
+   COAP_RING_BARRIER();
+   pRing->head = head + 1;
+   COAP_RING_BARRIER();
+
+   *pWasEmpty = (pRing->tail == head);
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Hands a slab request to coapTask
+ *
+ * Description:
+ *  Never blocks and takes no lock.  Only one task may push to a ring.  On
+ *  success the buffer belongs to coapTask, which returns it to the free ring
+ *  once the exchange completes; a CON is retransmitted, the result is not
+ *  reported back.  coapTask writes the message id and token when it sends
+ *  the request, so the producer only encodes the rest, e.g. with
+ *  coapTemplateBuild and any id.  The slab has one buffer per slot, so a
+ *  buffer from coapRingAlloc always finds a free slot.
+ *
+ * \param CoapRing *pRing [in\out] - Ring of the calling task.
+ *
+ * \param U8 *pBuffer [in] - Request from coapRingAlloc.
+ *
+ * \param U16 length [in] - Length of the request.
+ *
+ *
+ * \return Returns COAP_OK, COAP_INVALID_BUFFER_LENGTH if length does not fit
+ *         a slab buffer or COAP_NO_RESOURCES if the ring is full, the caller
+ *         keeps the buffer on error.
+ *
+ ********************************************************************************/
+int8_t coapRingPush(CoapRing *pRing, uint8_t *pBuffer, uint16_t length)
+{
+   bool wasEmpty = false;   // Used to store whether coapTask must be woken.
+   int8_t results;          // Used to store the results.
+
+   results = coapRingPublish(pRing, pBuffer, length, &wasEmpty);
+
+   if( wasEmpty )
+   {
+      coapTaskNotifySend();
+   }
+
+   return results;
+}
+
+/*!*****************************************************************************
+ * \brief Hands a slab request to coapTask, interrupt version
+ *
+ * Description:
+ *  The ring must only be pushed to from this ISR.  With coapRingAlloc the
+ *  per-sample path takes no lock; only the notification sent on the empty
+ *  to non-empty transition masks interrupts briefly inside FreeRTOS.
+ *
+ * \param CoapRing *pRing [in\out] - Ring of the calling ISR.
+ *
+ * \param U8 *pBuffer [in] - Request from coapRingAlloc.
+ *
+ * \param U16 length [in] - Length of the request.
+ *
+ * \param BaseType_t *pHigherPriorityTaskWoken [out] - Set if a yield is needed.
+ *
+ *
+ * \return Returns COAP_OK, COAP_INVALID_BUFFER_LENGTH if length does not fit
+ *         a slab buffer or COAP_NO_RESOURCES if the ring is full, the caller
+ *         keeps the buffer on error.
+ *
+ ********************************************************************************/
+int8_t coapRingPushFromISR(CoapRing *pRing, uint8_t *pBuffer, uint16_t length, BaseType_t *pHigherPriorityTaskWoken)
+{
+   bool wasEmpty = false;   // Used to store whether coapTask must be woken.
+   int8_t results;          // Used to store the results.
+
+   results = coapRingPublish(pRing, pBuffer, length, &wasEmpty);
+
+   if( wasEmpty )
+   {
+      coapTaskNotifySendFromISR(pHigherPriorityTaskWoken);
+   }
+
+   return results;
+}
+
+/*!*****************************************************************************
+ * \brief Gets the oldest request without removing it
+ *
+ * Description:
+ *  Only called by coapTask, the slot stays in the ring until coapRingPop so a
+ *  CON can wait there for the congestion window.
+ *
+ * \param CoapRing *pRing [in] - Ring to read.
+ *
+ *
+ * \return Returns the slot or NULL if the ring is empty.
+ *
+ ********************************************************************************/
+CoapRingSlot *coapRingPeek(CoapRing *pRing)
+{
+   uint16_t tail = pRing->tail;   // Used to store the slot to send.
+
+   if( pRing->head == tail )
+   {
+      return NULL;
+   }
+
+   // The slot was written before head, don't let the read move ahead of it.
+   COAP_RING_BARRIER();
+
+   return &pRing->slots[tail & (COAP_RING_SIZE - 1)];
+}
+
+/*!*****************************************************************************
+ * \brief Removes the request returned by coapRingPeek
+ *
+ * Description:
+ *  Only called by coapTask.  The barrier after tail pairs with the one in
+ *  coapRingPublish: either the producer sees the ring empty and notifies, or
+ *  coapTask sees the new head on its next coapRingPeek.
+ *
+ * \param CoapRing *pRing [in\out] - Ring to advance.
+ *
+ ********************************************************************************/
+void coapRingPop(CoapRing *pRing)
+{
+   COAP_RING_BARRIER();
+   pRing->tail = pRing->tail + 1;
+   COAP_RING_BARRIER();
+}
+
+/*!*****************************************************************************
+ * \brief Returns a slab buffer to the producer
+ *
+ * Description:
+ *  Only called by coapTask once the exchange of a popped request completes.
+ *  The free ring cannot overflow, it has an entry for every slab buffer.
+ *
+ * \param CoapRing *pRing [in\out] - Ring the buffer came from.
+ *
+ * \param U8 *pBuffer [in] - Buffer from coapRingAlloc.
+ *
+ ********************************************************************************/
+void coapRingRelease(CoapRing *pRing, uint8_t *pBuffer)
+{
+   uint16_t freeHead = pRing->freeHead;   // Used to store the entry to fill.
+
+   pRing->pFree[freeHead & (COAP_RING_SIZE - 1)] = pBuffer;
+
+   COAP_RING_BARRIER();
+   pRing->freeHead = freeHead + 1;
+}
+
+/*!*****************************************************************************
+ * \brief Gets the number of requests in a ring
+ *
+ * Description:
+ *  A snapshot when called by the producer or another task.
+ *
+ * \param CoapRing *pRing [in] - Ring to read.
+ *
+ *
+ * \return Returns the number of queued requests.
+ *
+ ********************************************************************************/
+uint16_t coapRingCount(const CoapRing *pRing)
+{
+   return (uint16_t)(pRing->head - pRing->tail);
+}
+
+//! @}
@@ -0,0 +1,64 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_RING_H
+#define COAP_RING_H
+
+#include "coap.h"
+#include "coap_template.h"
+
+/*Producer Ring Related*/
+#ifndef COAP_RING_SIZE
+#define COAP_RING_SIZE              16    //slots of one ring, a power of 2 up to 32768
+#endif
+#ifndef COAP_RING_PAYLOAD_SIZE
+#define COAP_RING_PAYLOAD_SIZE      64    //payload bytes of one sample
+#endif
+#define COAP_RING_BUFFER_SIZE       (COAP_TEMPLATE_SIZE + 1 + COAP_RING_PAYLOAD_SIZE)   //template, payload marker, payload
+#ifndef COAP_RING_MAX_RINGS
+#define COAP_RING_MAX_RINGS         4     //rings coapTask drains, one per producer task or ISR
+#endif
+
+// Orders the slot write before the index that publishes it, and the index
+// write before the other index is read.  DMB on Cortex-M, override for other
+// compilers.
+#ifndef COAP_RING_BARRIER
+#define COAP_RING_BARRIER()         __sync_synchronize()
+#endif
+
+#if (COAP_RING_SIZE & (COAP_RING_SIZE - 1)) != 0 || COAP_RING_SIZE > 32768
+#error "COAP_RING_SIZE must be a power of 2 up to 32768"
+#endif
+
+/// CoapRingSlot struct, a slab buffer handed to coapTask
+typedef struct
+{
+   uint8_t *pBuffer;                    ///< Encoded NON or CON request from coapRingAlloc, id and token set by coapTask
+   uint16_t length;                     ///< Length of the request
+} CoapRingSlot;
+
+/// CoapRing struct, single producer and single consumer (coapTask), no lock
+typedef struct
+{
+   CoapRingSlot slots[COAP_RING_SIZE];  ///< Requests, indexed by head and tail modulo COAP_RING_SIZE
+   volatile uint16_t head;              ///< Next slot to fill, only written by the producer
+   volatile uint16_t tail;              ///< Next slot to send, only written by coapTask
+   uint8_t *pFree[COAP_RING_SIZE];      ///< Buffers returned by coapTask, indexed by freeHead and freeTail
+   volatile uint16_t freeHead;          ///< Next free entry to fill, only written by coapTask
+   volatile uint16_t freeTail;          ///< Next free entry to take, only written by the producer
+   uint8_t buffers[COAP_RING_SIZE][COAP_RING_BUFFER_SIZE];  ///< Slab, one buffer per slot so a push never finds the ring full
+} CoapRing;
+
+void coapRingInit(CoapRing *pRing);
+uint8_t *coapRingAlloc(CoapRing *pRing);
+int8_t coapRingPush(CoapRing *pRing, uint8_t *pBuffer, uint16_t length);
+int8_t coapRingPushFromISR(CoapRing *pRing, uint8_t *pBuffer, uint16_t length, BaseType_t *pHigherPriorityTaskWoken);
+CoapRingSlot *coapRingPeek(CoapRing *pRing);
+void coapRingPop(CoapRing *pRing);
+void coapRingRelease(CoapRing *pRing, uint8_t *pBuffer);
+uint16_t coapRingCount(const CoapRing *pRing);
+
+//! @}
+#endif  /* COAP_RING_H */
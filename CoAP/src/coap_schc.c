@@ -0,0 +1,400 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_schc.h"
+
+// Request shapes sent over the radio, RuleID = index + 1.  Device and gateway
+// build the same rules from the names in coap.h.
+static const CoapSchcRuleSpec coapSchcRuleSpecs[COAP_SCHC_RULE_COUNT] =
+{
+   { COAP_POST, PACKET_ALIAS, COAP_FORMAT_CBOR },
+   { COAP_POST, PACKET_ALIAS, COAP_FORMAT_OCTET_STREAM },
+   { COAP_GET, CONFIG_ALIAS, COAP_FORMAT_NONE },
+   { COAP_GET, LED_ALIAS, COAP_FORMAT_NONE },
+   { COAP_PUT, LED_ALIAS, COAP_FORMAT_TEXT_PLAIN }
+};
+
+/*!*****************************************************************************
+ * \brief Generates the compression rules of one device
+ *
+ * Description:
+ *  Encodes the options of every request shape (Uri-Host, Uri-Path
+ *  prefix/alias/CIK and Content-Format) once with coapTemplateInitFrom.  A
+ *  request matches a rule when its code and option bytes are identical, which
+ *  is exact because option encoding is canonical.  The CIK makes the rules
+ *  per device: a device builds its context from coapConfigGet, a gateway
+ *  keeps one context per device (e.g. per link address) built from that
+ *  device's coapConfigDevice, and decompresses with the context of the
+ *  sender.  Rules whose options do not fit are left unmatched.
+ *
+ * Rule definition:
+ *          https://tools.ietf.org/html/rfc8724#section-7
+ *
+ * \param CoapSchcContext *pContext [out] - Context to build.
+ *
+ * \param CoapConfig *pConfig [in] - Endpoint of the device, must stay valid.
+ *
+ ********************************************************************************/
+void coapSchcInit(CoapSchcContext *pContext, const CoapConfig *pConfig)
+{
+   CoapTemplate request;   // Used to encode the options.
+   uint8_t i;              // Used as an iterator.
+
+   pContext->pConfig = pConfig;
+   pContext->generation = pConfig->generation;
+
+   for( i = 0; i < COAP_SCHC_RULE_COUNT; i++ )
+   {
+      pContext->rules[i].code = coapSchcRuleSpecs[i].code;
+      pContext->rules[i].optionsLength = 0;
+
+      if( coapTemplateInitFrom(&request, pConfig, COAP_TYPE_CON, coapSchcRuleSpecs[i].code, coapSchcRuleSpecs[i].pAlias,
+                               coapSchcRuleSpecs[i].format) == COAP_OK )
+      {
+         pContext->rules[i].optionsLength = request.length - COAP_HDR_BYTES - request.tokenLength;
+         memcpy(pContext->rules[i].options, request.buffer + COAP_HDR_BYTES + request.tokenLength, pContext->rules[i].optionsLength);
+      }
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Picks up a changed endpoint, e.g. a rotated CIK
+ *
+ * Description:
+ *  Rebuilds the rules if the configuration they were built from changed,
+ *  otherwise costs one compare.  coapSchcSend and coapSchcReceive call this,
+ *  so both ends follow a rotation once each has the new CIK; a datagram
+ *  compressed with the old rules in between decompresses with the new CIK.
+ *
+ * \param CoapSchcContext *pContext [in\out] - Context from coapSchcInit.
+ *
+ ********************************************************************************/
+void coapSchcRefresh(CoapSchcContext *pContext)
+{
+   if( pContext->generation != pContext->pConfig->generation )
+   {
+      coapSchcInit(pContext, pContext->pConfig);
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Compresses a CoAP message for the radio link
+ *
+ * Description:
+ *  Version is elided, Type and TKL share one byte and Message ID and Token
+ *  are sent in full (value-sent).  A request matching a rule loses its code
+ *  and options, and the response rule keeps the code of messages without
+ *  options; the payload marker is implied by a payload.  The Exosite POST of
+ *  about 80 header bytes goes out as 8.  Anything else is sent behind the
+ *  uncompressed RuleID.  Residues are byte aligned, so neither end shifts
+ *  bits and decompression is two copies.
+ *
+ * SCHC for CoAP:
+ *          https://tools.ietf.org/html/rfc8824#section-5
+ *
+ * Compressed packet:
+ *          https://tools.ietf.org/html/rfc8724#section-7.2
+ *
+ *
+ * \param CoapSchcContext *pContext [in] - Rules of the device.
+ *
+ * \param U8 *pPacket [in] - CoAP message.
+ *
+ * \param U16 length [in] - Length of the message.
+ *
+ * \param U8 *pBuffer [out] - Receives the compressed datagram.
+ *
+ * \param U16 bufferSize [in] - Size of pBuffer, length + 1 always fits.
+ *
+ * \param U16 *pLength [out] - Length of the compressed datagram.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapSchcCompress(const CoapSchcContext *pContext, const uint8_t *pPacket, uint16_t length, uint8_t *pBuffer, uint16_t bufferSize, uint16_t *pLength)
+{
+   const uint8_t *pOptions;                 // Used to store the first byte after the token.
+   const uint8_t *pEnd = pPacket + length;  // Used to store the end of the message.
+   const uint8_t *pPayload = NULL;          // Used to store the payload.
+   const CoapSchcRule *pRule;               // Used to store the current rule.
+   uint8_t tokenLength;                     // Used to store the token length.
+   uint8_t ruleId = COAP_SCHC_RULE_UNCOMPRESSED;   // Used to store the matching rule.
+   uint8_t *pPointer = pBuffer;             // Used to write the residue.
+   uint8_t i;                               // Used as an iterator.
+
+   tokenLength = (length > 0) ? pPacket[0] & COAP_HDR_TKL_MASK : 0;
+
+   if( length >= COAP_HDR_BYTES && (pPacket[0] >> 6) == COAP_VERSION && tokenLength <= MAX_TOKEN_LENGTH &&
+       length >= COAP_HDR_BYTES + tokenLength )
+   {
+      pOptions = pPacket + COAP_HDR_BYTES + tokenLength;
+
+      if( pOptions == pEnd || (pOptions[0] == COAP_PAYLOAD_MARKER && pOptions + 1 < pEnd) )
+      {
+         ruleId = COAP_SCHC_RULE_RESPONSE;
+         pPayload = pOptions;
+      }
+
+      for( i = 0; i < COAP_SCHC_RULE_COUNT && ruleId == COAP_SCHC_RULE_UNCOMPRESSED; i++ )
+      {
+         pRule = &pContext->rules[i];
+
+         if( pRule->optionsLength == 0 || pRule->code != pPacket[1] || pEnd - pOptions < pRule->optionsLength ||
+             memcmp(pOptions, pRule->options, pRule->optionsLength) != 0 )
+         {
+            continue;
+         }
+
+         pPayload = pOptions + pRule->optionsLength;
+
+         if( pPayload == pEnd || (pPayload[0] == COAP_PAYLOAD_MARKER && pPayload + 1 < pEnd) )
+         {
+            ruleId = i + 1;
+         }
+      }
+   }
+
+   if( ruleId == COAP_SCHC_RULE_UNCOMPRESSED )
+   {
+      if( bufferSize < 1 + length )
+      {
+         return COAP_INSUFFICIENT_BUFFER;
+      }
+
+      pBuffer[0] = COAP_SCHC_RULE_UNCOMPRESSED;
+      memcpy(pBuffer + 1, pPacket, length);
+      *pLength = 1 + length;
+
+      return COAP_OK;
+   }
+
+   // Skip the payload marker, its presence is implied by the length.
+   if( pPayload != pEnd )
+   {
+      pPayload++;
+   }
+
+   if( bufferSize < 5 + tokenLength + (pEnd - pPayload) )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   *pPointer++ = ruleId;
+   *pPointer++ = pPacket[0] & (COAP_HDR_TYPE_MASK | COAP_HDR_TKL_MASK);
+
+   if( ruleId == COAP_SCHC_RULE_RESPONSE )
+   {
+      *pPointer++ = pPacket[1];
+   }
+
+   *pPointer++ = pPacket[2];
+   *pPointer++ = pPacket[3];
+   memcpy(pPointer, pPacket + COAP_HDR_BYTES, tokenLength);
+   pPointer += tokenLength;
+   memcpy(pPointer, pPayload, pEnd - pPayload);
+   pPointer += pEnd - pPayload;
+
+   *pLength = pPointer - pBuffer;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Restores a CoAP message compressed by coapSchcCompress
+ *
+ * \param CoapSchcContext *pContext [in] - Rules of the device that sent it.
+ *
+ * \param U8 *pCompressed [in] - Compressed datagram.
+ *
+ * \param U16 length [in] - Length of the datagram.
+ *
+ * \param U8 *pBuffer [out] - Receives the CoAP message.
+ *
+ * \param U16 bufferSize [in] - Size of pBuffer.
+ *
+ * \param U16 *pLength [out] - Length of the CoAP message.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapSchcDecompress(const CoapSchcContext *pContext, const uint8_t *pCompressed, uint16_t length, uint8_t *pBuffer, uint16_t bufferSize, uint16_t *pLength)
+{
+   const uint8_t *pPointer = pCompressed;     // Used to read the residue.
+   const uint8_t *pEnd = pCompressed + length;   // Used to store the end of the datagram.
+   const CoapSchcRule *pRule = NULL;          // Used to store the rule.
+   uint8_t ruleId;                            // Used to store the RuleID.
+   uint8_t tokenLength;                       // Used to store the token length.
+   uint8_t code;                              // Used to store the code.
+   uint16_t payloadLength;                    // Used to store the payload length.
+   uint8_t *pOut = pBuffer;                   // Used to write the message.
+
+   if( length < 1 )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
+   ruleId = *pPointer++;
+
+   if( ruleId == COAP_SCHC_RULE_UNCOMPRESSED )
+   {
+      if( bufferSize < length - 1 )
+      {
+         return COAP_INSUFFICIENT_BUFFER;
+      }
+
+      memcpy(pBuffer, pPointer, length - 1);
+      *pLength = length - 1;
+
+      return COAP_OK;
+   }
+
+   if( ruleId != COAP_SCHC_RULE_RESPONSE )
+   {
+      if( ruleId > COAP_SCHC_RULE_COUNT || pContext->rules[ruleId - 1].optionsLength == 0 )
+      {
+         return COAP_INVALID_PACKET;
+      }
+
+      pRule = &pContext->rules[ruleId - 1];
+   }
+
+   if( pEnd - pPointer < ((pRule == NULL) ? 4 : 3) )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
+   tokenLength = pPointer[0] & COAP_HDR_TKL_MASK;
+
+   if( !coapTokenLengthIsValid(tokenLength) )
+   {
+      return COAP_INVALID_TOKEN_LENGTH;
+   }
+
+   pOut[0] = (COAP_VERSION << 6) | (pPointer[0] & (COAP_HDR_TYPE_MASK | COAP_HDR_TKL_MASK));
+   pPointer++;
+
+   code = (pRule == NULL) ? *pPointer++ : pRule->code;
+
+   if( pEnd - pPointer < 2 + tokenLength )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
+   payloadLength = pEnd - pPointer - 2 - tokenLength;
+
+   if( bufferSize < COAP_HDR_BYTES + tokenLength + ((pRule == NULL) ? 0 : pRule->optionsLength) + ((payloadLength > 0) ? 1 + payloadLength : 0) )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   pOut[1] = code;
+   pOut[2] = pPointer[0];
+   pOut[3] = pPointer[1];
+   pPointer += 2;
+   pOut += COAP_HDR_BYTES;
+
+   memcpy(pOut, pPointer, tokenLength);
+   pOut += tokenLength;
+   pPointer += tokenLength;
+
+   if( pRule != NULL )
+   {
+      memcpy(pOut, pRule->options, pRule->optionsLength);
+      pOut += pRule->optionsLength;
+   }
+
+   if( payloadLength > 0 )
+   {
+      *pOut++ = COAP_PAYLOAD_MARKER;
+      memcpy(pOut, pPointer, payloadLength);
+      pOut += payloadLength;
+   }
+
+   *pLength = pOut - pBuffer;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief CoapSendCallback of the compressing transport
+ *
+ * Description:
+ *  Compresses the message and sends it over the radio transport.  Give
+ *  coapTaskInit a CoapTransport of coapSchcSend, coapSchcReceive and a
+ *  CoapSchcLink whose pContext was built with coapSchcInit; coapTask and the
+ *  retransmission engine then send and receive
+ *  plain CoAP while only compressed datagrams go over the air.
+ *
+ * \param void *pContext [in] - CoapSchcLink of the radio.
+ *
+ * \param U8 *pBuffer [in] - CoAP message to send.
+ *
+ * \param U16 length [in] - Length of the message.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapSchcSend(void *pContext, uint8_t *pBuffer, uint16_t length)
+{
+   CoapSchcLink *pLink = (CoapSchcLink *)pContext;   // Used to access the link.
+   uint16_t compressedLength;                       // Used to store the compressed length.
+   int8_t results;                                  // Used to store the results.
+
+   coapSchcRefresh(pLink->pContext);
+
+   results = coapSchcCompress(pLink->pContext, pBuffer, length, pLink->buffer, sizeof(pLink->buffer), &compressedLength);
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   return pLink->radio.send(pLink->radio.pContext, pLink->buffer, compressedLength);
+}
+
+/*!*****************************************************************************
+ * \brief CoapReceiveCallback of the compressing transport
+ *
+ * \param void *pContext [in] - CoapSchcLink of the radio.
+ *
+ * \param U8 *pBuffer [out] - Receives the CoAP message.
+ *
+ * \param U16 bufferSize [in] - Size of pBuffer.
+ *
+ *
+ * \return Returns the message length, 0 if nothing is waiting or < 0 for error.
+ *
+ ********************************************************************************/
+int16_t coapSchcReceive(void *pContext, uint8_t *pBuffer, uint16_t bufferSize)
+{
+   CoapSchcLink *pLink = (CoapSchcLink *)pContext;   // Used to access the link.
+   int16_t received;                                // Used to store the datagram length.
+   uint16_t length;                                 // Used to store the message length.
+   int8_t results;                                  // Used to store the results.
+
+   received = pLink->radio.receive(pLink->radio.pContext, pLink->buffer, sizeof(pLink->buffer));
+
+   if( received <= 0 )
+   {
+      return received;
+   }
+
+   coapSchcRefresh(pLink->pContext);
+
+   results = coapSchcDecompress(pLink->pContext, pLink->buffer, received, pBuffer, bufferSize, &length);
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   return length;
+}
+
+//! @}
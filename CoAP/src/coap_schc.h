@@ -0,0 +1,59 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_SCHC_H
+#define COAP_SCHC_H
+
+#include "coap.h"
+#include "coap_task.h"
+#include "coap_template.h"
+
+/*Header Compression Related (SCHC, RFC 8724 / RFC 8824)*/
+#define COAP_SCHC_RULE_RESPONSE       0x00   //messages without options (responses, empty ACK/RST), code sent
+#define COAP_SCHC_RULE_UNCOMPRESSED   0xFF   //no rule matched, the CoAP message follows as is
+#define COAP_SCHC_OPTIONS_SIZE        (COAP_TEMPLATE_SIZE - COAP_HDR_BYTES - COAP_TEMPLATE_TOKEN_LENGTH)
+#define COAP_SCHC_RULE_COUNT          5      //request rules, RuleIDs 1 to COAP_SCHC_RULE_COUNT
+
+/// CoapSchcRuleSpec struct, the request shape a rule is generated from
+typedef struct
+{
+   CoapCode code;                       ///< Method of the request
+   const char *pAlias;                  ///< Exosite alias in the Uri-Path
+   CoapContentFormat format;            ///< Content-Format or COAP_FORMAT_NONE
+} CoapSchcRuleSpec;
+
+/// CoapSchcRule struct, the fields a request rule elides
+typedef struct
+{
+   uint8_t code;                                ///< Code the rule matches
+   uint8_t optionsLength;                       ///< Length of options
+   uint8_t options[COAP_SCHC_OPTIONS_SIZE];     ///< Encoded Uri-Host, Uri-Path and Content-Format
+} CoapSchcRule;
+
+/// CoapSchcContext struct, the rules of one device
+typedef struct
+{
+   CoapSchcRule rules[COAP_SCHC_RULE_COUNT];    ///< Request rules, RuleID = index + 1
+   const CoapConfig *pConfig;                   ///< Endpoint of the device the rules are built for
+   uint16_t generation;                         ///< pConfig generation the rules were built from
+} CoapSchcContext;
+
+/// CoapSchcLink struct, the pContext of a compressing CoapTransport
+typedef struct
+{
+   CoapTransport radio;                 ///< Transport carrying the compressed datagrams
+   CoapSchcContext *pContext;           ///< Rules of the device at the other end of the radio
+   uint8_t buffer[MAX_BUFFER_SIZE + 1]; ///< Compressed datagram being sent or received
+} CoapSchcLink;
+
+void coapSchcInit(CoapSchcContext *pContext, const CoapConfig *pConfig);
+void coapSchcRefresh(CoapSchcContext *pContext);
+int8_t coapSchcCompress(const CoapSchcContext *pContext, const uint8_t *pPacket, uint16_t length, uint8_t *pBuffer, uint16_t bufferSize, uint16_t *pLength);
+int8_t coapSchcDecompress(const CoapSchcContext *pContext, const uint8_t *pCompressed, uint16_t length, uint8_t *pBuffer, uint16_t bufferSize, uint16_t *pLength);
+int8_t coapSchcSend(void *pContext, uint8_t *pBuffer, uint16_t length);
+int16_t coapSchcReceive(void *pContext, uint8_t *pBuffer, uint16_t bufferSize);
+
+//! @}
+#endif  /* COAP_SCHC_H */
@@ -0,0 +1,303 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_sensor.h"
+
+#define COAP_CBOR_UINT              0x00
+#define COAP_CBOR_NEGATIVE          0x20
+#define COAP_CBOR_BYTES             0x40
+#define COAP_CBOR_ARRAY             0x80
+#define COAP_CBOR_MAP               0xA0
+#define COAP_SENSOR_VARINT_MAX      3    //bytes of a zigzag LEB128 17 bit value
+
+/*!*****************************************************************************
+ * \brief Writes a CBOR item head
+ *
+ * Description:
+ *  Uses the shortest argument encoding (RFC 7049 section 3.9 canonical form).
+ *
+ * Major types:
+ *          https://tools.ietf.org/html/rfc7049#section-2.1
+ *
+ * \param U8 major [in] - Major type, already shifted into the top 3 bits.
+ *
+ * \param U32 value [in] - Argument of the item.
+ *
+ * \param U8 *pPointer [out] - Where the head is written, 5 bytes must be free.
+ *
+ *
+ * \return Returns the number of bytes written.
+ *
+ ********************************************************************************/
+static uint8_t coapCborHead(uint8_t major, uint32_t value, uint8_t *pPointer)
+{
+   if( value < 24 )
+   {
+      pPointer[0] = major | value;
+      return 1;
+   }
+
+   if( value <= 0xFF )
+   {
+      pPointer[0] = major | 24;
+      pPointer[1] = value;
+      return 2;
+   }
+
+   if( value <= 0xFFFF )
+   {
+      pPointer[0] = major | 25;
+      pPointer[1] = value >> 8;
+      pPointer[2] = value & 0xFF;
+      return 3;
+   }
+
+   pPointer[0] = major | 26;
+   pPointer[1] = value >> 24;
+   pPointer[2] = (value >> 16) & 0xFF;
+   pPointer[3] = (value >> 8) & 0xFF;
+   pPointer[4] = value & 0xFF;
+   return 5;
+}
+
+/*!*****************************************************************************
+ * \brief Writes a CBOR integer
+ *
+ * \param S32 value [in] - Value to write.
+ *
+ * \param U8 *pPointer [out] - Where the item is written, 5 bytes must be free.
+ *
+ *
+ * \return Returns the number of bytes written.
+ *
+ ********************************************************************************/
+static uint8_t coapCborInt(int32_t value, uint8_t *pPointer)
+{
+   if( value < 0 )
+   {
+      return coapCborHead(COAP_CBOR_NEGATIVE, (uint32_t)(-1 - value), pPointer);
+   }
+
+   return coapCborHead(COAP_CBOR_UINT, (uint32_t)value, pPointer);
+}
+
+/*!*****************************************************************************
+ * \brief Encodes the accelerometer block as a CBOR byte string
+ *
+ * Description:
+ *  The first sample and then each difference to the previous sample is zigzag
+ *  mapped and written as a LEB128 varint, so the slowly changing samples of a
+ *  resting or steadily moving sensor take one byte each instead of two.
+ *
+ * \param int16_t *pSamples [in] - COAP_SENSOR_ACCEL_SAMPLES samples.
+ *
+ * \param U8 *pPointer [out] - Where the byte string is written.
+ *
+ * \param U16 size [in] - Bytes free at pPointer.
+ *
+ *
+ * \return Returns the number of bytes written or 0 if they did not fit.
+ *
+ ********************************************************************************/
+static uint16_t coapSensorEncodeAccel(const int16_t *pSamples, uint8_t *pPointer, uint16_t size)
+{
+   uint8_t *pData;      // Used to write the varints.
+   uint8_t *pEnd;       // Used to store the end of the free space.
+   uint8_t head;        // Used to store the length of the byte string head.
+   int32_t previous = 0;   // Used to store the previous sample.
+   uint32_t zigzag;     // Used to store the mapped difference.
+   uint16_t length;     // Used to store the varint bytes.
+   uint16_t i;          // Used as an iterator.
+
+   // Room for the widest head, moved down once the length is known.
+   if( size < 3 )
+   {
+      return 0;
+   }
+
+   pData = pPointer + 3;
+   pEnd = pPointer + size;
+
+   for( i = 0; i < COAP_SENSOR_ACCEL_SAMPLES; i++ )
+   {
+      if( pEnd - pData < COAP_SENSOR_VARINT_MAX )
+      {
+         return 0;
+      }
+
+      zigzag = (uint32_t)((pSamples[i] - previous) * 2) ^ (uint32_t)((pSamples[i] - previous) >> 31);
+      previous = pSamples[i];
+
+      while( zigzag >= 0x80 )
+      {
+         *pData++ = (zigzag & 0x7F) | 0x80;
+         zigzag >>= 7;
+      }
+
+      *pData++ = zigzag;
+   }
+
+   length = pData - (pPointer + 3);
+   head = coapCborHead(COAP_CBOR_BYTES, length, pPointer);
+
+   if( head != 3 )
+   {
+      memmove(pPointer + head, pPointer + 3, length);
+   }
+
+   return head + length;
+}
+
+/*!*****************************************************************************
+ * \brief Encodes a batch of sensor frames as CBOR
+ *
+ * Description:
+ *  Writes an array with one map per frame, keyed by the COAP_SENSOR_KEY_x
+ *  numbers.  The first frame is complete, so every datagram decodes on its own
+ *  even if earlier ones were lost.  Later frames carry their time as the delta
+ *  to the previous frame and leave GPS out when it did not change.  A report of
+ *  a slowly moving sensor drops from the raw 250 bytes to about 150, and later
+ *  frames of a batch to about 120, so ten reports fit in one datagram without a
+ *  block-wise transfer.  The message must carry Content-Format COAP_FORMAT_CBOR.
+ *
+ * CBOR:
+ *          https://tools.ietf.org/html/rfc7049
+ *
+ * \param CoapSensorFrame *pFrames [in] - Frames, oldest first.
+ *
+ * \param U8 frameCount [in] - 1 to COAP_SENSOR_MAX_FRAMES frames.
+ *
+ * \param U8 *pBuffer [out] - Where the payload is written, e.g. the message buffer.
+ *
+ * \param U16 bufferSize [in] - Bytes free at pBuffer.
+ *
+ * \param U16 *pLength [out] - Length of the payload.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapSensorEncode(const CoapSensorFrame *pFrames, uint8_t frameCount, uint8_t *pBuffer, uint16_t bufferSize, uint16_t *pLength)
+{
+   const CoapSensorFrame *pFrame;   // Used to store the current frame.
+   uint8_t *pPointer = pBuffer;     // Used to write the items.
+   uint8_t *pEnd = pBuffer + bufferSize;   // Used to store the end of the buffer.
+   uint16_t accelLength;            // Used to store the accelerometer item length.
+   bool hasGps;                     // Used to store whether GPS is sent.
+   uint8_t i;                       // Used as an iterator.
+
+   if( frameCount == 0 || frameCount > COAP_SENSOR_MAX_FRAMES )
+   {
+      return COAP_INVALID_PAYLOAD;
+   }
+
+   if( bufferSize < 1 )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   pPointer += coapCborHead(COAP_CBOR_ARRAY, frameCount, pPointer);
+
+   for( i = 0; i < frameCount; i++ )
+   {
+      pFrame = &pFrames[i];
+      hasGps = (i == 0) || memcmp(pFrame->gps, pFrames[i - 1].gps, GPS_SIZE) != 0;
+
+      // Map head, time and the accelerometer key.
+      if( pEnd - pPointer < 1 + 6 + 1 )
+      {
+         return COAP_INSUFFICIENT_BUFFER;
+      }
+
+      pPointer += coapCborHead(COAP_CBOR_MAP, hasGps ? 5 : 4, pPointer);
+
+      *pPointer++ = COAP_SENSOR_KEY_TIME;
+      pPointer += coapCborHead(COAP_CBOR_UINT, (i == 0) ? pFrame->timeStamp : pFrame->timeStamp - pFrames[i - 1].timeStamp, pPointer);
+
+      *pPointer++ = COAP_SENSOR_KEY_ACCEL;
+      accelLength = coapSensorEncodeAccel(pFrame->accel, pPointer, pEnd - pPointer);
+
+      if( accelLength == 0 )
+      {
+         return COAP_INSUFFICIENT_BUFFER;
+      }
+
+      pPointer += accelLength;
+
+      if( hasGps )
+      {
+         if( pEnd - pPointer < 1 + 2 + GPS_SIZE )
+         {
+            return COAP_INSUFFICIENT_BUFFER;
+         }
+
+         *pPointer++ = COAP_SENSOR_KEY_GPS;
+         pPointer += coapCborHead(COAP_CBOR_BYTES, GPS_SIZE, pPointer);
+         memcpy(pPointer, pFrame->gps, GPS_SIZE);
+         pPointer += GPS_SIZE;
+      }
+
+      if( pEnd - pPointer < 1 + 5 + 1 + 3 )
+      {
+         return COAP_INSUFFICIENT_BUFFER;
+      }
+
+      *pPointer++ = COAP_SENSOR_KEY_TEMP;
+      pPointer += coapCborInt(pFrame->temperature, pPointer);
+
+      *pPointer++ = COAP_SENSOR_KEY_LIGHT;
+      pPointer += coapCborHead(COAP_CBOR_UINT, pFrame->light, pPointer);
+   }
+
+   *pLength = pPointer - pBuffer;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Encodes a batch of sensor frames as the payload of a message
+ *
+ * Description:
+ *  The CBOR counterpart of coapBuilderSetPayload: the frames are encoded
+ *  straight behind the payload marker, with no intermediate copy.  Add the
+ *  Content-Format option (COAP_FORMAT_CBOR) before calling.
+ *
+ * \param CoapMessageBuilder *pBuilder [in\out] - Cursor from coapBuilderInit.
+ *
+ * \param CoapSensorFrame *pFrames [in] - Frames, oldest first.
+ *
+ * \param U8 frameCount [in] - 1 to COAP_SENSOR_MAX_FRAMES frames.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapBuilderSetSensorPayload(CoapMessageBuilder *pBuilder, const CoapSensorFrame *pFrames, uint8_t frameCount)
+{
+   uint8_t *pPayload;   // Used to store the reserved payload.
+   uint16_t length;     // Used to store the payload length.
+   int8_t results;      // Used to store the encode results.
+
+   if( pBuilder->hasPayload )
+   {
+      return COAP_INVALID_PAYLOAD;
+   }
+
+   if( pBuilder->remaining < 2 )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   // Encode where the payload will be, then commit the marker and length.
+   results = coapSensorEncode(pFrames, frameCount, pBuilder->pPointer + 1, pBuilder->remaining - 1, &length);
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   return coapBuilderReservePayload(pBuilder, length, &pPayload);
+}
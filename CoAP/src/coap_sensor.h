@@ -0,0 +1,34 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_SENSOR_H
+#define COAP_SENSOR_H
+
+#include "coap.h"
+
+/*Sensor Payload Related (Content-Format 60, application/cbor)*/
+#define COAP_SENSOR_ACCEL_SAMPLES   (ACCEL_SIZE / 2)   //int16 samples in the raw accelerometer block
+#define COAP_SENSOR_MAX_FRAMES      16                 //frames in one batch
+#define COAP_SENSOR_KEY_TIME        0    //uint, seconds; later frames of a batch carry the delta
+#define COAP_SENSOR_KEY_ACCEL       1    //bstr, zigzag LEB128 of the first sample then of each delta
+#define COAP_SENSOR_KEY_GPS         2    //bstr, GPS_SIZE bytes, omitted when equal to the previous frame
+#define COAP_SENSOR_KEY_TEMP        3    //int
+#define COAP_SENSOR_KEY_LIGHT       4    //uint
+
+/// CoapSensorFrame struct, one report of the dataPacket sensors
+typedef struct
+{
+   uint32_t timeStamp;                                  ///< TIME_STAMP_SIZE bytes in the raw frame
+   int16_t accel[COAP_SENSOR_ACCEL_SAMPLES];            ///< ACCEL_SIZE bytes in the raw frame
+   uint8_t gps[GPS_SIZE];                               ///< GPS_SIZE bytes in the raw frame
+   int32_t temperature;                                 ///< TEMP_SIZE bytes in the raw frame
+   uint16_t light;                                      ///< LIGHT_SIZE bytes in the raw frame
+} CoapSensorFrame;
+
+int8_t coapSensorEncode(const CoapSensorFrame *pFrames, uint8_t frameCount, uint8_t *pBuffer, uint16_t bufferSize, uint16_t *pLength);
+int8_t coapBuilderSetSensorPayload(CoapMessageBuilder *pBuilder, const CoapSensorFrame *pFrames, uint8_t frameCount);
+
+//! @}
+#endif  /* COAP_SENSOR_H */
@@ -0,0 +1,410 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_server.h"
+
+#define COAP_SERVER_FNV_BASIS       2166136261UL
+#define COAP_SERVER_FNV_PRIME       16777619UL
+
+/*!*****************************************************************************
+ * \brief Adds bytes to a path hash
+ *
+ * \param U32 hash [in] - Hash so far.
+ *
+ * \param U8 *pData [in] - Bytes to add.
+ *
+ * \param U16 length [in] - Number of bytes.
+ *
+ *
+ * \return Returns the new hash.
+ *
+ ********************************************************************************/
+static uint32_t coapServerHash(uint32_t hash, const uint8_t *pData, uint16_t length)
+{
+   uint16_t i;   // Used as an iterator.
+
+   for( i = 0; i < length; i++ )
+   {
+      hash = (hash ^ pData[i]) * COAP_SERVER_FNV_PRIME;
+   }
+
+   return hash;
+}
+
+/*!*****************************************************************************
+ * \brief Finds the resource for the Uri-Path options of a request
+ *
+ * Description:
+ *  The segments are hashed as if joined with '/', which gives the same value
+ *  coapServerRegister computed from the registered path, and the hash selects
+ *  the slot directly.  Only the one candidate in the slot chain with an equal
+ *  hash is verified against its path, so lookup cost does not grow with the
+ *  number of resources.
+ *
+ * \param CoapServer *pServer [in] - Server to search.
+ *
+ * \param CoapMessageView *pView [in] - Parsed request.
+ *
+ *
+ * \return Returns the resource or NULL.
+ *
+ ********************************************************************************/
+static const CoapResource *coapServerFind(const CoapServer *pServer, CoapMessageView *pView)
+{
+   static const uint8_t separator = '/';   // Used to join the segments.
+   const CoapResource *pResource;          // Used to store the candidate.
+   CoapOptionEntry *pOption;               // Used to store the current option.
+   uint32_t hash = COAP_SERVER_FNV_BASIS;  // Used to store the path hash.
+   uint16_t pathLength = 0;                // Used to store the joined path length.
+   uint16_t offset;                        // Used to verify the candidate.
+   uint8_t slot;                           // Used to store the probed slot.
+   uint8_t i;                              // Used as an iterator.
+   uint8_t j;                              // Used as an iterator.
+
+   for( i = 0; i < pView->optionCount; i++ )
+   {
+      pOption = &pView->options[i];
+
+      if( pOption->number == COAP_OPTION_URI_PATH )
+      {
+         if( pathLength > 0 )
+         {
+            hash = coapServerHash(hash, &separator, 1);
+            pathLength++;
+         }
+
+         hash = coapServerHash(hash, pOption->pData, pOption->length);
+         pathLength += pOption->length;
+      }
+   }
+
+   slot = hash & (COAP_SERVER_HASH_SIZE - 1);
+
+   for( j = 0; j < COAP_SERVER_HASH_SIZE && pServer->slots[slot] != COAP_SERVER_SLOT_EMPTY; j++ )
+   {
+      pResource = &pServer->resources[pServer->slots[slot]];
+
+      if( pResource->hash == hash && pResource->pathLength == pathLength )
+      {
+         offset = 0;
+
+         for( i = 0; i < pView->optionCount; i++ )
+         {
+            pOption = &pView->options[i];
+
+            if( pOption->number == COAP_OPTION_URI_PATH )
+            {
+               if( offset > 0 )
+               {
+                  offset++;
+               }
+
+               // A '/' inside a segment is data, not a separator.
+               if( memcmp(pResource->pPath + offset, pOption->pData, pOption->length) != 0 ||
+                   memchr(pOption->pData, '/', pOption->length) != NULL )
+               {
+                  break;
+               }
+
+               offset += pOption->length;
+            }
+         }
+
+         if( i == pView->optionCount )
+         {
+            return pResource;
+         }
+      }
+
+      slot = (slot + 1) & (COAP_SERVER_HASH_SIZE - 1);
+   }
+
+   return NULL;
+}
+
+/*!*****************************************************************************
+ * \brief Turns a request into a header-only response in its own buffer
+ *
+ * Description:
+ *  Used for responses that carry nothing but a code (4.04, 4.05, 4.02, 5.00).
+ *  The token is already in place, so only the type, code and, for a NON
+ *  request, the message id are rewritten and the options are dropped.
+ *
+ * \param CoapMessageIdGenerator *pMessageIds [in\out] - Generator of the socket.
+ *
+ * \param CoapMessageView *pView [in] - Parsed request in pBuffer.
+ *
+ * \param U8 *pBuffer [in\out] - Request buffer, becomes the response.
+ *
+ * \param CoapCode code [in] - Response code.
+ *
+ *
+ * \return Returns the response length.
+ *
+ ********************************************************************************/
+static uint16_t coapServerReplyInPlace(CoapMessageIdGenerator *pMessageIds, CoapMessageView *pView, uint8_t *pBuffer, CoapCode code)
+{
+   uint16_t length;   // Used by the set primitives.
+
+   if( pView->type == COAP_TYPE_CON )
+   {
+      coapSetType(pBuffer, &length, COAP_TYPE_ACK);
+   }
+   else
+   {
+      coapSetMessageId(pBuffer, &length, coapMessageIdNext(pMessageIds));
+   }
+
+   coapSetCode(pBuffer, &length, code);
+
+   return COAP_HDR_BYTES + pView->tokenLength;
+}
+
+/*!*****************************************************************************
+ * \brief Initialises a server
+ *
+ * \param CoapServer *pServer [out] - Server to initialise.
+ *
+ ********************************************************************************/
+void coapServerInit(CoapServer *pServer)
+{
+   memset(pServer, 0, sizeof(*pServer));
+   memset(pServer->slots, COAP_SERVER_SLOT_EMPTY, sizeof(pServer->slots));
+}
+
+/*!*****************************************************************************
+ * \brief Registers a handler for a method and path
+ *
+ * Description:
+ *  The path is given without a leading '/' and with '/' between segments, e.g.
+ *  URI_PREFIX "/" LED_ALIAS.  It must stay valid while the server is used.  The
+ *  hash of the path is computed here once; registering another method on an
+ *  existing path reuses its entry.
+ *
+ * \param CoapServer *pServer [in\out] - Server to register with.
+ *
+ * \param CoapCode method [in] - COAP_GET, COAP_POST, COAP_PUT or COAP_DELETE.
+ *
+ * \param char *pPath [in] - Resource path.
+ *
+ * \param CoapResourceHandler handler [in] - Builds the response.
+ *
+ * \param void *pContext [in] - Passed to handler.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapServerRegister(CoapServer *pServer, CoapCode method, const char *pPath, CoapResourceHandler handler, void *pContext)
+{
+   CoapResource *pResource;     // Used to store the path entry.
+   uint32_t hash;               // Used to store the path hash.
+   uint16_t pathLength;         // Used to store the path length.
+   uint8_t slot;                // Used to store the probed slot.
+
+   if( method < COAP_GET || method > COAP_DELETE )
+   {
+      return COAP_UNKNOWN_CODE;
+   }
+
+   pathLength = strlen(pPath);
+   hash = coapServerHash(COAP_SERVER_FNV_BASIS, (const uint8_t *)pPath, pathLength);
+   slot = hash & (COAP_SERVER_HASH_SIZE - 1);
+
+   while( pServer->slots[slot] != COAP_SERVER_SLOT_EMPTY )
+   {
+      pResource = &pServer->resources[pServer->slots[slot]];
+
+      if( pResource->hash == hash && pResource->pathLength == pathLength &&
+          memcmp(pResource->pPath, pPath, pathLength) == 0 )
+      {
+         pResource->handlers[method - COAP_GET] = handler;
+         pResource->pContexts[method - COAP_GET] = pContext;
+         return COAP_OK;
+      }
+
+      slot = (slot + 1) & (COAP_SERVER_HASH_SIZE - 1);
+   }
+
+   if( pServer->resourceCount >= COAP_SERVER_MAX_RESOURCES )
+   {
+      return COAP_NO_RESOURCES;
+   }
+
+   pResource = &pServer->resources[pServer->resourceCount];
+   pResource->pPath = pPath;
+   pResource->pathLength = pathLength;
+   pResource->hash = hash;
+   pResource->handlers[method - COAP_GET] = handler;
+   pResource->pContexts[method - COAP_GET] = pContext;
+
+   pServer->slots[slot] = pServer->resourceCount++;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Dispatches a parsed request to its handler
+ *
+ * Description:
+ *  Looks the path up by hash.  Responses that only
+ *  carry a code (ping, 4.02 for an unrecognised critical option, 4.04, 4.05,
+ *  5.00) are built in the request's own buffer.  Otherwise the handler fills a
+ *  response in pResponse that is piggybacked on the ACK of a CON request, or
+ *  sent as NON for a NON request.  *ppReply points at whichever buffer holds
+ *  the reply.
+ *
+ * Request/Response matching:
+ *          https://tools.ietf.org/html/rfc7252#section-5.3
+ *
+ * \param CoapServer *pServer [in] - Server holding the resources.
+ *
+ * \param CoapMessageIdGenerator *pMessageIds [in\out] - Generator of the socket
+ *        the reply goes out on, used for NON responses.  The server itself is
+ *        only read, so threads sharing it each pass their own.
+ *
+ * \param CoapMessageView *pView [in] - Request parsed from pBuffer.
+ *
+ * \param U8 *pBuffer [in\out] - Received request, may be overwritten.
+ *
+ * \param U8 *pResponse [out] - Buffer handlers build the response in.
+ *
+ * \param U16 responseSize [in] - Size of pResponse.
+ *
+ * \param U8 **ppReply [out] - Reply to send, pBuffer or pResponse.
+ *
+ * \param U16 *pReplyLength [out] - Length of the reply, 0 if none is sent.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 if the message is not a request.
+ *
+ ********************************************************************************/
+int8_t coapServerDispatchView(const CoapServer *pServer, CoapMessageIdGenerator *pMessageIds, CoapMessageView *pView, uint8_t *pBuffer, uint8_t *pResponse, uint16_t responseSize, uint8_t **ppReply, uint16_t *pReplyLength)
+{
+   CoapMessageBuilder builder;  // Used to build the handler response.
+   const CoapResource *pResource;   // Used to store the matched resource.
+   CoapResourceHandler handler; // Used to store the method handler.
+   int16_t code;                // Used to store the handler result.
+   uint16_t headerLength;       // Used by coapSetCode.
+   int8_t results;              // Used to store the results.
+   uint8_t i;                   // Used as an iterator.
+
+   *ppReply = pBuffer;
+   *pReplyLength = 0;
+
+   if( pView->type == COAP_TYPE_ACK || pView->type == COAP_TYPE_RST )
+   {
+      return COAP_INVALID_TYPE;
+   }
+
+   if( pView->code == COAP_EMPTY )
+   {
+      // CoAP ping, answered with a Reset.
+      coapSetType(pBuffer, &headerLength, COAP_TYPE_RST);
+      *pReplyLength = COAP_HDR_BYTES;
+      return COAP_OK;
+   }
+
+   if( pView->code > COAP_DELETE )
+   {
+      return COAP_UNKNOWN_CODE;
+   }
+
+   for( i = 0; i < pView->optionCount; i++ )
+   {
+      if( (coapOptionGetFlags(pView->options[i].number) & (COAP_OPTION_FLAG_CRITICAL | COAP_OPTION_FLAG_KNOWN)) == COAP_OPTION_FLAG_CRITICAL )
+      {
+         *pReplyLength = coapServerReplyInPlace(pMessageIds, pView, pBuffer, COAP_BAD_OPTION);
+         return COAP_OK;
+      }
+   }
+
+   pResource = coapServerFind(pServer, pView);
+
+   if( pResource == NULL )
+   {
+      *pReplyLength = coapServerReplyInPlace(pMessageIds, pView, pBuffer, COAP_NOT_FOUND);
+      return COAP_OK;
+   }
+
+   handler = pResource->handlers[pView->code - COAP_GET];
+
+   if( handler == NULL )
+   {
+      *pReplyLength = coapServerReplyInPlace(pMessageIds, pView, pBuffer, COAP_METHOD_NOT_ALLOWED);
+      return COAP_OK;
+   }
+
+   results = coapBuilderInit(&builder, pResponse, responseSize,
+                             pView->type == COAP_TYPE_CON ? COAP_TYPE_ACK : COAP_TYPE_NON, COAP_CONTENT,
+                             pView->type == COAP_TYPE_CON ? pView->messageId : coapMessageIdNext(pMessageIds),
+                             pView->pToken, pView->tokenLength);
+
+   if( results < 0 )
+   {
+      *pReplyLength = coapServerReplyInPlace(pMessageIds, pView, pBuffer, COAP_INTERNAL_SERVER_ERROR);
+      return COAP_OK;
+   }
+
+   code = handler(pResource->pContexts[pView->code - COAP_GET], pView, &builder);
+
+   if( code < 0 || coapSetCode(pResponse, &headerLength, (CoapCode)code) < 0 )
+   {
+      *pReplyLength = coapServerReplyInPlace(pMessageIds, pView, pBuffer, COAP_INTERNAL_SERVER_ERROR);
+      return COAP_OK;
+   }
+
+   *ppReply = pResponse;
+   *pReplyLength = builder.length;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Dispatches a received request to its handler
+ *
+ * Description:
+ *  Parses the request in a single pass and hands it to coapServerDispatchView.
+ *
+ * \param CoapServer *pServer [in] - Server holding the resources.
+ *
+ * \param CoapMessageIdGenerator *pMessageIds [in\out] - Generator of the socket
+ *        the reply goes out on, used for NON responses.  The server itself is
+ *        only read, so threads sharing it each pass their own.
+ *
+ * \param U8 *pBuffer [in\out] - Received request, may be overwritten.
+ *
+ * \param U16 length [in] - Length of the request.
+ *
+ * \param U8 *pResponse [out] - Buffer handlers build the response in.
+ *
+ * \param U16 responseSize [in] - Size of pResponse.
+ *
+ * \param U8 **ppReply [out] - Reply to send, pBuffer or pResponse.
+ *
+ * \param U16 *pReplyLength [out] - Length of the reply, 0 if none is sent.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 if the message is not a request.
+ *
+ ********************************************************************************/
+int8_t coapServerDispatch(const CoapServer *pServer, CoapMessageIdGenerator *pMessageIds, uint8_t *pBuffer, uint16_t length, uint8_t *pResponse, uint16_t responseSize, uint8_t **ppReply, uint16_t *pReplyLength)
+{
+   CoapMessageView view;   // Used to store the parsed request.
+   int8_t results;         // Used to store the results.
+
+   *ppReply = pBuffer;
+   *pReplyLength = 0;
+
+   results = coapValidateMessage(pBuffer, length, &view);
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   return coapServerDispatchView(pServer, pMessageIds, &view, pBuffer, pResponse, responseSize, ppReply, pReplyLength);
+}
@@ -0,0 +1,45 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_SERVER_H
+#define COAP_SERVER_H
+
+#include "coap.h"
+#include "coap_random.h"
+
+/*Server Related*/
+#define COAP_SERVER_MAX_RESOURCES   16    //registered paths
+#define COAP_SERVER_HASH_SIZE       32    //lookup slots, power of 2 and > COAP_SERVER_MAX_RESOURCES
+#define COAP_SERVER_METHOD_COUNT    4     //GET, POST, PUT, DELETE
+#define COAP_SERVER_SLOT_EMPTY      0xFF
+
+/// Fills in the response, returns the response code (e.g. COAP_CONTENT) or < 0 for 5.00.
+typedef int16_t (*CoapResourceHandler)(void *pContext, CoapMessageView *pRequest, CoapMessageBuilder *pResponse);
+
+/// CoapResource struct
+typedef struct
+{
+   const char *pPath;                                    ///< Path without leading '/', e.g. "1a/led"
+   uint16_t pathLength;                                  ///< Length of pPath
+   uint32_t hash;                                        ///< Hash of the path segments
+   CoapResourceHandler handlers[COAP_SERVER_METHOD_COUNT];   ///< Handler per method, NULL gives 4.05
+   void *pContexts[COAP_SERVER_METHOD_COUNT];            ///< Passed to the handlers
+} CoapResource;
+
+/// CoapServer struct
+typedef struct
+{
+   CoapResource resources[COAP_SERVER_MAX_RESOURCES];   ///< Registered paths
+   uint8_t slots[COAP_SERVER_HASH_SIZE];                ///< Path hash to resource index
+   uint8_t resourceCount;                               ///< Used resources entries
+} CoapServer;
+
+void coapServerInit(CoapServer *pServer);
+int8_t coapServerRegister(CoapServer *pServer, CoapCode method, const char *pPath, CoapResourceHandler handler, void *pContext);
+int8_t coapServerDispatchView(const CoapServer *pServer, CoapMessageIdGenerator *pMessageIds, CoapMessageView *pView, uint8_t *pBuffer, uint8_t *pResponse, uint16_t responseSize, uint8_t **ppReply, uint16_t *pReplyLength);
+int8_t coapServerDispatch(const CoapServer *pServer, CoapMessageIdGenerator *pMessageIds, uint8_t *pBuffer, uint16_t length, uint8_t *pResponse, uint16_t responseSize, uint8_t **ppReply, uint16_t *pReplyLength);
+
+//! @}
+#endif  /* COAP_SERVER_H */
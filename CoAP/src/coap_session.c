@@ -0,0 +1,507 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_session.h"
+
+#define COAP_SESSION_FNV_BASIS      2166136261UL
+#define COAP_SESSION_FNV_PRIME      16777619UL
+#define COAP_SESSION_FLAG_MID       0x01
+#define COAP_SESSION_FLAG_DEDUP     0x02
+#define COAP_SESSION_FLAG_CACHE     0x04
+#define COAP_SESSION_FLAG_OBSERVE   0x08
+
+/*!*****************************************************************************
+ * \brief Computes the FNV-1a checksum of a saved session
+ *
+ * \param U8 *pData [in] - Bytes to hash.
+ *
+ * \param U16 length [in] - Number of bytes.
+ *
+ *
+ * \return Returns the checksum.
+ *
+ ********************************************************************************/
+static uint32_t coapSessionChecksum(const uint8_t *pData, uint16_t length)
+{
+   uint32_t hash = COAP_SESSION_FNV_BASIS;   // Used to accumulate the hash.
+   uint16_t i;                               // Used as an iterator.
+
+   for( i = 0; i < length; i++ )
+   {
+      hash = (hash ^ pData[i]) * COAP_SESSION_FNV_PRIME;
+   }
+
+   return hash;
+}
+
+/*!*****************************************************************************
+ * \brief Appends bytes to a saved session
+ *
+ * \param U8 **pPointer [in\out] - Write cursor.
+ *
+ * \param U8 *pEnd [in] - End of the buffer.
+ *
+ * \param void *pData [in] - Bytes to append.
+ *
+ * \param U16 length [in] - Number of bytes.
+ *
+ *
+ * \return Returns false if the bytes did not fit.
+ *
+ ********************************************************************************/
+static bool coapSessionPut(uint8_t **pPointer, const uint8_t *pEnd, const void *pData, uint16_t length)
+{
+   if( pEnd - *pPointer < length )
+   {
+      return false;
+   }
+
+   memcpy(*pPointer, pData, length);
+   *pPointer += length;
+
+   return true;
+}
+
+/*!*****************************************************************************
+ * \brief Reads bytes from a saved session
+ *
+ * \param U8 **pPointer [in\out] - Read cursor.
+ *
+ * \param U8 *pEnd [in] - End of the session.
+ *
+ * \param void *pData [out] - Receives the bytes.
+ *
+ * \param U16 length [in] - Number of bytes.
+ *
+ *
+ * \return Returns false if the session ended first.
+ *
+ ********************************************************************************/
+static bool coapSessionGet(const uint8_t **pPointer, const uint8_t *pEnd, void *pData, uint16_t length)
+{
+   if( pEnd - *pPointer < length )
+   {
+      return false;
+   }
+
+   memcpy(pData, *pPointer, length);
+   *pPointer += length;
+
+   return true;
+}
+
+/*!*****************************************************************************
+ * \brief Gets the ticks until a deadline, 0 once it has passed
+ *
+ * \param TickType_t tick [in] - Deadline.
+ *
+ * \param TickType_t now [in] - Current tick.
+ *
+ *
+ * \return Returns the remaining ticks.
+ *
+ ********************************************************************************/
+static uint32_t coapSessionRemaining(TickType_t tick, TickType_t now)
+{
+   return ((int32_t)(tick - now) > 0) ? (uint32_t)(tick - now) : 0;
+}
+
+/*!*****************************************************************************
+ * \brief Moves a saved deadline onto the tick count after the wake
+ *
+ * Description:
+ *  The tick count restarts during deep sleep, so deadlines are saved as the
+ *  time left and the sleep is taken off on restore.  A deadline that passed
+ *  while asleep is due at once.
+ *
+ * \param U32 remaining [in] - Ticks that were left at sleep time.
+ *
+ * \param TickType_t slept [in] - Ticks spent asleep.
+ *
+ * \param TickType_t now [in] - Current tick.
+ *
+ *
+ * \return Returns the deadline.
+ *
+ ********************************************************************************/
+static TickType_t coapSessionDeadline(uint32_t remaining, TickType_t slept, TickType_t now)
+{
+   return (remaining > slept) ? now + (remaining - slept) : now;
+}
+
+/*!*****************************************************************************
+ * \brief Serializes the transient state before deep sleep
+ *
+ * Description:
+ *  Writes the message id counter, the live deduplication entries, the cached
+ *  responses with their ETags and the observe relations with their tokens,
+ *  each record trimmed to the bytes in use.  Deadlines are stored as the time
+ *  left and past ticks as ages, so the blob does not depend on the tick count.
+ *  The blob ends with an FNV-1a checksum and carries COAP_SESSION_IMAGE_ID,
+ *  because observe handlers are saved as code addresses.  The whole state is
+ *  bounded by COAP_SESSION_MAX_SIZE; write the result to retained RAM or flash.
+ *
+ * \param CoapSession *pSession [in] - State to save.
+ *
+ * \param U8 *pBuffer [out] - Receives the session.
+ *
+ * \param U16 bufferSize [in] - Size of pBuffer.
+ *
+ * \param U16 *pLength [out] - Length of the session.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapSessionSave(const CoapSession *pSession, uint8_t *pBuffer, uint16_t bufferSize, uint16_t *pLength)
+{
+   uint8_t *pPointer = pBuffer + COAP_SESSION_HEADER_SIZE;   // Used to write the records.
+   uint8_t *pEnd = pBuffer + bufferSize;                     // Used to store the end of the buffer.
+   uint8_t *pCount;                    // Used to store where the record count goes.
+   CoapDedupEntry *pDedupEntry;        // Used to store the current deduplication entry.
+   CoapCacheEntry *pCacheEntry;        // Used to store the current cache entry.
+   CoapObservation *pObservation;      // Used to store the current observation.
+   TickType_t now = xTaskGetTickCount();   // Used to store the current tick.
+   uint32_t magic = COAP_SESSION_MAGIC;        // Used to store the magic number.
+   uint32_t image = COAP_SESSION_IMAGE_ID;     // Used to store the firmware image.
+   uint32_t remaining;                 // Used to store the time left.
+   uint32_t age;                       // Used to store the time passed.
+   uint32_t checksum;                  // Used to store the checksum.
+   uint16_t length;                    // Used to store the session length.
+   uint8_t flags = 0;                  // Used to store the saved tables.
+   uint8_t count = 0;                  // Used to store an empty record count.
+   bool fits = bufferSize >= COAP_SESSION_HEADER_SIZE + 4;   // Used to track overflow.
+   uint8_t i;                          // Used as an iterator.
+
+   if( pSession->pDedup != NULL && pSession->pDedup->entryCount > COAP_SESSION_MAX_DEDUP )
+   {
+      return COAP_INVALID_BUFFER_LENGTH;
+   }
+
+   if( fits && pSession->pMessageIds != NULL )
+   {
+      flags |= COAP_SESSION_FLAG_MID;
+      fits = coapSessionPut(&pPointer, pEnd, &pSession->pMessageIds->next, sizeof(uint16_t));
+   }
+
+   if( fits && pSession->pDedup != NULL )
+   {
+      flags |= COAP_SESSION_FLAG_DEDUP;
+      pCount = pPointer;
+      fits = coapSessionPut(&pPointer, pEnd, &count, 1);
+
+      // Expired entries are kept too, probing goes past them.
+      for( i = 0; fits && i < pSession->pDedup->entryCount; i++ )
+      {
+         pDedupEntry = &pSession->pDedup->pEntries[i];
+
+         if( !pDedupEntry->inUse )
+         {
+            continue;
+         }
+
+         remaining = coapSessionRemaining(pDedupEntry->expiryTick, now);
+
+         fits = coapSessionPut(&pPointer, pEnd, &i, 1) &&
+                coapSessionPut(&pPointer, pEnd, &pDedupEntry->address, sizeof(pDedupEntry->address)) &&
+                coapSessionPut(&pPointer, pEnd, &pDedupEntry->port, sizeof(pDedupEntry->port)) &&
+                coapSessionPut(&pPointer, pEnd, &pDedupEntry->messageId, sizeof(pDedupEntry->messageId)) &&
+                coapSessionPut(&pPointer, pEnd, &remaining, sizeof(remaining)) &&
+                coapSessionPut(&pPointer, pEnd, &pDedupEntry->replyLength, sizeof(pDedupEntry->replyLength)) &&
+                coapSessionPut(&pPointer, pEnd, pDedupEntry->reply, pDedupEntry->replyLength);
+         (*pCount)++;
+      }
+   }
+
+   if( fits && pSession->pCache != NULL )
+   {
+      flags |= COAP_SESSION_FLAG_CACHE;
+      pCount = pPointer;
+      fits = coapSessionPut(&pPointer, pEnd, &count, 1);
+
+      // Stale responses are kept, their ETag revalidates them in one exchange.
+      for( i = 0; fits && i < COAP_CACHE_ENTRIES; i++ )
+      {
+         pCacheEntry = &pSession->pCache->entries[i];
+
+         if( !pCacheEntry->inUse )
+         {
+            continue;
+         }
+
+         remaining = coapSessionRemaining(pCacheEntry->expiryTick, now);
+         age = now - pCacheEntry->usedTick;
+
+         fits = coapSessionPut(&pPointer, pEnd, &i, 1) &&
+                coapSessionPut(&pPointer, pEnd, &pCacheEntry->hash, sizeof(pCacheEntry->hash)) &&
+                coapSessionPut(&pPointer, pEnd, &pCacheEntry->keyLength, sizeof(pCacheEntry->keyLength)) &&
+                coapSessionPut(&pPointer, pEnd, pCacheEntry->key, pCacheEntry->keyLength) &&
+                coapSessionPut(&pPointer, pEnd, &pCacheEntry->responseLength, sizeof(pCacheEntry->responseLength)) &&
+                coapSessionPut(&pPointer, pEnd, pCacheEntry->response, pCacheEntry->responseLength) &&
+                coapSessionPut(&pPointer, pEnd, &pCacheEntry->etagLength, sizeof(pCacheEntry->etagLength)) &&
+                coapSessionPut(&pPointer, pEnd, pCacheEntry->etag, pCacheEntry->etagLength) &&
+                coapSessionPut(&pPointer, pEnd, &remaining, sizeof(remaining)) &&
+                coapSessionPut(&pPointer, pEnd, &age, sizeof(age));
+         (*pCount)++;
+      }
+   }
+
+   if( fits && pSession->pObserve != NULL )
+   {
+      flags |= COAP_SESSION_FLAG_OBSERVE;
+      fits = coapSessionPut(&pPointer, pEnd, &pSession->pObserve->pMessageIds->next, sizeof(uint16_t));
+      pCount = pPointer;
+      fits = fits && coapSessionPut(&pPointer, pEnd, &count, 1);
+
+      for( i = 0; fits && i < COAP_MAX_OBSERVATIONS; i++ )
+      {
+         pObservation = &pSession->pObserve->entries[i];
+
+         if( !pObservation->inUse )
+         {
+            continue;
+         }
+
+         remaining = coapSessionRemaining(pObservation->expiryTick, now);
+         age = now - pObservation->notifyTick;
+
+         fits = coapSessionPut(&pPointer, pEnd, &i, 1) &&
+                coapSessionPut(&pPointer, pEnd, &pObservation->requestLength, sizeof(pObservation->requestLength)) &&
+                coapSessionPut(&pPointer, pEnd, pObservation->request, pObservation->requestLength) &&
+                coapSessionPut(&pPointer, pEnd, &pObservation->sequence, sizeof(pObservation->sequence)) &&
+                coapSessionPut(&pPointer, pEnd, &remaining, sizeof(remaining)) &&
+                coapSessionPut(&pPointer, pEnd, &age, sizeof(age)) &&
+                coapSessionPut(&pPointer, pEnd, &pObservation->hasSequence, sizeof(pObservation->hasSequence)) &&
+                coapSessionPut(&pPointer, pEnd, &pObservation->handler, sizeof(pObservation->handler)) &&
+                coapSessionPut(&pPointer, pEnd, &pObservation->pUserData, sizeof(pObservation->pUserData));
+         (*pCount)++;
+      }
+   }
+
+   if( !fits || pEnd - pPointer < 4 )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   length = (pPointer - pBuffer) + 4;
+
+   memcpy(pBuffer, &magic, 4);
+   memcpy(pBuffer + 4, &image, 4);
+   pBuffer[8] = COAP_SESSION_VERSION;
+   pBuffer[9] = flags;
+   memcpy(pBuffer + 10, &length, 2);
+
+   checksum = coapSessionChecksum(pBuffer, length - 4);
+   memcpy(pPointer, &checksum, 4);
+
+   *pLength = length;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Restores the transient state after a wake from deep sleep
+ *
+ * Description:
+ *  Initialise the tables as on a cold boot (coapDedupInit, coapCacheInit,
+ *  coapObserveInit with the send callback and generator), then restore with
+ *  the same CoapSession members the session was saved with.  Every record goes
+ *  back to its slot, so no table is rebuilt or rehashed and the work is
+ *  bounded by the table sizes.  Deadlines lose sleptMs; Observe relations that are still
+ *  within their Max-Age need no re-registration and the message id counter
+ *  continues, so the first message after the wake is the next report.  A
+ *  session failing the header or checksum checks leaves the tables untouched,
+ *  and so does one with observe relations when COAP_SESSION_IMAGE_ID is left
+ *  at 0, as their handler addresses cannot be trusted across builds.
+ *
+ * \param CoapSession *pSession [in] - State to restore.
+ *
+ * \param U8 *pBuffer [in] - Session from coapSessionSave.
+ *
+ * \param U16 length [in] - Length of the session.
+ *
+ * \param U32 sleptMs [in] - Time spent asleep, e.g. from the RTC.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapSessionRestore(const CoapSession *pSession, const uint8_t *pBuffer, uint16_t length, uint32_t sleptMs)
+{
+   const uint8_t *pPointer = pBuffer + COAP_SESSION_HEADER_SIZE;   // Used to read the records.
+   const uint8_t *pEnd;                // Used to store the end of the records.
+   CoapDedupEntry *pDedupEntry;        // Used to store the current deduplication entry.
+   CoapCacheEntry *pCacheEntry;        // Used to store the current cache entry.
+   CoapObservation *pObservation;      // Used to store the current observation.
+   TickType_t now = xTaskGetTickCount();   // Used to store the current tick.
+   TickType_t slept = (TickType_t)(((uint64_t)sleptMs * configTICK_RATE_HZ) / 1000);   // Used to store the sleep in ticks.
+   uint32_t magic;                     // Used to store the magic number.
+   uint32_t image;                     // Used to store the firmware image.
+   uint32_t checksum;                  // Used to store the checksum.
+   uint32_t remaining;                 // Used to store the time left.
+   uint32_t age;                       // Used to store the time passed.
+   uint16_t savedLength;               // Used to store the saved length.
+   uint8_t flags = 0;                  // Used to store the requested tables.
+   uint8_t count = 0;                  // Used to store the record count.
+   uint8_t index;                      // Used to store the slot of a record.
+   bool valid = true;                  // Used to track malformed records.
+   uint8_t i;                          // Used as an iterator.
+
+   if( length < COAP_SESSION_HEADER_SIZE + 4 )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
+   if( pSession->pDedup != NULL && pSession->pDedup->entryCount > COAP_SESSION_MAX_DEDUP )
+   {
+      return COAP_INVALID_BUFFER_LENGTH;
+   }
+
+   // Without a per-build id the saved handlers may point into another image.
+   if( pSession->pObserve != NULL && COAP_SESSION_IMAGE_ID == 0 )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
+   memcpy(&magic, pBuffer, 4);
+   memcpy(&image, pBuffer + 4, 4);
+   memcpy(&savedLength, pBuffer + 10, 2);
+   memcpy(&checksum, pBuffer + length - 4, 4);
+
+   flags |= (pSession->pMessageIds != NULL) ? COAP_SESSION_FLAG_MID : 0;
+   flags |= (pSession->pDedup != NULL) ? COAP_SESSION_FLAG_DEDUP : 0;
+   flags |= (pSession->pCache != NULL) ? COAP_SESSION_FLAG_CACHE : 0;
+   flags |= (pSession->pObserve != NULL) ? COAP_SESSION_FLAG_OBSERVE : 0;
+
+   if( magic != COAP_SESSION_MAGIC || image != COAP_SESSION_IMAGE_ID || pBuffer[8] != COAP_SESSION_VERSION ||
+       pBuffer[9] != flags || savedLength != length || checksum != coapSessionChecksum(pBuffer, length - 4) )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
+   pEnd = pBuffer + length - 4;
+
+   if( pSession->pMessageIds != NULL )
+   {
+      valid = coapSessionGet(&pPointer, pEnd, &pSession->pMessageIds->next, sizeof(uint16_t));
+   }
+
+   if( valid && pSession->pDedup != NULL )
+   {
+      valid = coapSessionGet(&pPointer, pEnd, &count, 1);
+
+      for( i = 0; valid && i < count; i++ )
+      {
+         valid = coapSessionGet(&pPointer, pEnd, &index, 1) && index < pSession->pDedup->entryCount;
+
+         if( !valid )
+         {
+            break;
+         }
+
+         pDedupEntry = &pSession->pDedup->pEntries[index];
+
+         valid = coapSessionGet(&pPointer, pEnd, &pDedupEntry->address, sizeof(pDedupEntry->address)) &&
+                 coapSessionGet(&pPointer, pEnd, &pDedupEntry->port, sizeof(pDedupEntry->port)) &&
+                 coapSessionGet(&pPointer, pEnd, &pDedupEntry->messageId, sizeof(pDedupEntry->messageId)) &&
+                 coapSessionGet(&pPointer, pEnd, &remaining, sizeof(remaining)) &&
+                 coapSessionGet(&pPointer, pEnd, &pDedupEntry->replyLength, sizeof(pDedupEntry->replyLength)) &&
+                 pDedupEntry->replyLength <= COAP_DEDUP_RESPONSE_SIZE &&
+                 coapSessionGet(&pPointer, pEnd, pDedupEntry->reply, pDedupEntry->replyLength);
+
+         // remaining is only read if the whole record was.
+         if( valid )
+         {
+            pDedupEntry->expiryTick = coapSessionDeadline(remaining, slept, now);
+         }
+
+         pDedupEntry->inUse = valid;
+      }
+   }
+
+   if( valid && pSession->pCache != NULL )
+   {
+      valid = coapSessionGet(&pPointer, pEnd, &count, 1);
+
+      for( i = 0; valid && i < count; i++ )
+      {
+         valid = coapSessionGet(&pPointer, pEnd, &index, 1) && index < COAP_CACHE_ENTRIES;
+
+         if( !valid )
+         {
+            break;
+         }
+
+         pCacheEntry = &pSession->pCache->entries[index];
+
+         valid = coapSessionGet(&pPointer, pEnd, &pCacheEntry->hash, sizeof(pCacheEntry->hash)) &&
+                 coapSessionGet(&pPointer, pEnd, &pCacheEntry->keyLength, sizeof(pCacheEntry->keyLength)) &&
+                 pCacheEntry->keyLength <= COAP_CACHE_KEY_SIZE &&
+                 coapSessionGet(&pPointer, pEnd, pCacheEntry->key, pCacheEntry->keyLength) &&
+                 coapSessionGet(&pPointer, pEnd, &pCacheEntry->responseLength, sizeof(pCacheEntry->responseLength)) &&
+                 pCacheEntry->responseLength <= COAP_CACHE_RESPONSE_SIZE &&
+                 coapSessionGet(&pPointer, pEnd, pCacheEntry->response, pCacheEntry->responseLength) &&
+                 coapSessionGet(&pPointer, pEnd, &pCacheEntry->etagLength, sizeof(pCacheEntry->etagLength)) &&
+                 pCacheEntry->etagLength <= COAP_CACHE_ETAG_SIZE &&
+                 coapSessionGet(&pPointer, pEnd, pCacheEntry->etag, pCacheEntry->etagLength) &&
+                 coapSessionGet(&pPointer, pEnd, &remaining, sizeof(remaining)) &&
+                 coapSessionGet(&pPointer, pEnd, &age, sizeof(age));
+
+         if( valid )
+         {
+            pCacheEntry->expiryTick = coapSessionDeadline(remaining, slept, now);
+            pCacheEntry->usedTick = now - age - slept;
+         }
+
+         pCacheEntry->inUse = valid;
+      }
+   }
+
+   if( valid && pSession->pObserve != NULL )
+   {
+      valid = coapSessionGet(&pPointer, pEnd, &pSession->pObserve->pMessageIds->next, sizeof(uint16_t)) &&
+              coapSessionGet(&pPointer, pEnd, &count, 1);
+
+      for( i = 0; valid && i < count; i++ )
+      {
+         valid = coapSessionGet(&pPointer, pEnd, &index, 1) && index < COAP_MAX_OBSERVATIONS;
+
+         if( !valid )
+         {
+            break;
+         }
+
+         pObservation = &pSession->pObserve->entries[index];
+
+         valid = coapSessionGet(&pPointer, pEnd, &pObservation->requestLength, sizeof(pObservation->requestLength)) &&
+                 pObservation->requestLength <= COAP_OBSERVE_REQUEST_SIZE &&
+                 coapSessionGet(&pPointer, pEnd, pObservation->request, pObservation->requestLength) &&
+                 coapSessionGet(&pPointer, pEnd, &pObservation->sequence, sizeof(pObservation->sequence)) &&
+                 coapSessionGet(&pPointer, pEnd, &remaining, sizeof(remaining)) &&
+                 coapSessionGet(&pPointer, pEnd, &age, sizeof(age)) &&
+                 coapSessionGet(&pPointer, pEnd, &pObservation->hasSequence, sizeof(pObservation->hasSequence)) &&
+                 coapSessionGet(&pPointer, pEnd, &pObservation->handler, sizeof(pObservation->handler)) &&
+                 coapSessionGet(&pPointer, pEnd, &pObservation->pUserData, sizeof(pObservation->pUserData));
+
+         if( valid )
+         {
+            pObservation->expiryTick = coapSessionDeadline(remaining, slept, now);
+            pObservation->notifyTick = now - age - slept;
+         }
+
+         pObservation->inUse = valid;
+      }
+   }
+
+   if( !valid || pPointer != pEnd )
+   {
+      return COAP_INVALID_PACKET;
+   }
+
+   return COAP_OK;
+}
+
+//! @}
@@ -0,0 +1,46 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_SESSION_H
+#define COAP_SESSION_H
+
+#include "coap.h"
+#include "coap_random.h"
+#include "coap_dedup.h"
+#include "coap_cache.h"
+#include "coap_observe.h"
+
+/*Session Resumption Related*/
+#define COAP_SESSION_MAGIC          0x434F5353UL   //"COSS"
+#define COAP_SESSION_VERSION        1
+// Sessions hold code and data addresses (observe handlers), so one saved by
+// another firmware image must never be restored.  Define a value that changes
+// with every build, e.g. -DCOAP_SESSION_IMAGE_ID=0x$(git rev-parse --short=8 HEAD).
+// Left at 0 the message ids, dedup and cache still resume, but observe
+// relations are refused and have to be registered again.
+#ifndef COAP_SESSION_IMAGE_ID
+#define COAP_SESSION_IMAGE_ID       0UL            //unset, see above
+#endif
+#define COAP_SESSION_MAX_DEDUP      128            //largest dedup table kept, slots and record count are one byte
+#define COAP_SESSION_HEADER_SIZE    12             //magic, image id, version, flags, length
+#define COAP_SESSION_MAX_SIZE       (COAP_SESSION_HEADER_SIZE + 4 + sizeof(CoapMessageIdGenerator) + \
+                                     1 + COAP_DEDUP_ENTRIES * (1 + sizeof(CoapDedupEntry)) + \
+                                     1 + COAP_CACHE_ENTRIES * (1 + sizeof(CoapCacheEntry)) + \
+                                     1 + sizeof(CoapMessageIdGenerator) + COAP_MAX_OBSERVATIONS * (1 + sizeof(CoapObservation)))
+
+/// CoapSession struct, the state saved at sleep, NULL members are skipped
+typedef struct
+{
+   CoapMessageIdGenerator *pMessageIds;  ///< Message ids of the reports, e.g. coapTaskMessageIds()
+   CoapDedupTable *pDedup;               ///< Deduplication window
+   CoapCache *pCache;                    ///< Response cache and its ETags
+   CoapObserveTable *pObserve;           ///< Observe relations and their tokens
+} CoapSession;
+
+int8_t coapSessionSave(const CoapSession *pSession, uint8_t *pBuffer, uint16_t bufferSize, uint16_t *pLength);
+int8_t coapSessionRestore(const CoapSession *pSession, const uint8_t *pBuffer, uint16_t length, uint32_t sleptMs);
+
+//! @}
+#endif  /* COAP_SESSION_H */
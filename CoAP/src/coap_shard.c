@@ -0,0 +1,357 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_shard.h"
+
+#ifdef COAP_LINUX_GATEWAY
+
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+static __thread CoapShard *coapShardSelf = NULL;   // Shard of the calling worker thread.
+
+/*!*****************************************************************************
+ * \brief Reads the monotonic clock
+ *
+ * \return Returns milliseconds since an arbitrary start.
+ *
+ ********************************************************************************/
+static uint64_t coapShardNowMs(void)
+{
+   struct timespec now;   // Used to store the clock.
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/*!*****************************************************************************
+ * \brief CoapSendCallback of a shard's retransmit engine
+ *
+ * Description:
+ *  The engine only hands over the buffer, which is one of the shard's message
+ *  slots, so the slot index gives the destination without a search.
+ *
+ * \param void *pContext [in] - Shard of the engine.
+ *
+ * \param U8 *pBuffer [in] - Message to retransmit.
+ *
+ * \param U16 length [in] - Length of the message.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+static int8_t coapShardRetransmit(void *pContext, uint8_t *pBuffer, uint16_t length)
+{
+   CoapShard *pShard = (CoapShard *)pContext;                                       // Used to access the shard.
+   uint8_t index = (pBuffer - pShard->messages[0]) / COAP_SHARD_MESSAGE_SIZE;      // Used to store the slot.
+
+   pShard->io.peer = pShard->peers[index];
+
+   return coapBatchSend(&pShard->io, pBuffer, length);
+}
+
+/*!*****************************************************************************
+ * \brief CoapRetransmitCallback of a shard's retransmit engine
+ *
+ * Description:
+ *  Releases the message slot once the exchange is over.
+ *
+ * \param void *pUserData [in] - messageInUse flag of the slot.
+ *
+ * \param U16 messageId [in] - Message id of the exchange.
+ *
+ * \param S8 result [in] - Result of the exchange.
+ *
+ * \param CoapMessageView *pResponse [in] - ACK view or NULL.
+ *
+ ********************************************************************************/
+static void coapShardComplete(void *pUserData, uint16_t messageId, int8_t result, CoapMessageView *pResponse)
+{
+   (void)messageId;
+   (void)result;
+   (void)pResponse;
+
+   *(bool *)pUserData = false;
+}
+
+/*!*****************************************************************************
+ * \brief Opens a worker socket
+ *
+ * Description:
+ *  Every worker binds its own socket to the same port with SO_REUSEPORT.  The
+ *  kernel picks the socket by hashing the source address and port, so every
+ *  datagram of a client lands on the same worker and its dedup and retransmit
+ *  state never has to be shared.
+ *
+ * \param U16 port [in] - UDP port to serve.
+ *
+ *
+ * \return Returns the socket or < 0 for error.
+ *
+ ********************************************************************************/
+static int coapShardOpenSocket(uint16_t port)
+{
+   struct sockaddr_in address;   // Used to store the bind address.
+   int enable = 1;               // Used to enable SO_REUSEPORT.
+   int fd;                       // Used to store the socket.
+
+   fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+
+   if( fd < 0 )
+   {
+      return -1;
+   }
+
+   memset(&address, 0, sizeof(address));
+   address.sin_family = AF_INET;
+   address.sin_port = htons(port);
+   address.sin_addr.s_addr = htonl(INADDR_ANY);
+
+   if( setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0 ||
+       bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 )
+   {
+      close(fd);
+      return -1;
+   }
+
+   return fd;
+}
+
+/*!*****************************************************************************
+ * \brief Worker thread
+ *
+ * Description:
+ *  Pins itself to its CPU, then serves batches whenever the socket is readable
+ *  and advances its own retransmit wheel.  Nothing on this path takes a lock.
+ *
+ * \param void *pArgument [in] - Shard of the worker.
+ *
+ *
+ * \return Returns NULL.
+ *
+ ********************************************************************************/
+static void *coapShardWorker(void *pArgument)
+{
+   CoapShard *pShard = (CoapShard *)pArgument;   // Used to access the shard.
+   struct pollfd descriptor;                     // Used to wait for the socket.
+   cpu_set_t cpus;                               // Used to pin the thread.
+   uint64_t lastTick;                            // Last retransmission tick processed.
+   uint64_t now;                                 // Used to store the current time.
+   int timeout;                                  // Used to store the poll timeout.
+
+   coapShardSelf = pShard;
+   coapRandomTaskInit(&pShard->random);
+#if COAP_STATS
+   coapStatsTaskInit(&pShard->stats);
+#endif
+   coapMessageIdInit(&pShard->messageIds);
+
+   CPU_ZERO(&cpus);
+   CPU_SET(pShard->index, &cpus);
+   pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+   descriptor.fd = pShard->socket;
+   descriptor.events = POLLIN;
+   lastTick = coapShardNowMs();
+
+   while( pShard->running )
+   {
+      timeout = (pShard->engine.pendingCount > 0) ? COAP_RETRANS_TICK_MS : COAP_SHARD_IDLE_POLL_MS;
+
+      if( poll(&descriptor, 1, timeout) > 0 )
+      {
+         coapBatchServe(&pShard->io, pShard->pServer, &pShard->messageIds, &pShard->dedup, &pShard->engine);
+      }
+
+      now = coapShardNowMs();
+
+      if( pShard->engine.pendingCount == 0 )
+      {
+         lastTick = now;
+      }
+
+      while( now - lastTick >= COAP_RETRANS_TICK_MS )
+      {
+         coapRetransmitTick(&pShard->engine);
+         lastTick += COAP_RETRANS_TICK_MS;
+      }
+
+      coapBatchFlush(&pShard->io);
+   }
+
+   return NULL;
+}
+
+/*!*****************************************************************************
+ * \brief Starts the sharded server
+ *
+ * Description:
+ *  Starts shardCount workers, each with its own socket, batch rings, dedup
+ *  table, retransmit engine, message id generator and message slots.  pServer
+ *  is shared but never written by dispatch (NON responses take their ids from
+ *  the shard), so all resources must be registered before the call.
+ *
+ * \param CoapShardRuntime *pRuntime [out] - Runtime to start.
+ *
+ * \param CoapServer *pServer [in] - Registered resources.
+ *
+ * \param U16 port [in] - UDP port to serve.
+ *
+ * \param U8 shardCount [in] - Number of workers, usually the number of cores.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapShardStart(CoapShardRuntime *pRuntime, const CoapServer *pServer, uint16_t port, uint8_t shardCount)
+{
+   CoapShard *pShard;   // Used to store the shard being started.
+   int fd;              // Used to store the worker socket.
+   uint8_t i;           // Used as an iterator.
+
+   if( shardCount == 0 || shardCount > COAP_MAX_SHARDS )
+   {
+      return COAP_NO_RESOURCES;
+   }
+
+   pRuntime->shardCount = 0;
+
+   for( i = 0; i < shardCount; i++ )
+   {
+      fd = coapShardOpenSocket(port);
+
+      if( fd < 0 )
+      {
+         coapShardStop(pRuntime);
+         return COAP_MEMALLOCATE_FAILED;
+      }
+
+      pShard = &pRuntime->shards[i];
+      memset(pShard, 0, sizeof(*pShard));
+      pShard->socket = fd;
+      pShard->index = i;
+      pShard->pServer = pServer;
+      pShard->running = true;
+
+      coapBatchInit(&pShard->io, fd);
+      coapDedupInit(&pShard->dedup, pShard->dedupEntries, COAP_SHARD_DEDUP_ENTRIES);
+      coapRetransmitInit(&pShard->engine, coapShardRetransmit, coapShardComplete, pShard);
+
+      if( pthread_create(&pShard->thread, NULL, coapShardWorker, pShard) != 0 )
+      {
+         close(fd);
+         coapShardStop(pRuntime);
+         return COAP_MEMALLOCATE_FAILED;
+      }
+
+      pRuntime->shardCount++;
+   }
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Stops every worker and closes its socket
+ *
+ * \param CoapShardRuntime *pRuntime [in\out] - Runtime to stop.
+ *
+ ********************************************************************************/
+void coapShardStop(CoapShardRuntime *pRuntime)
+{
+   uint8_t i;   // Used as an iterator.
+
+   for( i = 0; i < pRuntime->shardCount; i++ )
+   {
+      pRuntime->shards[i].running = false;
+   }
+
+   for( i = 0; i < pRuntime->shardCount; i++ )
+   {
+      pthread_join(pRuntime->shards[i].thread, NULL);
+      close(pRuntime->shards[i].socket);
+   }
+
+   pRuntime->shardCount = 0;
+}
+
+/*!*****************************************************************************
+ * \brief Gets the shard of the calling worker
+ *
+ * Description:
+ *  Lets a resource handler reach its shard, e.g. to send a confirmable.
+ *
+ * \return Returns the shard or NULL outside a worker.
+ *
+ ********************************************************************************/
+CoapShard *coapShardCurrent(void)
+{
+   return coapShardSelf;
+}
+
+/*!*****************************************************************************
+ * \brief Sends a confirmable message from a shard
+ *
+ * Description:
+ *  Copies the message into a free slot of the shard, stamps it with the next
+ *  message id of the shard and hands it to the shard's engine.  Must be called
+ *  on the shard's worker thread.
+ *
+ * \param CoapShard *pShard [in\out] - Shard to send from.
+ *
+ * \param struct sockaddr_in *pPeer [in] - Destination.
+ *
+ * \param U8 *pBuffer [in] - Confirmable message.
+ *
+ * \param U16 length [in] - Length of the message.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapShardSendConfirmable(CoapShard *pShard, struct sockaddr_in *pPeer, uint8_t *pBuffer, uint16_t length)
+{
+   uint8_t *pMessage;   // Used to store the slot.
+   uint16_t header;     // Used by coapSetMessageId.
+   int8_t results;      // Used to store the results.
+   uint8_t i;           // Used as an iterator.
+
+   if( length > COAP_SHARD_MESSAGE_SIZE )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   for( i = 0; i < COAP_MAX_PENDING; i++ )
+   {
+      if( !pShard->messageInUse[i] )
+      {
+         pMessage = pShard->messages[i];
+         memcpy(pMessage, pBuffer, length);
+         coapSetMessageId(pMessage, &header, coapMessageIdNext(&pShard->messageIds));
+
+         results = coapRetransmitAddPeer(&pShard->engine, pShard->engine.pCongestion, pPeer->sin_addr.s_addr, ntohs(pPeer->sin_port),
+                                         pMessage, length, &pShard->messageInUse[i]);
+
+         if( results < 0 )
+         {
+            return results;
+         }
+
+         pShard->messageInUse[i] = true;
+         pShard->peers[i] = *pPeer;
+
+         return coapShardRetransmit(pShard, pMessage, length);
+      }
+   }
+
+   return COAP_NO_RESOURCES;
+}
+
+#endif  /* COAP_LINUX_GATEWAY */
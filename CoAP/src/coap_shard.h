@@ -0,0 +1,70 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_SHARD_H
+#define COAP_SHARD_H
+
+#include "coap.h"
+
+#ifdef COAP_LINUX_GATEWAY
+
+#include <pthread.h>
+#include "coap_batch.h"
+#include "coap_dedup.h"
+#include "coap_random.h"
+#include "coap_retransmit.h"
+#include "coap_server.h"
+#include "coap_stats.h"
+
+/*Sharded Server Related (Linux gateway build)*/
+#ifndef COAP_MAX_SHARDS
+#define COAP_MAX_SHARDS             16    //worker threads, one socket each
+#endif
+#ifndef COAP_SHARD_DEDUP_ENTRIES
+#define COAP_SHARD_DEDUP_ENTRIES    4096  //client exchanges remembered per shard, about 16 CON/s over EXCHANGE_LIFETIME (~600 KB)
+#endif
+#define COAP_SHARD_IDLE_POLL_MS     1000  //poll timeout while nothing is pending
+#define COAP_SHARD_MESSAGE_SIZE     256   //largest confirmable a shard sends itself
+
+#if (COAP_SHARD_DEDUP_ENTRIES & (COAP_SHARD_DEDUP_ENTRIES - 1)) != 0 || COAP_SHARD_DEDUP_ENTRIES > 32768
+#error "COAP_SHARD_DEDUP_ENTRIES must be a power of 2 up to 32768"
+#endif
+
+/// CoapShard struct, everything one worker touches on its hot path
+typedef struct
+{
+   pthread_t thread;                                   ///< Worker thread
+   int socket;                                         ///< SO_REUSEPORT socket of the worker
+   uint8_t index;                                      ///< Shard number, also the CPU it is pinned to
+   volatile bool running;                              ///< Cleared by coapShardStop
+   const CoapServer *pServer;                          ///< Shared resources, never written by the workers
+   CoapBatchIo io;                                     ///< Receive/send rings, the shard's buffers
+   CoapDedupTable dedup;                               ///< Exchanges of the shard's clients
+   CoapDedupEntry dedupEntries[COAP_SHARD_DEDUP_ENTRIES];   ///< Storage of dedup
+   CoapRetransmitEngine engine;                        ///< Confirmables the shard sent
+   CoapMessageIdGenerator messageIds;                  ///< Message ids of the shard's socket, confirmables and NON responses
+   CoapRandomState random;                             ///< Generator of the worker thread
+   CoapStats stats;                                    ///< Counters of the worker thread
+   uint8_t messages[COAP_MAX_PENDING][COAP_SHARD_MESSAGE_SIZE];   ///< Pending confirmables, the shard's own pool
+   struct sockaddr_in peers[COAP_MAX_PENDING];         ///< Destination of each pending confirmable
+   bool messageInUse[COAP_MAX_PENDING];                ///< messages entry is in use
+} CoapShard;
+
+/// CoapShardRuntime struct
+typedef struct
+{
+   CoapShard shards[COAP_MAX_SHARDS];                  ///< Workers
+   uint8_t shardCount;                                 ///< Workers started
+} CoapShardRuntime;
+
+int8_t coapShardStart(CoapShardRuntime *pRuntime, const CoapServer *pServer, uint16_t port, uint8_t shardCount);
+void coapShardStop(CoapShardRuntime *pRuntime);
+CoapShard *coapShardCurrent(void);
+int8_t coapShardSendConfirmable(CoapShard *pShard, struct sockaddr_in *pPeer, uint8_t *pBuffer, uint16_t length);
+
+#endif  /* COAP_LINUX_GATEWAY */
+
+//! @}
+#endif  /* COAP_SHARD_H */
@@ -0,0 +1,365 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_stats.h"
+
+#if COAP_STATS
+
+#include <stdio.h>
+
+#ifdef COAP_LINUX_GATEWAY
+#include <time.h>
+
+static __thread CoapStats *coapStatsThread = NULL;         // Block of the calling thread.
+#endif
+static CoapStats coapStatsShared;                          // Used by tasks without their own block.
+static CoapStats *coapStatsBlocks[COAP_STATS_MAX_TASKS];   // Registered task blocks.
+static uint8_t coapStatsBlockCount = 0;                    // Used coapStatsBlocks entries.
+
+/*!*****************************************************************************
+ * \brief Gets the block of the calling task
+ *
+ * \return Returns the task block or NULL if the task has none.
+ *
+ ********************************************************************************/
+static inline CoapStats *coapStatsLocal(void)
+{
+#ifdef COAP_LINUX_GATEWAY
+   return coapStatsThread;
+#else
+   return (CoapStats *)pvTaskGetThreadLocalStoragePointer(NULL, COAP_STATS_TLS_INDEX);
+#endif
+}
+
+#ifdef COAP_LINUX_GATEWAY
+/*!*****************************************************************************
+ * \brief Default cycle source of the Linux gateway build
+ *
+ * \return Returns the monotonic clock in nanoseconds, wrapping at 32 bits.
+ *
+ ********************************************************************************/
+uint32_t coapStatsNanoseconds(void)
+{
+   struct timespec now;   // Used to store the clock.
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return (uint32_t)((uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
+#endif
+
+/*!*****************************************************************************
+ * \brief Gives the calling task its own counters
+ *
+ * Description:
+ *  Clears pStats, stores it in the task's thread local storage slot
+ *  COAP_STATS_TLS_INDEX (a __thread pointer on the Linux gateway) and adds it
+ *  to the blocks coapStatsRead sums.  The task then updates its counters with
+ *  plain increments, no lock and no shared cache line.  pStats must live as
+ *  long as the task.  Tasks without a block share one under a critical section.
+ *
+ * \param CoapStats *pStats [in] - Block for the calling task.
+ *
+ ********************************************************************************/
+void coapStatsTaskInit(CoapStats *pStats)
+{
+   memset(pStats, 0, sizeof(*pStats));
+
+   taskENTER_CRITICAL();
+
+   if( coapStatsBlockCount < COAP_STATS_MAX_TASKS )
+   {
+      coapStatsBlocks[coapStatsBlockCount++] = pStats;
+   }
+   else
+   {
+      pStats = NULL;
+   }
+
+   taskEXIT_CRITICAL();
+
+#ifdef COAP_LINUX_GATEWAY
+   coapStatsThread = pStats;
+#else
+   vTaskSetThreadLocalStoragePointer(NULL, COAP_STATS_TLS_INDEX, pStats);
+#endif
+}
+
+/*!*****************************************************************************
+ * \brief Counts events
+ *
+ * \param CoapStatCounter counter [in] - Event to count.
+ *
+ * \param U32 amount [in] - Number of events.
+ *
+ ********************************************************************************/
+void coapStatsAdd(CoapStatCounter counter, uint32_t amount)
+{
+   CoapStats *pStats = coapStatsLocal();   // Used to store the task block.
+
+   if( pStats != NULL )
+   {
+      pStats->counters[counter] += amount;
+      return;
+   }
+
+   taskENTER_CRITICAL();
+   coapStatsShared.counters[counter] += amount;
+   taskEXIT_CRITICAL();
+}
+
+/*!*****************************************************************************
+ * \brief Counts an error
+ *
+ * \param S32 code [in] - CoapErrorCode, values >= 0 are ignored.
+ *
+ ********************************************************************************/
+void coapStatsError(int32_t code)
+{
+   CoapStats *pStats = coapStatsLocal();   // Used to store the task block.
+   uint32_t index;                         // Used to store the counter index.
+
+   if( code >= 0 )
+   {
+      return;
+   }
+
+   index = (uint32_t)-code;
+
+   if( index >= COAP_STATS_ERROR_COUNT )
+   {
+      index = COAP_STATS_ERROR_COUNT - 1;
+   }
+
+   if( pStats != NULL )
+   {
+      pStats->errors[index]++;
+      return;
+   }
+
+   taskENTER_CRITICAL();
+   coapStatsShared.errors[index]++;
+   taskEXIT_CRITICAL();
+}
+
+/*!*****************************************************************************
+ * \brief Adds a sample to a cycle histogram
+ *
+ * \param CoapStatHistogram histogram [in] - Histogram to update.
+ *
+ * \param U32 cycles [in] - Measured cycles.
+ *
+ ********************************************************************************/
+void coapStatsRecord(CoapStatHistogram histogram, uint32_t cycles)
+{
+   CoapStats *pStats = coapStatsLocal();   // Used to store the task block.
+   uint8_t bucket = 0;                     // Used to store the log2 bucket.
+
+   while( cycles != 0 && bucket < COAP_STATS_BUCKETS - 1 )
+   {
+      cycles >>= 1;
+      bucket++;
+   }
+
+   if( pStats != NULL )
+   {
+      pStats->histograms[histogram][bucket]++;
+      return;
+   }
+
+   taskENTER_CRITICAL();
+   coapStatsShared.histograms[histogram][bucket]++;
+   taskEXIT_CRITICAL();
+}
+
+/*!*****************************************************************************
+ * \brief Records the depth of coapMsgQ
+ *
+ * \param U32 depth [in] - Requests waiting in the queue.
+ *
+ ********************************************************************************/
+void coapStatsQueueDepth(uint32_t depth)
+{
+   CoapStats *pStats = coapStatsLocal();   // Used to store the task block.
+
+   if( pStats == NULL )
+   {
+      pStats = &coapStatsShared;
+   }
+
+   pStats->queueDepth = depth;
+
+   if( depth > pStats->queueDepthMax )
+   {
+      pStats->queueDepthMax = depth;
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Sums the counters of every task
+ *
+ * Description:
+ *  Reads every block without stopping the tasks that write them.  Each word is
+ *  read whole, so a total may miss the increments made during the read but is
+ *  never torn.  Queue depths are the maximum over the blocks.
+ *
+ * \param CoapStats *pTotal [out] - Receives the totals.
+ *
+ ********************************************************************************/
+void coapStatsRead(CoapStats *pTotal)
+{
+   CoapStats *pStats;   // Used to store the current block.
+   uint8_t block;       // Used as an iterator.
+   uint8_t i;           // Used as an iterator.
+   uint8_t j;           // Used as an iterator.
+
+   memset(pTotal, 0, sizeof(*pTotal));
+
+   for( block = 0; block <= coapStatsBlockCount; block++ )
+   {
+      pStats = (block < coapStatsBlockCount) ? coapStatsBlocks[block] : &coapStatsShared;
+
+      for( i = 0; i < COAP_STAT_COUNTERS; i++ )
+      {
+         pTotal->counters[i] += pStats->counters[i];
+      }
+
+      for( i = 0; i < COAP_STATS_ERROR_COUNT; i++ )
+      {
+         pTotal->errors[i] += pStats->errors[i];
+      }
+
+      for( i = 0; i < COAP_HIST_COUNT; i++ )
+      {
+         for( j = 0; j < COAP_STATS_BUCKETS; j++ )
+         {
+            pTotal->histograms[i][j] += pStats->histograms[i][j];
+         }
+      }
+
+      if( pStats->queueDepth > pTotal->queueDepth )
+      {
+         pTotal->queueDepth = pStats->queueDepth;
+      }
+
+      if( pStats->queueDepthMax > pTotal->queueDepthMax )
+      {
+         pTotal->queueDepthMax = pStats->queueDepthMax;
+      }
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Formats the totals as text
+ *
+ * Description:
+ *  One line of counters, one of the non-zero error counters ("e<code>=<count>")
+ *  and one per histogram listing the bucket counts.
+ *
+ * \param char *pText [out] - Receives the text.
+ *
+ * \param U16 size [in] - Size of pText.
+ *
+ *
+ * \return Returns the length of the text.
+ *
+ ********************************************************************************/
+static uint16_t coapStatsFormat(char *pText, uint16_t size)
+{
+   static const char *histogramNames[COAP_HIST_COUNT] = { "parse", "encode" };   // Used to label the histograms.
+   CoapStats total;     // Used to store the totals.
+   int length;          // Used to store the text length.
+   uint8_t i;           // Used as an iterator.
+   uint8_t j;           // Used as an iterator.
+
+   coapStatsRead(&total);
+
+   length = snprintf(pText, size, "rx=%lu tx=%lu retransmit=%lu duplicate=%lu dedupFull=%lu queue=%lu queueMax=%lu\n",
+                     (unsigned long)total.counters[COAP_STAT_RX], (unsigned long)total.counters[COAP_STAT_TX],
+                     (unsigned long)total.counters[COAP_STAT_RETRANSMIT], (unsigned long)total.counters[COAP_STAT_DUPLICATE],
+                     (unsigned long)total.counters[COAP_STAT_DEDUP_FULL],
+                     (unsigned long)total.queueDepth, (unsigned long)total.queueDepthMax);
+
+   for( i = 1; i < COAP_STATS_ERROR_COUNT && length < size; i++ )
+   {
+      if( total.errors[i] != 0 )
+      {
+         length += snprintf(pText + length, size - length, "e-%u=%lu ", i, (unsigned long)total.errors[i]);
+      }
+   }
+
+   for( i = 0; i < COAP_HIST_COUNT && length < size; i++ )
+   {
+      length += snprintf(pText + length, size - length, "\n%s", histogramNames[i]);
+
+      for( j = 0; j < COAP_STATS_BUCKETS && length < size; j++ )
+      {
+         length += snprintf(pText + length, size - length, " %lu", (unsigned long)total.histograms[i][j]);
+      }
+   }
+
+   return (length < size) ? (uint16_t)length : size - 1;
+}
+
+/*!*****************************************************************************
+ * \brief Prints the totals with diagprint
+ ********************************************************************************/
+void coapStatsDump(void)
+{
+   char text[512];   // Used to store the formatted totals.
+
+   coapStatsFormat(text, sizeof(text));
+
+   diagprint("%s\n", text);
+}
+
+/*!*****************************************************************************
+ * \brief Resource handler exporting the totals
+ *
+ * Description:
+ *  Register for GET (e.g. on "stats") with coapServerRegister; the response
+ *  is the text of coapStatsDump as text/plain.
+ *
+ * \param void *pContext [in] - Unused.
+ *
+ * \param CoapMessageView *pRequest [in] - Unused.
+ *
+ * \param CoapMessageBuilder *pResponse [in\out] - Receives the payload.
+ *
+ *
+ * \return Returns COAP_CONTENT or < 0 for error.
+ *
+ ********************************************************************************/
+int16_t coapStatsResource(void *pContext, CoapMessageView *pRequest, CoapMessageBuilder *pResponse)
+{
+   char text[512];                        // Used to store the formatted totals.
+   uint8_t format = COAP_FORMAT_TEXT_PLAIN;   // Used as the Content-Format.
+   uint16_t length;                       // Used to store the text length.
+   int8_t results;                        // Used to store the encode results.
+
+   (void)pContext;
+   (void)pRequest;
+
+   length = coapStatsFormat(text, sizeof(text));
+
+   results = coapBuilderAddOption(pResponse, COAP_OPTION_CONTENT_FORMAT, 0, &format);
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   results = coapBuilderSetPayload(pResponse, length, (uint8_t *)text);
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   return COAP_CONTENT;
+}
+
+#endif  /* COAP_STATS */
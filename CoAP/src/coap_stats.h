@@ -0,0 +1,89 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_STATS_H
+#define COAP_STATS_H
+
+#include "coap.h"
+
+/*Statistics Related*/
+#ifndef COAP_STATS
+#define COAP_STATS                  0     //1 to compile in the counters, 0 compiles every hook out
+#endif
+#ifndef COAP_STATS_TLS_INDEX
+#define COAP_STATS_TLS_INDEX        1     //FreeRTOS thread local storage slot holding the task block
+#endif
+#define COAP_STATS_MAX_TASKS        17    //registered blocks, coapTask or one per gateway shard, plus one
+#define COAP_STATS_ERROR_COUNT      32    //one counter per CoapErrorCode, larger codes share the last
+#define COAP_STATS_BUCKETS          16    //log2 buckets, bucket n counts [2^(n-1), 2^n) cycles
+#ifndef COAP_STATS_CYCLES
+#ifdef COAP_LINUX_GATEWAY
+#define COAP_STATS_CYCLES()         coapStatsNanoseconds()
+#else
+#define COAP_STATS_CYCLES()         ((uint32_t)xTaskGetTickCount())   //override with DWT->CYCCNT or similar
+#endif
+#endif
+
+/// CoapStatCounter enum
+typedef enum
+{
+   COAP_STAT_RX = 0,                    ///< Datagrams received
+   COAP_STAT_TX,                        ///< Datagrams sent
+   COAP_STAT_RETRANSMIT,                ///< Confirmables sent again
+   COAP_STAT_DUPLICATE,                 ///< Duplicates answered from the dedup table
+   COAP_STAT_DEDUP_FULL,                ///< Messages not recorded, every dedup slot was live
+   COAP_STAT_COUNTERS                   ///< Number of counters
+} CoapStatCounter;
+
+/// CoapStatHistogram enum
+typedef enum
+{
+   COAP_HIST_PARSE = 0,                 ///< coapParseMessage/coapValidateMessage
+   COAP_HIST_ENCODE,                    ///< coapTemplateBuild, coapBuilderInit to the payload
+   COAP_HIST_COUNT                      ///< Number of histograms
+} CoapStatHistogram;
+
+/// CoapStats struct, written by one task only
+typedef struct
+{
+   uint32_t counters[COAP_STAT_COUNTERS];               ///< CoapStatCounter totals
+   uint32_t errors[COAP_STATS_ERROR_COUNT];             ///< Indexed by -CoapErrorCode
+   uint32_t histograms[COAP_HIST_COUNT][COAP_STATS_BUCKETS];   ///< Cycle histograms
+   uint32_t queueDepth;                                 ///< coapMsgQ depth at the last drain
+   uint32_t queueDepthMax;                              ///< Deepest coapMsgQ seen
+} CoapStats;
+
+#if COAP_STATS
+
+#define COAP_STAT_INC(counter)              coapStatsAdd(counter, 1)
+#define COAP_STAT_ADD(counter, amount)      coapStatsAdd(counter, amount)
+#define COAP_STAT_ERROR(code)               coapStatsError(code)
+#define COAP_STAT_START(start)              uint32_t start = COAP_STATS_CYCLES()
+#define COAP_STAT_STOP(histogram, start)    coapStatsRecord(histogram, COAP_STATS_CYCLES() - (start))
+#define COAP_STAT_QUEUE_DEPTH(depth)        coapStatsQueueDepth(depth)
+
+uint32_t coapStatsNanoseconds(void);
+void coapStatsTaskInit(CoapStats *pStats);
+void coapStatsAdd(CoapStatCounter counter, uint32_t amount);
+void coapStatsError(int32_t code);
+void coapStatsRecord(CoapStatHistogram histogram, uint32_t cycles);
+void coapStatsQueueDepth(uint32_t depth);
+void coapStatsRead(CoapStats *pTotal);
+void coapStatsDump(void);
+int16_t coapStatsResource(void *pContext, CoapMessageView *pRequest, CoapMessageBuilder *pResponse);
+
+#else
+
+#define COAP_STAT_INC(counter)              ((void)0)
+#define COAP_STAT_ADD(counter, amount)      ((void)0)
+#define COAP_STAT_ERROR(code)               ((void)0)
+#define COAP_STAT_START(start)              ((void)0)
+#define COAP_STAT_STOP(histogram, start)    ((void)0)
+#define COAP_STAT_QUEUE_DEPTH(depth)        ((void)0)
+
+#endif  /* COAP_STATS */
+
+//! @}
+#endif  /* COAP_STATS_H */
@@ -0,0 +1,875 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_task.h"
+#include "coap_dedup.h"
+#include "coap_pool.h"
+#include "coap_random.h"
+#include "coap_stats.h"
+
+xQueueHandle coapMsgQ;                                   // Queue of CoapRequest pointers.
+static xQueueHandle coapCancelQ;                         // Requests given up by coapWaitResponse.
+
+static TaskHandle_t coapTaskHandle = NULL;               // Task owning the socket.
+static CoapTransport coapTransport;                      // Socket access.
+static CoapRetransmitEngine coapEngine;                  // Outstanding CON requests.
+static CoapCongestion coapCongestion;                    // RTO estimate and window towards the server.
+static CoapMessageIdGenerator coapMessageIds;            // Message ids of everything sent on coapTransport.
+static bool coapWindowFull = false;                      // A CON is held back until the window opens.
+static CoapRequest *coapAwaiting[COAP_MAX_PENDING];      // Requests waiting for a separate/NON response.
+static uint8_t coapAwaitingCount = 0;                    // Number of used coapAwaiting entries.
+static uint8_t coapRxBuffer[MAX_BUFFER_SIZE];            // Receive buffer, only used by coapTask.
+static uint16_t coapRxLength = 0;                        // Length of the datagram in coapRxBuffer.
+static CoapMessageHandler coapMessageHandler = NULL;     // Unsolicited messages, e.g. notifications.
+static CoapPollHandler coapPollHandler = NULL;           // Periodic work in the task context.
+static void *coapHandlerContext = NULL;                  // Passed to the handlers.
+static CoapRing *coapRings[COAP_RING_MAX_RINGS];         // Producer rings drained after coapMsgQ.
+static uint8_t coapRingsCount = 0;                       // Number of used coapRings entries.
+static CoapRequest coapRingRequests[COAP_MAX_PENDING];   // Exchanges of ring requests, free while pBuffer is NULL.
+static CoapDedupTable coapDedup;                         // Messages received from the server and the reply sent.
+static CoapDedupEntry coapDedupEntries[COAP_DEDUP_ENTRIES];   // Storage of coapDedup.
+
+/*!*****************************************************************************
+ * \brief Completes a request
+ *
+ * Description:
+ *  Stores the result of an exchange in the request, copies the response datagram
+ *  if there is one and wakes the producer task.
+ *
+ * \param CoapRequest *pRequest [in\out] - Request to complete.
+ *
+ * \param S8 result [in] - COAP_OK or < 0 for error.
+ *
+ * \param bool hasResponse [in] - coapRxBuffer holds the response.
+ *
+ ********************************************************************************/
+static void coapTaskComplete(CoapRequest *pRequest, int8_t result, bool hasResponse)
+{
+   pRequest->responseLength = 0;
+
+   if( hasResponse && pRequest->pResponseBuffer != NULL )
+   {
+      if( coapRxLength <= pRequest->responseSize )
+      {
+         memcpy(pRequest->pResponseBuffer, coapRxBuffer, coapRxLength);
+         pRequest->responseLength = coapRxLength;
+      }
+      else
+      {
+         result = COAP_INSUFFICIENT_BUFFER;
+      }
+   }
+
+   pRequest->result = result;
+
+   COAP_STAT_ERROR(result);
+
+   // The request buffer is no longer needed for retransmission.
+   if( pRequest->pRing != NULL )
+   {
+      coapRingRelease(pRequest->pRing, pRequest->pBuffer);
+      pRequest->pBuffer = NULL;
+   }
+   else if( pRequest->freeBuffer )
+   {
+      coapPoolFree(pRequest->pBuffer);
+      pRequest->pBuffer = NULL;
+   }
+
+   if( pRequest->notifyTask != NULL )
+   {
+      xTaskNotifyGive(pRequest->notifyTask);
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Parks a request until its response arrives
+ *
+ * Description:
+ *  Used for NON requests and for CON requests answered with an empty ACK.  The
+ *  response is matched by token in coapTaskHandleResponse.
+ *
+ * \param CoapRequest *pRequest [in] - Request waiting for a response.
+ *
+ ********************************************************************************/
+static void coapTaskAwait(CoapRequest *pRequest)
+{
+   uint8_t i;   // Used as an iterator.
+
+   for( i = 0; i < COAP_MAX_PENDING; i++ )
+   {
+      if( coapAwaiting[i] == NULL )
+      {
+         coapAwaiting[i] = pRequest;
+         coapAwaitingCount++;
+         return;
+      }
+   }
+
+   coapTaskComplete(pRequest, COAP_NO_RESOURCES, false);
+}
+
+/*!*****************************************************************************
+ * \brief Retransmission engine completion callback
+ *
+ * \param void *pUserData [in] - The CoapRequest of the exchange.
+ *
+ * \param U16 messageId [in] - Message id of the exchange.
+ *
+ * \param S8 result [in] - Result of the exchange.
+ *
+ * \param CoapMessageView *pResponse [in] - ACK view or NULL.
+ *
+ ********************************************************************************/
+static void coapTaskRetransmitComplete(void *pUserData, uint16_t messageId, int8_t result, CoapMessageView *pResponse)
+{
+   CoapRequest *pRequest = (CoapRequest *)pUserData;   // Request of the exchange.
+
+   (void)messageId;
+
+   if( result == COAP_OK && pResponse->code == COAP_EMPTY )
+   {
+      // Empty ACK, the response will follow in a separate message.
+      if( pRequest->notifyTask != NULL )
+      {
+         pRequest->sentTick = xTaskGetTickCount();
+         coapTaskAwait(pRequest);
+      }
+      else
+      {
+         coapTaskComplete(pRequest, COAP_OK, false);
+      }
+   }
+   else
+   {
+      // Piggybacked response, reset or timeout.
+      coapTaskComplete(pRequest, result, pResponse != NULL);
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Sends one request and tracks it until completion
+ *
+ * \param CoapRequest *pRequest [in] - Request taken off coapMsgQ or a ring.
+ *
+ ********************************************************************************/
+static void coapTaskSend(CoapRequest *pRequest)
+{
+   int8_t results;   // Used to store the send results.
+
+   results = coapTransport.send(coapTransport.pContext, pRequest->pBuffer, pRequest->length);
+
+   if( results < 0 )
+   {
+      coapTaskComplete(pRequest, results, false);
+      return;
+   }
+
+   COAP_STAT_INC(COAP_STAT_TX);
+
+   pRequest->sentTick = xTaskGetTickCount();
+
+   if( coapGetType(pRequest->pBuffer, pRequest->length) == COAP_TYPE_CON )
+   {
+      results = coapRetransmitAdd(&coapEngine, pRequest->pBuffer, pRequest->length, pRequest);
+
+      if( results < 0 )
+      {
+         coapTaskComplete(pRequest, results, false);
+      }
+   }
+   else if( pRequest->notifyTask != NULL )
+   {
+      coapTaskAwait(pRequest);
+   }
+   else
+   {
+      coapTaskComplete(pRequest, COAP_OK, false);
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Sends the requests of one producer ring
+ *
+ * Description:
+ *  Each slot is wrapped in a coapRingRequests entry that lives until the
+ *  exchange completes; coapTaskComplete returns the slab buffer to the
+ *  ring's free ring, which also frees the entry.  The message id and token
+ *  are written here, so producers never touch the shared generator and its
+ *  critical section.  A CON that would exceed the congestion window stays in
+ *  the ring like it does on coapMsgQ.
+ *
+ * \param CoapRing *pRing [in\out] - Ring to drain.
+ *
+ *
+ * \return Returns false if the window is full and sending has to stop.
+ *
+ ********************************************************************************/
+static bool coapTaskSendRing(CoapRing *pRing)
+{
+   CoapRingSlot *pSlot;     // Used to store the oldest slot.
+   CoapRequest *pRequest;   // Used to store the request entry.
+   uint16_t messageId;      // Used to store the message id of the request.
+   uint8_t tokenLength;     // Used to store the token length of the request.
+   uint8_t i;               // Used as an iterator.
+
+   while( (pSlot = coapRingPeek(pRing)) != NULL )
+   {
+      if( coapGetType(pSlot->pBuffer, pSlot->length) == COAP_TYPE_CON && !coapCongestionCanSend(&coapCongestion) )
+      {
+         return false;
+      }
+
+      pRequest = NULL;
+
+      for( i = 0; i < COAP_MAX_PENDING; i++ )
+      {
+         if( coapRingRequests[i].pBuffer == NULL )
+         {
+            pRequest = &coapRingRequests[i];
+            break;
+         }
+      }
+
+      // Entries are freed by completions, which also open the window.
+      if( pRequest == NULL )
+      {
+         return false;
+      }
+
+      memset(pRequest, 0, sizeof(*pRequest));
+      pRequest->pBuffer = pSlot->pBuffer;
+      pRequest->length = pSlot->length;
+      pRequest->pRing = pRing;
+
+      coapRingPop(pRing);
+
+      // As per RFC 7252, the message id is the 3rd and 4th header bytes.
+      messageId = coapMessageIdNext(&coapMessageIds);
+      pRequest->pBuffer[2] = messageId >> 8;
+      pRequest->pBuffer[3] = messageId & 0xFF;
+
+      tokenLength = pRequest->pBuffer[0] & 0x0F;
+
+      if( tokenLength <= MAX_TOKEN_LENGTH && COAP_HDR_BYTES + tokenLength <= pRequest->length )
+      {
+         coapGenerateToken(pRequest->pBuffer + COAP_HDR_BYTES, tokenLength);
+      }
+
+      coapTaskSend(pRequest);
+   }
+
+   return true;
+}
+
+/*!*****************************************************************************
+ * \brief Sends the requests queued on coapMsgQ and the producer rings
+ *
+ * Description:
+ *  Drains coapMsgQ in one go so everything the producers queued while the task
+ *  was blocked goes out back to back in a single radio wake up.  A CON that
+ *  would exceed the congestion window stays at the head of the queue; the
+ *  queue is drained again once an exchange completes.  The rings are drained
+ *  after coapMsgQ the same way, each one on its own, so NON traffic of one
+ *  producer never waits behind a CON held back in coapMsgQ or another ring.
+ *
+ ********************************************************************************/
+static void coapTaskSendQueued(void)
+{
+   CoapRequest *pRequest;   // Used to store the dequeued request.
+   uint8_t i;               // Used as an iterator.
+
+   COAP_STAT_QUEUE_DEPTH(uxQueueMessagesWaiting(coapMsgQ));
+
+   coapWindowFull = false;
+
+   while( xQueuePeek(coapMsgQ, &pRequest, 0) == pdPASS )
+   {
+      if( coapGetType(pRequest->pBuffer, pRequest->length) == COAP_TYPE_CON && !coapCongestionCanSend(&coapCongestion) )
+      {
+         coapWindowFull = true;
+         break;
+      }
+
+      xQueueReceive(coapMsgQ, &pRequest, 0);
+
+      coapTaskSend(pRequest);
+   }
+
+   for( i = 0; i < coapRingsCount; i++ )
+   {
+      if( !coapTaskSendRing(coapRings[i]) )
+      {
+         coapWindowFull = true;
+      }
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Handles a separate or NON response
+ *
+ * Description:
+ *  Matches a CON/NON message to a parked request by token and completes the
+ *  request.  Anything unmatched goes to the message handler (Observe
+ *  notifications, requests for a server).  A confirmable message is
+ *  acknowledged if it was consumed and reset otherwise, as is a NON message
+ *  nobody wants, so a server stops sending notifications we no longer observe.
+ *  No empty ACK is sent when the handler returns COAP_TASK_REPLIED.
+ *
+ *  Every message goes through coapDedup first: a retransmission, e.g. of a
+ *  separate response whose request already completed, gets the same ACK or
+ *  RST again instead of being handled twice.  A duplicate of a CON the handler
+ *  answered itself is dropped, the handler keeps its own reply.
+ *
+ * Rejecting:
+ *          https://tools.ietf.org/html/rfc7252#section-4.2
+ *
+ * Message Deduplication:
+ *          https://tools.ietf.org/html/rfc7252#section-4.5
+ *
+ * \param CoapMessageView *pView [in] - Parsed response in coapRxBuffer.
+ *
+ ********************************************************************************/
+static void coapTaskHandleResponse(CoapMessageView *pView)
+{
+   CoapMessageBuilder reply;   // Used to build the empty ACK or RST.
+   uint8_t replyBuffer[COAP_HDR_BYTES];   // Empty messages are header only.
+   CoapRequest *pRequest;      // Used to store the candidate request.
+   uint8_t *pReply;            // Used to store the reply of a duplicate.
+   uint16_t replyLength;       // Used to store the length of that reply.
+   int8_t result = COAP_UNKNOWN_TOKEN;   // Used to store whether the message was consumed.
+   uint8_t i;                  // Used as an iterator.
+
+   // coapTask only talks to the server, the endpoint is always the same.
+   if( coapDedupCheck(&coapDedup, 0, 0, pView, &pReply, &replyLength) == COAP_DUPLICATE_MESSAGE )
+   {
+      if( replyLength > 0 )
+      {
+         coapTransport.send(coapTransport.pContext, pReply, replyLength);
+      }
+
+      return;
+   }
+
+   for( i = 0; i < COAP_MAX_PENDING; i++ )
+   {
+      pRequest = coapAwaiting[i];
+
+      if( pRequest != NULL &&
+          (pRequest->pBuffer[0] & COAP_HDR_TKL_MASK) == pView->tokenLength &&
+          memcmp(pRequest->pBuffer + COAP_HDR_BYTES, pView->pToken, pView->tokenLength) == 0 )
+      {
+         coapAwaiting[i] = NULL;
+         coapAwaitingCount--;
+         coapTaskComplete(pRequest, COAP_OK, true);
+         result = COAP_OK;
+         break;
+      }
+   }
+
+   if( result != COAP_OK && coapMessageHandler != NULL )
+   {
+      result = coapMessageHandler(coapHandlerContext, pView);
+   }
+
+   if( result == COAP_TASK_REPLIED )
+   {
+      return;
+   }
+
+   if( pView->type == COAP_TYPE_CON || result != COAP_OK )
+   {
+      if( coapBuilderInit(&reply, replyBuffer, sizeof(replyBuffer), result == COAP_OK ? COAP_TYPE_ACK : COAP_TYPE_RST,
+                          COAP_EMPTY, pView->messageId, NULL, 0) == COAP_OK )
+      {
+         coapTransport.send(coapTransport.pContext, replyBuffer, reply.length);
+         coapDedupStore(&coapDedup, 0, 0, pView->messageId, replyBuffer, reply.length);
+      }
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Drops every reference coapTask holds to a request
+ *
+ * Description:
+ *  The request may still be on coapMsgQ, in the retransmission engine or
+ *  parked, or it may already have completed.  coapMsgQ cannot remove from the
+ *  middle, so the queued requests are rotated once and the cancelled one left
+ *  out, with the scheduler suspended so no producer takes a freed slot or
+ *  changes the order.  This only runs after a timeout.  A pooled buffer is
+ *  freed as completion would have done.
+ *
+ * \param CoapRequest *pRequest [in\out] - Request to detach.
+ *
+ ********************************************************************************/
+static void coapTaskDetach(CoapRequest *pRequest)
+{
+   CoapRequest *pQueued;   // Used to store a rotated request.
+   UBaseType_t count;      // Used to store the number of queued requests.
+   uint8_t i;              // Used as an iterator.
+
+   vTaskSuspendAll();
+
+   for( count = uxQueueMessagesWaiting(coapMsgQ); count > 0; count-- )
+   {
+      if( xQueueReceive(coapMsgQ, &pQueued, 0) == pdPASS && pQueued != pRequest )
+      {
+         xQueueSend(coapMsgQ, &pQueued, 0);
+      }
+   }
+
+   xTaskResumeAll();
+
+   for( i = 0; i < COAP_MAX_PENDING; i++ )
+   {
+      if( coapEngine.entries[i].inUse && coapEngine.entries[i].pUserData == pRequest )
+      {
+         coapRetransmitCancel(&coapEngine, coapEngine.entries[i].messageId);
+      }
+
+      if( coapAwaiting[i] == pRequest )
+      {
+         coapAwaiting[i] = NULL;
+         coapAwaitingCount--;
+      }
+   }
+
+   if( pRequest->freeBuffer && pRequest->pBuffer != NULL )
+   {
+      coapPoolFree(pRequest->pBuffer);
+      pRequest->pBuffer = NULL;
+   }
+
+   pRequest->detached = true;
+}
+
+/*!*****************************************************************************
+ * \brief Detaches the requests given up by coapWaitResponse
+ ********************************************************************************/
+static void coapTaskCancelQueued(void)
+{
+   CoapRequest *pRequest;   // Used to store the cancelled request.
+
+   while( xQueueReceive(coapCancelQ, &pRequest, 0) == pdPASS )
+   {
+      coapTaskDetach(pRequest);
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Reads and dispatches every waiting datagram
+ ********************************************************************************/
+static void coapTaskReceive(void)
+{
+   CoapMessageView view;   // Used to store the parsed datagram.
+   int16_t length;         // Used to store the datagram length.
+
+   while( (length = coapTransport.receive(coapTransport.pContext, coapRxBuffer, sizeof(coapRxBuffer))) > 0 )
+   {
+      coapRxLength = (uint16_t)length;
+
+      COAP_STAT_INC(COAP_STAT_RX);
+
+      // Validate and parse in the same pass, drop anything malformed.
+      if( coapValidateMessage(coapRxBuffer, coapRxLength, &view) < 0 )
+      {
+         continue;
+      }
+
+      if( view.type == COAP_TYPE_ACK || view.type == COAP_TYPE_RST )
+      {
+         // An ACK or RST of a message sent outside the engine (an Observe
+         // registration) belongs to the message handler.
+         if( coapRetransmitHandleMessage(&coapEngine, &view) == COAP_UNKNOWN_MESSAGE_ID &&
+             coapMessageHandler != NULL )
+         {
+            coapMessageHandler(coapHandlerContext, &view);
+         }
+      }
+      else
+      {
+         coapTaskHandleResponse(&view);
+      }
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Expires parked requests that never got a response
+ *
+ * Description:
+ *  Requests parked for longer than COAP_MAX_WAIT_COUNT seconds complete with
+ *  COAP_MESSAGE_TIMEOUT.  The table is only COAP_MAX_PENDING entries and the
+ *  sweep runs once a second, only while something is parked.
+ *
+ ********************************************************************************/
+static void coapTaskSweep(void)
+{
+   TickType_t now = xTaskGetTickCount();   // Used to compute waited time.
+   uint8_t i;                              // Used as an iterator.
+
+   for( i = 0; i < COAP_MAX_PENDING; i++ )
+   {
+      if( coapAwaiting[i] != NULL &&
+          (now - coapAwaiting[i]->sentTick) >= pdMS_TO_TICKS(COAP_MAX_WAIT_COUNT * 1000) )
+      {
+         coapTaskComplete(coapAwaiting[i], COAP_MESSAGE_TIMEOUT, false);
+         coapAwaiting[i] = NULL;
+         coapAwaitingCount--;
+      }
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Initialises the CoAP task
+ *
+ * Description:
+ *  Creates coapMsgQ and stores the transport used by coapTask.  Must be called
+ *  before coapTask is started and before any request is submitted.  The queue
+ *  only carries CoapRequest pointers; the message bytes live in caller or pool
+ *  (coapPoolAlloc) buffers, so each queue slot costs one pointer.
+ *
+ * \param CoapTransport *pTransport [in] - Socket access for coapTask.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapTaskInit(CoapTransport *pTransport)
+{
+   coapMsgQ = xQueueCreate(MAX_MESSAGE_QUEUE, sizeof(CoapRequest *));
+   coapCancelQ = xQueueCreate(MAX_MESSAGE_QUEUE, sizeof(CoapRequest *));
+
+   if( coapMsgQ == NULL || coapCancelQ == NULL )
+   {
+      return COAP_MEMALLOCATE_FAILED;
+   }
+
+   coapTransport = *pTransport;
+
+   coapMessageIdInitShared(&coapMessageIds);
+   coapDedupInit(&coapDedup, coapDedupEntries, COAP_DEDUP_ENTRIES);
+   coapRetransmitInit(&coapEngine, coapTransport.send, coapTaskRetransmitComplete, coapTransport.pContext);
+   coapCongestionInit(&coapCongestion);
+   coapRetransmitSetCongestion(&coapEngine, &coapCongestion);
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Installs the handlers for unsolicited messages and periodic work
+ *
+ * Description:
+ *  Both handlers run in the coapTask context and may send on the transport,
+ *  which keeps the socket single-owner.  Observe registrations are therefore
+ *  made from the poll handler, e.g. with coapObserveRegister and
+ *  coapObservePoll, and notifications reach coapObserveHandleMessage through
+ *  the message handler.  Must be called before coapTask is started.
+ *
+ * \param CoapMessageHandler message [in] - Unmatched messages, may be NULL.
+ *
+ * \param CoapPollHandler poll [in] - Called about once a second, may be NULL.
+ *
+ * \param void *pContext [in] - Passed to the handlers.
+ *
+ ********************************************************************************/
+void coapTaskSetHandler(CoapMessageHandler message, CoapPollHandler poll, void *pContext)
+{
+   coapMessageHandler = message;
+   coapPollHandler = poll;
+   coapHandlerContext = pContext;
+}
+
+/*!*****************************************************************************
+ * \brief Queues a request for coapTask
+ *
+ * Description:
+ *  Never blocks: if coapMsgQ is full the request is rejected immediately so a
+ *  producer never waits on the network.  The request and its buffers must stay
+ *  valid until it completes.
+ *
+ * \param CoapRequest *pRequest [in] - Request to send.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapSubmit(CoapRequest *pRequest)
+{
+   // Only requests taken from a ring go back to a slab.
+   pRequest->pRing = NULL;
+   pRequest->detached = false;
+
+   if( xQueueSend(coapMsgQ, &pRequest, 0) != pdPASS )
+   {
+      COAP_STAT_ERROR(COAP_NO_RESOURCES);
+      return COAP_NO_RESOURCES;
+   }
+
+   coapTaskNotifySend();
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Registers a producer ring with coapTask
+ *
+ * Description:
+ *  Gives a task or ISR its own lock-free path to coapTask, see coapRingPush.
+ *  Must be called before coapTask is started.
+ *
+ * \param CoapRing *pRing [in] - Initialised ring, must stay valid.
+ *
+ *
+ * \return Returns COAP_OK or COAP_NO_RESOURCES if COAP_RING_MAX_RINGS are
+ *         registered.
+ *
+ ********************************************************************************/
+int8_t coapTaskAddRing(CoapRing *pRing)
+{
+   if( coapRingsCount >= COAP_RING_MAX_RINGS )
+   {
+      return COAP_NO_RESOURCES;
+   }
+
+   coapRings[coapRingsCount] = pRing;
+   coapRingsCount++;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Waits for a submitted request to complete
+ *
+ * Description:
+ *  Blocks the calling task on its task notification until coapTask completes
+ *  the request.  pRequest->notifyTask must be the calling task.  On timeout
+ *  coapTask is asked to drop the request and this waits until it has, so the
+ *  caller owns the request again when this returns; a completion that raced
+ *  the timeout is consumed here and does not end the next wait early.
+ *
+ * \param CoapRequest *pRequest [in] - Submitted request.
+ *
+ * \param TickType_t ticksToWait [in] - Maximum time to wait.
+ *
+ *
+ * \return Returns the request result or COAP_MESSAGE_TIMEOUT.
+ *
+ ********************************************************************************/
+int8_t coapWaitResponse(CoapRequest *pRequest, TickType_t ticksToWait)
+{
+   bool completed;   // Used to store whether the completion was received.
+
+   if( ulTaskNotifyTake(pdTRUE, ticksToWait) != 0 )
+   {
+      return pRequest->result;
+   }
+
+   xQueueSend(coapCancelQ, &pRequest, portMAX_DELAY);
+   xTaskNotify(coapTaskHandle, COAP_EVENT_CANCEL, eSetBits);
+
+   // Polled, the completion and the detach can arrive in either order.
+   completed = false;
+
+   while( !pRequest->detached )
+   {
+      completed |= (ulTaskNotifyTake(pdTRUE, 1) != 0);
+   }
+
+   completed |= (ulTaskNotifyTake(pdTRUE, 0) != 0);
+
+   return completed ? pRequest->result : COAP_MESSAGE_TIMEOUT;
+}
+
+/*!*****************************************************************************
+ * \brief Reports the congestion state towards the server
+ *
+ * Description:
+ *  May be called from any task, e.g. a console command; the values are read
+ *  without stopping coapTask, so they are a snapshot.
+ *
+ * \param CoapCongestionReport *pReport [out] - Receives RTO, RTT and window.
+ *
+ ********************************************************************************/
+void coapTaskGetCongestion(CoapCongestionReport *pReport)
+{
+   coapCongestionReport(&coapCongestion, pReport);
+}
+
+/*!*****************************************************************************
+ * \brief Gets the message id generator of the server socket
+ *
+ * Description:
+ *  coapTask matches acknowledgements by message id only, so every request
+ *  submitted to it (uplink batches, Observe registrations, server responses
+ *  from the message handler) must take its id from here.  Safe to use from
+ *  any task.
+ *
+ * \return Returns the shared generator.
+ *
+ ********************************************************************************/
+CoapMessageIdGenerator *coapTaskMessageIds(void)
+{
+   return &coapMessageIds;
+}
+
+/*!*****************************************************************************
+ * \brief Signals coapTask that datagrams are waiting
+ *
+ * Description:
+ *  Called from the network stack receive callback.
+ *
+ ********************************************************************************/
+void coapTaskNotifyReceive(void)
+{
+   if( coapTaskHandle != NULL )
+   {
+      xTaskNotify(coapTaskHandle, COAP_EVENT_RX, eSetBits);
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Signals coapTask that datagrams are waiting, interrupt version
+ *
+ * \param BaseType_t *pHigherPriorityTaskWoken [out] - Set if a yield is needed.
+ *
+ ********************************************************************************/
+void coapTaskNotifyReceiveFromISR(BaseType_t *pHigherPriorityTaskWoken)
+{
+   if( coapTaskHandle != NULL )
+   {
+      xTaskNotifyFromISR(coapTaskHandle, COAP_EVENT_RX, eSetBits, pHigherPriorityTaskWoken);
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Signals coapTask that requests are waiting
+ *
+ * Description:
+ *  Called by coapSubmit and coapRingPush.
+ *
+ ********************************************************************************/
+void coapTaskNotifySend(void)
+{
+   if( coapTaskHandle != NULL )
+   {
+      xTaskNotify(coapTaskHandle, COAP_EVENT_TX, eSetBits);
+   }
+}
+
+/*!*****************************************************************************
+ * \brief Signals coapTask that requests are waiting, interrupt version
+ *
+ * Description:
+ *  Called by coapRingPushFromISR.
+ *
+ * \param BaseType_t *pHigherPriorityTaskWoken [out] - Set if a yield is needed.
+ *
+ ********************************************************************************/
+void coapTaskNotifySendFromISR(BaseType_t *pHigherPriorityTaskWoken)
+{
+   if( coapTaskHandle != NULL )
+   {
+      xTaskNotifyFromISR(coapTaskHandle, COAP_EVENT_TX, eSetBits, pHigherPriorityTaskWoken);
+   }
+}
+
+/*!*****************************************************************************
+ * \brief CoAP I/O task
+ *
+ * Description:
+ *  Single owner of the socket.  The task sleeps on its notification value until
+ *  a producer queues a request (COAP_EVENT_TX) or the network stack reports a
+ *  datagram (COAP_EVENT_RX).  It only wakes periodically while exchanges are
+ *  outstanding or a poll handler is installed, so the radio can sleep between
+ *  batches.
+ *
+ ********************************************************************************/
+void coapTask(void)
+{
+   TickType_t lastTick;      // Last retransmission tick processed.
+   TickType_t lastSweep;     // Last parked request sweep.
+   TickType_t lastPoll;      // Last poll handler call.
+   TickType_t now;           // Used to store the current tick.
+   TickType_t timeout;       // Used to store the notification wait time.
+   uint32_t events;          // Used to store the notification bits.
+   CoapRandomState random;   // Generator of this task, used without a lock.
+#if COAP_STATS
+   CoapStats stats;          // Counters of this task, updated without a lock.
+#endif
+
+   coapTaskHandle = xTaskGetCurrentTaskHandle();
+   coapRandomTaskInit(&random);
+#if COAP_STATS
+   coapStatsTaskInit(&stats);
+#endif
+   lastTick = xTaskGetTickCount();
+   lastSweep = lastTick;
+   lastPoll = lastTick;
+
+   // Catch anything queued before the handle was known.
+   coapTaskSendQueued();
+
+   for( ;; )
+   {
+      if( coapEngine.pendingCount > 0 || coapAwaitingCount > 0 )
+      {
+         timeout = pdMS_TO_TICKS(COAP_RETRANS_TICK_MS);
+      }
+      else if( coapPollHandler != NULL )
+      {
+         timeout = pdMS_TO_TICKS(1000);
+      }
+      else
+      {
+         timeout = portMAX_DELAY;
+      }
+
+      events = 0;
+      xTaskNotifyWait(0, COAP_EVENT_TX | COAP_EVENT_RX | COAP_EVENT_CANCEL, &events, timeout);
+
+      now = xTaskGetTickCount();
+
+      if( coapEngine.pendingCount == 0 )
+      {
+         // Nothing was outstanding, don't replay idle time into the wheel.
+         lastTick = now;
+      }
+
+      if( events & COAP_EVENT_RX )
+      {
+         coapTaskReceive();
+      }
+
+      if( events & COAP_EVENT_CANCEL )
+      {
+         coapTaskCancelQueued();
+      }
+
+      while( (now - lastTick) >= pdMS_TO_TICKS(COAP_RETRANS_TICK_MS) )
+      {
+         coapRetransmitTick(&coapEngine);
+         lastTick += pdMS_TO_TICKS(COAP_RETRANS_TICK_MS);
+      }
+
+      // Completions above may have opened the congestion window.
+      if( (events & COAP_EVENT_TX) || (coapWindowFull && coapCongestionCanSend(&coapCongestion)) )
+      {
+         coapTaskSendQueued();
+      }
+
+      if( coapAwaitingCount > 0 && (now - lastSweep) >= pdMS_TO_TICKS(1000) )
+      {
+         coapTaskSweep();
+         lastSweep = now;
+      }
+
+      if( coapPollHandler != NULL && (now - lastPoll) >= pdMS_TO_TICKS(1000) )
+      {
+         coapPollHandler(coapHandlerContext);
+         lastPoll = now;
+      }
+   }
+}
@@ -0,0 +1,67 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_TASK_H
+#define COAP_TASK_H
+
+#include "coap.h"
+#include "coap_retransmit.h"
+#include "coap_random.h"
+#include "coap_ring.h"
+
+/*CoAP Task Related*/
+#define COAP_EVENT_TX               0x01  //a request was queued on coapMsgQ or a CoapRing
+#define COAP_EVENT_RX               0x02  //the socket has datagrams to read
+#define COAP_EVENT_CANCEL           0x04  //coapWaitResponse gave up on a request
+#define COAP_TASK_REPLIED           1     //message handler result, consumed and already answered (piggybacked response)
+
+/// Non-blocking receive, returns the datagram length, 0 if nothing is waiting or < 0 for error.
+typedef int16_t (*CoapReceiveCallback)(void *pContext, uint8_t *pBuffer, uint16_t bufferSize);
+
+/// CoapTransport struct
+typedef struct
+{
+   CoapSendCallback send;               ///< Sends one datagram to the server
+   CoapReceiveCallback receive;         ///< Reads one datagram without blocking
+   void *pContext;                      ///< Passed to send and receive
+} CoapTransport;
+
+/// Handles a message no submitted request was waiting for, returns COAP_OK if it was consumed,
+/// COAP_TASK_REPLIED if it also sent the reply to a CON itself, < 0 otherwise.
+typedef int8_t (*CoapMessageHandler)(void *pContext, CoapMessageView *pView);
+
+/// Called from coapTask about once a second, e.g. for coapObservePoll.
+typedef void (*CoapPollHandler)(void *pContext);
+
+/// CoapRequest struct
+typedef struct
+{
+   uint8_t *pBuffer;                    ///< Encoded request, must stay valid until completion
+   uint16_t length;                     ///< Length of the request
+   uint8_t *pResponseBuffer;            ///< Response is copied here, may be NULL
+   uint16_t responseSize;               ///< Size of pResponseBuffer
+   uint16_t responseLength;             ///< [out] Length of the response
+   int8_t result;                       ///< [out] COAP_OK or < 0 for error
+   TaskHandle_t notifyTask;             ///< Task notified on completion, NULL for fire and forget
+   bool freeBuffer;                     ///< pBuffer came from coapPoolAlloc, release it on completion
+   CoapRing *pRing;                     ///< [internal] pBuffer came from this ring's slab, NULL otherwise
+   volatile bool detached;              ///< [internal] coapTask no longer references the cancelled request
+   TickType_t sentTick;                 ///< [internal] Tick the request was sent at
+} CoapRequest;
+
+int8_t coapTaskInit(CoapTransport *pTransport);
+void coapTaskSetHandler(CoapMessageHandler message, CoapPollHandler poll, void *pContext);
+int8_t coapSubmit(CoapRequest *pRequest);
+int8_t coapTaskAddRing(CoapRing *pRing);
+int8_t coapWaitResponse(CoapRequest *pRequest, TickType_t ticksToWait);
+void coapTaskGetCongestion(CoapCongestionReport *pReport);
+CoapMessageIdGenerator *coapTaskMessageIds(void);
+void coapTaskNotifyReceive(void);
+void coapTaskNotifyReceiveFromISR(BaseType_t *pHigherPriorityTaskWoken);
+void coapTaskNotifySend(void);
+void coapTaskNotifySendFromISR(BaseType_t *pHigherPriorityTaskWoken);
+
+//! @}
+#endif  /* COAP_TASK_H */
@@ -0,0 +1,653 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_tcp.h"
+#include "coap_stats.h"
+
+/*!*****************************************************************************
+ * \brief Starts a message in RFC 8323 framing
+ *
+ * Description:
+ *  The reliable transport counterpart of coapBuilderInit.  The frame header
+ *  has no type or message id and its length field depends on the options and
+ *  payload, so COAP_TCP_MAX_HEADER bytes are reserved in front of the token and
+ *  the header is written by coapTcpBuilderFinish.  The last four reserved bytes
+ *  carry the token length and code like a UDP header, which is what
+ *  coapBuilderAddOption reads back, so options and payload are added with the
+ *  usual coapBuilderAddOption and coapBuilderSetPayload calls.
+ *
+ * Message format:
+ *          https://tools.ietf.org/html/rfc8323#section-3.2
+ *
+ *
+ * \param CoapMessageBuilder *pBuilder [out] - Cursor to initialise.
+ *
+ * \param U8 *pBuffer [in] - Buffer the frame is built in.
+ *
+ * \param U16 bufferSize [in] - Size of pBuffer.
+ *
+ * \param U8 code [in] - CoapCode or COAP_SIGNAL_x code.
+ *
+ * \param U8 *pToken [in] - Token of the message.
+ *
+ * \param U8 tokenLength [in] - Length of the token (0-8).
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapTcpBuilderInit(CoapMessageBuilder *pBuilder, uint8_t *pBuffer, uint16_t bufferSize, uint8_t code, uint8_t *pToken, uint8_t tokenLength)
+{
+   uint8_t *pHeader = pBuffer + COAP_TCP_MAX_HEADER - COAP_HDR_BYTES;   // Used to store the header the builder sees.
+
+   if( !coapTokenLengthIsValid(tokenLength) )
+   {
+      return COAP_INVALID_TOKEN_LENGTH;
+   }
+
+   // Check that the header and token fit in the buffer.
+   if( bufferSize < (COAP_TCP_MAX_HEADER + tokenLength) )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   pHeader[0] = tokenLength;
+   pHeader[1] = 0;
+   pHeader[2] = 0;
+   pHeader[3] = code;
+   memcpy(pHeader + COAP_HDR_BYTES, pToken, tokenLength);
+
+   pBuilder->pBuffer = pHeader;
+   pBuilder->pPointer = pHeader + COAP_HDR_BYTES + tokenLength;
+   pBuilder->length = COAP_HDR_BYTES + tokenLength;
+   pBuilder->remaining = bufferSize - COAP_TCP_MAX_HEADER - tokenLength;
+   pBuilder->lastOption = 0;
+   pBuilder->hasPayload = false;
+
+#if COAP_STATS
+   pBuilder->start = COAP_STATS_CYCLES();
+#endif
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Writes the frame header of a message started with coapTcpBuilderInit
+ *
+ * Description:
+ *  Len counts the options, payload marker and payload.  0-12 are stored in the
+ *  header byte and 13 and 14 add one and two extended length bytes; the four
+ *  byte form (15) is never needed for frames that fit a 16 bit length.  Over
+ *  WebSockets the length is carried by the WebSocket frame and Len is always 0.
+ *  The header is written right-aligned against the code, so the frame starts 0
+ *  to 2 bytes into the buffer; the builder must not be used afterwards.
+ *
+ * Message length:
+ *          https://tools.ietf.org/html/rfc8323#section-3.2
+ *
+ * WebSocket framing:
+ *          https://tools.ietf.org/html/rfc8323#section-4.2
+ *
+ *
+ * \param CoapMessageBuilder *pBuilder [in] - Cursor from coapTcpBuilderInit.
+ *
+ * \param bool webSocket [in] - Frame for a WebSocket message.
+ *
+ * \param U8 **pFrame [out] - Start of the frame.
+ *
+ * \param U16 *pFrameLength [out] - Length of the frame.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapTcpBuilderFinish(CoapMessageBuilder *pBuilder, bool webSocket, uint8_t **pFrame, uint16_t *pFrameLength)
+{
+   uint8_t tokenLength = pBuilder->pBuffer[0] & COAP_HDR_TKL_MASK;   // Used to store the token length.
+   uint8_t *pCode = pBuilder->pBuffer + COAP_HDR_BYTES - 1;          // Used to store the position of the code.
+   uint16_t length = pBuilder->length - COAP_HDR_BYTES - tokenLength;   // Used to store Len.
+   uint8_t *pStart;                                                  // Used to store the start of the frame.
+
+   if( webSocket )
+   {
+      pStart = pCode - 1;
+      pStart[0] = tokenLength;
+   }
+   else if( length < 13 )
+   {
+      pStart = pCode - 1;
+      pStart[0] = (length << 4) | tokenLength;
+   }
+   else if( length < 269 )
+   {
+      pStart = pCode - 2;
+      pStart[0] = (13 << 4) | tokenLength;
+      pStart[1] = length - 13;
+   }
+   else
+   {
+      pStart = pCode - 3;
+      pStart[0] = (14 << 4) | tokenLength;
+      pStart[1] = (length - 269) >> 8;
+      pStart[2] = (length - 269) & 0xFF;
+   }
+
+   *pFrame = pStart;
+   *pFrameLength = pBuilder->pPointer - pStart;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Parses a message in RFC 8323 framing into a message view
+ *
+ * Description:
+ *  Decodes the frame header and hands the options and payload to
+ *  coapWalkOptions, so both framings fill the same CoapMessageView.  The view
+ *  has no message id and type COAP_TYPE_NON, the transport being reliable.
+ *  Over TCP pBuffer may hold a partial frame or several frames: a frame that
+ *  is not complete yet returns COAP_END_OF_PACKET and pFrameLength tells where
+ *  the next one starts.  Over WebSockets pBuffer is one WebSocket message.
+ *  Signaling codes (7.01-7.05) are accepted along with the CoapCode values.
+ *
+ * Message format:
+ *          https://tools.ietf.org/html/rfc8323#section-3.2
+ *
+ *
+ * \param U8 *pBuffer [in] - Received bytes.
+ *
+ * \param U16 bufferLength [in] - Number of received bytes.
+ *
+ * \param bool webSocket [in] - pBuffer is a WebSocket message.
+ *
+ * \param CoapMessageView *pView [out] - View to fill or NULL.
+ *
+ * \param U16 *pFrameLength [out] - Length of the frame.
+ *
+ *
+ * \return Returns COAP_OK on success, COAP_END_OF_PACKET if more bytes are
+ *         needed or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapTcpParse(uint8_t *pBuffer, uint16_t bufferLength, bool webSocket, CoapMessageView *pView, uint16_t *pFrameLength)
+{
+   uint8_t lengthNibble;     // Used to store the Len field.
+   uint8_t tokenLength;      // Used to store the token length.
+   uint8_t extended;         // Used to store the extended length bytes.
+   uint32_t length;          // Used to store the options and payload length.
+   uint32_t frameLength;     // Used to store the length of the whole frame.
+   uint8_t code;             // Used to store the code.
+   uint8_t *pToken;          // Used to store the start of the token.
+   int8_t results;           // Used to store the walk results.
+
+   if( bufferLength < 2 )
+   {
+      return webSocket ? COAP_INVALID_PACKET : COAP_END_OF_PACKET;
+   }
+
+   lengthNibble = pBuffer[0] >> 4;
+   tokenLength = pBuffer[0] & COAP_HDR_TKL_MASK;
+
+   if( !coapTokenLengthIsValid(tokenLength) )
+   {
+      return COAP_INVALID_TOKEN_LENGTH;
+   }
+
+   if( webSocket )
+   {
+      if( lengthNibble != 0 || bufferLength < 2 + tokenLength )
+      {
+         return COAP_INVALID_PACKET;
+      }
+
+      extended = 0;
+      frameLength = bufferLength;
+   }
+   else
+   {
+      extended = (lengthNibble < 13) ? 0 : (lengthNibble == 15) ? 4 : lengthNibble - 12;
+
+      if( bufferLength < 2 + extended )
+      {
+         return COAP_END_OF_PACKET;
+      }
+
+      switch( lengthNibble )
+      {
+         case 13:
+            length = pBuffer[1] + 13UL;
+            break;
+
+         case 14:
+            length = (((uint32_t)pBuffer[1] << 8) | pBuffer[2]) + 269UL;
+            break;
+
+         case 15:
+            length = (((uint32_t)pBuffer[1] << 24) | ((uint32_t)pBuffer[2] << 16) | ((uint32_t)pBuffer[3] << 8) | pBuffer[4]) + 65805UL;
+            break;
+
+         default:
+            length = lengthNibble;
+            break;
+      }
+
+      // Frames longer than a 16 bit length can never be reassembled.
+      if( length > 0xFFFFUL - 2 - extended - tokenLength )
+      {
+         return COAP_INSUFFICIENT_BUFFER;
+      }
+
+      frameLength = 2 + extended + tokenLength + length;
+
+      if( frameLength > bufferLength )
+      {
+         return COAP_END_OF_PACKET;
+      }
+   }
+
+   COAP_STAT_START(start);
+
+   code = pBuffer[1 + extended];
+   pToken = pBuffer + 2 + extended;
+
+   if( pView != NULL )
+   {
+      pView->version = COAP_VERSION;
+      pView->type = COAP_TYPE_NON;
+      pView->tokenLength = tokenLength;
+      pView->code = code;
+      pView->messageId = 0;
+      pView->pToken = pToken;
+      pView->optionCount = 0;
+      pView->pPayload = NULL;
+      pView->payloadLength = 0;
+   }
+
+   if( !coapCodeIsValid(code) && (code < COAP_SIGNAL_CSM || code > COAP_SIGNAL_ABORT) )
+   {
+      results = COAP_UNKNOWN_CODE;
+   }
+   else
+   {
+      results = coapWalkOptions(pToken + tokenLength, pBuffer + frameLength, pView);
+   }
+
+   COAP_STAT_STOP(COAP_HIST_PARSE, start);
+   COAP_STAT_ERROR(results);
+
+   *pFrameLength = frameLength;
+
+   return results;
+}
+
+/*!*****************************************************************************
+ * \brief Initialises the state of a new connection
+ *
+ * Description:
+ *  Tokens of the connection start at a random value so requests of a previous
+ *  connection are not mistaken for new ones.  Until the peer CSM arrives its
+ *  Max-Message-Size is the RFC 8323 default of 1152 bytes.
+ *
+ * \param CoapTcpConnection *pConnection [out] - Connection to initialise.
+ *
+ * \param bool webSocket [in] - Connection is a WebSocket.
+ *
+ ********************************************************************************/
+void coapTcpInit(CoapTcpConnection *pConnection, bool webSocket)
+{
+   memset(pConnection, 0, sizeof(*pConnection));
+
+   pConnection->nextToken = ((uint32_t)coapGetRandom() << 16) | coapGetRandom();
+   pConnection->peerMaxMessageSize = COAP_TCP_DEFAULT_MESSAGE_SIZE;
+   pConnection->webSocket = webSocket;
+}
+
+/*!*****************************************************************************
+ * \brief Gets the free part of the receive buffer
+ *
+ * Description:
+ *  Read or recv straight into the returned space and report the bytes with
+ *  coapTcpReceiveCommit.  Consumed frames are dropped first, which moves the
+ *  unconsumed bytes and so ends the views returned by coapTcpNext.  Over
+ *  WebSockets commit one WebSocket message at a time and consume it with
+ *  coapTcpNext before the next one.
+ *
+ * \param CoapTcpConnection *pConnection [in\out] - Connection.
+ *
+ * \param U8 **pWrite [out] - Where the next bytes go.
+ *
+ *
+ * \return Returns the number of free bytes.
+ *
+ ********************************************************************************/
+uint16_t coapTcpReceiveSpace(CoapTcpConnection *pConnection, uint8_t **pWrite)
+{
+   if( pConnection->rxStart > 0 )
+   {
+      pConnection->rxLength -= pConnection->rxStart;
+      memmove(pConnection->rx, pConnection->rx + pConnection->rxStart, pConnection->rxLength);
+      pConnection->rxStart = 0;
+   }
+
+   *pWrite = pConnection->rx + pConnection->rxLength;
+
+   return COAP_TCP_RX_SIZE - pConnection->rxLength;
+}
+
+/*!*****************************************************************************
+ * \brief Adds received bytes to the receive buffer
+ *
+ * \param CoapTcpConnection *pConnection [in\out] - Connection.
+ *
+ * \param U16 length [in] - Bytes written at the space from coapTcpReceiveSpace.
+ *
+ ********************************************************************************/
+void coapTcpReceiveCommit(CoapTcpConnection *pConnection, uint16_t length)
+{
+   pConnection->rxLength += length;
+}
+
+/*!*****************************************************************************
+ * \brief Takes the next complete message off a connection
+ *
+ * Description:
+ *  Call until it returns COAP_END_OF_PACKET after each commit; pipelined
+ *  messages are handed out in order while the views point into the receive
+ *  buffer.  A CSM is applied to the connection before it is returned.  Any
+ *  other error leaves the byte stream out of step and the connection must be
+ *  closed, after an Abort signal (coapTcpBuildSignal).
+ *
+ * Signaling:
+ *          https://tools.ietf.org/html/rfc8323#section-5
+ *
+ *
+ * \param CoapTcpConnection *pConnection [in\out] - Connection.
+ *
+ * \param CoapMessageView *pView [out] - View to fill.
+ *
+ *
+ * \return Returns COAP_OK on success, COAP_END_OF_PACKET if no message is
+ *         complete or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapTcpNext(CoapTcpConnection *pConnection, CoapMessageView *pView)
+{
+   uint16_t frameLength;     // Used to store the length of the frame.
+   CoapOptionEntry *pEntry;  // Used to store the current option.
+   uint8_t i;                // Used as an iterator.
+   int8_t results;           // Used to store the parse results.
+
+   if( pConnection->rxStart == pConnection->rxLength )
+   {
+      return COAP_END_OF_PACKET;
+   }
+
+   results = coapTcpParse(pConnection->rx + pConnection->rxStart, pConnection->rxLength - pConnection->rxStart,
+                          pConnection->webSocket, pView, &frameLength);
+
+   if( results == COAP_END_OF_PACKET && pConnection->rxStart == 0 && pConnection->rxLength == COAP_TCP_RX_SIZE )
+   {
+      // Larger than the Max-Message-Size we announced.
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   pConnection->rxStart += frameLength;
+
+   if( pView->code == COAP_SIGNAL_CSM )
+   {
+      for( i = 0; i < pView->optionCount; i++ )
+      {
+         pEntry = &pView->options[i];
+
+         if( pEntry->number == COAP_CSM_MAX_MESSAGE_SIZE )
+         {
+            pConnection->peerMaxMessageSize = coapDecodeOptionUint(pEntry->pData, pEntry->length);
+         }
+         else if( pEntry->number == COAP_CSM_BLOCK_WISE_TRANSFER )
+         {
+            pConnection->peerBlockWise = true;
+         }
+      }
+
+      pConnection->csmReceived = true;
+   }
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Starts a request on a connection
+ *
+ * Description:
+ *  Takes an exchange slot, gives it the next token of the connection and
+ *  starts the frame with coapTcpBuilderInit.  Any number of requests up to
+ *  COAP_TCP_MAX_PENDING may be outstanding; there is no message id or
+ *  acknowledgement on a reliable transport, so the token alone pairs each
+ *  response with its request whatever order the responses come in.  Finish
+ *  the frame with coapTcpBuilderFinish and keep it within peerMaxMessageSize.
+ *
+ * Tokens:
+ *          https://tools.ietf.org/html/rfc8323#section-3.3
+ *
+ *
+ * \param CoapTcpConnection *pConnection [in\out] - Connection.
+ *
+ * \param CoapMessageBuilder *pBuilder [out] - Cursor to initialise.
+ *
+ * \param U8 *pBuffer [in] - Buffer the frame is built in.
+ *
+ * \param U16 bufferSize [in] - Size of pBuffer.
+ *
+ * \param CoapCode code [in] - Method of the request.
+ *
+ * \param void *pContext [in] - Returned by coapTcpMatch with the response.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapTcpRequest(CoapTcpConnection *pConnection, CoapMessageBuilder *pBuilder, uint8_t *pBuffer, uint16_t bufferSize, CoapCode code, void *pContext)
+{
+   CoapTcpExchange *pExchange = NULL;   // Used to store the free slot.
+   uint8_t i;                           // Used as an iterator.
+   int8_t results;                      // Used to store the builder results.
+
+   for( i = 0; i < COAP_TCP_MAX_PENDING; i++ )
+   {
+      if( !pConnection->exchanges[i].inUse )
+      {
+         pExchange = &pConnection->exchanges[i];
+         break;
+      }
+   }
+
+   if( pExchange == NULL )
+   {
+      return COAP_NO_RESOURCES;
+   }
+
+   pExchange->token[0] = pConnection->nextToken >> 24;
+   pExchange->token[1] = (pConnection->nextToken >> 16) & 0xFF;
+   pExchange->token[2] = (pConnection->nextToken >> 8) & 0xFF;
+   pExchange->token[3] = pConnection->nextToken & 0xFF;
+
+   results = coapTcpBuilderInit(pBuilder, pBuffer, bufferSize, code, pExchange->token, COAP_TCP_TOKEN_LENGTH);
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   pConnection->nextToken++;
+   pExchange->pContext = pContext;
+   pExchange->inUse = true;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Pairs a response with its request
+ *
+ * Description:
+ *  The exchange is released unless the response carries an Observe option,
+ *  in which case more notifications will follow on the same token.
+ *
+ * \param CoapTcpConnection *pConnection [in\out] - Connection.
+ *
+ * \param CoapMessageView *pView [in] - Response from coapTcpNext.
+ *
+ * \param void **pContext [out] - Context given to coapTcpRequest.
+ *
+ *
+ * \return Returns COAP_OK on success or COAP_UNKNOWN_TOKEN.
+ *
+ ********************************************************************************/
+int8_t coapTcpMatch(CoapTcpConnection *pConnection, CoapMessageView *pView, void **pContext)
+{
+   CoapTcpExchange *pExchange;   // Used to store the current slot.
+   uint8_t i;                    // Used as an iterator.
+
+   if( pView->tokenLength != COAP_TCP_TOKEN_LENGTH )
+   {
+      return COAP_UNKNOWN_TOKEN;
+   }
+
+   for( i = 0; i < COAP_TCP_MAX_PENDING; i++ )
+   {
+      pExchange = &pConnection->exchanges[i];
+
+      if( pExchange->inUse && memcmp(pExchange->token, pView->pToken, COAP_TCP_TOKEN_LENGTH) == 0 )
+      {
+         *pContext = pExchange->pContext;
+
+         if( coapViewFindOption(pView, COAP_OPTION_OBSERVE, 0) < 0 )
+         {
+            pExchange->inUse = false;
+         }
+
+         return COAP_OK;
+      }
+   }
+
+   return COAP_UNKNOWN_TOKEN;
+}
+
+/*!*****************************************************************************
+ * \brief Builds the CSM that opens a connection
+ *
+ * Description:
+ *  Announces COAP_TCP_RX_SIZE as Max-Message-Size and Block-wise support.
+ *  Both peers send a CSM as their first message.  The signaling options reuse
+ *  numbers that are reserved or mean something else in requests, so they are
+ *  written here rather than through the option table of coapBuilderAddOption.
+ *
+ * Capabilities and Settings Messages:
+ *          https://tools.ietf.org/html/rfc8323#section-5.3
+ *
+ *
+ * \param CoapTcpConnection *pConnection [in] - Connection.
+ *
+ * \param U8 *pBuffer [in] - Buffer the frame is built in.
+ *
+ * \param U16 bufferSize [in] - Size of pBuffer.
+ *
+ * \param U8 **pFrame [out] - Start of the frame.
+ *
+ * \param U16 *pFrameLength [out] - Length of the frame.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapTcpBuildCsm(CoapTcpConnection *pConnection, uint8_t *pBuffer, uint16_t bufferSize, uint8_t **pFrame, uint16_t *pFrameLength)
+{
+   CoapMessageBuilder builder;   // Used to build the frame.
+   uint8_t value[4];             // Used to store the Max-Message-Size value.
+   uint8_t valueLength;          // Used to store the value length.
+   int8_t results;               // Used to store the results.
+
+   results = coapTcpBuilderInit(&builder, pBuffer, bufferSize, COAP_SIGNAL_CSM, NULL, 0);
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   valueLength = coapEncodeOptionUint(COAP_TCP_RX_SIZE, value);
+
+   if( builder.remaining < 1 + valueLength + 1 )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   // Deltas 2 and 2, both below 13, so every option header is one byte.
+   *builder.pPointer++ = (COAP_CSM_MAX_MESSAGE_SIZE << 4) | valueLength;
+   memcpy(builder.pPointer, value, valueLength);
+   builder.pPointer += valueLength;
+   *builder.pPointer++ = (COAP_CSM_BLOCK_WISE_TRANSFER - COAP_CSM_MAX_MESSAGE_SIZE) << 4;
+
+   builder.length += 1 + valueLength + 1;
+   builder.remaining -= 1 + valueLength + 1;
+   builder.lastOption = COAP_CSM_BLOCK_WISE_TRANSFER;
+
+   return coapTcpBuilderFinish(&builder, pConnection->webSocket, pFrame, pFrameLength);
+}
+
+/*!*****************************************************************************
+ * \brief Builds a signal without options
+ *
+ * Description:
+ *  Ping keeps the connection alive, Pong answers it with the token of the Ping,
+ *  Release and Abort close the connection.
+ *
+ * Ping and Pong:
+ *          https://tools.ietf.org/html/rfc8323#section-5.4
+ *
+ *
+ * \param CoapTcpConnection *pConnection [in] - Connection.
+ *
+ * \param U8 code [in] - COAP_SIGNAL_PING, PONG, RELEASE or ABORT.
+ *
+ * \param CoapMessageView *pPing [in] - Ping being answered, NULL for an empty token.
+ *
+ * \param U8 *pBuffer [in] - Buffer the frame is built in.
+ *
+ * \param U16 bufferSize [in] - Size of pBuffer.
+ *
+ * \param U8 **pFrame [out] - Start of the frame.
+ *
+ * \param U16 *pFrameLength [out] - Length of the frame.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapTcpBuildSignal(CoapTcpConnection *pConnection, uint8_t code, CoapMessageView *pPing, uint8_t *pBuffer, uint16_t bufferSize, uint8_t **pFrame, uint16_t *pFrameLength)
+{
+   CoapMessageBuilder builder;   // Used to build the frame.
+   int8_t results;               // Used to store the results.
+
+   if( code < COAP_SIGNAL_PING || code > COAP_SIGNAL_ABORT )
+   {
+      return COAP_UNKNOWN_CODE;
+   }
+
+   results = coapTcpBuilderInit(&builder, pBuffer, bufferSize, code, (pPing != NULL) ? pPing->pToken : NULL, (pPing != NULL) ? pPing->tokenLength : 0);
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   return coapTcpBuilderFinish(&builder, pConnection->webSocket, pFrame, pFrameLength);
+}
+
+//! @}
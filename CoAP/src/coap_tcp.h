@@ -0,0 +1,69 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_TCP_H
+#define COAP_TCP_H
+
+#include "coap.h"
+
+/*TCP/WebSocket Framing Related (RFC 8323)*/
+#define COAP_TCP_MAX_HEADER             4      //Len/TKL byte, 2 extended length bytes (16 bit frames), code
+#define COAP_TCP_DEFAULT_MESSAGE_SIZE   1152   //peer Max-Message-Size until its CSM arrives
+#ifndef COAP_TCP_RX_SIZE
+#define COAP_TCP_RX_SIZE                (2 * MAX_BUFFER_SIZE)   //reassembly buffer, sent as our Max-Message-Size
+#endif
+#ifndef COAP_TCP_MAX_PENDING
+#define COAP_TCP_MAX_PENDING            16     //requests pipelined on one connection
+#endif
+#define COAP_TCP_TOKEN_LENGTH           4
+
+/*Signaling Related*/
+#define COAP_SIGNAL_CSM                 0xE1   //7.01 Capabilities and Settings
+#define COAP_SIGNAL_PING                0xE2   //7.02
+#define COAP_SIGNAL_PONG                0xE3   //7.03
+#define COAP_SIGNAL_RELEASE             0xE4   //7.04
+#define COAP_SIGNAL_ABORT               0xE5   //7.05
+#define COAP_CSM_MAX_MESSAGE_SIZE       2
+#define COAP_CSM_BLOCK_WISE_TRANSFER    4
+
+/// CoapTcpExchange struct, one request waiting for its response
+typedef struct
+{
+   uint8_t token[COAP_TCP_TOKEN_LENGTH];   ///< Token of the request
+   void *pContext;                         ///< Caller data returned with the response
+   bool inUse;                             ///< Slot holds a request
+} CoapTcpExchange;
+
+/// CoapTcpConnection struct, the state of one reliable transport connection
+typedef struct
+{
+   uint8_t rx[COAP_TCP_RX_SIZE];                     ///< Received bytes not yet consumed
+   uint16_t rxStart;                                 ///< First unconsumed byte in rx
+   uint16_t rxLength;                                ///< Bytes received into rx
+   CoapTcpExchange exchanges[COAP_TCP_MAX_PENDING];  ///< Requests awaiting a response
+   uint32_t nextToken;                               ///< Token of the next request
+   uint32_t peerMaxMessageSize;                      ///< Largest message the peer accepts
+   bool peerBlockWise;                               ///< Peer supports Block-wise over this connection
+   bool csmReceived;                                 ///< Peer CSM has been processed
+   bool webSocket;                                   ///< Framing is WebSocket (Len is always 0)
+} CoapTcpConnection;
+
+// Frame codec
+int8_t coapTcpBuilderInit(CoapMessageBuilder *pBuilder, uint8_t *pBuffer, uint16_t bufferSize, uint8_t code, uint8_t *pToken, uint8_t tokenLength);
+int8_t coapTcpBuilderFinish(CoapMessageBuilder *pBuilder, bool webSocket, uint8_t **pFrame, uint16_t *pFrameLength);
+int8_t coapTcpParse(uint8_t *pBuffer, uint16_t bufferLength, bool webSocket, CoapMessageView *pView, uint16_t *pFrameLength);
+
+// Connection
+void coapTcpInit(CoapTcpConnection *pConnection, bool webSocket);
+uint16_t coapTcpReceiveSpace(CoapTcpConnection *pConnection, uint8_t **pWrite);
+void coapTcpReceiveCommit(CoapTcpConnection *pConnection, uint16_t length);
+int8_t coapTcpNext(CoapTcpConnection *pConnection, CoapMessageView *pView);
+int8_t coapTcpRequest(CoapTcpConnection *pConnection, CoapMessageBuilder *pBuilder, uint8_t *pBuffer, uint16_t bufferSize, CoapCode code, void *pContext);
+int8_t coapTcpMatch(CoapTcpConnection *pConnection, CoapMessageView *pView, void **pContext);
+int8_t coapTcpBuildCsm(CoapTcpConnection *pConnection, uint8_t *pBuffer, uint16_t bufferSize, uint8_t **pFrame, uint16_t *pFrameLength);
+int8_t coapTcpBuildSignal(CoapTcpConnection *pConnection, uint8_t code, CoapMessageView *pPing, uint8_t *pBuffer, uint16_t bufferSize, uint8_t **pFrame, uint16_t *pFrameLength);
+
+//! @}
+#endif  /* COAP_TCP_H */
@@ -0,0 +1,337 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_template.h"
+#include "coap_stats.h"
+
+/*!*****************************************************************************
+ * \brief Pre-encodes an Exosite request shape
+ *
+ * Description:
+ *  Encodes, once, everything a request to an alias has in common: the header,
+ *  a zero token of COAP_TEMPLATE_TOKEN_LENGTH bytes, Uri-Host, Uri-Path
+ *  prefix/alias/CIK and the Content-Format.  The endpoint options are copied
+ *  from coapConfigGet as they are; only the alias and format are encoded.
+ *  Call at init for every alias that is sent (e.g. PACKET_ALIAS, LED_ALIAS,
+ *  CONFIG_ALIAS); pAlias must stay valid for coapTemplateRefresh.
+ *
+ * Uris:
+ *          https://tools.ietf.org/html/rfc7252#section-6.4
+ *
+ * \param CoapTemplate *pTemplate [out] - Template to build.
+ *
+ * \param U8 type [in] - Message type, usually COAP_TYPE_CON.
+ *
+ * \param CoapCode code [in] - Method, usually COAP_POST.
+ *
+ * \param char *pAlias [in] - Exosite alias.
+ *
+ * \param CoapContentFormat format [in] - Content-Format or COAP_FORMAT_NONE.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapTemplateInit(CoapTemplate *pTemplate, uint8_t type, CoapCode code, const char *pAlias, CoapContentFormat format)
+{
+   return coapTemplateInitFrom(pTemplate, coapConfigGet(), type, code, pAlias, format);
+}
+
+/*!*****************************************************************************
+ * \brief Pre-encodes a request shape of a given endpoint
+ *
+ * Description:
+ *  Same as coapTemplateInit with the options of pConfig instead of
+ *  coapConfigGet, e.g. a device behind a gateway from coapConfigDevice.  The
+ *  template must not be passed to coapTemplateRefresh, which follows
+ *  coapConfigGet.
+ *
+ * \param CoapTemplate *pTemplate [out] - Template to build.
+ *
+ * \param CoapConfig *pConfig [in] - Endpoint options.
+ *
+ * \param U8 type [in] - Message type, usually COAP_TYPE_CON.
+ *
+ * \param CoapCode code [in] - Method, usually COAP_POST.
+ *
+ * \param char *pAlias [in] - Exosite alias.
+ *
+ * \param CoapContentFormat format [in] - Content-Format or COAP_FORMAT_NONE.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapTemplateInitFrom(CoapTemplate *pTemplate, const CoapConfig *pConfig, uint8_t type, CoapCode code, const char *pAlias, CoapContentFormat format)
+{
+   CoapMessageBuilder builder;                     // Used to encode the options.
+   uint8_t token[COAP_TEMPLATE_TOKEN_LENGTH];     // Used as the token placeholder.
+   uint8_t formatData[4];                          // Used to store the encoded format.
+   int8_t results;                                 // Used to store the results.
+
+   memset(token, 0, sizeof(token));
+
+   results = coapBuilderInit(&builder, pTemplate->buffer, sizeof(pTemplate->buffer), type, code, 0, token, sizeof(token));
+
+   if( results == COAP_OK )
+   {
+      results = coapBuilderAddEncoded(&builder, pConfig->options, pConfig->optionsLength, 0, COAP_OPTION_URI_PATH);
+   }
+
+   if( results == COAP_OK )
+   {
+      results = coapBuilderAddOption(&builder, COAP_OPTION_URI_PATH, strlen(pAlias), (uint8_t *)pAlias);
+   }
+
+   if( results == COAP_OK )
+   {
+      results = coapBuilderAddEncoded(&builder, pConfig->cikOption, pConfig->cikOptionLength, COAP_OPTION_URI_PATH, COAP_OPTION_URI_PATH);
+   }
+
+   if( results == COAP_OK && format != COAP_FORMAT_NONE )
+   {
+      results = coapBuilderAddOption(&builder, COAP_OPTION_CONTENT_FORMAT, coapEncodeOptionUint(format, formatData), formatData);
+   }
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   pTemplate->length = builder.length;
+   pTemplate->tokenLength = COAP_TEMPLATE_TOKEN_LENGTH;
+   pTemplate->generation = pConfig->generation;
+   pTemplate->pAlias = pAlias;
+   pTemplate->format = format;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Picks up a changed endpoint
+ *
+ * Description:
+ *  Re-encodes the template if coapConfigSetServer, coapConfigSetPrefix or
+ *  coapConfigSetCik ran since it was built, otherwise costs one compare.  Call
+ *  before coapTemplateBuild wherever the endpoint can change at runtime.
+ *
+ * \param CoapTemplate *pTemplate [in\out] - Template from coapTemplateInit.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapTemplateRefresh(CoapTemplate *pTemplate)
+{
+   if( pTemplate->generation == coapConfigGet()->generation )
+   {
+      return COAP_OK;
+   }
+
+   return coapTemplateInit(pTemplate, (pTemplate->buffer[0] & COAP_HDR_TYPE_MASK) >> 4, (CoapCode)pTemplate->buffer[1],
+                           pTemplate->pAlias, pTemplate->format);
+}
+
+/*!*****************************************************************************
+ * \brief Gets where the payload of a templated message goes
+ *
+ * Description:
+ *  Lets the caller write the payload straight into pBuffer before calling
+ *  coapTemplateBuild with a NULL pPayload.
+ *
+ * \param CoapTemplate *pTemplate [in] - Template of the message.
+ *
+ * \param U8 *pBuffer [in] - Message buffer.
+ *
+ *
+ * \return Returns the first payload byte in pBuffer.
+ *
+ ********************************************************************************/
+uint8_t *coapTemplatePayload(const CoapTemplate *pTemplate, uint8_t *pBuffer)
+{
+   return pBuffer + pTemplate->length + 1;
+}
+
+/*!*****************************************************************************
+ * \brief Builds a message from a template
+ *
+ * Description:
+ *  One memcpy of the template, two message id stores, the token bytes and the
+ *  payload marker.  No option is encoded and the buffer is not scanned.
+ *
+ * \param CoapTemplate *pTemplate [in] - Template of the message.
+ *
+ * \param U8 *pBuffer [out] - Receives the message.
+ *
+ * \param U16 bufferSize [in] - Size of pBuffer.
+ *
+ * \param U16 messageId [in] - Message id.
+ *
+ * \param U8 *pToken [in] - COAP_TEMPLATE_TOKEN_LENGTH token bytes.
+ *
+ * \param U8 *pPayload [in] - Payload, or NULL if already written at
+ *                            coapTemplatePayload.
+ *
+ * \param U16 payloadLength [in] - Length of the payload, 0 for none.
+ *
+ * \param U16 *pLength [out] - Length of the message.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapTemplateBuild(const CoapTemplate *pTemplate, uint8_t *pBuffer, uint16_t bufferSize, uint16_t messageId, uint8_t *pToken, uint8_t *pPayload, uint16_t payloadLength, uint16_t *pLength)
+{
+   uint16_t length = pTemplate->length;   // Used to store the message length.
+
+   COAP_STAT_START(start);
+
+   if( (uint32_t)length + (payloadLength > 0 ? payloadLength + 1 : 0) > bufferSize )
+   {
+      COAP_STAT_ERROR(COAP_INSUFFICIENT_BUFFER);
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   memcpy(pBuffer, pTemplate->buffer, length);
+
+   pBuffer[2] = messageId >> 8;
+   pBuffer[3] = messageId & 0xFF;
+   memcpy(pBuffer + COAP_HDR_BYTES, pToken, pTemplate->tokenLength);
+
+   if( payloadLength > 0 )
+   {
+      pBuffer[length++] = COAP_PAYLOAD_MARKER;
+
+      if( pPayload != NULL )
+      {
+         memcpy(pBuffer + length, pPayload, payloadLength);
+      }
+
+      length += payloadLength;
+   }
+
+   *pLength = length;
+
+   COAP_STAT_STOP(COAP_HIST_ENCODE, start);
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Builds a message from a template and a gathered payload
+ *
+ * Description:
+ *  Same as coapTemplateBuild, with the payload written fragment by fragment
+ *  directly into pBuffer.
+ *
+ * \param CoapTemplate *pTemplate [in] - Template of the message.
+ *
+ * \param U8 *pBuffer [out] - Receives the message.
+ *
+ * \param U16 bufferSize [in] - Size of pBuffer.
+ *
+ * \param U16 messageId [in] - Message id.
+ *
+ * \param U8 *pToken [in] - COAP_TEMPLATE_TOKEN_LENGTH token bytes.
+ *
+ * \param CoapFragment *pFragments [in] - Payload fragments in order.
+ *
+ * \param U8 fragmentCount [in] - Number of fragments.
+ *
+ * \param U16 *pLength [out] - Length of the message.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapTemplateBuildGather(const CoapTemplate *pTemplate, uint8_t *pBuffer, uint16_t bufferSize, uint16_t messageId, uint8_t *pToken, const CoapFragment *pFragments, uint8_t fragmentCount, uint16_t *pLength)
+{
+   uint32_t payloadLength;   // Used to store the payload length.
+   uint8_t *pPayload;        // Used to store the next payload byte.
+   int8_t results;           // Used to store the results.
+   uint8_t i;                // Used as an iterator.
+
+   payloadLength = coapFragmentsLength(pFragments, fragmentCount);
+
+   if( payloadLength > 0xFFFF )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   results = coapTemplateBuild(pTemplate, pBuffer, bufferSize, messageId, pToken, NULL, (uint16_t)payloadLength, pLength);
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   pPayload = coapTemplatePayload(pTemplate, pBuffer);
+
+   for( i = 0; i < fragmentCount; i++ )
+   {
+      memcpy(pPayload, pFragments[i].pData, pFragments[i].length);
+      pPayload += pFragments[i].length;
+   }
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Builds a gather list for sockets that send from several buffers
+ *
+ * Description:
+ *  Only the header (template, message id, token and payload marker) is
+ *  written, into pHeader.  pList receives that header followed by the payload
+ *  fragments, ready for sendmsg/iovec style transmission, so the payload is
+ *  never copied by the library.
+ *
+ * \param CoapTemplate *pTemplate [in] - Template of the message.
+ *
+ * \param U8 *pHeader [out] - COAP_TEMPLATE_SIZE + 1 bytes for the header.
+ *
+ * \param U16 messageId [in] - Message id.
+ *
+ * \param U8 *pToken [in] - COAP_TEMPLATE_TOKEN_LENGTH token bytes.
+ *
+ * \param CoapFragment *pFragments [in] - Payload fragments in order.
+ *
+ * \param U8 fragmentCount [in] - Number of fragments.
+ *
+ * \param CoapFragment *pList [out] - Receives the gather list.
+ *
+ * \param U8 listSize [in] - Entries in pList, at least fragmentCount + 1.
+ *
+ *
+ * \return Returns the number of entries in pList or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapTemplateGatherList(const CoapTemplate *pTemplate, uint8_t *pHeader, uint16_t messageId, uint8_t *pToken, const CoapFragment *pFragments, uint8_t fragmentCount, CoapFragment *pList, uint8_t listSize)
+{
+   uint32_t payloadLength;   // Used to store the payload length.
+   uint16_t length;          // Used to store the message length.
+   int8_t results;           // Used to store the results.
+
+   payloadLength = coapFragmentsLength(pFragments, fragmentCount);
+
+   if( fragmentCount >= listSize || fragmentCount > 126 || payloadLength > 0xFFFF )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   // Payload bytes are only counted, pHeader must not receive them.
+   results = coapTemplateBuild(pTemplate, pHeader, 0xFFFF, messageId, pToken, NULL, (uint16_t)payloadLength, &length);
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   pList[0].pData = pHeader;
+   pList[0].length = length - (uint16_t)payloadLength;
+   memcpy(&pList[1], pFragments, fragmentCount * sizeof(CoapFragment));
+
+   return fragmentCount + 1;
+}
@@ -0,0 +1,36 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_TEMPLATE_H
+#define COAP_TEMPLATE_H
+
+#include "coap.h"
+#include "coap_config.h"
+
+/*Message Template Related*/
+#define COAP_TEMPLATE_SIZE          128   //header, token and options of one request shape
+#define COAP_TEMPLATE_TOKEN_LENGTH  4     //token bytes reserved in every template
+
+/// CoapTemplate struct, a pre-encoded request with placeholders for message id, token and payload
+typedef struct
+{
+   uint8_t buffer[COAP_TEMPLATE_SIZE];  ///< Header, zero token, options
+   uint16_t length;                     ///< Bytes of buffer in use, payload marker excluded
+   uint8_t tokenLength;                 ///< Token bytes reserved after the header
+   uint16_t generation;                 ///< CoapConfig generation the options were copied from
+   const char *pAlias;                  ///< Alias, kept for coapTemplateRefresh
+   CoapContentFormat format;            ///< Content-Format, kept for coapTemplateRefresh
+} CoapTemplate;
+
+int8_t coapTemplateInit(CoapTemplate *pTemplate, uint8_t type, CoapCode code, const char *pAlias, CoapContentFormat format);
+int8_t coapTemplateInitFrom(CoapTemplate *pTemplate, const CoapConfig *pConfig, uint8_t type, CoapCode code, const char *pAlias, CoapContentFormat format);
+int8_t coapTemplateRefresh(CoapTemplate *pTemplate);
+int8_t coapTemplateBuild(const CoapTemplate *pTemplate, uint8_t *pBuffer, uint16_t bufferSize, uint16_t messageId, uint8_t *pToken, uint8_t *pPayload, uint16_t payloadLength, uint16_t *pLength);
+uint8_t *coapTemplatePayload(const CoapTemplate *pTemplate, uint8_t *pBuffer);
+int8_t coapTemplateBuildGather(const CoapTemplate *pTemplate, uint8_t *pBuffer, uint16_t bufferSize, uint16_t messageId, uint8_t *pToken, const CoapFragment *pFragments, uint8_t fragmentCount, uint16_t *pLength);
+int8_t coapTemplateGatherList(const CoapTemplate *pTemplate, uint8_t *pHeader, uint16_t messageId, uint8_t *pToken, const CoapFragment *pFragments, uint8_t fragmentCount, CoapFragment *pList, uint8_t listSize);
+
+//! @}
+#endif  /* COAP_TEMPLATE_H */
@@ -0,0 +1,321 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+
+#include "coap_uplink.h"
+#include "coap_pool.h"
+
+/*!*****************************************************************************
+ * \brief Finds a request slot that coapTask is done with
+ *
+ * Description:
+ *  Batches are submitted fire and forget with a pool buffer, which coapTask
+ *  releases (clearing pBuffer) once it is finished with the exchange, so a
+ *  slot is free again as soon as pBuffer is NULL.
+ *
+ * \param CoapUplink *pUplink [in] - Scheduler owning the slots.
+ *
+ *
+ * \return Returns a free request or NULL.
+ *
+ ********************************************************************************/
+static CoapRequest *coapUplinkRequest(CoapUplink *pUplink)
+{
+   uint8_t i;   // Used as an iterator.
+
+   for( i = 0; i < COAP_UPLINK_REQUESTS; i++ )
+   {
+      if( pUplink->requests[i].pBuffer == NULL )
+      {
+         return &pUplink->requests[i];
+      }
+   }
+
+   return NULL;
+}
+
+/*!*****************************************************************************
+ * \brief Initialises an uplink scheduler
+ *
+ * \param CoapUplink *pUplink [out] - Scheduler to initialise.
+ *
+ ********************************************************************************/
+void coapUplinkInit(CoapUplink *pUplink)
+{
+   memset(pUplink, 0, sizeof(*pUplink));
+}
+
+/*!*****************************************************************************
+ * \brief Sets up the stream of a sensor alias
+ *
+ * Description:
+ *  Readings appended to the stream are merged into one POST to pPath until the
+ *  payload is full or the first reading has waited maxDelay.  Batches go out
+ *  as NON, except every checkpointInterval-th batch which is CON, so the
+ *  high-rate stream costs no round trips while the device still learns
+ *  regularly that the server is reachable.
+ *
+ * Non-confirmable messages:
+ *          https://tools.ietf.org/html/rfc7252#section-4.3
+ *
+ * \param CoapUplink *pUplink [in\out] - Scheduler.
+ *
+ * \param CoapAlias alias [in] - Sensor, below COAP_UPLINK_MAX_STREAMS.
+ *
+ * \param char *pPath [in] - Exosite alias the readings are posted to.
+ *
+ * \param CoapContentFormat format [in] - Content-Format of the readings.
+ *
+ * \param TickType_t maxDelay [in] - Longest a reading is held back.
+ *
+ * \param U8 checkpointInterval [in] - Every n-th batch is CON, 1 for all, 0 for none.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapUplinkConfigure(CoapUplink *pUplink, CoapAlias alias, const char *pPath, CoapContentFormat format, TickType_t maxDelay, uint8_t checkpointInterval)
+{
+   CoapUplinkStream *pStream;   // Used to store the stream.
+   int8_t results;              // Used to store the template results.
+
+   if( (unsigned)alias >= COAP_UPLINK_MAX_STREAMS )
+   {
+      return COAP_INVALID_OPTION_DATA;
+   }
+
+   pStream = &pUplink->streams[alias];
+
+   results = coapTemplateInit(&pStream->request, COAP_TYPE_NON, COAP_POST, pPath, format);
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   pStream->payloadLength = 0;
+   pStream->maxDelay = maxDelay;
+   pStream->checkpointInterval = checkpointInterval;
+   pStream->batchCount = 0;
+   pStream->configured = true;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Adds a reading to the batch of its sensor
+ *
+ * Description:
+ *  Readings are concatenated, so they should be self delimiting (fixed size
+ *  records, or CBOR items forming a CBOR sequence).  A reading that does not fit
+ *  the open batch sends the batch first; the first reading of a batch starts
+ *  its deadline.
+ *
+ * \param CoapUplink *pUplink [in\out] - Scheduler.
+ *
+ * \param CoapAlias alias [in] - Sensor of the reading.
+ *
+ * \param U8 *pReading [in] - Encoded reading.
+ *
+ * \param U16 length [in] - Length of the reading.
+ *
+ *
+ * \return Returns COAP_OK on success or < 0 for error (the reading is dropped).
+ *
+ ********************************************************************************/
+int8_t coapUplinkAppend(CoapUplink *pUplink, CoapAlias alias, const uint8_t *pReading, uint16_t length)
+{
+   CoapUplinkStream *pStream;   // Used to store the stream.
+   int8_t results;              // Used to store the flush results.
+
+   if( (unsigned)alias >= COAP_UPLINK_MAX_STREAMS || !pUplink->streams[alias].configured )
+   {
+      return COAP_INVALID_OPTION_DATA;
+   }
+
+   pStream = &pUplink->streams[alias];
+
+   if( length > COAP_UPLINK_PAYLOAD_SIZE || pStream->request.length + 1 + length > MAX_BUFFER_SIZE )
+   {
+      return COAP_INSUFFICIENT_BUFFER;
+   }
+
+   if( pStream->payloadLength + length > COAP_UPLINK_PAYLOAD_SIZE ||
+       pStream->request.length + 1 + pStream->payloadLength + length > MAX_BUFFER_SIZE )
+   {
+      results = coapUplinkFlush(pUplink, alias);
+
+      if( results < 0 )
+      {
+         return results;
+      }
+   }
+
+   if( pStream->payloadLength == 0 )
+   {
+      pStream->deadlineTick = xTaskGetTickCount() + pStream->maxDelay;
+   }
+
+   memcpy(pStream->payload + pStream->payloadLength, pReading, length);
+   pStream->payloadLength += length;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Sends the open batch of a sensor
+ *
+ * Description:
+ *  Builds the POST from the stream template into a pool buffer of the exact
+ *  size and submits it to coapTask fire and forget.  If no buffer or request
+ *  slot is free the batch stays open and is retried by the next append or poll.
+ *
+ * \param CoapUplink *pUplink [in\out] - Scheduler.
+ *
+ * \param CoapAlias alias [in] - Sensor to flush.
+ *
+ *
+ * \return Returns COAP_OK on success (or if nothing was waiting) or < 0 for error.
+ *
+ ********************************************************************************/
+int8_t coapUplinkFlush(CoapUplink *pUplink, CoapAlias alias)
+{
+   CoapUplinkStream *pStream;      // Used to store the stream.
+   CoapRequest *pRequest;          // Used to store the request slot.
+   uint8_t token[COAP_TEMPLATE_TOKEN_LENGTH];   // Used to store the token.
+   uint8_t *pBuffer;               // Used to store the message buffer.
+   uint16_t length;                // Used to store the message length.
+   bool confirmable;               // Used to store the message type.
+   int8_t results;                 // Used to store the results.
+
+   if( (unsigned)alias >= COAP_UPLINK_MAX_STREAMS )
+   {
+      return COAP_INVALID_OPTION_DATA;
+   }
+
+   pStream = &pUplink->streams[alias];
+
+   if( pStream->payloadLength == 0 )
+   {
+      return COAP_OK;
+   }
+
+   results = coapTemplateRefresh(&pStream->request);
+
+   if( results < 0 )
+   {
+      return results;
+   }
+
+   pRequest = coapUplinkRequest(pUplink);
+
+   if( pRequest == NULL )
+   {
+      return COAP_NO_RESOURCES;
+   }
+
+   pBuffer = coapPoolAlloc(pStream->request.length + 1 + pStream->payloadLength);
+
+   if( pBuffer == NULL )
+   {
+      return COAP_NO_RESOURCES;
+   }
+
+   coapGenerateToken(token, sizeof(token));
+
+   results = coapTemplateBuild(&pStream->request, pBuffer, coapPoolBlockSize(pBuffer), coapMessageIdNext(coapTaskMessageIds()),
+                               token, pStream->payload, pStream->payloadLength, &length);
+
+   if( results < 0 )
+   {
+      coapPoolFree(pBuffer);
+      return results;
+   }
+
+   confirmable = pStream->checkpointInterval != 0 && ++pStream->batchCount >= pStream->checkpointInterval;
+
+   if( confirmable )
+   {
+      pBuffer[0] = (pBuffer[0] & ~COAP_HDR_TYPE_MASK) | (COAP_TYPE_CON << 4);
+   }
+
+   memset(pRequest, 0, sizeof(*pRequest));
+   pRequest->pBuffer = pBuffer;
+   pRequest->length = length;
+   pRequest->freeBuffer = true;
+
+   results = coapSubmit(pRequest);
+
+   if( results < 0 )
+   {
+      pRequest->pBuffer = NULL;
+      coapPoolFree(pBuffer);
+
+      if( confirmable )
+      {
+         pStream->batchCount--;
+      }
+
+      return results;
+   }
+
+   if( confirmable )
+   {
+      pStream->batchCount = 0;
+   }
+
+   pStream->payloadLength = 0;
+
+   return COAP_OK;
+}
+
+/*!*****************************************************************************
+ * \brief Sends the batches whose deadline passed
+ *
+ * Description:
+ *  Call from the producer task whenever it wakes up; block for at most the
+ *  returned ticks so no reading waits longer than its stream's maxDelay.
+ *
+ * \param CoapUplink *pUplink [in\out] - Scheduler.
+ *
+ *
+ * \return Returns the ticks until the next deadline or portMAX_DELAY if no
+ *         batch is open.
+ *
+ ********************************************************************************/
+TickType_t coapUplinkPoll(CoapUplink *pUplink)
+{
+   CoapUplinkStream *pStream;             // Used to store the current stream.
+   TickType_t now = xTaskGetTickCount();  // Used to store the current tick.
+   TickType_t wait = portMAX_DELAY;       // Used to store the time to the next deadline.
+   TickType_t left;                       // Used to store the time left on a batch.
+   uint8_t i;                             // Used as an iterator.
+
+   for( i = 0; i < COAP_UPLINK_MAX_STREAMS; i++ )
+   {
+      pStream = &pUplink->streams[i];
+
+      if( pStream->payloadLength == 0 )
+      {
+         continue;
+      }
+
+      if( (int32_t)(now - pStream->deadlineTick) >= 0 )
+      {
+         coapUplinkFlush(pUplink, (CoapAlias)i);
+      }
+
+      // A batch that could not be sent is retried on the next retransmission tick.
+      left = (pStream->payloadLength == 0) ? portMAX_DELAY :
+             ((int32_t)(pStream->deadlineTick - now) > 0) ? pStream->deadlineTick - now : pdMS_TO_TICKS(COAP_RETRANS_TICK_MS);
+
+      if( left < wait )
+      {
+         wait = left;
+      }
+   }
+
+   return wait;
+}
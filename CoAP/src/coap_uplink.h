@@ -0,0 +1,48 @@
+/*!
+ *
+ * \addtogroup CoAP_Library
+ * @{
+ */
+#ifndef COAP_UPLINK_H
+#define COAP_UPLINK_H
+
+#include "coap.h"
+#include "coap_random.h"
+#include "coap_task.h"
+#include "coap_template.h"
+
+/*Uplink Coalescing Related*/
+#define COAP_UPLINK_MAX_STREAMS     4     //one per sensor alias, indexed by CoapAlias
+#ifndef COAP_UPLINK_PAYLOAD_SIZE
+#define COAP_UPLINK_PAYLOAD_SIZE    (MAX_BUFFER_SIZE - COAP_TEMPLATE_SIZE - 1)   //batch payload staged per stream
+#endif
+#define COAP_UPLINK_REQUESTS        8     //batches in flight at once
+
+/// CoapUplinkStream struct, the readings waiting for one resource
+typedef struct
+{
+   CoapTemplate request;                            ///< Encoded POST to the alias
+   uint8_t payload[COAP_UPLINK_PAYLOAD_SIZE];       ///< Readings of the open batch
+   uint16_t payloadLength;                          ///< Bytes of payload in use
+   TickType_t maxDelay;                             ///< Longest a reading waits for company
+   TickType_t deadlineTick;                         ///< Open batch is sent by this tick
+   uint8_t checkpointInterval;                      ///< Every n-th batch is CON, 1 for all, 0 for none
+   uint8_t batchCount;                              ///< Batches since the last checkpoint
+   bool configured;                                 ///< Stream was set up with coapUplinkConfigure
+} CoapUplinkStream;
+
+/// CoapUplink struct, owned by the task producing the readings
+typedef struct
+{
+   CoapUplinkStream streams[COAP_UPLINK_MAX_STREAMS];   ///< Streams by CoapAlias
+   CoapRequest requests[COAP_UPLINK_REQUESTS];          ///< Batches handed to coapTask
+} CoapUplink;
+
+void coapUplinkInit(CoapUplink *pUplink);
+int8_t coapUplinkConfigure(CoapUplink *pUplink, CoapAlias alias, const char *pPath, CoapContentFormat format, TickType_t maxDelay, uint8_t checkpointInterval);
+int8_t coapUplinkAppend(CoapUplink *pUplink, CoapAlias alias, const uint8_t *pReading, uint16_t length);
+int8_t coapUplinkFlush(CoapUplink *pUplink, CoapAlias alias);
+TickType_t coapUplinkPoll(CoapUplink *pUplink);
+
+//! @}
+#endif  /* COAP_UPLINK_H */